@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include <types.h>
@@ -26,6 +27,7 @@
 extern int mtd_manager_init(void);
 extern int mtd_manager_destroy(void);
 extern int mmc_manager_init(void);
+extern int mmc_manager_destroy(void);
 
 static LIST_HEAD(block_manager_list);
 
@@ -83,6 +85,51 @@ struct block_manager* get_block_manager(struct block_manager* this,
     return NULL;
 }
 
+static inline pid_t bm_gettid(void) {
+    return syscall(__NR_gettid);
+}
+
+/*
+ * Returns the operation prepared by the calling thread, a new one if
+ * alloc is set
+ */
+struct bm_operate_prepare_info* bm_find_prepare_info(
+        struct bm_prepared_table *table, int alloc) {
+    struct bm_operate_prepare_info *prepared = NULL;
+    pid_t tid = bm_gettid();
+    int i;
+
+    pthread_mutex_lock(&table->lock);
+
+    for (i = 0; i < BM_PREPARED_MAX; i++) {
+        if (table->info[i].tid == tid) {
+            prepared = &table->info[i];
+            break;
+        }
+    }
+
+    for (i = 0; alloc && !prepared && i < BM_PREPARED_MAX; i++) {
+        if (!table->info[i].tid) {
+            prepared = &table->info[i];
+            prepared->tid = tid;
+        }
+    }
+
+    pthread_mutex_unlock(&table->lock);
+
+    return prepared;
+}
+
+/*
+ * Frees the slot, its context_handle is up to the caller
+ */
+void bm_drop_prepare_info(struct bm_prepared_table *table,
+        struct bm_operate_prepare_info *prepared) {
+    pthread_mutex_lock(&table->lock);
+    memset(prepared, 0, sizeof(*prepared));
+    pthread_mutex_unlock(&table->lock);
+}
+
 static void get_supported_filetype(struct block_manager* this, char *buf) {
     BM_MTD_FILE_TYPE_INIT(supported_array);
     char list[128];
@@ -109,6 +156,7 @@ static int set_operation_option(struct block_manager* this,
     }
 
     option->method = method;
+    option->skip_erased = 0;
     if (strlen(filetype) > sizeof(option->filetype) - 1)
         return -1;
 
@@ -155,11 +203,14 @@ void construct_block_manager(struct block_manager* this, const char *blockname,
         bm_event_listener_t listener, void* param) {
 
     int retval;
-    retval = mtd_manager_init();
-    // retval &= mmc_manager_init();
+
+    if (!strcmp(blockname, BM_BLOCK_TYPE_MMC))
+        retval = mmc_manager_init();
+    else
+        retval = mtd_manager_init();
 
     if (retval < 0) {
-        LOGE("Failed to init mtd block manager\n");
+        LOGE("Failed to init %s block manager\n", blockname);
         goto out;
     }
 
@@ -180,7 +231,7 @@ void construct_block_manager(struct block_manager* this, const char *blockname,
     this->dump_event = dump_event;
 
 #ifdef BM_SYSINFO_SUPPORT
-    if (get_system_platform() == XBURST)
+    if (get_system_platform() == XBURST && !strcmp(bm->name, BM_BLOCK_TYPE_MTD))
         sysinfo_manager_bind(GET_SYSINFO_MANAGER(), this);
     else
         bm->sysinfo = NULL;
@@ -203,10 +254,12 @@ void destruct_block_manager(struct block_manager* this) {
         }
     }
 #endif
-    // mmc_manager_destroy();
-    retval = mtd_manager_destroy();
+    if (!strcmp(this->name, BM_BLOCK_TYPE_MMC))
+        retval = mmc_manager_destroy();
+    else
+        retval = mtd_manager_destroy();
     if (retval < 0) {
-        LOGE("Failed to destory mtd block manager\n");
+        LOGE("Failed to destory %s block manager\n", this->name);
         goto out;
     }
     memset(this, 0, sizeof(* this));
@@ -0,0 +1,781 @@
+#define _GNU_SOURCE /* for O_DIRECT and fallocate */
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <linux/fs.h>
+#include <linux/falloc.h>
+#include <types.h>
+#include <utils/log.h>
+#include <utils/update_stats.h>
+#include <lib/libcommon.h>
+#include <utils/list.h>
+#include <block/block_manager.h>
+#include <block/mmc/mmc.h>
+
+#define LOG_TAG BM_BLOCK_TYPE_MMC
+
+/*
+ * What a prepared operation works on, its context_handle
+ */
+struct mmc_operation {
+    struct mmc_dev_info *part;
+    int64_t start;
+    int64_t length;
+    int64_t done;
+};
+
+static struct bm_prepared_table prepared_table = BM_PREPARED_TABLE_INITIALIZER;
+static pthread_mutex_t device_lock = PTHREAD_MUTEX_INITIALIZER;
+static char mmc_device[PATH_MAX] = MMC_DEFAULT_DEVICE;
+
+/*
+ * Device the next init opens, a loop device or a plain file will do
+ */
+int mmc_manager_set_device(const char *path) {
+    if (path == NULL)
+        path = MMC_DEFAULT_DEVICE;
+
+    if (strlen(path) >= sizeof(mmc_device)) {
+        LOGE("Device path %s is too long\n", path);
+        return -1;
+    }
+
+    strcpy(mmc_device, path);
+
+    return 0;
+}
+
+static int mmc_get_part_index_by_offset(struct block_manager* this,
+        int64_t offset) {
+    struct mmc_info *mmc_info = BM_GET_MMC_INFO(this);
+
+    for (int i = 0; i < mmc_info->part_cnt; i++) {
+        struct mmc_dev_info *mmc = BM_GET_PARTINFO_MMC_DEV(this, i);
+        int64_t start = BM_GET_PARTINFO_START(this, i);
+
+        if (offset >= start && offset < start + mmc->size)
+            return i;
+    }
+
+    LOGE("Cannot get mmc partition at 0x%" PRIx64 "\n", offset);
+
+    return -1;
+}
+
+static int mmc_get_part_index_by_name(struct block_manager* this,
+        char *name) {
+    struct mmc_info *mmc_info = BM_GET_MMC_INFO(this);
+
+    for (int i = 0; name && i < mmc_info->part_cnt; i++)
+        if (!strcmp(BM_GET_PARTINFO_MMC_DEV(this, i)->name, name))
+            return i;
+
+    LOGE("Cannot get mmc partition %s\n", name);
+
+    return -1;
+}
+
+static int64_t mmc_get_partition_size_by_offset(struct block_manager* this,
+        int64_t offset) {
+    int i = mmc_get_part_index_by_offset(this, offset);
+
+    return i < 0 ? -1 : BM_GET_PARTINFO_MMC_DEV(this, i)->size;
+}
+
+static int64_t mmc_get_partition_size_by_name(struct block_manager* this,
+        char *name) {
+    int i = mmc_get_part_index_by_name(this, name);
+
+    return i < 0 ? -1 : BM_GET_PARTINFO_MMC_DEV(this, i)->size;
+}
+
+static int64_t mmc_get_partition_start_by_offset(struct block_manager* this,
+        int64_t offset) {
+    int i = mmc_get_part_index_by_offset(this, offset);
+
+    return i < 0 ? -1 : BM_GET_PARTINFO_START(this, i);
+}
+
+static int64_t mmc_get_partition_start_by_name(struct block_manager* this,
+        char *name) {
+    int i = mmc_get_part_index_by_name(this, name);
+
+    return i < 0 ? -1 : BM_GET_PARTINFO_START(this, i);
+}
+
+static int mmc_get_partition_count(struct block_manager* this) {
+    return BM_GET_MMC_INFO(this)->part_cnt;
+}
+
+static int64_t mmc_get_capacity(struct block_manager* this) {
+    return BM_GET_MMC_INFO(this)->size;
+}
+
+static int mmc_get_blocksize_by_offset(struct block_manager* this,
+        int64_t offset) {
+    return BM_GET_MMC_INFO(this)->io_size;
+}
+
+static int mmc_get_iosize_by_offset(struct block_manager* this,
+        int64_t offset) {
+    return BM_GET_MMC_INFO(this)->sector_size;
+}
+
+static char* mmc_get_block_type_by_offset(struct block_manager* this,
+        int64_t offset) {
+    return BM_BLOCK_TYPE_MMC;
+}
+
+static int mmc_get_device_id_by_offset(struct block_manager* this,
+        int64_t offset) {
+    return 0;
+}
+
+static pthread_mutex_t* mmc_get_device_lock(struct block_manager* this,
+        int64_t offset) {
+    return this->desc.mmc.device_lock;
+}
+
+static int64_t mmc_sysfs_read(const char *dir, const char *attr) {
+    char path[PATH_MAX];
+    long long val = -1;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+
+    if (fscanf(fp, "%lld", &val) != 1)
+        val = -1;
+
+    fclose(fp);
+
+    return val;
+}
+
+static int mmc_add_partition(struct block_manager* this, const char *name,
+        int64_t start, int64_t size) {
+    struct bm_part_info **part_info = &BM_GET_PARTINFO(this);
+    struct mmc_info *mmc_info = BM_GET_MMC_INFO(this);
+    struct bm_part_info *p;
+    int i = mmc_info->part_cnt;
+
+    p = realloc(*part_info, (i + 1) * sizeof(struct bm_part_info));
+    if (p == NULL) {
+        LOGE("Cannot allocate partition info: %s\n", strerror(errno));
+        return -1;
+    }
+    *part_info = p;
+
+    memset(&p[i], 0, sizeof(p[i]));
+    snprintf(p[i].part.mmc_dev_info.name,
+             sizeof(p[i].part.mmc_dev_info.name), "%s", name);
+    snprintf(p[i].path, sizeof(p[i].path), "%s", name);
+    p[i].part.mmc_dev_info.size = size;
+    p[i].start = start;
+    p[i].fd = mmc_info->fd;
+    p[i].id = i;
+    mmc_info->part_cnt++;
+
+    return 0;
+}
+
+static int mmc_compare_partition(const void *a, const void *b) {
+    const struct bm_part_info *pa = a, *pb = b;
+
+    return pa->start < pb->start ? -1 : pa->start > pb->start;
+}
+
+/*
+ * Partitions of the disk in sysfs, e.g. /sys/class/block/mmcblk0/mmcblk0p1
+ */
+static int mmc_scan_partitions(struct block_manager* this, const char *disk) {
+    struct mmc_info *mmc_info = BM_GET_MMC_INFO(this);
+    char dir[PATH_MAX], sub[PATH_MAX];
+    struct dirent *de;
+    DIR *dp;
+
+    snprintf(dir, sizeof(dir), "%s/%s", MMC_SYSFS_BLOCK, disk);
+    dp = opendir(dir);
+    if (dp == NULL)
+        return 0;
+
+    while ((de = readdir(dp)) != NULL) {
+        int64_t start, size;
+
+        if (strncmp(de->d_name, disk, strlen(disk)))
+            continue;
+
+        if (snprintf(sub, sizeof(sub), "%s/%s", dir, de->d_name)
+                >= (int) sizeof(sub))
+            continue;
+        if (mmc_sysfs_read(sub, "partition") < 0)
+            continue;
+
+        start = mmc_sysfs_read(sub, "start");
+        size = mmc_sysfs_read(sub, "size");
+        if (start < 0 || size <= 0)
+            continue;
+
+        if (mmc_add_partition(this, de->d_name, start * MMC_SECTOR_SIZE,
+                size * MMC_SECTOR_SIZE) < 0) {
+            closedir(dp);
+            return -1;
+        }
+    }
+
+    closedir(dp);
+
+    qsort(BM_GET_PARTINFO(this), mmc_info->part_cnt,
+          sizeof(struct bm_part_info), mmc_compare_partition);
+    for (int i = 0; i < mmc_info->part_cnt; i++)
+        BM_GET_PARTINFO_ID(this, i) = i;
+
+    return 0;
+}
+
+/*
+ * Sector size, discard support and the unit of the prepared operations
+ * from the queue of the disk
+ */
+static int mmc_get_geometry(struct block_manager* this, const char *disk) {
+    struct mmc_info *mmc_info = BM_GET_MMC_INFO(this);
+    uint64_t size = 0;
+    int sector_size = 0;
+    int64_t optimal;
+    char dir[PATH_MAX];
+
+    if (ioctl(mmc_info->fd, BLKGETSIZE64, &size) < 0
+            || ioctl(mmc_info->fd, BLKSSZGET, &sector_size) < 0) {
+        LOGE("Cannot get geometry of %s: %s\n", mmc_info->path,
+             strerror(errno));
+        return -1;
+    }
+
+    mmc_info->size = size;
+    mmc_info->sector_size = sector_size;
+
+    snprintf(dir, sizeof(dir), "%s/%s/queue", MMC_SYSFS_BLOCK, disk);
+    mmc_info->discard = mmc_sysfs_read(dir, "discard_max_bytes") > 0;
+
+    optimal = mmc_sysfs_read(dir, "optimal_io_size");
+    if (optimal > MMC_IO_SIZE && !(optimal % sector_size))
+        mmc_info->io_size = optimal;
+
+    return 0;
+}
+
+static int mmc_block_init(struct block_manager* this) {
+    struct mmc_info *mmc_info = BM_GET_MMC_INFO(this);
+    char name[PATH_MAX];
+    char *disk;
+    struct stat st;
+
+    memset(mmc_info, 0, sizeof(*mmc_info));
+    strcpy(mmc_info->path, mmc_device);
+    mmc_info->io_size = MMC_IO_SIZE;
+    mmc_info->sector_size = MMC_SECTOR_SIZE;
+
+    mmc_info->fd = open(mmc_info->path, O_RDWR | O_DIRECT);
+    mmc_info->direct = 1;
+    if (mmc_info->fd < 0 && errno == EINVAL) {
+        LOGW("%s does not take O_DIRECT\n", mmc_info->path);
+        mmc_info->fd = open(mmc_info->path, O_RDWR);
+        mmc_info->direct = 0;
+    }
+    if (mmc_info->fd < 0) {
+        LOGE("Cannot open mmc device %s: %s\n", mmc_info->path,
+             strerror(errno));
+        goto out;
+    }
+
+    if (fstat(mmc_info->fd, &st) < 0) {
+        LOGE("Cannot stat %s: %s\n", mmc_info->path, strerror(errno));
+        goto out;
+    }
+
+    strcpy(name, mmc_info->path);
+    disk = basename(name);
+
+    if (S_ISREG(st.st_mode)) {
+        mmc_info->is_file = 1;
+        mmc_info->discard = 1;
+        mmc_info->size = st.st_size;
+
+    } else if (S_ISBLK(st.st_mode)) {
+        if (mmc_get_geometry(this, disk) < 0
+                || mmc_scan_partitions(this, disk) < 0)
+            goto out;
+
+    } else {
+        LOGE("%s is neither a block device nor a file\n", mmc_info->path);
+        goto out;
+    }
+
+    if (!mmc_info->part_cnt
+            && mmc_add_partition(this, disk, 0, mmc_info->size) < 0)
+        goto out;
+
+    if (posix_memalign((void **)&mmc_info->bounce, MMC_DIRECT_ALIGN,
+            mmc_info->io_size + 2 * MMC_DIRECT_ALIGN)) {
+        LOGE("Cannot allocate bounce buffer\n");
+        mmc_info->bounce = NULL;
+        goto out;
+    }
+
+    this->desc.mmc.device_lock = &device_lock;
+
+    for (int i = 0; i < mmc_info->part_cnt; i++)
+        LOGD("id: %d, name: %s, start: 0x%" PRIx64 ", size: %" PRId64 "\n",
+             BM_GET_PARTINFO_ID(this, i), BM_GET_PARTINFO_PATH(this, i),
+             BM_GET_PARTINFO_START(this, i),
+             BM_GET_PARTINFO_MMC_DEV(this, i)->size);
+
+    LOGI("%s: %" PRId64 " bytes, %d partitions, sector %u, %s, %s\n",
+         mmc_info->path, mmc_info->size, mmc_info->part_cnt,
+         mmc_info->sector_size, mmc_info->direct ? "direct" : "buffered",
+         mmc_info->discard ? "discard" : "no discard");
+
+    return 0;
+
+out:
+    if (mmc_info->fd >= 0)
+        close(mmc_info->fd);
+    mmc_info->fd = -1;
+    free(BM_GET_PARTINFO(this));
+    BM_GET_PARTINFO(this) = NULL;
+    mmc_info->part_cnt = 0;
+
+    return -1;
+}
+
+static int mmc_block_exit(struct block_manager* this) {
+    struct mmc_info *mmc_info = BM_GET_MMC_INFO(this);
+
+    if (mmc_info->fd >= 0) {
+        close(mmc_info->fd);
+        mmc_info->fd = -1;
+    }
+
+    free(mmc_info->bounce);
+    mmc_info->bounce = NULL;
+
+    free(BM_GET_PARTINFO(this));
+    BM_GET_PARTINFO(this) = NULL;
+    mmc_info->part_cnt = 0;
+
+    return 0;
+}
+
+static void mmc_release_prepare_info(struct bm_operate_prepare_info *prepared) {
+    free(prepared->context_handle);
+
+    bm_drop_prepare_info(&prepared_table, prepared);
+}
+
+static struct mmc_operation* mmc_get_prepared_operation(void) {
+    struct bm_operate_prepare_info *prepared =
+            bm_find_prepare_info(&prepared_table, 0);
+
+    if (prepared == NULL || prepared->context_handle == NULL) {
+        LOGE("Cannot get prepare info\n");
+        return NULL;
+    }
+
+    return prepared->context_handle;
+}
+
+static void mmc_process_info(struct block_manager* this,
+        struct mmc_operation *op, int type, int64_t length) {
+    struct bm_event info;
+
+    op->done += length;
+
+    info.part_name = op->part->name;
+    info.operation = type;
+    info.progress = op->length ? (int)(MIN(op->done, op->length) * 100
+            / op->length) : 100;
+
+    if (BM_GET_LISTENER(this))
+        BM_GET_LISTENER(this)(this, &info, this->param);
+}
+
+/*
+ * The range of a request has to stay inside the prepared partition
+ */
+static struct mmc_operation* mmc_check_range(struct block_manager* this,
+        int64_t offset, int64_t length) {
+    struct mmc_operation *op = mmc_get_prepared_operation();
+    int i;
+
+    if (op == NULL)
+        return NULL;
+
+    i = mmc_get_part_index_by_offset(this, offset);
+    if (i < 0 || BM_GET_PARTINFO_MMC_DEV(this, i) != op->part || length < 0
+            || offset + length > BM_GET_PARTINFO_START(this, i)
+                + op->part->size) {
+        LOGE("Range 0x%" PRIx64 "+%" PRId64 " is off partition %s\n", offset, length,
+             op->part->name);
+        return NULL;
+    }
+
+    return op;
+}
+
+static int mmc_pio(struct mmc_info *mmc_info, int write, char *buf,
+        int64_t length, int64_t offset) {
+    while (length > 0) {
+        ssize_t n = write ? pwrite(mmc_info->fd, buf, length, offset)
+                : pread(mmc_info->fd, buf, length, offset);
+
+        if (n <= 0) {
+            LOGE("Cannot %s %s at 0x%" PRIx64 ": %s\n", write ? "write" : "read",
+                 mmc_info->path, offset, n ? strerror(errno) : "end of device");
+            return -1;
+        }
+
+        buf += n;
+        length -= n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+/*
+ * One request of io_size at most. O_DIRECT wants sector aligned buffer,
+ * offset and length: anything else goes through the bounce buffer, with
+ * the partial sectors at both ends read back first when writing.
+ */
+static int mmc_transfer(struct mmc_info *mmc_info, int write, char *buf,
+        int64_t length, int64_t offset) {
+    uint32_t sector = mmc_info->sector_size;
+    int64_t start, end;
+    char *bounce = mmc_info->bounce;
+
+    if (!mmc_info->direct
+            || (!((uintptr_t)buf % MMC_DIRECT_ALIGN)
+                && !(offset % sector) && !(length % sector)))
+        return mmc_pio(mmc_info, write, buf, length, offset);
+
+    start = offset - offset % sector;
+    end = offset + length + (sector - (offset + length) % sector) % sector;
+
+    if (!write) {
+        if (mmc_pio(mmc_info, 0, bounce, end - start, start) < 0)
+            return -1;
+
+        memcpy(buf, bounce + (offset - start), length);
+        return 0;
+    }
+
+    if (start != offset
+            && mmc_pio(mmc_info, 0, bounce, sector, start) < 0)
+        return -1;
+
+    if (end != offset + length && (end - sector > start || start == offset)
+            && mmc_pio(mmc_info, 0, bounce + (end - start - sector), sector,
+                       end - sector) < 0)
+        return -1;
+
+    memcpy(bounce + (offset - start), buf, length);
+
+    return mmc_pio(mmc_info, 1, bounce, end - start, start);
+}
+
+static int64_t mmc_block_io(struct block_manager* this, int write,
+        int64_t offset, char* buf, int64_t length) {
+    struct mmc_info *mmc_info = BM_GET_MMC_INFO(this);
+    struct mmc_operation *op = mmc_check_range(this, offset, length);
+    int64_t done = 0;
+    uint64_t start;
+
+    if (op == NULL)
+        return -1;
+
+    pthread_mutex_lock(this->desc.mmc.device_lock);
+    start = update_stats_now();
+
+    while (done < length) {
+        int64_t n = MIN(length - done, mmc_info->io_size);
+
+        if (mmc_transfer(mmc_info, write, buf + done, n, offset + done) < 0)
+            break;
+
+        done += n;
+    }
+
+    update_stats_add(write ? UPDATE_STAGE_WRITE : UPDATE_STAGE_READ, done,
+                     start);
+    pthread_mutex_unlock(this->desc.mmc.device_lock);
+
+    if (done != length)
+        return -1;
+
+    if (write)
+        mmc_process_info(this, op, BM_OPERATION_WRITE, length);
+
+    return offset + length;
+}
+
+static int64_t mmc_block_write(struct block_manager* this, int64_t offset,
+                               char* buf, int64_t length) {
+    return mmc_block_io(this, 1, offset, buf, length);
+}
+
+static int64_t mmc_block_read(struct block_manager* this, int64_t offset,
+                              char* buf, int64_t length) {
+    return mmc_block_io(this, 0, offset, buf, length);
+}
+
+/*
+ * Discards the whole sectors of the range, a device without discard has
+ * nothing to do
+ */
+static int mmc_discard(struct mmc_info *mmc_info, int64_t offset,
+        int64_t length, int secure) {
+    uint32_t sector = mmc_info->sector_size;
+    int64_t start = offset + (sector - offset % sector) % sector;
+    int64_t end = (offset + length) - (offset + length) % sector;
+    uint64_t range[2];
+
+    if (end <= start || !mmc_info->discard)
+        return 0;
+
+    if (mmc_info->is_file) {
+        if (!fallocate(mmc_info->fd, FALLOC_FL_PUNCH_HOLE
+                | FALLOC_FL_KEEP_SIZE, start, end - start))
+            return 0;
+
+    } else {
+        range[0] = start;
+        range[1] = end - start;
+
+        if (secure && !ioctl(mmc_info->fd, BLKSECDISCARD, &range))
+            return 0;
+
+        if (!ioctl(mmc_info->fd, BLKDISCARD, &range))
+            return 0;
+    }
+
+    if (errno == EOPNOTSUPP || errno == ENOTTY) {
+        LOGW("%s cannot discard, erase is skipped\n", mmc_info->path);
+        mmc_info->discard = 0;
+        return 0;
+    }
+
+    LOGE("Cannot discard %s at 0x%" PRIx64 ", length %" PRId64 ": %s\n", mmc_info->path,
+         start, end - start, strerror(errno));
+
+    return -1;
+}
+
+static int64_t mmc_block_erase(struct block_manager* this, int64_t offset,
+                               int64_t length) {
+    struct mmc_info *mmc_info = BM_GET_MMC_INFO(this);
+    struct mmc_operation *op = mmc_check_range(this, offset, length);
+    uint64_t start;
+    int retval;
+
+    if (op == NULL)
+        return -1;
+
+    pthread_mutex_lock(this->desc.mmc.device_lock);
+    start = update_stats_now();
+    retval = mmc_discard(mmc_info, offset, length, 0);
+    update_stats_add(UPDATE_STAGE_ERASE, length, start);
+    pthread_mutex_unlock(this->desc.mmc.device_lock);
+    if (retval < 0)
+        return -1;
+
+    return offset + length;
+}
+
+static int mmc_chip_erase(struct block_manager* this) {
+    struct mmc_info *mmc_info = BM_GET_MMC_INFO(this);
+    int retval;
+
+    pthread_mutex_lock(this->desc.mmc.device_lock);
+    retval = mmc_discard(mmc_info, 0, mmc_info->size, 1);
+    pthread_mutex_unlock(this->desc.mmc.device_lock);
+
+    return retval;
+}
+
+static int mmc_block_format(struct block_manager* this) {
+    LOGE("Format is not supported on %s\n", BM_BLOCK_TYPE_MMC);
+
+    return -1;
+}
+
+/*
+ * Images are written as they are, no filesystem is laid out by the block
+ * manager on mmc
+ */
+static struct bm_operate_prepare_info* mmc_block_prepare(
+    struct block_manager* this, int64_t offset, int64_t length,
+    struct bm_operation_option *option) {
+    struct mmc_info *mmc_info = BM_GET_MMC_INFO(this);
+    struct bm_operate_prepare_info *prepared = NULL;
+    struct mmc_operation *op = NULL;
+    int i;
+
+    if (option && strcmp(option->filetype, BM_FILE_TYPE_NORMAL)
+            && strcmp(option->filetype, BM_FILE_TYPE_CRAMFS)) {
+        LOGE("Filetype:\"%s\" is not supported on %s\n", option->filetype,
+             BM_BLOCK_TYPE_MMC);
+        return NULL;
+    }
+
+    i = mmc_get_part_index_by_offset(this, offset);
+    if (i < 0)
+        return NULL;
+
+    op = calloc(1, sizeof(*op));
+    if (op == NULL) {
+        LOGE("Cannot allocate %zd bytes of memory\n", sizeof(*op));
+        return NULL;
+    }
+
+    op->part = BM_GET_PARTINFO_MMC_DEV(this, i);
+    op->start = offset;
+    op->length = length;
+    if (option == NULL || option->method == BM_OPERATION_METHOD_PARTITION) {
+        op->start = BM_GET_PARTINFO_START(this, i);
+        op->length = op->part->size;
+    }
+
+    prepared = bm_find_prepare_info(&prepared_table, 1);
+    if (prepared == NULL) {
+        LOGE("More than %d operations prepared at once\n", BM_PREPARED_MAX);
+        free(op);
+        return NULL;
+    }
+
+    /*
+     * Preparing again drops what the thread prepared before
+     */
+    free(prepared->context_handle);
+
+    prepared->context_handle = op;
+    prepared->write_start = offset;
+    prepared->physical_unit_size = mmc_info->io_size;
+    prepared->logical_unit_size = mmc_info->io_size;
+    prepared->max_size_mapped_in_partition = BM_GET_PARTINFO_START(this, i)
+            + op->part->size - offset;
+
+    return prepared;
+}
+
+static uint32_t mmc_get_prepare_leb_size(struct block_manager* this) {
+    struct bm_operate_prepare_info *prepared =
+            bm_find_prepare_info(&prepared_table, 0);
+
+    if (prepared == NULL)
+        return 0;
+
+    return prepared->logical_unit_size;
+}
+
+static int64_t mmc_get_prepare_write_start(struct block_manager* this) {
+    struct bm_operate_prepare_info *prepared =
+            bm_find_prepare_info(&prepared_table, 0);
+
+    if (prepared == NULL)
+        return -1;
+
+    return prepared->write_start;
+}
+
+static int64_t mmc_get_max_size_mapped_in(struct block_manager* this) {
+    struct bm_operate_prepare_info *prepared =
+            bm_find_prepare_info(&prepared_table, 0);
+
+    if (prepared == NULL)
+        return -1;
+
+    return prepared->max_size_mapped_in_partition;
+}
+
+/*
+ * O_DIRECT skips the page cache, not the cache of the device
+ */
+static int64_t mmc_block_finish(struct block_manager* this) {
+    struct bm_operate_prepare_info *prepared =
+            bm_find_prepare_info(&prepared_table, 0);
+    struct mmc_info *mmc_info = BM_GET_MMC_INFO(this);
+    uint64_t start;
+    int64_t retval;
+
+    if (prepared == NULL || prepared->context_handle == NULL) {
+        LOGE("Prepare info context_handle is lost\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(this->desc.mmc.device_lock);
+    start = update_stats_now();
+    retval = fsync(mmc_info->fd);
+    update_stats_add(UPDATE_STAGE_FINISH, 0, start);
+    pthread_mutex_unlock(this->desc.mmc.device_lock);
+    if (retval < 0)
+        LOGE("Cannot flush %s: %s\n", mmc_info->path, strerror(errno));
+
+    mmc_release_prepare_info(prepared);
+
+    return retval;
+}
+
+static struct block_manager mmc_manager =  {
+    .name = BM_BLOCK_TYPE_MMC,
+    .chip_erase = mmc_chip_erase,
+    .erase = mmc_block_erase,
+    .read = mmc_block_read,
+    .write = mmc_block_write,
+    .format = mmc_block_format,
+    .prepare = mmc_block_prepare,
+    .get_prepare_leb_size = mmc_get_prepare_leb_size,
+    .get_prepare_write_start = mmc_get_prepare_write_start,
+    .get_prepare_max_mapped_size = mmc_get_max_size_mapped_in,
+    .finish = mmc_block_finish,
+    .get_partition_count = mmc_get_partition_count,
+    .get_partition_size_by_name = mmc_get_partition_size_by_name,
+    .get_partition_size_by_offset = mmc_get_partition_size_by_offset,
+    .get_partition_start_by_name =  mmc_get_partition_start_by_name,
+    .get_partition_start_by_offset =  mmc_get_partition_start_by_offset,
+    .get_capacity = mmc_get_capacity,
+    .get_blocksize = mmc_get_blocksize_by_offset,
+    .get_iosize = mmc_get_iosize_by_offset,
+    .get_block_type = mmc_get_block_type_by_offset,
+    .get_device_id = mmc_get_device_id_by_offset,
+    .get_device_lock = mmc_get_device_lock,
+};
+
+int mmc_manager_init(void) {
+    if (!mmc_block_init(&mmc_manager)
+            && !register_block_manager(&mmc_manager))
+        return 0;
+
+    return -1;
+}
+
+int mmc_manager_destroy(void) {
+    if (!unregister_block_manager(&mmc_manager)
+            && !mmc_block_exit(&mmc_manager))
+        return 0;
+
+    return -1;
+}
@@ -1,4 +1,5 @@
 #include <inttypes.h>
+#include <stddef.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -11,6 +12,8 @@
 #include <unistd.h>
 #include <types.h>
 #include <utils/assert.h>
+#include <utils/update_stats.h>
+#include <utils/memscan.h>
 #include <lib/mtd/jffs2-user.h>
 #include <lib/libcommon.h>
 #include <lib/mtd/mtd-user.h>
@@ -22,9 +25,46 @@
 #include <block/sysinfo/sysinfo_manager.h>
 #include <block/block_manager.h>
 #include <block/mtd/mtd.h>
+#include <block/mtd/erase_ahead.h>
 
 #define LOG_TAG "mtd_base"
 
+/*
+ * The block map is shared by the partitions operated in parallel
+ */
+static pthread_mutex_t block_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Erase blocks taken by one MEMERASE64 at most, a partition whose driver
+ * turns down a multi-block request is erased block by block from then on
+ */
+#define MTD_ERASE_RUN_MAX   64
+
+/*
+ * Blocks a bad block table can hold in its sysinfo flag slot
+ */
+#define MTD_BBT_MAX_EB  ((SYSINFO_FLAG_BAD_BLOCK_TABLE_SIZE \
+                          - sizeof(struct mtd_bad_block_table)) * MTD_BLK_PER_BYTE)
+
+static inline int block_map_get(const uint8_t *map, int64_t eb) {
+    return (map[eb / MTD_BLK_PER_BYTE]
+            >> ((eb % MTD_BLK_PER_BYTE) * MTD_BLK_STATE_BITS)) & 0x3;
+}
+
+static inline void block_map_put(uint8_t *map, int64_t eb, int status) {
+    int shift = (eb % MTD_BLK_PER_BYTE) * MTD_BLK_STATE_BITS;
+    uint8_t *byte = &map[eb / MTD_BLK_PER_BYTE];
+
+    *byte = (*byte & ~(0x3 << shift)) | (status << shift);
+}
+
+/*
+ * State a block is kept with in the bad block table
+ */
+static inline int block_map_persistent(int status) {
+    return status == MTD_BLK_ERASED ? MTD_BLK_SCAN : status;
+}
+
 int mtd_type_is_nand(struct mtd_dev_info *mtd) {
     return mtd->type == MTD_NANDFLASH || mtd->type == MTD_MLCNANDFLASH;
 }
@@ -49,9 +89,10 @@ static int mtd_bm_block_map_test(struct filesystem *fs) {
     LOGI("total block count %d\n", total_eb);
     LOGI("map reading: \n");
     for (int i = 0; i < total_eb; ++i) {
-        LOGI("%d is reading, value is %d\n", i, mi->es[i]);
-        if (mi->es[i]) {
-            assert_die_if(1, "initial value of eb%d status cannot be %d\n", i, mi->es[i]);
+        int status = block_map_get(mi->es, i);
+        LOGI("%d is reading, value is %d\n", i, status);
+        if (status) {
+            assert_die_if(1, "initial value of eb%d status cannot be %d\n", i, status);
         }
     }
     LOGI("map reading done\n");
@@ -60,11 +101,108 @@ static int mtd_bm_block_map_test(struct filesystem *fs) {
 #endif
 #endif
 
+static uint32_t mtd_bbt_crc(struct mtd_bad_block_table *t) {
+    uint32_t crc = local_crc32(0, t, offsetof(struct mtd_bad_block_table, crc));
+
+    return local_crc32(crc, t->map,
+                       (t->eb_cnt + MTD_BLK_PER_BYTE - 1) / MTD_BLK_PER_BYTE);
+}
+
+static int mtd_bm_kernel_bad_count(struct block_manager *bm, uint32_t *count) {
+    struct mtd_ecc_stats stats;
+    int i;
+
+    *count = 0;
+    for (i = 0; i < bm->get_partition_count(bm); i++) {
+        if (mtd_get_ecc_stats(BM_GET_PARTINFO_MTD_DEV(bm, i),
+                              *BM_GET_PARTINFO_FD(bm, i), &stats) < 0) {
+            LOGW("Cannot get ecc stats of %s: %s\n",
+                 BM_GET_PARTINFO_PATH(bm, i), strerror(errno));
+            return -1;
+        }
+        *count += stats.badblocks;
+    }
+    return 0;
+}
+
+/*
+ * Fill the block map from the bad block table cached in sysinfo.
+ * The table is read straight from the partition, the flag accessors
+ * go through the filesystem ops which would scan and come back here.
+ */
+static void mtd_bm_block_map_load(struct block_manager *bm,
+                                  struct mtd_block_map *mi) {
+    struct mtd_dev_info *mtd = mtd_get_dev_info_by_offset(bm,
+                               SYSINFO_FLAG_OFFSET);
+    struct mtd_bad_block_table *t = NULL;
+    uint32_t kernel_bad;
+    int64_t eb, offset;
+
+    if (mtd == NULL) {
+        LOGW("Cannot get mtd devinfo at 0x%x\n", SYSINFO_FLAG_OFFSET);
+        return;
+    }
+
+    t = malloc(SYSINFO_FLAG_BAD_BLOCK_TABLE_SIZE);
+    if (t == NULL) {
+        LOGE("Cannot allocate %d bytes of memory\n",
+             SYSINFO_FLAG_BAD_BLOCK_TABLE_SIZE);
+        return;
+    }
+
+    offset = SYSINFO_FLAG_OFFSET + SYSINFO_FLAG_BAD_BLOCK_TABLE_OFFSET
+             - MTD_DEV_INFO_TO_START(mtd);
+    if (mtd_read(mtd, MTD_DEV_INFO_TO_FD(mtd), offset / mtd->eb_size,
+                 offset % mtd->eb_size, t, SYSINFO_FLAG_BAD_BLOCK_TABLE_SIZE)) {
+        LOGW("Cannot read bad block table: %s\n", strerror(errno));
+        goto out;
+    }
+
+    if (t->magic != MTD_BBT_MAGIC) {
+        LOGI("No bad block table cached\n");
+        goto out;
+    }
+
+    if (t->eb_cnt > MTD_BBT_MAX_EB || t->crc != mtd_bbt_crc(t)) {
+        LOGW("Bad block table is corrupted\n");
+        goto out;
+    }
+
+    if (t->eb_size != mi->eb_size || t->eb_cnt > mi->eb_cnt) {
+        LOGW("Bad block table is for another geometry\n");
+        goto out;
+    }
+
+    if (mtd_bm_kernel_bad_count(bm, &kernel_bad) < 0)
+        goto out;
+
+    if (kernel_bad != t->kernel_bad) {
+        LOGW("Bad block count changed from %u to %u, rescanning\n",
+             t->kernel_bad, kernel_bad);
+        goto out;
+    }
+
+    for (eb = 0; eb < t->eb_cnt; eb++) {
+        int status = block_map_persistent(block_map_get(t->map, eb));
+
+        if (status == MTD_BLK_BAD)
+            mi->bad_cnt++;
+        block_map_put(mi->es, eb, status);
+    }
+    mi->generation = t->generation;
+
+    LOGI("Bad block table generation %u: %u blocks known, %" PRId64 " bad\n",
+         t->generation, t->eb_cnt, mi->bad_cnt);
+out:
+    free(t);
+}
+
 static int mtd_bm_block_map_init(struct filesystem *fs) {
     struct block_manager *bm = FS_GET_BM(fs);
     struct mtd_dev_info *mtd = FS_GET_MTD_DEV(fs);
     struct mtd_block_map **mi = BM_GET_MTD_BLOCK_MAP(bm, struct mtd_block_map);
 
+    pthread_mutex_lock(&block_map_lock);
     if (*mi == NULL) {
         *mi = calloc(1, sizeof(struct mtd_block_map));
         if (!*mi) {
@@ -73,28 +211,32 @@ static int mtd_bm_block_map_init(struct filesystem *fs) {
             goto out;
         }
         int total_eb = bm->get_capacity(bm) / mtd->eb_size;
-        (*mi)->es = calloc(total_eb, sizeof(*((*mi)->es)));
+        int map_size = (total_eb + MTD_BLK_PER_BYTE - 1) / MTD_BLK_PER_BYTE;
+        (*mi)->es = calloc(1, map_size);
         if ((*mi)->es == NULL) {
-            LOGE("Cannot allocate %zd bytes of memory\n",
-                 total_eb * sizeof((*mi)->es));
+            LOGE("Cannot allocate %d bytes of memory\n", map_size);
             goto out;
         }
         (*mi)->eb_start = 0;
         (*mi)->eb_cnt = total_eb;
+        (*mi)->eb_size = mtd->eb_size;
+        mtd_bm_block_map_load(bm, *mi);
 #if 0
 #ifdef MTD_OPEN_DEBUG
         mtd_bm_block_map_test(fs);
 #endif
 #endif
     }
+    pthread_mutex_unlock(&block_map_lock);
     return 0;
 out:
-    if ((*mi)->es)
+    if (*mi && (*mi)->es)
         free((*mi)->es);
     if (*mi) {
         free(*mi);
         *mi = NULL;
     }
+    pthread_mutex_unlock(&block_map_lock);
     return -1;
 }
 
@@ -111,6 +253,57 @@ void mtd_bm_block_map_destroy(struct block_manager *bm) {
     }
 }
 
+/*
+ * Write the bad and scanned blocks back to the bad block table, when
+ * they changed since it was loaded
+ */
+int mtd_bm_block_map_save(struct block_manager *bm) {
+    struct mtd_block_map *mi = *BM_GET_MTD_BLOCK_MAP(bm, struct mtd_block_map);
+    struct mtd_bad_block_table *t = NULL;
+    int64_t eb;
+
+    if (mi == NULL || mi->es == NULL || !mi->dirty)
+        return 0;
+
+    t = calloc(1, SYSINFO_FLAG_BAD_BLOCK_TABLE_SIZE);
+    if (t == NULL) {
+        LOGE("Cannot allocate %d bytes of memory\n",
+             SYSINFO_FLAG_BAD_BLOCK_TABLE_SIZE);
+        return -1;
+    }
+
+    pthread_mutex_lock(&block_map_lock);
+    if (mtd_bm_kernel_bad_count(bm, &t->kernel_bad) < 0) {
+        pthread_mutex_unlock(&block_map_lock);
+        goto out;
+    }
+    t->magic = MTD_BBT_MAGIC;
+    t->generation = mi->generation + 1;
+    t->eb_size = mi->eb_size;
+    t->eb_cnt = MIN(mi->eb_cnt, MTD_BBT_MAX_EB);
+    for (eb = 0; eb < t->eb_cnt; eb++)
+        block_map_put(t->map, eb,
+                      block_map_persistent(block_map_get(mi->es, eb)));
+    t->crc = mtd_bbt_crc(t);
+    mi->dirty = 0;
+    pthread_mutex_unlock(&block_map_lock);
+
+    if (GET_SYSINFO_FLAG()->write(SYSINFO_FLAG_ID_BAD_BLOCK_TABLE, t) < 0) {
+        LOGE("Cannot write flag%d\n", SYSINFO_FLAG_ID_BAD_BLOCK_TABLE);
+        mi->dirty = 1;
+        goto out;
+    }
+    mi->generation = t->generation;
+
+    LOGI("Bad block table generation %u saved: %u blocks, %" PRId64 " bad\n",
+         t->generation, t->eb_cnt, mi->bad_cnt);
+    free(t);
+    return 0;
+out:
+    free(t);
+    return -1;
+}
+
 int mtd_bm_block_map_is_valid(struct filesystem *fs) {
     struct block_manager *bm = FS_GET_BM(fs);
     struct mtd_block_map *mi = *BM_GET_MTD_BLOCK_MAP(bm, struct mtd_block_map);
@@ -126,10 +319,8 @@ int  mtd_bm_block_map_is_taged(struct filesystem *fs, int64_t eb) {
     struct block_manager *bm = FS_GET_BM(fs);
     struct mtd_block_map *mi = *BM_GET_MTD_BLOCK_MAP(bm, struct mtd_block_map);
 
-    if ((mi->es[eb] & MTD_BLK_PREFIX)
-            != MTD_BLK_PREFIX) {
+    if (block_map_get(mi->es, eb) == MTD_BLK_UNKNOWN)
         return false;
-    }
     return true;
 }
 
@@ -137,8 +328,8 @@ int mtd_bm_block_map_is_bad(struct filesystem *fs, int64_t eb) {
     struct block_manager *bm = FS_GET_BM(fs);
     struct mtd_block_map *mi = *BM_GET_MTD_BLOCK_MAP(bm, struct mtd_block_map);
 
-    if (mi->es[eb] == MTD_BLK_BAD) {
-        LOGI("Skipping bad block at %llx\n", eb);
+    if (block_map_get(mi->es, eb) == MTD_BLK_BAD) {
+        LOGI("Skipping bad block at %" PRIx64 "\n", eb);
         return true;
     }
     return false;
@@ -148,7 +339,7 @@ int mtd_bm_block_map_is_erased(struct filesystem *fs, int64_t eb) {
     struct block_manager *bm = FS_GET_BM(fs);
     struct mtd_block_map *mi = *BM_GET_MTD_BLOCK_MAP(bm, struct mtd_block_map);
 
-    if (mi->es[eb] == MTD_BLK_ERASED)
+    if (block_map_get(mi->es, eb) == MTD_BLK_ERASED)
         return true;
     return false;
 }
@@ -157,16 +348,29 @@ int mtd_bm_block_map_set(struct filesystem *fs, int64_t eb, int status) {
     struct block_manager *bm = FS_GET_BM(fs);
     struct mtd_block_map *mi = *BM_GET_MTD_BLOCK_MAP(bm, struct mtd_block_map);
 
-    if (mi->es[eb] != status) {
-        if (status == MTD_BLK_BAD)
+    int old;
+
+    /*
+     * Neighbouring blocks share a byte, partitions written in parallel
+     * must not lose each other's updates
+     */
+    pthread_mutex_lock(&block_map_lock);
+    old = block_map_get(mi->es, eb);
+    if (old != status) {
+        if (status == MTD_BLK_BAD) {
             mi->bad_cnt++;
+            update_stats_count(UPDATE_COUNTER_BAD_BLOCKS, 1);
+        }
         // else if (status == MTD_BLK_WRITEN_EIO)
         //     mi->write_eio++;
-        if (mi->es[eb] == MTD_BLK_BAD)
+        if (old == MTD_BLK_BAD)
             goto out;
-        mi->es[eb] = status;
+        if (block_map_persistent(old) != block_map_persistent(status))
+            mi->dirty = 1;
+        block_map_put(mi->es, eb, status);
     }
 out:
+    pthread_mutex_unlock(&block_map_lock);
     return 0;
 }
 
@@ -175,7 +379,7 @@ int mtd_boundary_is_valid(struct filesystem *fs, int64_t eb_start, int64_t eb_en
     int64_t left_limit = 0;
     int64_t right_limit = MTD_OFFSET_TO_EB_INDEX(mtd, mtd->size);
     if ((eb_start < left_limit) || (eb_end > right_limit)) {
-        LOGE("start eb%lld to end eb%lld is invalid, valid boundary is from %lld to %lld\n",
+        LOGE("start eb%" PRId64 " to end eb%" PRId64 " is invalid, valid boundary is from %" PRId64 " to %" PRId64 "\n",
              eb_start, eb_end, left_limit, right_limit);
         return false;
     }
@@ -199,20 +403,21 @@ void mtd_scan_dump(struct filesystem *fs) {
         LOGE("Parameter mtd block map is null\n");
         return;
     }
-    LOGI("total eb count: %lld, start from %lld to %lld\n",
+    LOGI("total eb count: %" PRId64 ", start from %" PRId64 " to %" PRId64 "\n",
          (mi)->eb_cnt,  (mi)->eb_start, (mi)->eb_start + (mi)->eb_cnt);
-    LOGI("bad eb count: %lld\n",  (mi)->bad_cnt);
+    LOGI("bad eb count: %" PRId64 "\n",  (mi)->bad_cnt);
     LOGI("eb table status table: \n");
 
     for (i = (mi)->eb_start; i < (mi)->eb_cnt; i++) {
-        if ((mi)->es[i] & MTD_BLK_PREFIX) {
-            if ((mi)->es[i] == MTD_BLK_SCAN) {
+        int status = block_map_get((mi)->es, i);
+        if (status != MTD_BLK_UNKNOWN) {
+            if (status == MTD_BLK_SCAN) {
                 buf = s_scaned;
                 pointer = &scaned_cnt;
-            } else if  ((mi)->es[i] == MTD_BLK_BAD) {
+            } else if  (status == MTD_BLK_BAD) {
                 buf = s_bad;
                 pointer = &bad_cnt;
-            } else if  ((mi)->es[i] == MTD_BLK_ERASED) {
+            } else if  (status == MTD_BLK_ERASED) {
                 buf = s_erased;
                 pointer = &erased_cnt;
             }
@@ -246,7 +451,7 @@ int64_t mtd_block_scan(struct filesystem *fs) {
     int noskipbad = 0, retval;
 
     if (mtd == NULL) {
-        LOGE("Cannot get mtd devinfo at 0x%llx\n", offset);
+        LOGE("Cannot get mtd devinfo at 0x%" PRIx64 "\n", offset);
         goto out;
     }
 
@@ -280,13 +485,13 @@ int64_t mtd_block_scan(struct filesystem *fs) {
                                       offset + length + mtd->eb_size - 1);
 
     total_bytes = (end_eb - start_eb) * mtd->eb_size;
-    LOGI("Scan mtdchar dev \"%s\" from eb%lld to eb%lld, total scaned bytes is %lld\n",
+    LOGI("Scan mtdchar dev \"%s\" from eb%" PRId64 " to eb%" PRId64 ", total scaned bytes is %" PRId64 "\n",
          MTD_DEV_INFO_TO_PATH(mtd), start_eb, end_eb, total_bytes);
 
     start_eb = MTD_EB_ABSOLUTE_TO_RELATIVE(mtd, start_eb);
     end_eb = MTD_EB_ABSOLUTE_TO_RELATIVE(mtd, end_eb);
     if (!mtd_boundary_is_valid(fs, start_eb, end_eb)) {
-        LOGE("mtd boundary start eb %lld to end eb %lld is invalid\n",
+        LOGE("mtd boundary start eb %" PRId64 " to end eb %" PRId64 " is invalid\n",
              start_eb, end_eb);
         goto out;
     }
@@ -301,8 +506,11 @@ int64_t mtd_block_scan(struct filesystem *fs) {
     }
 
     for (eb = start_eb; eb < mtd->eb_cnt; eb++) {
-        if (mtd_bm_block_map_is_taged(fs, MTD_EB_RELATIVE_TO_ABSOLUTE(mtd, eb))
-                && !mtd_bm_block_map_is_bad(fs, MTD_EB_RELATIVE_TO_ABSOLUTE(mtd, eb))) {
+        if (mtd_bm_block_map_is_taged(fs, MTD_EB_RELATIVE_TO_ABSOLUTE(mtd, eb))) {
+            //Known bad, from this or a cached scan
+            if (!noskipbad
+                    && mtd_bm_block_map_is_bad(fs, MTD_EB_RELATIVE_TO_ABSOLUTE(mtd, eb)))
+                continue;
             pass += mtd->eb_size;
             //exit1: The block has been scaned before.
             if (pass >= total_bytes) {
@@ -333,7 +541,7 @@ int64_t mtd_block_scan(struct filesystem *fs) {
         }
         retval = mtd_is_bad(mtd, fd, eb);
         if (retval == -1) {
-            LOGE("mtd block %lld bad detecting wrong\n", eb);
+            LOGE("mtd block %" PRId64 " bad detecting wrong\n", eb);
             goto out;
         }
         if (retval) {
@@ -344,7 +552,7 @@ int64_t mtd_block_scan(struct filesystem *fs) {
             }
             mtd_bm_block_map_set(fs,
                                  MTD_EB_RELATIVE_TO_ABSOLUTE(mtd, eb), MTD_BLK_BAD);
-            LOGI("Block%lld is bad\n", eb);
+            LOGI("Block%" PRId64 " is bad\n", eb);
             continue;
         }
         //exit3: explicitly for nand flash
@@ -360,7 +568,7 @@ int64_t mtd_block_scan(struct filesystem *fs) {
              MTD_DEV_INFO_TO_PATH(mtd));
         goto out;
     }
-    LOGI("Actually total %lld bytes is scaned\n",
+    LOGI("Actually total %" PRId64 " bytes is scaned\n",
          (eb - start_eb + 1)*mtd->eb_size);
     return (eb - start_eb + 1) * mtd->eb_size;
 out:
@@ -382,6 +590,98 @@ void set_process_info(struct filesystem *fs,
         BM_GET_LISTENER(bm)(bm, &info, bm->param);
 }
 
+int mtd_bm_block_map_is_known_bad(struct filesystem *fs, int64_t eb) {
+    struct block_manager *bm = FS_GET_BM(fs);
+    struct mtd_block_map *mi = *BM_GET_MTD_BLOCK_MAP(bm, struct mtd_block_map);
+
+    return block_map_get(mi->es, eb) == MTD_BLK_BAD;
+}
+
+/*
+ * Reads eb into buf, an eraseblock large, and tells whether it holds
+ * nothing but 0xFF. On NAND the OOB of every page has to read 0xFF too,
+ * a page programmed with 0xFF data still carries its ECC there. A block
+ * that cannot be read is not blank.
+ */
+int mtd_block_is_blank(libmtd_t mtd_desc, struct mtd_dev_info *mtd, int fd,
+                       int64_t eb, void *buf) {
+    int pages = mtd->eb_size / mtd->min_io_size;
+
+    if (mtd_read(mtd, fd, eb, 0, buf, mtd->eb_size))
+        return false;
+
+    if (!memscan_is_ff(buf, mtd->eb_size))
+        return false;
+
+    if (!mtd_type_is_nand(mtd) || mtd->oob_size <= 0)
+        return true;
+
+    for (int i = 0; i < pages; i++) {
+        if (mtd_read_oob(mtd_desc, mtd, fd, (uint64_t)eb * mtd->eb_size
+                         + i * mtd->min_io_size, mtd->oob_size,
+                         (char *)buf + i * mtd->oob_size))
+            return false;
+    }
+
+    return memscan_is_ff(buf, pages * mtd->oob_size);
+}
+
+/*
+ * Good blocks from eb on which can go in one erase request. With blankbuf
+ * the run stops short of a blank block, which is left in *blank_eb.
+ */
+static int64_t mtd_erase_run_length(struct filesystem *fs, int64_t eb,
+                                    int64_t max, int skipbad,
+                                    void *blankbuf, int64_t *blank_eb) {
+    struct block_manager *bm = FS_GET_BM(fs);
+    struct mtd_dev_info *mtd = FS_GET_MTD_DEV(fs);
+    int64_t count = 1;
+
+    if (MTD_DEV_INFO_TO_ERASE_SINGLE(mtd) || FS_FLAG_IS_SET(fs, UNLOCK)
+            || FS_FLAG_IS_SET(fs, BLOCKERASE))
+        return 1;
+
+    max = MIN(max, MTD_ERASE_RUN_MAX);
+    while (count < max && eb + count < mtd->eb_cnt) {
+        if (skipbad && mtd_bm_block_map_is_known_bad(fs,
+                MTD_EB_RELATIVE_TO_ABSOLUTE(mtd, eb + count)))
+            break;
+        if (blankbuf && mtd_block_is_blank(BM_GET_MTD_DESC(bm), mtd,
+                                           MTD_DEV_INFO_TO_FD(mtd),
+                                           eb + count, blankbuf)) {
+            *blank_eb = eb + count;
+            break;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+/*
+ * Book eb as erased, giving it a cleanmarker on JFFS2
+ */
+static int mtd_erase_done(struct filesystem *fs, int64_t eb,
+                          struct jffs2_unknown_node *cleanmarker,
+                          int clmpos, int clmlen) {
+    struct mtd_dev_info *mtd = FS_GET_MTD_DEV(fs);
+
+    mtd_bm_block_map_set(fs, MTD_EB_RELATIVE_TO_ABSOLUTE(mtd, eb),
+                         MTD_BLK_ERASED);
+
+    if (cleanmarker == NULL)
+        return 0;
+
+    LOGI("Cleanmarker is writing at %" PRIx64 "\n", eb * mtd->eb_size);
+    if (jffs2_write_cleanmarker(fs, eb * mtd->eb_size, cleanmarker,
+                                clmpos, clmlen) < 0) {
+        LOGE("MTD \"%s\" cannot write cleanmarker at offset 0x%" PRIx64 "\n",
+             MTD_DEV_INFO_TO_PATH(mtd), eb * mtd->eb_size);
+        return -1;
+    }
+    return 0;
+}
+
 int64_t mtd_basic_erase(struct filesystem *fs) {
     struct block_manager *bm = FS_GET_BM(fs);
     libmtd_t mtd_desc = BM_GET_MTD_DESC(bm);
@@ -400,6 +700,10 @@ int64_t mtd_basic_erase(struct filesystem *fs) {
     int is_jffs2 = !strcmp(fs->name, BM_FILE_TYPE_JFFS2);
 
     int64_t bad_unlock_nerase_ebs = 0, nerase_size = 0;
+    int64_t run, single_until = -1, requests = 0;
+    int64_t blank_eb = -1, blank_ebs = 0;
+    void *blankbuf = NULL;
+    uint64_t begin_time;
     int err;
 
     fs_flags_get(fs, &noskipbad);
@@ -412,7 +716,7 @@ int64_t mtd_basic_erase(struct filesystem *fs) {
     if (is_jffs2 && (jffs2_init_cleanmarker(fs, &cleanmarker, &clmpos, &clmlen) < 0))
         goto closeall;
 
-    offset = MTD_DEV_INFO_TO_START(mtd);
+    offset = fs->params->offset;
     start = MTD_OFFSET_TO_EB_INDEX(mtd, offset);
     end = MTD_OFFSET_TO_EB_INDEX(mtd,
                                  MTD_BLOCK_ALIGN(mtd, offset + fs->params->length + mtd->eb_size - 1));
@@ -421,7 +725,7 @@ int64_t mtd_basic_erase(struct filesystem *fs) {
     start = MTD_EB_ABSOLUTE_TO_RELATIVE(mtd, start);
     end = MTD_EB_ABSOLUTE_TO_RELATIVE(mtd, end);
     if (!mtd_boundary_is_valid(fs, start, end)) {
-        LOGE("mtd boundary start eb %lld to end eb %lld is invalid\n",
+        LOGE("mtd boundary start eb %" PRId64 " to end eb %" PRId64 " is invalid\n",
              start, end);
         goto closeall;
     }
@@ -430,11 +734,20 @@ int64_t mtd_basic_erase(struct filesystem *fs) {
              MTD_DEV_INFO_TO_PATH(mtd));
         goto closeall;
     }
-    LOGI("MTD \"%s\" is going to erase from eb%lld to eb%lld, total length is %lld bytes\n",
+    LOGI("MTD \"%s\" is going to erase from eb%" PRId64 " to eb%" PRId64 ", total length is %" PRId64 " bytes\n",
          MTD_DEV_INFO_TO_PATH(mtd), start, end, total_bytes);
 
+    if (FS_FLAG_IS_SET(fs, SKIPERASED) && !FS_FLAG_IS_SET(fs, UNLOCK)) {
+        blankbuf = malloc(mtd->eb_size);
+        if (blankbuf == NULL) {
+            LOGE("Cannot allocate %d bytes of memory\n", mtd->eb_size);
+            goto closeall;
+        }
+    }
+
     eb = start;
     erased_bytes = 0;
+    begin_time = update_stats_now();
     while ((erased_bytes < total_bytes)
             && (eb < mtd->eb_cnt)) {
         offset = eb * mtd->eb_size;
@@ -453,12 +766,41 @@ int64_t mtd_basic_erase(struct filesystem *fs) {
                 continue;
             }
         }
-        LOGI("MTD %s: erase at block%lld with fd%d\n", MTD_DEV_INFO_TO_PATH(mtd), eb, *fd);
+
+        /*
+         * A block already reading all 0xFF costs a read instead of an
+         * erase. There is no system info to save from it either.
+         */
+        if (blankbuf && eb >= single_until && (eb == blank_eb
+                || mtd_block_is_blank(mtd_desc, mtd, *fd, eb, blankbuf))) {
+            if (mtd_erase_done(fs, eb, is_jffs2 ? &cleanmarker : NULL,
+                               clmpos, clmlen) < 0)
+                goto closeall;
+            blank_ebs++;
+            erased_bytes += mtd->eb_size;
+            eb++;
+            continue;
+        }
+
+        /*
+         * A run of known good blocks goes in one request; a failed run is
+         * erased again block by block, so that the bad one is found and
+         * marked, its system info having been saved already
+         */
+        run = 1;
+        if (eb >= single_until)
+            run = mtd_erase_run_length(fs, eb,
+                                       (total_bytes - erased_bytes) / mtd->eb_size,
+                                       is_nand && !noskipbad,
+                                       blankbuf, &blank_eb);
+
+        LOGI("MTD %s: erase at block%" PRId64 " with fd%d\n", MTD_DEV_INFO_TO_PATH(mtd), eb, *fd);
 
 #ifdef BM_SYSINFO_SUPPORT
-        if (bm->sysinfo) {
+        if (bm->sysinfo && eb >= single_until) {
             err = bm->sysinfo->traversal_save(bm->sysinfo,
-                                              offset + MTD_DEV_INFO_TO_START(mtd), mtd->eb_size);
+                                              offset + MTD_DEV_INFO_TO_START(mtd),
+                                              run * mtd->eb_size);
             if (err < 0) {
                 LOGE("MTD \"%s\" failed to save system info\n", MTD_DEV_INFO_TO_PATH(mtd));
                 goto closeall;
@@ -466,17 +808,39 @@ int64_t mtd_basic_erase(struct filesystem *fs) {
         }
 #endif
 
+        if (run > 1) {
+            requests++;
+            if (mtd_erase_multi(mtd_desc, mtd, *fd, eb, run) == 0) {
+                for (int64_t i = 0; i < run; i++)
+                    if (mtd_erase_done(fs, eb + i, is_jffs2 ? &cleanmarker : NULL,
+                                       clmpos, clmlen) < 0)
+                        goto closeall;
+                erased_bytes += run * mtd->eb_size;
+                eb += run;
+                continue;
+            }
+
+            if (errno == ENOTTY || errno == EOPNOTSUPP || errno == EINVAL)
+                MTD_DEV_INFO_TO_ERASE_SINGLE(mtd) = 1;
+
+            LOGW("MTD \"%s\" failed to erase %" PRId64 " blocks from eb%" PRId64 ", "
+                 "erasing them one by one\n", MTD_DEV_INFO_TO_PATH(mtd), run, eb);
+            single_until = eb + run;
+            continue;
+        }
+
+        requests++;
         err = mtd_erase(mtd_desc, mtd, *fd, eb);
         if (err) {
-            LOGE("MTD \"%s\" failed to erase eraseblock %lld\n",
+            LOGE("MTD \"%s\" failed to erase eraseblock %" PRId64 "\n",
                  MTD_DEV_INFO_TO_PATH(mtd), eb);
             if (errno != EIO) {
-                LOGE("MTD \"%s\" fatal error occured on %lld\n",
+                LOGE("MTD \"%s\" fatal error occured on %" PRId64 "\n",
                      MTD_DEV_INFO_TO_PATH(mtd), eb);
                 goto closeall;
             }
             if (mtd_mark_bad(mtd, *fd, eb)) {
-                LOGE("MTD \"%s\" mark bad block failed on %lld\n",
+                LOGE("MTD \"%s\" mark bad block failed on %" PRId64 "\n",
                      MTD_DEV_INFO_TO_PATH(mtd), eb);
                 goto closeall;
             }
@@ -486,17 +850,10 @@ int64_t mtd_basic_erase(struct filesystem *fs) {
             bad_unlock_nerase_ebs++;
             continue;
         }
-        mtd_bm_block_map_set(fs,
-                             MTD_EB_RELATIVE_TO_ABSOLUTE(mtd, eb), MTD_BLK_ERASED);
         /* format for JFFS2 ? */
-        if (is_jffs2) {
-            LOGI("Cleanmarker is writing at %x\n", (unsigned int)offset);
-            if (jffs2_write_cleanmarker(fs, offset, &cleanmarker, clmpos, clmlen) < 0) {
-                LOGE("MTD \"%s\" cannot write cleanmarker at offset 0x%llx\n",
-                     MTD_DEV_INFO_TO_PATH(mtd), offset);
-                goto closeall;
-            }
-        }
+        if (mtd_erase_done(fs, eb, is_jffs2 ? &cleanmarker : NULL,
+                           clmpos, clmlen) < 0)
+            goto closeall;
         erased_bytes += mtd->eb_size;
         eb++;
     }
@@ -505,15 +862,23 @@ int64_t mtd_basic_erase(struct filesystem *fs) {
     if ((eb >= mtd->eb_cnt)
             && (erased_bytes + nerase_size < total_bytes)) {
         LOGE("The erase length you have requested is too large to issuing\n");
-        LOGE("Request length: %lld, erase length: %lld, non erase length: %lld\n",
+        LOGE("Request length: %" PRId64 ", erase length: %" PRId64 ", non erase length: %" PRId64 "\n",
              total_bytes, erased_bytes, nerase_size);
         goto closeall;
     }
     set_process_info(fs, BM_OPERATION_ERASE, erased_bytes, total_bytes);
+
+    begin_time = update_stats_now() - begin_time;
+    LOGI("MTD \"%s\" erased %" PRId64 " bytes in %" PRId64 " requests, %" PRId64 " blank blocks left alone, %.2f MB/s\n",
+         MTD_DEV_INFO_TO_PATH(mtd), erased_bytes, requests, blank_ebs,
+         begin_time ? erased_bytes * 1e9 / begin_time / (1024 * 1024) : 0.0);
+
+    free(blankbuf);
     start = MTD_EB_RELATIVE_TO_ABSOLUTE(mtd, eb) * mtd->eb_size;
     return start;
 closeall:
     LOGE("%s has crashed\n", __func__);
+    free(blankbuf);
     if (*fd) {
         close(*fd);
         *fd = 0;
@@ -529,6 +894,16 @@ static void erase_buffer(void *buffer, size_t size)
         memset(buffer, bytes, size);
 }
 
+/*
+ * Programs a run of whole pages inside one erase block in a single
+ * request
+ */
+static int mtd_write_run(libmtd_t mtd_desc, struct mtd_dev_info *mtd, int fd,
+                         long long offset, char *buf, long long length) {
+    return mtd_write(mtd_desc, mtd, fd, MTD_OFFSET_TO_EB_INDEX(mtd, offset),
+                     offset % mtd->eb_size, buf, length, NULL, 0, 0);
+}
+
 int64_t mtd_basic_write(struct filesystem *fs) {
     struct block_manager *bm = FS_GET_BM(fs);
     libmtd_t mtd_desc = BM_GET_MTD_DESC(bm);
@@ -539,7 +914,7 @@ int64_t mtd_basic_write(struct filesystem *fs) {
 
     int noecc, autoplace, writeoob, oobsize, pad, markbad, pagelen;
     unsigned int write_mode;
-    long long mtd_start, w_length, w_offset, blockstart = -1, writen;
+    long long mtd_start, w_length, w_offset, blockstart = -1, writen, run;
     char *w_buffer, *oobbuf;
     char *pad_buffer = NULL;
     int ret;
@@ -617,25 +992,48 @@ int64_t mtd_basic_write(struct filesystem *fs) {
             LOGI("Writing data to block %lld at offset 0x%llx\n",
                  blockstart / mtd->eb_size, w_offset);
 
-            if (!is_nand)
-                continue;
-            do {
-                if (mtd_bm_block_map_is_bad(fs, MTD_OFFSET_TO_EB_INDEX(mtd, w_offset))) {
-                    w_offset += mtd->eb_size;
-                    w_offset = MTD_BLOCK_ALIGN(mtd, w_offset);
-                    continue;
+            if (is_nand) {
+                do {
+                    if (mtd_bm_block_map_is_bad(fs, MTD_EB_RELATIVE_TO_ABSOLUTE(mtd,
+                            MTD_OFFSET_TO_EB_INDEX(mtd, w_offset)))) {
+                        w_offset += mtd->eb_size;
+                        w_offset = MTD_BLOCK_ALIGN(mtd, w_offset);
+                        continue;
+                    }
+                    break;
+                } while (w_offset < mtd->size);
+
+                if (w_offset >= mtd->size) {
+                    LOGE("write boundary is overlow\n");
+                    goto closeall;
                 }
-                break;
-            } while (w_offset < mtd->size);
+                blockstart = MTD_BLOCK_ALIGN(mtd, w_offset);
+            }
 
-            if (w_offset >= mtd->size) {
-                LOGE("write boundary is overlow\n");
+            /*
+             * Catch up with the erase-ahead worker if the write got in
+             * front of it, the block may turn bad on the way
+             */
+            ret = mtd_erase_ahead_ensure(fs, mtd_start + blockstart);
+            if (ret < 0)
                 goto closeall;
-            }
-            blockstart = MTD_BLOCK_ALIGN(mtd, w_offset);
-            continue;
+            if (ret > 0)
+                w_offset = blockstart + mtd->eb_size;
+        }
+        /*
+         * Without OOB the whole pages left in the erase block go down in
+         * one run, with the system info merged and the progress reported
+         * once for it; the last partial page and OOB writes are done a
+         * page at a time
+         */
+        if (!writeoob && !FS_FLAG_IS_SET(fs, PAGEWRITE) && w_length >= pagelen) {
+            run = mtd->eb_size - (w_offset % mtd->eb_size);
+            run = MIN(run, w_length - (w_length % pagelen));
+            writen = run;
+        } else {
+            run = mtd->min_io_size;
+            writen = (w_length > pagelen) ? pagelen : w_length;
         }
-        writen = (w_length > pagelen) ? pagelen : w_length;
         if (writen % pagelen) {
             LOGI("Padding\n");
             if (pad_buffer == NULL) {
@@ -662,20 +1060,23 @@ int64_t mtd_basic_write(struct filesystem *fs) {
         if (bm->sysinfo) {
             ret = bm->sysinfo->traversal_merge(bm->sysinfo, w_buffer,
                                                w_offset + MTD_DEV_INFO_TO_START(mtd),
-                                               mtd->min_io_size);
+                                               run);
             if (ret < 0) {
                 LOGE("MTD \"%s\" failed to merge system info\n", MTD_DEV_INFO_TO_PATH(mtd));
                 goto closeall;
             }
         }
 #endif
-        ret = mtd_write(mtd_desc, mtd, *fd, MTD_OFFSET_TO_EB_INDEX(mtd, w_offset),
-                        w_offset % mtd->eb_size,
-                        w_buffer,
-                        mtd->min_io_size,
-                        writeoob ? oobbuf : NULL,
-                        writeoob ? oobsize : 0,
-                        write_mode);
+        if (run > mtd->min_io_size)
+            ret = mtd_write_run(mtd_desc, mtd, *fd, w_offset, w_buffer, run);
+        else
+            ret = mtd_write(mtd_desc, mtd, *fd, MTD_OFFSET_TO_EB_INDEX(mtd, w_offset),
+                            w_offset % mtd->eb_size,
+                            w_buffer,
+                            mtd->min_io_size,
+                            writeoob ? oobbuf : NULL,
+                            writeoob ? oobsize : 0,
+                            write_mode);
         if (ret) {
             if (errno != EIO) {
                 LOGE("MTD \"%s\" write failure\n", MTD_DEV_INFO_TO_PATH(mtd));
@@ -695,8 +1096,8 @@ int64_t mtd_basic_write(struct filesystem *fs) {
                     goto closeall;
                 }
             }
-            if (mtd_bm_block_map_set(fs,
-                                     MTD_OFFSET_TO_EB_INDEX(mtd, w_offset), MTD_BLK_BAD) < 0) {
+            if (mtd_bm_block_map_set(fs, MTD_EB_RELATIVE_TO_ABSOLUTE(mtd,
+                                     MTD_OFFSET_TO_EB_INDEX(mtd, w_offset)), MTD_BLK_BAD) < 0) {
                 LOGE("MTD \"%s\" block map wrong at eb %lld\n", MTD_DEV_INFO_TO_PATH(mtd),
                      MTD_OFFSET_TO_EB_INDEX(mtd, w_offset));
                 goto closeall;
@@ -705,8 +1106,8 @@ int64_t mtd_basic_write(struct filesystem *fs) {
             w_offset = MTD_BLOCK_ALIGN(mtd, w_offset);
             continue;
         }
-        w_offset += mtd->min_io_size;
-        w_buffer += pagelen;
+        w_offset += run;
+        w_buffer += (run / mtd->min_io_size) * pagelen;
         w_length -= writen;
         fs->params->progress_size += writen;
     }
@@ -756,7 +1157,8 @@ int64_t mtd_basic_read(struct filesystem *fs) {
             if (!is_nand)
                 continue;
             do {
-                if (mtd_bm_block_map_is_bad(fs, MTD_OFFSET_TO_EB_INDEX(mtd, offset))) {
+                if (mtd_bm_block_map_is_bad(fs, MTD_EB_RELATIVE_TO_ABSOLUTE(mtd,
+                            MTD_OFFSET_TO_EB_INDEX(mtd, offset)))) {
                     offset += mtd->eb_size;
                     offset = MTD_BLOCK_ALIGN(mtd, offset);
                     continue;
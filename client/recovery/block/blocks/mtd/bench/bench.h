@@ -0,0 +1,51 @@
+#ifndef __BENCH_H_
+#define __BENCH_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <block/block_manager.h>
+
+#define BENCH_MAX_NAMES     16
+
+enum bench_format {
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON,
+};
+
+struct bench_options {
+    char *parts[BENCH_MAX_NAMES];   /* names or "mtdN" */
+    int part_cnt;
+    char *writers[BENCH_MAX_NAMES]; /* "raw" or a BM_FILE_TYPE_* */
+    int writer_cnt;
+    int64_t size;                   /* bytes per pass, 0: whole partition */
+    int64_t chunk;                  /* bytes per block manager call */
+    int repeat;
+    int format;
+    FILE *out;
+    int rows;
+};
+
+/*
+ * Latencies of the operations of one kind, one sample per call
+ */
+struct bench_samples {
+    uint64_t *ns;
+    int count;
+    int size;
+    uint64_t bytes;
+};
+
+int bench_samples_add(struct bench_samples *s, uint64_t ns, uint64_t bytes);
+void bench_samples_free(struct bench_samples *s);
+
+void bench_report_begin(struct bench_options *opts);
+void bench_report(struct bench_options *opts, struct block_manager *bm,
+                  int part, const char *writer, const char *op,
+                  struct bench_samples *s);
+void bench_report_end(struct bench_options *opts);
+
+int bench_raw(struct bench_options *opts, struct block_manager *bm, int part);
+int bench_fs(struct bench_options *opts, struct block_manager *bm, int part,
+             const char *writer);
+
+#endif
@@ -0,0 +1,239 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <utils/log.h>
+#include <types.h>
+#include <lib/libcommon.h>
+#include <lib/mtd/mtd-user.h>
+#include <lib/libmtd.h>
+#include <lib/mtd/ubi-media.h>
+#include <lib/ubi/libubigen.h>
+#include <utils/list.h>
+#include <utils/update_stats.h>
+#include <block/block_manager.h>
+#include <block/fs/fs_manager.h>
+#include <block/fs/yaffs2.h>
+#include <block/fs/ubifs.h>
+#include <block/mtd/mtd.h>
+#include "bench.h"
+
+/*
+ * A filesystem writer through the block manager, the way an update
+ * drives it: prepare, the partition erased and the image written in
+ * chunks, read back where the writer can, then finish. One sample per
+ * block manager call, plus the block scan and the UBI format.
+ */
+#define LOG_TAG         "bench-fs"
+
+enum {
+    FS_PREPARE,
+    FS_SCAN,
+    FS_ERASE,
+    FS_WRITE,
+    FS_READ,
+    FS_FINISH,
+    FS_FORMAT,
+    FS_OP_COUNT,
+};
+
+static const char *fs_op_names[FS_OP_COUNT] = {
+    [FS_PREPARE] = "prepare",
+    [FS_SCAN] = "scan",
+    [FS_ERASE] = "erase",
+    [FS_WRITE] = "write",
+    [FS_READ] = "read",
+    [FS_FINISH] = "finish",
+    [FS_FORMAT] = "format",
+};
+
+/*
+ * What a write takes whole: pages with their tags for yaffs2, LEBs
+ * otherwise
+ */
+static int64_t fs_write_unit(struct block_manager *bm, int64_t offset,
+                             const char *writer) {
+    if (!strcmp(writer, BM_FILE_TYPE_YAFFS2))
+        return bm->get_iosize(bm, offset) + YAFFS2_TAG_SIZE;
+
+    return bm->get_prepare_leb_size(bm);
+}
+
+/*
+ * The other writers do not serve reads
+ */
+static int fs_can_read(const char *writer) {
+    return !strcmp(writer, BM_FILE_TYPE_NORMAL);
+}
+
+static int fs_erase(struct block_manager *bm, int64_t offset, int64_t end,
+                    int64_t step, struct bench_samples *s) {
+    while (offset < end) {
+        uint64_t start = update_stats_now();
+        int64_t next = bm->erase(bm, offset, MIN(step, end - offset));
+
+        if (next < 0) {
+            LOGE("Failed to erase at 0x%" PRIx64 "\n", offset);
+            return -1;
+        }
+        if (bench_samples_add(s, update_stats_now() - start,
+                              MIN(step, end - offset)) < 0)
+            return -1;
+
+        if (next <= offset)
+            break;
+        offset = next;
+    }
+
+    return 0;
+}
+
+static int fs_pass(struct bench_options *opts, struct block_manager *bm,
+                   int part, const char *writer, char *src, char *dst,
+                   int64_t length, struct bench_samples *samples) {
+    struct bm_operation_option option;
+    struct bm_operate_prepare_info *prepared;
+    int64_t start = BM_GET_PARTINFO_START(bm, part);
+    int64_t size = bm->get_partition_size_by_offset(bm, start);
+    int64_t offset, chunk, unit, step;
+    uint64_t t, format_bytes, format_ns, bytes, ns;
+    int error = -1;
+
+    bm->set_operation_option(bm, &option, BM_OPERATION_METHOD_PARTITION,
+                             (char *)writer);
+
+    t = update_stats_now();
+    prepared = bm->prepare(bm, start, length, &option);
+    if (prepared == NULL) {
+        LOGE("Failed to prepare \"%s\" for %s\n",
+             BM_GET_PARTINFO_MTD_DEV(bm, part)->name, writer);
+        return -1;
+    }
+    bench_samples_add(&samples[FS_PREPARE], update_stats_now() - t, 0);
+
+    t = update_stats_now();
+    if (mtd_block_scan((struct filesystem *)prepared->context_handle) <= 0) {
+        LOGE("Failed to scan \"%s\"\n", BM_GET_PARTINFO_MTD_DEV(bm, part)->name);
+        goto finish;
+    }
+    bench_samples_add(&samples[FS_SCAN], update_stats_now() - t, size);
+
+    unit = fs_write_unit(bm, start, writer);
+    chunk = MAX(unit, opts->chunk / unit * unit);
+    step = bm->get_blocksize(bm, start);
+    step = MAX(step, opts->chunk / step * step);
+
+    if (fs_erase(bm, start, start + size, step, &samples[FS_ERASE]) < 0)
+        goto finish;
+
+    offset = bm->get_prepare_write_start(bm);
+    for (int64_t done = 0; done < length; done += chunk) {
+        int64_t n = MIN(chunk, length - done);
+
+        t = update_stats_now();
+        offset = bm->write(bm, offset, src + done, n);
+        if (offset < 0) {
+            LOGE("Failed to write %s at 0x%" PRIx64 "\n", writer, done);
+            goto finish;
+        }
+        if (bench_samples_add(&samples[FS_WRITE], update_stats_now() - t, n) < 0)
+            goto finish;
+    }
+
+    if (fs_can_read(writer)) {
+        offset = bm->get_prepare_write_start(bm);
+        for (int64_t done = 0; done < length; done += chunk) {
+            int64_t n = MIN(chunk, length - done);
+
+            t = update_stats_now();
+            offset = bm->read(bm, offset, dst + done, n);
+            if (offset < 0) {
+                LOGE("Failed to read %s at 0x%" PRIx64 "\n", writer, done);
+                goto finish;
+            }
+            if (bench_samples_add(&samples[FS_READ], update_stats_now() - t,
+                                  n) < 0)
+                goto finish;
+        }
+
+        if (memcmp(src, dst, length)) {
+            LOGE("%s image reads back different\n", writer);
+            goto finish;
+        }
+    }
+
+    error = 0;
+
+finish:
+    update_stats_get_stage(UPDATE_STAGE_FORMAT, &format_bytes, &format_ns);
+
+    t = update_stats_now();
+    if (bm->finish(bm) < 0) {
+        LOGE("Failed to finish %s\n", writer);
+        return -1;
+    }
+    bench_samples_add(&samples[FS_FINISH], update_stats_now() - t, 0);
+
+    update_stats_get_stage(UPDATE_STAGE_FORMAT, &bytes, &ns);
+    if (ns > format_ns)
+        bench_samples_add(&samples[FS_FORMAT], ns - format_ns,
+                          bytes - format_bytes);
+
+    return error;
+}
+
+int bench_fs(struct bench_options *opts, struct block_manager *bm, int part,
+             const char *writer) {
+    struct mtd_dev_info *mtd = BM_GET_PARTINFO_MTD_DEV(bm, part);
+    struct bench_samples samples[FS_OP_COUNT];
+    int64_t length = opts->size ? opts->size : mtd->size / 2;
+    char *src = NULL, *dst = NULL;
+    int error = -1;
+
+    memset(samples, 0, sizeof(samples));
+
+    /*
+     * Room left for the bad blocks and what the writer adds
+     */
+    length = MIN(length, mtd->size / 4 * 3);
+
+    /*
+     * Whole pages with their tags, whole LEBs, like mkyaffs2image and
+     * mkfs.ubifs make them
+     */
+    if (!strcmp(writer, BM_FILE_TYPE_YAFFS2)) {
+        length -= length % (mtd->min_io_size + YAFFS2_TAG_SIZE);
+    } else if (!strcmp(writer, BM_FILE_TYPE_UBIFS)) {
+        struct ubigen_info ui;
+
+        ubigen_info_init(&ui, mtd->eb_size, mtd->min_io_size,
+                         mtd->subpage_size, UBI_VID_HDR_OFFSET_INIT,
+                         UBI_VERSION_DEFAULT, 0);
+        length -= length % ui.leb_size;
+    }
+
+    src = malloc(length);
+    dst = malloc(length);
+    if (src == NULL || dst == NULL) {
+        LOGE("Cannot allocate %" PRId64 " bytes of image\n", length);
+        goto out;
+    }
+    for (int64_t i = 0; i < length; i++)
+        src[i] = rand();
+
+    for (int r = 0; r < opts->repeat; r++)
+        if (fs_pass(opts, bm, part, writer, src, dst, length, samples) < 0)
+            goto out;
+
+    for (int i = 0; i < FS_OP_COUNT; i++)
+        bench_report(opts, bm, part, writer, fs_op_names[i], &samples[i]);
+
+    error = 0;
+
+out:
+    for (int i = 0; i < FS_OP_COUNT; i++)
+        bench_samples_free(&samples[i]);
+    free(src);
+    free(dst);
+    return error;
+}
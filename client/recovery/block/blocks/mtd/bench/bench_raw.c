@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <utils/log.h>
+#include <types.h>
+#include <lib/libcommon.h>
+#include <lib/mtd/mtd-user.h>
+#include <lib/libmtd.h>
+#include <utils/list.h>
+#include <utils/update_stats.h>
+#include <block/block_manager.h>
+#include <block/fs/fs_manager.h>
+#include <block/mtd/mtd.h>
+#include "bench.h"
+
+/*
+ * The flash itself through libmtd, under the block manager: every good
+ * block of the pass erased, programmed and read back a page at a time,
+ * one sample per erase block or page
+ */
+#define LOG_TAG         "bench-raw"
+#define RAW_NOR_IO_SIZE 2048            /* NOR takes any size, sampled so */
+
+enum {
+    RAW_ERASE,
+    RAW_PROGRAM,
+    RAW_READ,
+    RAW_OP_COUNT,
+};
+
+static const char *raw_op_names[RAW_OP_COUNT] = {
+    [RAW_ERASE] = "erase",
+    [RAW_PROGRAM] = "program",
+    [RAW_READ] = "read",
+};
+
+static int raw_block(libmtd_t desc, struct mtd_dev_info *mtd, int fd, int eb,
+                     char *src, char *dst, struct bench_samples *samples) {
+    int io_size = mtd->min_io_size > 1 ? mtd->min_io_size : RAW_NOR_IO_SIZE;
+    uint64_t start;
+
+    start = update_stats_now();
+    if (mtd_erase(desc, mtd, fd, eb) < 0) {
+        LOGE("Failed to erase block %d of \"%s\"\n", eb, mtd->name);
+        return -1;
+    }
+    if (bench_samples_add(&samples[RAW_ERASE], update_stats_now() - start,
+                          mtd->eb_size) < 0)
+        return -1;
+
+    for (int offs = 0; offs < mtd->eb_size; offs += io_size) {
+        start = update_stats_now();
+        if (mtd_write(desc, mtd, fd, eb, offs, src + offs, io_size, NULL, 0,
+                      0) < 0) {
+            LOGE("Failed to program block %d of \"%s\" at 0x%x\n", eb,
+                 mtd->name, offs);
+            return -1;
+        }
+        if (bench_samples_add(&samples[RAW_PROGRAM],
+                              update_stats_now() - start, io_size) < 0)
+            return -1;
+    }
+
+    for (int offs = 0; offs < mtd->eb_size; offs += io_size) {
+        start = update_stats_now();
+        if (mtd_read(mtd, fd, eb, offs, dst + offs, io_size) < 0) {
+            LOGE("Failed to read block %d of \"%s\" at 0x%x\n", eb,
+                 mtd->name, offs);
+            return -1;
+        }
+        if (bench_samples_add(&samples[RAW_READ], update_stats_now() - start,
+                              io_size) < 0)
+            return -1;
+    }
+
+    if (memcmp(src, dst, mtd->eb_size)) {
+        LOGE("Block %d of \"%s\" reads back different\n", eb, mtd->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+int bench_raw(struct bench_options *opts, struct block_manager *bm, int part) {
+    struct mtd_dev_info *mtd = BM_GET_PARTINFO_MTD_DEV(bm, part);
+    libmtd_t desc = BM_GET_MTD_DESC(bm);
+    int fd = *BM_GET_PARTINFO_FD(bm, part);
+    struct bench_samples samples[RAW_OP_COUNT];
+    char *src = malloc(mtd->eb_size), *dst = malloc(mtd->eb_size);
+    int64_t blocks = mtd->eb_cnt;
+    int error = -1;
+
+    memset(samples, 0, sizeof(samples));
+
+    if (src == NULL || dst == NULL) {
+        LOGE("Cannot allocate the block buffers\n");
+        goto out;
+    }
+    for (int i = 0; i < mtd->eb_size; i++)
+        src[i] = rand();
+
+    if (opts->size)
+        blocks = MIN(blocks, (opts->size + mtd->eb_size - 1) / mtd->eb_size);
+
+    for (int r = 0; r < opts->repeat; r++) {
+        int64_t done = 0;
+
+        for (int eb = 0; eb < mtd->eb_cnt && done < blocks; eb++) {
+            int bad = mtd->bb_allowed ? mtd_is_bad(mtd, fd, eb) : 0;
+
+            if (bad < 0) {
+                LOGE("Cannot tell if block %d of \"%s\" is bad\n", eb,
+                     mtd->name);
+                goto out;
+            }
+            if (bad)
+                continue;
+
+            if (raw_block(desc, mtd, fd, eb, src, dst, samples) < 0)
+                goto out;
+            done++;
+        }
+    }
+
+    for (int i = 0; i < RAW_OP_COUNT; i++)
+        bench_report(opts, bm, part, "raw", raw_op_names[i], &samples[i]);
+
+    error = 0;
+
+out:
+    for (int i = 0; i < RAW_OP_COUNT; i++)
+        bench_samples_free(&samples[i]);
+    free(src);
+    free(dst);
+    return error;
+}
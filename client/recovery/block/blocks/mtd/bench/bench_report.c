@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <utils/log.h>
+#include <types.h>
+#include <lib/libcommon.h>
+#include <lib/mtd/mtd-user.h>
+#include <lib/libmtd.h>
+#include <utils/list.h>
+#include <block/block_manager.h>
+#include <block/fs/fs_manager.h>
+#include <block/mtd/mtd.h>
+#include "bench.h"
+
+#define LOG_TAG         "bench-report"
+
+#define BENCH_CSV_HEADER                                                       \
+    "partition,device,type,eb_size,page_size,writer,op,count,bytes,"           \
+    "seconds,mb_s,p50_us,p90_us,p99_us,max_us\n"
+
+int bench_samples_add(struct bench_samples *s, uint64_t ns, uint64_t bytes) {
+    if (s->count == s->size) {
+        int size = s->size ? s->size * 2 : 1024;
+        uint64_t *ns_new = realloc(s->ns, size * sizeof(*s->ns));
+
+        if (ns_new == NULL) {
+            LOGE("Cannot grow the samples to %d\n", size);
+            return -1;
+        }
+        s->ns = ns_new;
+        s->size = size;
+    }
+
+    s->ns[s->count++] = ns;
+    s->bytes += bytes;
+
+    return 0;
+}
+
+void bench_samples_free(struct bench_samples *s) {
+    free(s->ns);
+    memset(s, 0, sizeof(*s));
+}
+
+static int compare_ns(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Nearest rank, of sorted samples
+ */
+static double percentile_us(struct bench_samples *s, int percent) {
+    int rank = (s->count * percent + 99) / 100;
+
+    return s->ns[MAX(rank, 1) - 1] / 1e3;
+}
+
+void bench_report_begin(struct bench_options *opts) {
+    opts->rows = 0;
+
+    if (opts->format == BENCH_FORMAT_JSON)
+        fprintf(opts->out, "[\n");
+    else
+        fprintf(opts->out, BENCH_CSV_HEADER);
+}
+
+void bench_report(struct bench_options *opts, struct block_manager *bm,
+                  int part, const char *writer, const char *op,
+                  struct bench_samples *s) {
+    struct mtd_dev_info *mtd = BM_GET_PARTINFO_MTD_DEV(bm, part);
+    uint64_t total = 0;
+    double seconds;
+
+    if (!s->count)
+        return;
+
+    qsort(s->ns, s->count, sizeof(*s->ns), compare_ns);
+    for (int i = 0; i < s->count; i++)
+        total += s->ns[i];
+    seconds = total / 1e9;
+
+    if (opts->format == BENCH_FORMAT_JSON)
+        fprintf(opts->out, "%s  {\"partition\": \"%s\", \"device\": \"%s\", "
+                "\"type\": \"%s\", \"eb_size\": %d, \"page_size\": %d, "
+                "\"writer\": \"%s\", \"op\": \"%s\", \"count\": %d, "
+                "\"bytes\": %llu, \"seconds\": %.6f, \"mb_s\": %.3f, "
+                "\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, "
+                "\"max_us\": %.1f}", opts->rows ? ",\n" : "",
+                mtd->name, MTD_DEV_INFO_TO_PATH(mtd), mtd->type_str,
+                mtd->eb_size, mtd->min_io_size, writer, op, s->count,
+                (unsigned long long)s->bytes, seconds,
+                seconds > 0 ? s->bytes / seconds / (1024 * 1024) : 0.0,
+                percentile_us(s, 50), percentile_us(s, 90),
+                percentile_us(s, 99), s->ns[s->count - 1] / 1e3);
+    else
+        fprintf(opts->out, "%s,%s,%s,%d,%d,%s,%s,%d,%llu,%.6f,%.3f,"
+                "%.1f,%.1f,%.1f,%.1f\n",
+                mtd->name, MTD_DEV_INFO_TO_PATH(mtd), mtd->type_str,
+                mtd->eb_size, mtd->min_io_size, writer, op, s->count,
+                (unsigned long long)s->bytes, seconds,
+                seconds > 0 ? s->bytes / seconds / (1024 * 1024) : 0.0,
+                percentile_us(s, 50), percentile_us(s, 90),
+                percentile_us(s, 99), s->ns[s->count - 1] / 1e3);
+
+    fflush(opts->out);
+    opts->rows++;
+}
+
+void bench_report_end(struct bench_options *opts) {
+    if (opts->format == BENCH_FORMAT_JSON)
+        fprintf(opts->out, "%s]\n", opts->rows ? "\n" : "");
+    fflush(opts->out);
+}
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <utils/log.h>
+#include <types.h>
+#include <lib/libcommon.h>
+#include <lib/mtd/mtd-user.h>
+#include <lib/libmtd.h>
+#include <utils/list.h>
+#include <block/block_manager.h>
+#include "bench.h"
+
+/*
+ * Flash micro-benchmarks: erase, program and read throughput and latency
+ * percentiles of MTD partitions, raw and through each filesystem writer
+ * of the block manager, with the block scan and the UBI format times.
+ *
+ * bench_blockmtd runs on the /dev/mtdN of the board, bench_blockmtd_emu
+ * on the file-backed emulator set up from $MTD_EMU. The partitions given
+ * are ERASED.
+ */
+#define LOG_TAG         "bench-blockmtd"
+
+#define BENCH_DEFAULT_WRITERS   "raw,normal,jffs2,yaffs2,ubifs"
+#define BENCH_DEFAULT_SIZE      (4 << 20)
+#define BENCH_DEFAULT_CHUNK     (1 << 20)
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s -p <partitions> [options]\n"
+            "  -p <names>   partitions to run on, by name or mtdN, comma separated\n"
+            "  -f <names>   writers, default " BENCH_DEFAULT_WRITERS "\n"
+            "  -s <bytes>   bytes per pass, default 4M, 0 for the whole partition\n"
+            "  -c <bytes>   bytes per block manager call, default 1M\n"
+            "  -r <count>   passes, default 1\n"
+            "  -o csv|json  output format, default csv\n"
+            "  -w <file>    output file, default stdout\n", name);
+}
+
+static int parse_size(const char *s, int64_t *size) {
+    char *end;
+    int64_t val = strtoll(s, &end, 0);
+
+    if (end == s || val < 0)
+        return -1;
+
+    switch (*end) {
+    case 'G':
+        val <<= 10;
+    case 'M':
+        val <<= 10;
+    case 'K':
+        val <<= 10;
+        end++;
+    default:
+        break;
+    }
+
+    if (*end)
+        return -1;
+
+    *size = val;
+
+    return 0;
+}
+
+static int parse_list(char *s, char **names, int *count) {
+    char *save = NULL;
+
+    *count = 0;
+    for (char *name = strtok_r(s, ",", &save); name;
+            name = strtok_r(NULL, ",", &save)) {
+        if (*count == BENCH_MAX_NAMES)
+            return -1;
+        names[(*count)++] = name;
+    }
+
+    return *count ? 0 : -1;
+}
+
+static int find_partition(struct block_manager *bm, const char *name) {
+    for (int i = 0; i < bm->get_partition_count(bm); i++) {
+        struct mtd_dev_info *mtd = BM_GET_PARTINFO_MTD_DEV(bm, i);
+        char node[16];
+
+        snprintf(node, sizeof(node), "mtd%d", mtd->mtd_num);
+        if (!strcmp(mtd->name, name) || !strcmp(node, name))
+            return i;
+    }
+
+    return -1;
+}
+
+static void bm_mtd_event_listener(struct block_manager *bm,
+                                  struct bm_event* event, void* param) {
+    return;
+}
+
+int main(int argc, char **argv) {
+    struct bench_options opts;
+    struct block_manager *bm;
+    char writers[] = BENCH_DEFAULT_WRITERS;
+    char *path = NULL;
+    int failures = 0;
+    int c;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.size = BENCH_DEFAULT_SIZE;
+    opts.chunk = BENCH_DEFAULT_CHUNK;
+    opts.repeat = 1;
+    opts.format = BENCH_FORMAT_CSV;
+    opts.out = stdout;
+    parse_list(writers, opts.writers, &opts.writer_cnt);
+
+    while ((c = getopt(argc, argv, "p:f:s:c:r:o:w:h")) != -1) {
+        switch (c) {
+        case 'p':
+            if (parse_list(optarg, opts.parts, &opts.part_cnt) < 0)
+                goto usage;
+            break;
+        case 'f':
+            if (parse_list(optarg, opts.writers, &opts.writer_cnt) < 0)
+                goto usage;
+            break;
+        case 's':
+            if (parse_size(optarg, &opts.size) < 0)
+                goto usage;
+            break;
+        case 'c':
+            if (parse_size(optarg, &opts.chunk) < 0 || !opts.chunk)
+                goto usage;
+            break;
+        case 'r':
+            opts.repeat = atoi(optarg);
+            if (opts.repeat < 1)
+                goto usage;
+            break;
+        case 'o':
+            if (!strcmp(optarg, "json"))
+                opts.format = BENCH_FORMAT_JSON;
+            else if (strcmp(optarg, "csv"))
+                goto usage;
+            break;
+        case 'w':
+            path = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (!opts.part_cnt)
+        goto usage;
+
+    if (path) {
+        opts.out = fopen(path, "w");
+        if (opts.out == NULL) {
+            LOGE("Cannot open %s\n", path);
+            return 1;
+        }
+    }
+
+    bm = (struct block_manager *)calloc(1, sizeof(*bm));
+    bm->construct = construct_block_manager;
+    bm->destruct = destruct_block_manager;
+    bm->construct(bm, BM_BLOCK_TYPE_MTD, bm_mtd_event_listener, "bench");
+
+    bench_report_begin(&opts);
+
+    for (int i = 0; i < opts.part_cnt; i++) {
+        int part = find_partition(bm, opts.parts[i]);
+
+        if (part < 0) {
+            LOGE("No partition \"%s\"\n", opts.parts[i]);
+            failures++;
+            continue;
+        }
+
+        for (int j = 0; j < opts.writer_cnt; j++) {
+            int error;
+
+            LOGI("%s: %s\n", opts.parts[i], opts.writers[j]);
+
+            if (!strcmp(opts.writers[j], "raw"))
+                error = bench_raw(&opts, bm, part);
+            else
+                error = bench_fs(&opts, bm, part, opts.writers[j]);
+
+            if (error < 0) {
+                LOGE("%s: %s FAILED\n", opts.parts[i], opts.writers[j]);
+                failures++;
+            }
+        }
+    }
+
+    bench_report_end(&opts);
+
+    bm->destruct(bm);
+    free(bm);
+    if (path)
+        fclose(opts.out);
+
+    return failures ? 1 : 0;
+
+usage:
+    usage(argv[0]);
+    return 2;
+}
@@ -0,0 +1,250 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <types.h>
+#include <utils/log.h>
+#include <utils/update_stats.h>
+#include <lib/libcommon.h>
+#include <lib/mtd/mtd-user.h>
+#include <utils/list.h>
+#include <block/fs/fs_manager.h>
+#include <block/block_manager.h>
+#include <block/mtd/mtd.h>
+#include <block/mtd/erase_ahead.h>
+
+#define LOG_TAG "mtd_erase_ahead"
+
+static int64_t erase_ahead_good_blocks(struct mtd_erase_ahead *ea,
+                                       int64_t from, int64_t to) {
+    int64_t eb_size = ea->mtd->eb_size;
+    int64_t count = 0;
+
+    for (; from < to; from += eb_size)
+        if (!mtd_bm_block_map_is_known_bad(ea->fs, from / eb_size))
+            count++;
+
+    return count;
+}
+
+/*
+ * End of the range, far enough for its good blocks to hold the length
+ * asked for, like mtd_basic_erase() does
+ */
+static int64_t erase_ahead_end(struct mtd_erase_ahead *ea) {
+    int64_t eb_size = ea->mtd->eb_size;
+    int64_t limit = MTD_DEV_INFO_TO_START(ea->mtd) + ea->mtd->size;
+    int64_t blocks = ea->blocks;
+    int64_t end;
+
+    for (end = ea->start; blocks > 0 && end < limit; end += eb_size)
+        if (!mtd_bm_block_map_is_known_bad(ea->fs, end / eb_size))
+            blocks--;
+
+    return end;
+}
+
+/*
+ * Erases the next count good blocks of the range, with the device lock
+ * held by the caller. With only bad blocks left the range is done.
+ */
+static int erase_ahead_step(struct mtd_erase_ahead *ea, int64_t count) {
+    struct filesystem *fs = ea->fs;
+    int64_t left = erase_ahead_good_blocks(ea, ea->next, ea->end);
+    int64_t next = ea->end;
+    uint64_t start;
+
+    if (count <= 0 && left > 0)
+        return 0;
+
+    if (left > 0) {
+        fs->params->offset = ea->next;
+        fs->params->length = MIN(count, left) * ea->mtd->eb_size;
+
+        start = update_stats_now();
+        next = fs->erase(fs);
+        update_stats_add(UPDATE_STAGE_ERASE, fs->params->length, start);
+    }
+
+    pthread_mutex_lock(&ea->lock);
+    if (next < 0) {
+        LOGE("MTD \"%s\" failed to erase ahead at 0x%" PRIx64 "\n",
+             MTD_DEV_INFO_TO_PATH(ea->mtd), ea->next);
+        ea->error = 1;
+    } else {
+        ea->next = next;
+        ea->end = erase_ahead_end(ea);
+    }
+    pthread_mutex_unlock(&ea->lock);
+
+    return next < 0 ? -1 : 0;
+}
+
+static void* erase_ahead_worker(void *param) {
+    struct mtd_erase_ahead *ea = (struct mtd_erase_ahead *)param;
+    int64_t count;
+
+    for (;;) {
+        pthread_mutex_lock(&ea->lock);
+        for (;;) {
+            if (ea->error || ea->next >= ea->end) {
+                pthread_mutex_unlock(&ea->lock);
+                goto out;
+            }
+
+            count = ea->window;
+            if (!ea->tail && ea->cursor < ea->next)
+                count -= erase_ahead_good_blocks(ea, ea->cursor, ea->next);
+            if (count > 0)
+                break;
+
+            pthread_cond_wait(&ea->cond, &ea->lock);
+        }
+        pthread_mutex_unlock(&ea->lock);
+
+        pthread_mutex_lock(ea->device_lock);
+        erase_ahead_step(ea, count);
+        pthread_mutex_unlock(ea->device_lock);
+    }
+
+out:
+    LOGI("MTD \"%s\" erase ahead stopped at 0x%" PRIx64 "%s\n",
+         MTD_DEV_INFO_TO_PATH(ea->mtd), ea->next, ea->error ? ", failed" : "");
+    return NULL;
+}
+
+static int erase_ahead_join(struct mtd_erase_ahead *ea) {
+    int error;
+
+    pthread_mutex_lock(&ea->lock);
+    ea->tail = 1;
+    pthread_cond_signal(&ea->cond);
+    pthread_mutex_unlock(&ea->lock);
+
+    pthread_join(ea->thread, NULL);
+    error = ea->error;
+
+    MTD_DEV_INFO_TO_ERASE_AHEAD(ea->mtd) = NULL;
+    pthread_cond_destroy(&ea->cond);
+    pthread_mutex_destroy(&ea->lock);
+    fs_destroy(&ea->fs);
+    free(ea);
+
+    return error ? -1 : 0;
+}
+
+int mtd_erase_ahead_start(struct block_manager *bm, struct filesystem *fs,
+                          pthread_mutex_t *device_lock, int64_t offset,
+                          int64_t length, int window) {
+    struct mtd_dev_info *mtd = FS_GET_MTD_DEV(fs);
+    struct mtd_erase_ahead *ea = NULL;
+
+    /*
+     * The tail of an earlier operation on this partition goes first
+     */
+    if (MTD_DEV_INFO_TO_ERASE_AHEAD(mtd)
+            && erase_ahead_join(MTD_DEV_INFO_TO_ERASE_AHEAD(mtd)) < 0)
+        return -1;
+
+    ea = calloc(1, sizeof(*ea));
+    if (ea == NULL) {
+        LOGE("Cannot allocate %zd bytes of memory\n", sizeof(*ea));
+        return -1;
+    }
+
+    ea->fs = fs_derive(fs);
+    if (ea->fs == NULL) {
+        free(ea);
+        return -1;
+    }
+
+    ea->bm = bm;
+    ea->mtd = mtd;
+    ea->device_lock = device_lock;
+    ea->start = MTD_BLOCK_ALIGN(mtd, offset);
+    ea->blocks = (offset + length - ea->start + mtd->eb_size - 1)
+            / mtd->eb_size;
+    ea->next = ea->start;
+    ea->end = erase_ahead_end(ea);
+    ea->cursor = ea->next;
+    ea->window = MAX(window, 1);
+    pthread_mutex_init(&ea->lock, NULL);
+    pthread_cond_init(&ea->cond, NULL);
+
+    if (pthread_create(&ea->thread, NULL, erase_ahead_worker, ea)) {
+        LOGE("Cannot create erase ahead thread: %s\n", strerror(errno));
+        pthread_cond_destroy(&ea->cond);
+        pthread_mutex_destroy(&ea->lock);
+        fs_destroy(&ea->fs);
+        free(ea);
+        return -1;
+    }
+
+    MTD_DEV_INFO_TO_ERASE_AHEAD(mtd) = ea;
+
+    LOGI("MTD \"%s\" erase ahead from 0x%" PRIx64 " to 0x%" PRIx64 ", %d blocks\n",
+         MTD_DEV_INFO_TO_PATH(mtd), ea->next, ea->end, ea->window);
+
+    return 0;
+}
+
+/*
+ * Called by the writer, device lock held, before it writes the block at
+ * offset. Returns 1 if erasing it turned it bad.
+ */
+int mtd_erase_ahead_ensure(struct filesystem *fs, int64_t offset) {
+    struct mtd_dev_info *mtd = FS_GET_MTD_DEV(fs);
+    struct mtd_erase_ahead *ea = MTD_DEV_INFO_TO_ERASE_AHEAD(mtd);
+
+    if (ea == NULL || offset >= ea->end)
+        return 0;
+
+    pthread_mutex_lock(&ea->lock);
+    ea->cursor = offset;
+    pthread_cond_signal(&ea->cond);
+    pthread_mutex_unlock(&ea->lock);
+
+    /*
+     * next only moves under the device lock, which is held here
+     */
+    if (offset < ea->next)
+        return 0;
+
+    if (erase_ahead_step(ea, erase_ahead_good_blocks(ea, ea->next,
+                         offset + mtd->eb_size)) < 0)
+        return -1;
+
+    return mtd_bm_block_map_is_known_bad(fs, offset / mtd->eb_size);
+}
+
+void mtd_erase_ahead_detach(struct filesystem *fs) {
+    struct mtd_erase_ahead *ea = MTD_DEV_INFO_TO_ERASE_AHEAD(FS_GET_MTD_DEV(fs));
+
+    if (ea == NULL)
+        return;
+
+    pthread_mutex_lock(&ea->lock);
+    ea->tail = 1;
+    pthread_cond_signal(&ea->cond);
+    pthread_mutex_unlock(&ea->lock);
+}
+
+int mtd_erase_ahead_sync(struct block_manager *bm) {
+    int retval = 0;
+
+    if (BM_GET_PARTINFO(bm) == NULL)
+        return 0;
+
+    for (int i = 0; i < bm->get_partition_count(bm); i++) {
+        struct mtd_erase_ahead *ea = BM_GET_PARTINFO(bm)[i].erase_ahead;
+
+        if (ea && erase_ahead_join(ea) < 0)
+            retval = -1;
+    }
+
+    return retval;
+}
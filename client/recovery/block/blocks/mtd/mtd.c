@@ -8,10 +8,13 @@
 #include <stdbool.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
 #include <ctype.h>
 #include <types.h>
 #include <utils/assert.h>
 #include <utils/log.h>
+#include <utils/update_stats.h>
 #include <lib/mtd/jffs2-user.h>
 #include <lib/libcommon.h>
 #include <lib/mtd/mtd-user.h>
@@ -22,10 +25,11 @@
 #include <block/fs/fs_manager.h>
 #include <block/block_manager.h>
 #include <block/mtd/mtd.h>
+#include <block/mtd/erase_ahead.h>
 
 #define LOG_TAG BM_BLOCK_TYPE_MTD
 
-static pthread_mutex_t mtd_block_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct bm_prepared_table prepared_table = BM_PREPARED_TABLE_INITIALIZER;
 
 struct mtd_dev_info* mtd_get_dev_info_by_offset( struct block_manager* this,
         int64_t offset) {
@@ -91,7 +95,7 @@ static int64_t mtd_get_partition_size_by_offset(struct block_manager* this,
         int64_t offset) {
     struct mtd_dev_info* mtd = mtd_get_dev_info_by_offset(this, offset);
     if (mtd == NULL) {
-        LOGE("Cannot get mtd devinfo at 0x%llx\n", offset);
+        LOGE("Cannot get mtd devinfo at 0x%" PRIx64 "\n", offset);
         return -1;
     }
 
@@ -125,7 +129,7 @@ static int64_t mtd_get_partition_start_by_offset(struct block_manager* this,
         int64_t offset) {
     struct mtd_dev_info* mtd = mtd_get_dev_info_by_offset(this, offset);
     if (mtd == NULL) {
-        LOGE("Cannot get mtd devinfo at 0x%llx\n", offset);
+        LOGE("Cannot get mtd devinfo at 0x%" PRIx64 "\n", offset);
         return -1;
     }
 
@@ -158,7 +162,7 @@ static int64_t mtd_get_capacity(struct block_manager* this) {
 static int mtd_get_blocksize_by_offset(struct block_manager* this, int64_t offset) {
     struct mtd_dev_info* mtd = mtd_get_dev_info_by_offset(this, offset);
     if (mtd == NULL) {
-        LOGE("Cannot get mtd devinfo at 0x%llx\n", offset);
+        LOGE("Cannot get mtd devinfo at 0x%" PRIx64 "\n", offset);
         return -1;
     }
 
@@ -168,7 +172,7 @@ static int mtd_get_blocksize_by_offset(struct block_manager* this, int64_t offse
 static int mtd_get_pagesize_by_offset(struct block_manager* this, int64_t offset) {
     struct mtd_dev_info* mtd = mtd_get_dev_info_by_offset(this, offset);
     if (mtd == NULL) {
-        LOGE("Cannot get mtd devinfo at 0x%llx\n", offset);
+        LOGE("Cannot get mtd devinfo at 0x%" PRIx64 "\n", offset);
         return -1;
     }
 
@@ -178,7 +182,7 @@ static int mtd_get_pagesize_by_offset(struct block_manager* this, int64_t offset
 static char* mtd_get_block_type_by_offset(struct block_manager* this, int64_t offset) {
     struct mtd_dev_info* mtd = mtd_get_dev_info_by_offset(this, offset);
     if (mtd == NULL) {
-        LOGE("Cannot get mtd devinfo at 0x%llx\n", offset);
+        LOGE("Cannot get mtd devinfo at 0x%" PRIx64 "\n", offset);
         return NULL;
     }
     if (mtd_type_is_nand(mtd)) {
@@ -189,6 +193,26 @@ static char* mtd_get_block_type_by_offset(struct block_manager* this, int64_t of
     return NULL;
 }
 
+static int mtd_get_device_id_by_offset(struct block_manager* this,
+        int64_t offset) {
+    struct mtd_dev_info* mtd = mtd_get_dev_info_by_offset(this, offset);
+    if (mtd == NULL) {
+        LOGE("Cannot get mtd devinfo at 0x%" PRIx64 "\n", offset);
+        return -1;
+    }
+
+    return MTD_DEV_INFO_TO_DEVICE(mtd);
+}
+
+static pthread_mutex_t* mtd_get_device_lock(struct block_manager* this,
+        int64_t offset) {
+    int device = mtd_get_device_id_by_offset(this, offset);
+    if (device < 0)
+        return NULL;
+
+    return BM_GET_DEVICE_LOCK(this, device);
+}
+
 static int mtd_install_filesystem(struct block_manager* this) {
     BM_MTD_FILE_TYPE_INIT(user_list);
     struct list_head *head = &this->list_fs_head;
@@ -242,7 +266,7 @@ static void dump_mtd_dev_info(struct block_manager* this) {
 
     LOGD("Partinfo dumped:\n");
     for (i = 0; i < mtd_info->mtd_dev_cnt + 1; i++) {
-        LOGD("id: %d, path: %s, fd: %d, start: 0x%llx\n",
+        LOGD("id: %d, path: %s, fd: %d, start: 0x%" PRIx64 "\n",
              BM_GET_PARTINFO_ID(this, i),
              BM_GET_PARTINFO_PATH(this, i),
              *BM_GET_PARTINFO_FD(this, i),
@@ -251,6 +275,96 @@ static void dump_mtd_dev_info(struct block_manager* this) {
 }
 #endif
 
+/*
+ * The partitions of one chip hang below the same parent in sysfs, e.g.
+ * .../jz-sfc.0/mtd/mtd1, or .../jz-sfc.0/mtd/mtd0/mtd1 when the whole
+ * chip is registered as well
+ */
+static void mtd_get_device_key(struct mtd_dev_info* mtd, char* key,
+        int len) {
+    char path[64];
+    ssize_t n;
+    char* p;
+
+    sprintf(path, "/sys/class/mtd/mtd%d", mtd->mtd_num);
+    n = readlink(path, key, len - 1);
+    if (n > 0) {
+        key[n] = '\0';
+        p = strstr(key, "/mtd/mtd");
+        if (p != NULL) {
+            *p = '\0';
+            return;
+        }
+    }
+
+    /*
+     * Tell the chips apart by flash type at least
+     */
+    snprintf(key, len, "%s", mtd->type_str);
+}
+
+/*
+ * Maps the partitions to the physical devices they live on, each device
+ * gets its own lock so that different chips can be operated in parallel
+ */
+static int mtd_init_devices(struct block_manager* this) {
+    struct mtd_info *mtd_info = BM_GET_MTD_INFO(this);
+    pthread_mutex_t **device_lock = &this->desc.mtd.device_lock;
+    int *device_count = &this->desc.mtd.device_count;
+    char (*keys)[PATH_MAX];
+    int i, j;
+
+    keys = calloc(mtd_info->mtd_dev_cnt + 1, sizeof(*keys));
+    if (keys == NULL) {
+        LOGE("Cannot allocate device keys: %s\n", strerror(errno));
+        return -1;
+    }
+
+    *device_count = 0;
+    for (i = 0; i < mtd_info->mtd_dev_cnt; i++) {
+        mtd_get_device_key(BM_GET_PARTINFO_MTD_DEV(this, i),
+                keys[*device_count], PATH_MAX);
+
+        for (j = 0; strcmp(keys[j], keys[*device_count]); j++)
+            ;
+
+        BM_GET_PARTINFO_DEVICE(this, i) = j;
+        if (j == *device_count)
+            (*device_count)++;
+    }
+
+    free(keys);
+
+    *device_lock = calloc(*device_count + 1, sizeof(pthread_mutex_t));
+    if (*device_lock == NULL) {
+        LOGE("Cannot allocate device locks: %s\n", strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < *device_count; i++)
+        pthread_mutex_init(BM_GET_DEVICE_LOCK(this, i), NULL);
+
+    LOGI("%d mtd partitions on %d devices\n", mtd_info->mtd_dev_cnt,
+            *device_count);
+
+    return 0;
+}
+
+static void mtd_exit_devices(struct block_manager* this) {
+    pthread_mutex_t **device_lock = &this->desc.mtd.device_lock;
+    int *device_count = &this->desc.mtd.device_count;
+
+    if (*device_lock == NULL)
+        return;
+
+    for (int i = 0; i < *device_count; i++)
+        pthread_mutex_destroy(BM_GET_DEVICE_LOCK(this, i));
+
+    free(*device_lock);
+    *device_lock = NULL;
+    *device_count = 0;
+}
+
 static int mtd_block_init(struct block_manager* this) {
     struct bm_part_info **part_info = &BM_GET_PARTINFO(this);
     libmtd_t *mtd_desc = &BM_GET_MTD_DESC(this);
@@ -259,7 +373,6 @@ static int mtd_block_init(struct block_manager* this) {
     int retval = 0;
     int64_t size = 0;
 
-    pthread_mutex_lock(&mtd_block_lock);
     *mtd_desc = libmtd_open();
     if (!*mtd_desc) {
         LOGE("Failed to open libmtd\n");
@@ -283,7 +396,7 @@ static int mtd_block_init(struct block_manager* this) {
         int *fd = BM_GET_PARTINFO_FD(this, i);
         char *path = BM_GET_PARTINFO_PATH(this, i);
         sprintf(path, "%s%d", MTD_CHAR_HEAD, mtd_dev_info->mtd_num);
-        *fd = open(path, O_RDWR);
+        *fd = mtd_dev_open(*mtd_desc, mtd_dev_info, O_RDWR);
         if (*fd < 0) {
             LOGE("Cannot open mtd device %s: %s\n", path, strerror(errno));
             goto out;
@@ -297,6 +410,9 @@ static int mtd_block_init(struct block_manager* this) {
     BM_GET_PARTINFO_ID(this, i) = mtd_info->mtd_dev_cnt;
     BM_GET_PARTINFO_START(this, i) = size;
 
+    if (mtd_init_devices(this) < 0)
+        goto out;
+
 #ifdef MTD_OPEN_DEBUG
     dump_mtd_dev_info(this);
 #endif
@@ -305,8 +421,6 @@ static int mtd_block_init(struct block_manager* this) {
 
     return 0;
 out:
-    pthread_mutex_unlock(&mtd_block_lock);
-
     return -1;
 }
 
@@ -316,6 +430,8 @@ static int mtd_block_exit(struct block_manager* this) {
     libmtd_t *mtd_desc = &BM_GET_MTD_DESC(this);
     struct mtd_info *mtd_info = BM_GET_MTD_INFO(this);
 
+    mtd_erase_ahead_sync(this);
+
     if (*part_info) {
         if (mtd_info) {
             for (int i = 0; i < mtd_info->mtd_dev_cnt; i++) {
@@ -332,13 +448,13 @@ static int mtd_block_exit(struct block_manager* this) {
         *part_info = NULL;
     }
 
+    mtd_exit_devices(this);
+
     if (*mtd_desc) {
         libmtd_close(*mtd_desc);
         *mtd_desc = NULL;
     }
 
-    pthread_mutex_unlock(&mtd_block_lock);
-
     LOGD("mtd block exit successfully\n");
 
     return 0;
@@ -364,7 +480,7 @@ static struct filesystem * prepare_convert_params(struct block_manager* this,
     int op_method = BM_OPERATION_METHOD_RANDOM;
 
     if (mtd == NULL) {
-        LOGE("Cannot get mtd devinfo at 0x%llx", offset);
+        LOGE("Cannot get mtd devinfo at 0x%" PRIx64, offset);
         goto out;
     }
 
@@ -433,10 +549,16 @@ static int mtd_chip_erase(struct block_manager *this) {
             }
 
             FS_FLAG_SET(fs, NOSKIPBAD);
+            pthread_mutex_lock(BM_GET_DEVICE_LOCK(this,
+                    MTD_DEV_INFO_TO_DEVICE(mtd)));
             if (fs->erase(fs) < 0) {
-                LOGE("Cannot erase at offset 0x%llx by length %lld\n", offset, length);
+                pthread_mutex_unlock(BM_GET_DEVICE_LOCK(this,
+                        MTD_DEV_INFO_TO_DEVICE(mtd)));
+                LOGE("Cannot erase at offset 0x%" PRIx64 " by length %" PRId64 "\n", offset, length);
                 goto out;
             }
+            pthread_mutex_unlock(BM_GET_DEVICE_LOCK(this,
+                    MTD_DEV_INFO_TO_DEVICE(mtd)));
         }
     }
 
@@ -453,20 +575,38 @@ out:
 }
 
 
-static struct filesystem* data_transfer_params_set(struct block_manager* this,
-        int64_t offset, char *buf, int64_t length) {
+static void mtd_release_prepare_info(struct bm_operate_prepare_info *prepared) {
+    struct filesystem *fs = prepared->context_handle;
 
-    struct filesystem *fs = NULL;
+    if (fs)
+        fs_destroy(&fs);
+
+    bm_drop_prepare_info(&prepared_table, prepared);
+}
+
+static struct filesystem* mtd_get_prepared_fs(struct block_manager* this) {
+    struct bm_operate_prepare_info *prepared =
+            bm_find_prepare_info(&prepared_table, 0);
 
-    if (BM_GET_PREPARE_INFO(this) == NULL) {
+    if (prepared == NULL) {
         LOGE("Cannot get prepare info\n");
         return NULL;
     }
-    fs = BM_GET_PREPARE_INFO_CONTEXT(this);
-    if (fs == NULL) {
+
+    if (prepared->context_handle == NULL)
         LOGE("Prepare info context_handle is lost\n");
+
+    return prepared->context_handle;
+}
+
+static struct filesystem* data_transfer_params_set(struct block_manager* this,
+        int64_t offset, char *buf, int64_t length) {
+
+    struct filesystem *fs = NULL;
+
+    fs = mtd_get_prepared_fs(this);
+    if (fs == NULL)
         return NULL;
-    }
 
     fs->params->offset = offset;
     fs->params->buf = buf;
@@ -480,12 +620,22 @@ static int64_t mtd_block_erase(struct block_manager* this, int64_t offset,
 
     struct filesystem *fs = NULL;
     char *buf = NULL;
+    uint64_t start;
     int retval;
 
+    pthread_mutex_t *lock = mtd_get_device_lock(this, offset);
+
+    if (lock == NULL)
+        goto out;
+
     if ((fs = data_transfer_params_set(this, offset, buf, length)) == NULL)
         goto out;
 
+    pthread_mutex_lock(lock);
+    start = update_stats_now();
     retval = fs->erase(fs);
+    update_stats_add(UPDATE_STAGE_ERASE, length, start);
+    pthread_mutex_unlock(lock);
     if (retval < 0)
         goto out;
 
@@ -495,15 +645,45 @@ out:
     return -1;
 }
 
+static int mtd_block_erase_ahead(struct block_manager* this, int64_t offset,
+                                 int64_t length, int window) {
+    struct filesystem *fs = NULL;
+    pthread_mutex_t *lock = mtd_get_device_lock(this, offset);
+
+    if (lock == NULL)
+        return -1;
+
+    if ((fs = data_transfer_params_set(this, offset, NULL, length)) == NULL)
+        return -1;
+
+    /*
+     * UBI erases each PEB right before writing it
+     */
+    if (window <= 0 || !strcmp(fs->name, BM_FILE_TYPE_UBIFS))
+        return mtd_block_erase(this, offset, length) < 0 ? -1 : 0;
+
+    return mtd_erase_ahead_start(this, fs, lock, offset, length, window);
+}
+
 static int64_t mtd_block_write(struct block_manager* this, int64_t offset,
                                char* buf, int64_t length) {
     struct filesystem *fs = NULL;
+    uint64_t start;
     int retval;
 
+    pthread_mutex_t *lock = mtd_get_device_lock(this, offset);
+
+    if (lock == NULL)
+        goto out;
+
     if ((fs = data_transfer_params_set(this, offset, buf, length)) == NULL)
         goto out;
 
+    pthread_mutex_lock(lock);
+    start = update_stats_now();
     retval = fs->write(fs);
+    update_stats_add(UPDATE_STAGE_WRITE, length, start);
+    pthread_mutex_unlock(lock);
     if (retval < 0)
         goto out;
 
@@ -517,12 +697,22 @@ static int64_t mtd_block_read(struct block_manager* this, int64_t offset,
                               char* buf, int64_t length) {
 
     struct filesystem *fs = NULL;
+    uint64_t start;
     int retval;
 
+    pthread_mutex_t *lock = mtd_get_device_lock(this, offset);
+
+    if (lock == NULL)
+        goto out;
+
     if ((fs = data_transfer_params_set(this, offset, buf, length)) == NULL)
         goto out;
 
+    pthread_mutex_lock(lock);
+    start = update_stats_now();
     retval = fs->read(fs);
+    update_stats_add(UPDATE_STAGE_READ, length, start);
+    pthread_mutex_unlock(lock);
     if (retval < 0)
         goto out;
 
@@ -533,13 +723,15 @@ out:
 }
 
 int mtd_block_format(struct block_manager* this) {
+    struct bm_operate_prepare_info *prepared =
+            bm_find_prepare_info(&prepared_table, 0);
     struct filesystem *fs = NULL;
+    pthread_mutex_t *lock;
+    int retval;
 
-    fs = BM_GET_PREPARE_INFO_CONTEXT(this);
-    if (fs == NULL) {
-        LOGE("Prepare info context_handle is lost\n");
+    fs = mtd_get_prepared_fs(this);
+    if (fs == NULL)
         goto out;
-    }
 
     if (fs->format == NULL) {
         LOGE("\'%s\' not support method \'format\' yet\n",
@@ -547,7 +739,15 @@ int mtd_block_format(struct block_manager* this) {
         goto out;
     }
 
-    return fs->format(fs);
+    lock = mtd_get_device_lock(this, prepared->write_start);
+    if (lock == NULL)
+        goto out;
+
+    pthread_mutex_lock(lock);
+    retval = fs->format(fs);
+    pthread_mutex_unlock(lock);
+
+    return retval;
 
 out:
     return -1;
@@ -555,10 +755,10 @@ out:
 
 #ifdef MTD_OPEN_DEBUG
 static void dump_prepared_info(struct bm_operate_prepare_info *prepare) {
-    LOGI("write_start = 0x%llx\n", prepare->write_start);
+    LOGI("write_start = 0x%" PRIx64 "\n", prepare->write_start);
     LOGI("physical_unit_size = %u\n", prepare->physical_unit_size);
     LOGI("logical_unit_size = %u\n", prepare->logical_unit_size);
-    LOGI("max_size_mapped_in_partition = %lld\n", prepare->max_size_mapped_in_partition);
+    LOGI("max_size_mapped_in_partition = %" PRId64 "\n", prepare->max_size_mapped_in_partition);
     return;
 }
 #endif
@@ -566,56 +766,69 @@ static void dump_prepared_info(struct bm_operate_prepare_info *prepare) {
 static struct bm_operate_prepare_info* mtd_get_prepare_info(
     struct block_manager* this, ...) {
 
-    static struct bm_operate_prepare_info prepare_info;
+    struct bm_operate_prepare_info *prepare_info = NULL;
     struct filesystem *fs = NULL;
     va_list args;
 
-    if (this->prepared == NULL)
-        this->prepared = &prepare_info;
-
     va_start(args, this);
     fs = va_arg(args, struct filesystem *);
 
-    prepare_info.write_start = va_arg(args, int64_t);
-    prepare_info.physical_unit_size = va_arg(args, uint32_t);
-    prepare_info.logical_unit_size = va_arg(args, uint32_t);
-    prepare_info.max_size_mapped_in_partition = va_arg(args, int64_t);
-    if ((prepare_info.write_start < 0)
-            || !prepare_info.physical_unit_size
-            || !prepare_info.logical_unit_size
-            || (prepare_info.max_size_mapped_in_partition < 0))
+    prepare_info = bm_find_prepare_info(&prepared_table, 1);
+    if (prepare_info == NULL) {
+        LOGE("More than %d operations prepared at once\n", BM_PREPARED_MAX);
+        goto out;
+    }
+
+    /*
+     * Preparing again drops what the thread prepared before
+     */
+    if (prepare_info->context_handle) {
+        struct filesystem *old = prepare_info->context_handle;
+        fs_destroy(&old);
+        prepare_info->context_handle = NULL;
+    }
+
+    prepare_info->write_start = va_arg(args, int64_t);
+    prepare_info->physical_unit_size = va_arg(args, uint32_t);
+    prepare_info->logical_unit_size = va_arg(args, uint32_t);
+    prepare_info->max_size_mapped_in_partition = va_arg(args, int64_t);
+    if ((prepare_info->write_start < 0)
+            || !prepare_info->physical_unit_size
+            || !prepare_info->logical_unit_size
+            || (prepare_info->max_size_mapped_in_partition < 0)) {
+        mtd_release_prepare_info(prepare_info);
         goto out;
+    }
 
-    prepare_info.context_handle = fs;
-    FS_GET_PARAM(fs)->content_start = prepare_info.write_start;
+    prepare_info->context_handle = fs;
+    FS_GET_PARAM(fs)->content_start = prepare_info->write_start;
     FS_GET_PARAM(fs)->progress_size = 0;
     FS_GET_PARAM(fs)->max_size = FS_GET_PARAM(fs)->length;
-    FS_GET_PARAM(fs)->max_mapped_size = prepare_info.max_size_mapped_in_partition;
+    FS_GET_PARAM(fs)->max_mapped_size = prepare_info->max_size_mapped_in_partition;
 
-    this->prepared = &prepare_info;
     va_end(args);
 
 #ifdef MTD_OPEN_DEBUG
-    dump_prepared_info(&prepare_info);
+    dump_prepared_info(prepare_info);
 #endif
 
-    return &prepare_info;
+    return prepare_info;
 
 out:
+    va_end(args);
     return NULL;
 }
 
 static int mtd_put_prepare_info(struct block_manager* this) {
-    struct filesystem *fs = NULL;
-    fs = BM_GET_PREPARE_INFO_CONTEXT(this);
+    struct bm_operate_prepare_info *prepared =
+            bm_find_prepare_info(&prepared_table, 0);
 
-    if (fs == NULL) {
+    if (prepared == NULL || prepared->context_handle == NULL) {
         LOGE("Prepare info context_handle is lost\n");
         return -1;
     }
 
-    if (this->prepared)
-        this->prepared = NULL;
+    mtd_release_prepare_info(prepared);
 
     return 0;
 }
@@ -626,7 +839,10 @@ static struct bm_operate_prepare_info* mtd_block_prepare(
 
     char *default_filetype = BM_FILE_TYPE_NORMAL;
 
+    struct bm_operate_prepare_info *prepared = NULL;
     struct filesystem *fs = NULL;
+    int64_t write_start, max_mapped_size;
+    unsigned long leb_size;
 
     if (option && strcmp(option->filetype, default_filetype))
         default_filetype = option->filetype;
@@ -638,72 +854,119 @@ static struct bm_operate_prepare_info* mtd_block_prepare(
         goto out;
     }
 
+    /*
+     * Every prepared operation works on its own instance
+     */
+    fs = fs_derive(fs);
+    if (fs == NULL)
+        goto out;
+
     prepare_convert_params(this, fs, offset, length, option);
+    if (option && option->skip_erased)
+        FS_FLAG_SET(fs, SKIPERASED);
+
+    /*
+     * In this order, ubifs sets its parameters up in the first one
+     */
+    write_start = fs->get_operate_start_address(fs);
+    leb_size = fs->get_leb_size(fs);
+    max_mapped_size = fs->get_max_mapped_size_in_partition(fs);
 
-    return mtd_get_prepare_info(this,
+    prepared = mtd_get_prepare_info(this,
                                 fs,
-                                fs->get_operate_start_address(fs),
+                                write_start,
                                 mtd_get_blocksize_by_offset(this, offset),
-                                fs->get_leb_size(fs),
-                                fs->get_max_mapped_size_in_partition(fs));
+                                leb_size,
+                                max_mapped_size);
+    if (prepared == NULL)
+        fs_destroy(&fs);
+
+    return prepared;
 out:
     return NULL;
 }
 
 static uint32_t mtd_get_prepare_leb_size(struct block_manager* this) {
-    if (this->prepared == NULL)
+    struct bm_operate_prepare_info *prepared =
+            bm_find_prepare_info(&prepared_table, 0);
+
+    if (prepared == NULL)
         return 0;
 
-    return this->prepared->logical_unit_size;
+    return prepared->logical_unit_size;
 }
 
 static int64_t mtd_get_prepare_write_start(struct block_manager* this) {
-    if (this->prepared == NULL)
+    struct bm_operate_prepare_info *prepared =
+            bm_find_prepare_info(&prepared_table, 0);
+
+    if (prepared == NULL)
         return -1;
 
-    return this->prepared->write_start;
+    return prepared->write_start;
 }
 
 static int64_t mtd_get_max_size_mapped_in(struct block_manager* this) {
-    if (this->prepared == NULL)
+    struct bm_operate_prepare_info *prepared =
+            bm_find_prepare_info(&prepared_table, 0);
+
+    if (prepared == NULL)
         return -1;
 
-    return this->prepared->max_size_mapped_in_partition;
+    return prepared->max_size_mapped_in_partition;
 }
 
 static int64_t mtd_block_finish(struct block_manager* this) {
-    struct filesystem *fs = BM_GET_PREPARE_INFO_CONTEXT(this);
+    struct bm_operate_prepare_info *prepared =
+            bm_find_prepare_info(&prepared_table, 0);
+    struct filesystem *fs = mtd_get_prepared_fs(this);
+    pthread_mutex_t *lock;
+    uint64_t start;
     int64_t retval = 0;
 
-    if (fs == NULL) {
-        LOGE("Prepare info context_handle is lost\n");
+    if (fs == NULL)
         return -1;
-    }
 
+    lock = mtd_get_device_lock(this, prepared->write_start);
+    if (lock == NULL)
+        return -1;
+
+    pthread_mutex_lock(lock);
+    start = update_stats_now();
     if (fs->done)
         retval = fs->done(fs);
+    update_stats_add(UPDATE_STAGE_FINISH, 0, start);
+    pthread_mutex_unlock(lock);
 
 #ifdef MTD_OPEN_DEBUG
     mtd_scan_dump(fs);
 #endif
 
+    mtd_erase_ahead_detach(fs);
     mtd_put_prepare_info(this);
 
     return retval;
 }
 
+static int mtd_block_sync(struct block_manager* this) {
+    return mtd_erase_ahead_sync(this);
+}
+
 static struct block_manager mtd_manager =  {
     .name = BM_BLOCK_TYPE_MTD,
     .chip_erase = mtd_chip_erase,
     .erase = mtd_block_erase,
+    .erase_ahead = mtd_block_erase_ahead,
     .read = mtd_block_read,
     .write = mtd_block_write,
     .format = mtd_block_format,
+    .save_bad_block_table = mtd_bm_block_map_save,
     .prepare = mtd_block_prepare,
     .get_prepare_leb_size = mtd_get_prepare_leb_size,
     .get_prepare_write_start = mtd_get_prepare_write_start,
     .get_prepare_max_mapped_size = mtd_get_max_size_mapped_in,
     .finish = mtd_block_finish,
+    .sync = mtd_block_sync,
     .get_partition_count = mtd_get_partition_count,
     .get_partition_size_by_name = mtd_get_partition_size_by_name,
     .get_partition_size_by_offset = mtd_get_partition_size_by_offset,
@@ -713,6 +976,8 @@ static struct block_manager mtd_manager =  {
     .get_blocksize = mtd_get_blocksize_by_offset,
     .get_iosize = mtd_get_pagesize_by_offset,
     .get_block_type = mtd_get_block_type_by_offset,
+    .get_device_id = mtd_get_device_id_by_offset,
+    .get_device_lock = mtd_get_device_lock,
 };
 
 int mtd_manager_init(void) {
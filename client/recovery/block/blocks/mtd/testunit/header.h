@@ -6,4 +6,6 @@
 #define TEST_FLAG
 // #define TEST_FORMAT
 // #define TEST_UPDATE
+// #define TEST_WRITE_BENCH
+// #define TEST_MMC
 #endif
\ No newline at end of file
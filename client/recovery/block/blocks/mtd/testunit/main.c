@@ -26,6 +26,8 @@ extern int test_sysinfo(void);
 extern int test_format(void);
 extern int test_update(void);
 extern int test_flag(void);
+extern int test_write_bench(void);
+extern int test_mmc(void);
 int main(int argc, char **argv) {
 #if defined TEST_READ
     test_read();
@@ -37,6 +39,10 @@ int main(int argc, char **argv) {
     test_update();
 #elif defined TEST_FLAG
     test_flag();
+#elif defined TEST_WRITE_BENCH
+    test_write_bench();
+#elif defined TEST_MMC
+    test_mmc();
 #endif
 
     return 0;
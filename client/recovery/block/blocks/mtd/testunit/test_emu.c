@@ -0,0 +1,250 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <utils/log.h>
+#include <unistd.h>
+#include <types.h>
+#include <lib/mtd/mtd-user.h>
+#include <lib/libmtd.h>
+#include <lib/libmtd_emu.h>
+#include <utils/list.h>
+#include <block/block_manager.h>
+#include <block/fs/fs_manager.h>
+#include <block/mtd/mtd.h>
+
+/*
+ * The block manager on the file-backed MTD emulator, built with
+ * lib/mtd/libmtd_emu.o in place of libmtd.o: the emulator itself, then
+ * writes over a factory bad block and through injected program and erase
+ * failures
+ */
+#define LOG_TAG         "testcase-bm_emu"
+#define TEST_IMAGE      "/tmp/test_mtd_emu.img"
+#define TEST_SPEC       "type=nand size=16M eb=128K page=2K oob=64 "     \
+                        "parts=2M(boot),-(data) bad=20 image=" TEST_IMAGE
+#define TEST_EB_SIZE    (128 << 10)
+#define TEST_PAGE_SIZE  2048
+#define TEST_DATA_EB    16              /* first chip block of "data" */
+#define TEST_LENGTH     ((3 << 20) + 5000)
+
+#include <utils/testunit.h>
+
+static void bm_mtd_event_listener(struct block_manager *bm,
+                                  struct bm_event* event, void* param) {
+    return;
+}
+
+static int all_bytes(const uint8_t *buf, int len, uint8_t value) {
+    for (int i = 0; i < len; i++)
+        if (buf[i] != value)
+            return 0;
+
+    return 1;
+}
+
+static void test_primitives(void) {
+    libmtd_t desc = libmtd_open();
+    struct mtd_dev_info mtd;
+    struct mtd_ecc_stats ecc;
+    struct mtd_emu_stats stats;
+    struct mtd_emu_fault fault = {MTD_EMU_OP_READ, 1, 0, 1, EUCLEAN};
+    uint8_t page[TEST_PAGE_SIZE], oob[8], *blank;
+    int fd;
+
+    report("libmtd_open", desc != NULL);
+    report("two partitions, boot first",
+           mtd_get_dev_info1(desc, 0, &mtd) == 0 && !strcmp(mtd.name, "boot")
+           && mtd.eb_cnt == 16 && mtd.bb_allowed);
+    fd = mtd_dev_open(desc, &mtd, O_RDWR);
+    report("mtd_dev_open", fd >= 0);
+
+    mtd_emu_reset_stats();
+    memset(page, 0, sizeof(page));
+    report("erased block reads 0xff",
+           mtd_erase(desc, &mtd, fd, 1) == 0
+           && mtd_read(&mtd, fd, 1, 0, page, sizeof(page)) == 0
+           && all_bytes(page, sizeof(page), 0xff));
+
+    memset(page, 0x5a, sizeof(page));
+    mtd_write(desc, &mtd, fd, 1, 0, page, sizeof(page), NULL, 0, 0);
+    memset(page, 0x0f, sizeof(page));
+    mtd_write(desc, &mtd, fd, 1, 0, page, sizeof(page), NULL, 0, 0);
+    mtd_read(&mtd, fd, 1, 0, page, sizeof(page));
+    mtd_emu_get_stats(&stats);
+    report("programming twice ANDs the data",
+           all_bytes(page, sizeof(page), 0x0a) && stats.reprograms == 1);
+
+    memset(oob, 0x33, sizeof(oob));
+    mtd_write_oob(desc, &mtd, fd, TEST_EB_SIZE + 8, sizeof(oob), oob);
+    memset(oob, 0, sizeof(oob));
+    report("OOB write and read back",
+           mtd_read_oob(desc, &mtd, fd, TEST_EB_SIZE + 8, sizeof(oob), oob) == 0
+           && all_bytes(oob, sizeof(oob), 0x33));
+
+    mtd_emu_add_fault(&fault);
+    fault.error = EBADMSG;
+    mtd_emu_add_fault(&fault);
+    report("corrected bitflips read fine",
+           mtd_read(&mtd, fd, 1, 0, page, sizeof(page)) == 0);
+    errno = 0;
+    report("uncorrectable read fails with EBADMSG",
+           mtd_read(&mtd, fd, 1, 0, page, sizeof(page)) < 0 && errno == EBADMSG);
+    report("ECC stats count both",
+           mtd_get_ecc_stats(&mtd, fd, &ecc) == 0 && ecc.corrected == 1
+           && ecc.failed == 1 && ecc.badblocks == 0);
+    mtd_emu_clear_faults();
+    report("erase clears the block",
+           mtd_erase(desc, &mtd, fd, 1) == 0
+           && mtd_read(&mtd, fd, 1, 0, page, sizeof(page)) == 0
+           && all_bytes(page, sizeof(page), 0xff));
+
+    /*
+     * 0xFF data still programs the ECC in the OOB, so the block must be
+     * erased again before anything else goes there
+     */
+    blank = malloc(TEST_EB_SIZE);
+    report("erased block is blank",
+           mtd_block_is_blank(desc, &mtd, fd, 1, blank));
+    memset(page, 0xff, sizeof(page));
+    mtd_write(desc, &mtd, fd, 1, 0, page, sizeof(page), NULL, 0, 0);
+    report("block with a 0xff page programmed is not blank",
+           !mtd_block_is_blank(desc, &mtd, fd, 1, blank));
+    report("erase makes it blank again",
+           mtd_erase(desc, &mtd, fd, 1) == 0
+           && mtd_block_is_blank(desc, &mtd, fd, 1, blank));
+    free(blank);
+
+    mtd_get_dev_info1(desc, 1, &mtd);
+    errno = 0;
+    report("factory bad block is bad and refuses to erase",
+           mtd_is_bad(&mtd, fd, 20 - TEST_DATA_EB) == 1
+           && mtd_erase(desc, &mtd, fd, 20 - TEST_DATA_EB) < 0 && errno == EIO
+           && mtd_get_ecc_stats(&mtd, fd, &ecc) == 0 && ecc.badblocks == 1);
+
+    close(fd);
+    libmtd_close(desc);
+}
+
+/*
+ * Erases the start of "data", writes src there and reads it back
+ */
+static int write_verify(struct block_manager *bm, char *src, char *dst) {
+    struct bm_operation_option bm_option;
+    int64_t start = BM_GET_PARTINFO_START(bm, 1), ret;
+    int error = -1;
+
+    bm->set_operation_option(bm, &bm_option, BM_OPERATION_METHOD_PARTITION,
+                             BM_FILE_TYPE_NORMAL);
+    if (bm->prepare(bm, start, TEST_LENGTH, &bm_option) == NULL) {
+        LOGE("Block manager prepare failed\n");
+        return -1;
+    }
+
+    ret = bm->erase(bm, start, 4 << 20);
+    if (ret < 0) {
+        LOGE("Block manager erase failed\n");
+        goto out;
+    }
+
+    ret = bm->write(bm, bm->get_prepare_write_start(bm), src, TEST_LENGTH);
+    if (ret < 0) {
+        LOGE("Block manager write failed\n");
+        goto out;
+    }
+
+    memset(dst, 0, TEST_LENGTH);
+    ret = bm->read(bm, start, dst, TEST_LENGTH);
+    if (ret < 0) {
+        LOGE("Block manager read failed\n");
+        goto out;
+    }
+
+    for (int i = 0; i < TEST_LENGTH; i++) {
+        if (src[i] != dst[i]) {
+            LOGE("Read back differs at 0x%x\n", i);
+            goto out;
+        }
+    }
+
+    error = 0;
+
+out:
+    if (bm->finish(bm) < 0)
+        error = -1;
+    return error;
+}
+
+static void test_block_manager(void) {
+    struct block_manager *bm = (struct block_manager *)calloc(1, sizeof(*bm));
+    struct mtd_emu_fault fault = {MTD_EMU_OP_PROGRAM, TEST_DATA_EB + 2, 0, 1, EIO};
+    struct mtd_emu_stats stats;
+    char *src = malloc(TEST_LENGTH), *dst = malloc(TEST_LENGTH);
+    struct mtd_dev_info *mtd;
+    int fd;
+
+    bm->construct = construct_block_manager;
+    bm->destruct = destruct_block_manager;
+    bm->construct(bm, BM_BLOCK_TYPE_MTD, bm_mtd_event_listener, "test-emu");
+
+    report("block manager sees the two partitions",
+           bm->get_partition_count(bm) == 2 && bm->get_capacity(bm) == 16 << 20
+           && BM_GET_PARTINFO_START(bm, 1) == 2 << 20);
+
+    for (int i = 0; i < TEST_LENGTH; i++)
+        src[i] = rand();
+
+    report("write over a factory bad block", !write_verify(bm, src, dst));
+
+    mtd = BM_GET_PARTINFO_MTD_DEV(bm, 1);
+    fd = *BM_GET_PARTINFO_FD(bm, 1);
+
+    mtd_emu_reset_stats();
+    mtd_emu_add_fault(&fault);
+    report("write through a program failure", !write_verify(bm, src, dst));
+    mtd_emu_get_stats(&stats);
+    report("failed block is marked bad",
+           stats.faults == 1 && stats.marked_bad == 1
+           && mtd_is_bad(mtd, fd, 2) == 1);
+    mtd_emu_clear_faults();
+
+    /*
+     * The erase runs fail first, then the block on its own
+     */
+    mtd_emu_reset_stats();
+    fault.op = MTD_EMU_OP_ERASE;
+    fault.eb = TEST_DATA_EB + 6;
+    fault.count = -1;
+    mtd_emu_add_fault(&fault);
+    report("write through an erase failure", !write_verify(bm, src, dst));
+    mtd_emu_get_stats(&stats);
+    report("failed block is marked bad",
+           stats.marked_bad == 1 && mtd_is_bad(mtd, fd, 6) == 1);
+    mtd_emu_clear_faults();
+
+    bm->destruct(bm);
+    free(bm);
+    free(src);
+    free(dst);
+}
+
+int main(int argc, char **argv) {
+    struct mtd_emu_config cfg;
+
+    unlink(TEST_IMAGE);
+    unlink(TEST_IMAGE ".oob");
+    mtd_emu_default_config(&cfg);
+    if (mtd_emu_parse_config(&cfg, TEST_SPEC) < 0 || mtd_emu_setup(&cfg) < 0) {
+        LOGE("Cannot set the emulator up\n");
+        return 1;
+    }
+
+    test_primitives();
+    test_block_manager();
+
+    mtd_emu_teardown();
+
+    return report_summary();
+}
@@ -46,7 +46,7 @@ int test_flag(void) {
         LOGE("Cannot get flag%d size\n", SYSINFO_FLAG_ID_UPDATE_DONE);
         goto out;
     }
-    LOGD("flag%d size = %lld\n", SYSINFO_FLAG_ID_UPDATE_DONE, flag_size);
+    LOGD("flag%d size = %" PRId64 "\n", SYSINFO_FLAG_ID_UPDATE_DONE, flag_size);
 
     flag_update_done = malloc(flag_size);
     if (flag_update_done == NULL) {
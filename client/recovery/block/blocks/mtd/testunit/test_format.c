@@ -51,16 +51,16 @@ static int format(struct block_manager *bm) {
 #endif
 
     ret = bm->set_operation_option(bm, &bm_option, BM_OPERATION_METHOD_PARTITION, fs_type);
-    LOGI("set option ret = 0x%llx\n", ret);
+    LOGI("set option ret = 0x%" PRIx64 "\n", ret);
     prepared = bm->prepare(bm, start, 0, &bm_option);
     if (prepared == NULL) {
         LOGE("Block manager prepare failed\n");
         goto out;
     }
     ret = bm->format(bm);
-    LOGI("format ret = 0x%llx\n", ret);
+    LOGI("format ret = 0x%" PRIx64 "\n", ret);
     ret = bm->finish(bm);
-    LOGI("finish ret = 0x%llx\n", ret);
+    LOGI("finish ret = 0x%" PRIx64 "\n", ret);
 
     return 0;
 out:
@@ -0,0 +1,150 @@
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <utils/log.h>
+#include <unistd.h>
+#include <types.h>
+#include <lib/libcommon.h>
+#include <utils/list.h>
+#include <block/block_manager.h>
+#include <block/mmc/mmc.h>
+
+#define LOG_TAG         "testcase-bm_mmc"
+
+/*
+ * Runs against the device in $MMC_DEVICE, a loop device for instance,
+ * or against a plain file standing in for it
+ */
+#define TEST_IMAGE      "/tmp/test_mmc.img"
+#define TEST_SIZE       (16 << 20)
+#define TEST_LENGTH     ((3 << 20) + 777)
+
+static void bm_mmc_event_listener(struct block_manager *bm,
+                                  struct bm_event* event, void* param) {
+    return;
+}
+
+static int check_rw(struct block_manager *bm, int64_t offset,
+                    char *src, char *dst, int64_t length) {
+    int64_t ret;
+
+    ret = bm->write(bm, offset, src, length);
+    if (ret != offset + length) {
+        LOGE("write at 0x%llx returned 0x%llx\n", offset, ret);
+        return -1;
+    }
+
+    memset(dst, 0, length);
+    ret = bm->read(bm, offset, dst, length);
+    if (ret != offset + length) {
+        LOGE("read at 0x%llx returned 0x%llx\n", offset, ret);
+        return -1;
+    }
+
+    if (memcmp(src, dst, length)) {
+        LOGE("read back differs at 0x%llx, length %lld\n", offset, length);
+        return -1;
+    }
+
+    LOGI("write/read at 0x%llx, length %lld: ok\n", offset, length);
+
+    return 0;
+}
+
+int test_mmc(void) {
+    char *bm_params = "test-mmc";
+    struct block_manager *bm = (struct block_manager *)calloc(1, sizeof(*bm));
+    struct bm_operation_option bm_option;
+    struct bm_operate_prepare_info* prepared = NULL;
+    char *device = getenv("MMC_DEVICE");
+    char *src = NULL, *dst = NULL;
+    int64_t start, size, ret;
+    int error = -1;
+    int fd;
+
+    LOGI("=============%s is starting =========\n", __func__);
+
+    if (device == NULL) {
+        device = TEST_IMAGE;
+        fd = open(device, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, TEST_SIZE) < 0) {
+            LOGE("Cannot create %s\n", device);
+            goto out;
+        }
+        close(fd);
+    }
+
+    mmc_manager_set_device(device);
+    bm->construct = construct_block_manager;
+    bm->destruct = destruct_block_manager;
+    bm->construct(bm, BM_BLOCK_TYPE_MMC, bm_mmc_event_listener, bm_params);
+
+    LOGI("%s: capacity %lld, %d partitions\n", device, bm->get_capacity(bm),
+         bm->get_partition_count(bm));
+
+    src = malloc(TEST_LENGTH + 1);
+    dst = malloc(TEST_LENGTH + 1);
+    if (src == NULL || dst == NULL) {
+        LOGE("malloc failed\n");
+        goto destruct;
+    }
+    for (int i = 0; i < TEST_LENGTH + 1; i++)
+        src[i] = rand();
+
+    start = BM_GET_PARTINFO_START(bm, 0);
+    size = bm->get_partition_size_by_offset(bm, start);
+    if (size < TEST_LENGTH + (1 << 20)) {
+        LOGE("First partition is too small: %lld\n", size);
+        goto destruct;
+    }
+
+    bm->set_operation_option(bm, &bm_option, BM_OPERATION_METHOD_PARTITION,
+                             BM_FILE_TYPE_NORMAL);
+    prepared = bm->prepare(bm, start, 0, &bm_option);
+    if (prepared == NULL) {
+        LOGE("Block manager prepare failed\n");
+        goto destruct;
+    }
+    LOGI("prepared max length = 0x%llx, unit %u\n",
+         prepared->max_size_mapped_in_partition, prepared->logical_unit_size);
+
+    ret = bm->erase(bm, start, size);
+    if (ret != start + size) {
+        LOGE("erase returned 0x%llx\n", ret);
+        goto finish;
+    }
+
+    /*
+     * Aligned, then unaligned buffer, offset and length through the bounce
+     * buffer, then a write inside a single sector
+     */
+    if (check_rw(bm, start, src, dst, 1 << 20) < 0
+            || check_rw(bm, start + (1 << 20) + 13, src + 1, dst + 1,
+                        TEST_LENGTH - 13) < 0
+            || check_rw(bm, start + 100, src + 3, dst, 200) < 0)
+        goto finish;
+
+    ret = bm->write(bm, start + size - 512, src, 1024);
+    if (ret >= 0) {
+        LOGE("write past the partition end was accepted\n");
+        goto finish;
+    }
+
+    error = 0;
+
+finish:
+    if (bm->finish(bm) < 0)
+        error = -1;
+destruct:
+    bm->destruct(bm);
+out:
+    free(src);
+    free(dst);
+    free(bm);
+    LOGI("=============%s %s =========\n", __func__, error ? "FAILED" : "PASSED");
+    return error;
+}
@@ -51,7 +51,7 @@ static void dump_data(int64_t offset, char *buf, int length) {
 
     for (i = 0; i < length; i++) {
         if ((i % leap) == 0) {
-            sprintf(unit, "\t\toffset: 0x%08llx: ", addr + i);
+            sprintf(unit, "\t\toffset: 0x%08" PRIx64 ": ", addr + i);
             for (j = i; j < i + unit_count; j++) {
                 sprintf(data, "%02x ", (unsigned char)buf[j]);
                 strcat(unit, data);
@@ -99,25 +99,25 @@ int test_read(void) {
         LOGE("Block manager prepare failed\n");
         goto out;
     }
-    LOGI("prepared max length = 0x%llx\n", prepared->max_size_mapped_in_partition);
+    LOGI("prepared max length = 0x%" PRIx64 "\n", prepared->max_size_mapped_in_partition);
     test_offset = 0;
     test_length = 32 << 10;
-    LOGI("read at offset 0x%llx with length 0x%llx\n", test_offset, test_length);
-    memset(buf, 0, sizeof(buf));
+    LOGI("read at offset 0x%" PRIx64 " with length 0x%" PRIx64 "\n", test_offset, test_length);
+    memset(buf, 0, CHUNKSIZE);
     ret = bm->read(bm, test_offset, buf, test_length);
-    LOGI("ret = 0x%llx\n", ret);
+    LOGI("ret = 0x%" PRIx64 "\n", ret);
     dump_data(test_offset, buf, 32 << 10);
 
     test_offset = 200 << 10;
     test_length = 32 << 10;
-    LOGI("read at offset 0x%llx with length 0x%llx\n", test_offset, test_length);
-    memset(buf, 0, sizeof(buf));
+    LOGI("read at offset 0x%" PRIx64 " with length 0x%" PRIx64 "\n", test_offset, test_length);
+    memset(buf, 0, CHUNKSIZE);
     ret = bm->read(bm, test_offset, buf, test_length);
-    LOGI("ret = 0x%llx\n", ret);
+    LOGI("ret = 0x%" PRIx64 "\n", ret);
     dump_data(test_offset, buf, 32 << 10);
 
     ret = bm->finish(bm);
-    LOGI("ret = 0x%llx\n", ret);
+    LOGI("ret = 0x%" PRIx64 "\n", ret);
 
     LOGI("Operation at partition 2 <--> mtdblock1\n");
     test_offset = 1 << 20;
@@ -126,14 +126,14 @@ int test_read(void) {
         LOGE("Block manager prepare failed\n");
         goto out;
     }
-    LOGI("prepared max length = 0x%llx\n", prepared->max_size_mapped_in_partition);
-    LOGI("read at offset 0x%llx with length 0x%llx\n", test_offset, test_length);
-    memset(buf, 0, sizeof(buf));
+    LOGI("prepared max length = 0x%" PRIx64 "\n", prepared->max_size_mapped_in_partition);
+    LOGI("read at offset 0x%" PRIx64 " with length 0x%" PRIx64 "\n", test_offset, test_length);
+    memset(buf, 0, CHUNKSIZE);
     ret = bm->read(bm, test_offset, buf, test_length);
-    LOGI("ret = 0x%llx\n", ret);
+    LOGI("ret = 0x%" PRIx64 "\n", ret);
     dump_data(test_offset, buf, 32 << 10);
     ret = bm->finish(bm);
-    LOGI("ret = 0x%llx\n", ret);
+    LOGI("ret = 0x%" PRIx64 "\n", ret);
 
 
     LOGI("Operation at partition 5<--> mtdblock4\n");
@@ -144,23 +144,23 @@ int test_read(void) {
         LOGE("Block manager prepare failed\n");
         goto out;
     }
-    LOGI("prepared max length = 0x%llx\n", prepared->max_size_mapped_in_partition);
-    LOGI("read at offset 0x%llx with length 0x%llx\n", test_offset, test_length);
-    memset(buf, 0, sizeof(buf));
+    LOGI("prepared max length = 0x%" PRIx64 "\n", prepared->max_size_mapped_in_partition);
+    LOGI("read at offset 0x%" PRIx64 " with length 0x%" PRIx64 "\n", test_offset, test_length);
+    memset(buf, 0, CHUNKSIZE);
     ret = bm->read(bm, test_offset, buf, test_length);
-    LOGI("ret = 0x%llx\n", ret);
+    LOGI("ret = 0x%" PRIx64 "\n", ret);
     dump_data(test_offset + (1 << 20), buf + (1 << 20), 32 << 10);
 
     test_offset = 9 << 20;
     test_length = 1 << 20;
-    LOGI("read at offset 0x%llx with length 0x%llx\n", test_offset, test_length);
-    memset(buf, 0, sizeof(buf));
+    LOGI("read at offset 0x%" PRIx64 " with length 0x%" PRIx64 "\n", test_offset, test_length);
+    memset(buf, 0, CHUNKSIZE);
     ret = bm->read(bm, test_offset, buf, test_length);
-    LOGI("ret = 0x%llx\n", ret);
+    LOGI("ret = 0x%" PRIx64 "\n", ret);
     dump_data(test_offset + (512 << 10), buf + (512 << 10), 32 << 10);
 
     ret = bm->finish(bm);
-    LOGI("ret = 0x%llx\n", ret);
+    LOGI("ret = 0x%" PRIx64 "\n", ret);
 
 out:
     if (buf) {
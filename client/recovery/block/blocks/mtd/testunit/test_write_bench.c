@@ -0,0 +1,237 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <utils/log.h>
+#include <unistd.h>
+#include <types.h>
+#include <autoconf.h>
+#include <utils/list.h>
+#include <block/block_manager.h>
+#include <block/fs/fs_manager.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+
+/*
+ * Block at a time erase and page at a time programming versus multi-block
+ * erase runs and whole erase block programming, of the same data into a
+ * scratch partition. Then the erase of written and of blank blocks, with
+ * and without reading them first to leave the blank ones alone, and the
+ * same write with the erase running ahead of it in the background.
+ */
+#define LOG_TAG         "testcase-bm_write_bench"
+#define BENCH_PART_OFF  0x3780000
+#define BENCH_SIZE      (8 * 1024 * 1024)
+#define BENCH_WINDOW    8
+
+static int listener_calls;
+
+static void bm_mtd_event_listener(struct block_manager *bm,
+                                  struct bm_event* event, void* param) {
+    listener_calls++;
+}
+
+/*
+ * Write syscalls issued by this process so far
+ */
+static long long get_syscw(void) {
+    char line[128];
+    long long syscw = -1;
+    FILE *fp = fopen("/proc/self/io", "r");
+
+    if (fp == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), fp))
+        if (sscanf(line, "syscw: %lld", &syscw) == 1)
+            break;
+
+    fclose(fp);
+
+    return syscw;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_pass(struct block_manager *bm, char *buf, int single) {
+    struct bm_operation_option bm_option;
+    struct bm_operate_prepare_info *prepared;
+    struct filesystem *fs;
+    long long syscw;
+    int64_t offset;
+    double start;
+
+    bm->set_operation_option(bm, &bm_option, BM_OPERATION_METHOD_PARTITION,
+                             BM_FILE_TYPE_NORMAL);
+
+    prepared = bm->prepare(bm, BENCH_PART_OFF, BENCH_SIZE, &bm_option);
+    if (prepared == NULL) {
+        LOGE("Block manager prepare failed\n");
+        return -1;
+    }
+
+    fs = (struct filesystem *)prepared->context_handle;
+    if (single) {
+        FS_FLAG_SET(fs, BLOCKERASE);
+        FS_FLAG_SET(fs, PAGEWRITE);
+    }
+
+    start = now();
+
+    if (bm->erase(bm, BENCH_PART_OFF, BENCH_SIZE) < 0) {
+        LOGE("Block manager erase failed\n");
+        return -1;
+    }
+
+    double erase_elapsed = now() - start;
+
+    listener_calls = 0;
+    syscw = get_syscw();
+    start = now();
+
+    offset = bm->write(bm, bm->get_prepare_write_start(bm), buf, BENCH_SIZE);
+    if (offset < 0) {
+        LOGE("Block manager write failed\n");
+        return -1;
+    }
+
+    double elapsed = now() - start;
+    syscw = get_syscw() - syscw;
+
+    if (bm->finish(bm) < 0) {
+        LOGE("Block manager finish failed\n");
+        return -1;
+    }
+
+    LOGI("%-8s erase %7.3f s, %6.2f MB/s\n", single ? "single:" : "runs:",
+         erase_elapsed, BENCH_SIZE / erase_elapsed / (1024 * 1024));
+    LOGI("%-8s write %7.3f s, %6.2f MB/s, %lld write syscalls, %d progress "
+         "callbacks\n", single ? "single:" : "runs:", elapsed,
+         BENCH_SIZE / elapsed / (1024 * 1024), syscw, listener_calls);
+
+    return 0;
+}
+
+static int erase_pass(struct block_manager *bm, int skip_erased,
+                      const char *label) {
+    struct bm_operation_option bm_option;
+    double start, elapsed;
+
+    bm->set_operation_option(bm, &bm_option, BM_OPERATION_METHOD_PARTITION,
+                             BM_FILE_TYPE_NORMAL);
+    bm_option.skip_erased = skip_erased;
+
+    if (bm->prepare(bm, BENCH_PART_OFF, BENCH_SIZE, &bm_option) == NULL) {
+        LOGE("Block manager prepare failed\n");
+        return -1;
+    }
+
+    start = now();
+
+    if (bm->erase(bm, BENCH_PART_OFF, BENCH_SIZE) < 0) {
+        LOGE("Block manager erase failed\n");
+        return -1;
+    }
+
+    elapsed = now() - start;
+
+    if (bm->finish(bm) < 0) {
+        LOGE("Block manager finish failed\n");
+        return -1;
+    }
+
+    LOGI("%-24s erase %7.3f s, %6.2f MB/s\n", label, elapsed,
+         BENCH_SIZE / elapsed / (1024 * 1024));
+
+    return 0;
+}
+
+static int erase_ahead_pass(struct block_manager *bm, char *buf) {
+    struct bm_operation_option bm_option;
+    double start, write_elapsed, elapsed;
+
+    bm->set_operation_option(bm, &bm_option, BM_OPERATION_METHOD_PARTITION,
+                             BM_FILE_TYPE_NORMAL);
+
+    if (bm->prepare(bm, BENCH_PART_OFF, BENCH_SIZE, &bm_option) == NULL) {
+        LOGE("Block manager prepare failed\n");
+        return -1;
+    }
+
+    start = now();
+
+    if (bm->erase_ahead(bm, BENCH_PART_OFF, BENCH_SIZE, BENCH_WINDOW) < 0) {
+        LOGE("Block manager erase ahead failed\n");
+        return -1;
+    }
+
+    if (bm->write(bm, bm->get_prepare_write_start(bm), buf, BENCH_SIZE) < 0) {
+        LOGE("Block manager write failed\n");
+        return -1;
+    }
+
+    if (bm->finish(bm) < 0) {
+        LOGE("Block manager finish failed\n");
+        return -1;
+    }
+
+    write_elapsed = now() - start;
+
+    if (bm->sync(bm) < 0) {
+        LOGE("Block manager sync failed\n");
+        return -1;
+    }
+
+    elapsed = now() - start;
+
+    LOGI("%-8s erase+write %7.3f s, %6.2f MB/s, %7.3f s with the tail\n",
+         "ahead:", write_elapsed, BENCH_SIZE / write_elapsed / (1024 * 1024),
+         elapsed);
+
+    return 0;
+}
+
+int test_write_bench(void) {
+    struct block_manager *bm = (struct block_manager *)calloc(1, sizeof(*bm));
+    char *buf = NULL;
+    int ret = -1;
+
+    LOGI("=============%s is starting =========\n", __func__);
+    bm->construct = construct_block_manager;
+    bm->destruct = destruct_block_manager;
+    bm->construct(bm, "mtd", bm_mtd_event_listener, NULL);
+
+    buf = malloc(BENCH_SIZE);
+    if (buf == NULL) {
+        LOGE("malloc failed\n");
+        goto exit;
+    }
+
+    for (int i = 0; i < BENCH_SIZE; i++)
+        buf[i] = i * 7 + (i >> 11);
+
+    LOGI("%d bytes at 0x%x\n", BENCH_SIZE, BENCH_PART_OFF);
+
+    if (bench_pass(bm, buf, 1) < 0 || bench_pass(bm, buf, 0) < 0
+            || erase_ahead_pass(bm, buf) < 0)
+        goto exit;
+
+    if (erase_pass(bm, 1, "skip erased, written:") < 0
+            || erase_pass(bm, 0, "plain, blank:") < 0
+            || erase_pass(bm, 1, "skip erased, blank:") < 0)
+        goto exit;
+
+    ret = 0;
+exit:
+    free(buf);
+    bm->destruct(bm);
+    free(bm);
+    return ret;
+}
@@ -70,7 +70,7 @@ int fs_alloc_params(struct filesystem *this) {
         return 0;
     this->params = calloc(1, sizeof(*this->params));
     if (this->params == NULL) {
-        LOGE("Cannot get memory space, request size is %d\n",
+        LOGE("Cannot get memory space, request size is %" PRId64 "\n",
              sizeof(*this->params));
         return -1;
     }
@@ -124,7 +124,9 @@ int jffs2_write_cleanmarker(struct filesystem *fs,
             return -1;
         }
     } else {
-        if (pwrite(fd, cleanmarker, sizeof(*cleanmarker), (loff_t)offset) != sizeof(*cleanmarker)) {
+        if (mtd_write(mtd_desc, mtd, fd, offset / mtd->eb_size,
+                      offset % mtd->eb_size, cleanmarker,
+                      sizeof(*cleanmarker), NULL, 0, 0) != 0) {
             LOGE("MTD \"%s\" write failure", mtd->name);
             return -1;
         }
@@ -140,6 +142,7 @@ static int jffs2_init(struct filesystem *fs) {
 
 static int jffs2_format(struct filesystem *fs) {
     struct mtd_dev_info *mtd = FS_GET_MTD_DEV(fs);
+    fs->params->offset = MTD_DEV_INFO_TO_START(mtd);
     fs->params->length = mtd->size;
     if (mtd_basic_erase(fs) < 0) {
         LOGE("Cannot format on fs\'%s\'\n", fs->name);
@@ -23,6 +23,8 @@
 #include <utils/log.h>
 #include <utils/assert.h>
 #include <utils/common.h>
+#include <utils/update_stats.h>
+#include <utils/memscan.h>
 #include <block/fs/fs_manager.h>
 #include <block/fs/ubifs.h>
 #include <block/block_manager.h>
@@ -30,7 +32,11 @@
 
 #define LOG_TAG  "fs_ubifs"
 
-static struct ubi_params *ubi;
+/*
+ * Kept per thread, as each partition is prepared and written by the
+ * thread of its device
+ */
+static __thread struct ubi_params *ubi;
 
 #ifdef UBI_OPEN_DEBUG
 static void dump_ubi_vi_info(struct ubi_params *params ) {
@@ -93,16 +99,16 @@ static void dump_ubi_params(struct ubi_params *params) {
     LOGI("=========device depends info=========\n");
     LOGI("peb size: %d\n", params->devinfo.peb_size);
     LOGI("page size: %d\n", params->devinfo.page_size);
-    LOGI("partition size: 0x%llx\n",
+    LOGI("partition size: 0x%" PRIx64 "\n",
          params->devinfo.partition_size);
-    LOGI("device size: 0x%llx\n", params->devinfo.device_size);
+    LOGI("device size: 0x%" PRIx64 "\n", params->devinfo.device_size);
     LOGI("volume name: %s\n", params->vol_name);
     LOGI("max beb per1024: %d\n", params->max_beb_per1024);
     LOGI("ubi reserved blks: %d\n", params->ubi_reserved_blks);
     LOGI("leg size: %d\n", params->lebsize);
-    LOGI("volume size: %lld\n", params->vol_size);
+    LOGI("volume size: %" PRId64 "\n", params->vol_size);
     LOGI("override_ec: %d\n", params->override_ec);
-    LOGI("ec: %lld\n", params->ec);
+    LOGI("ec: %" PRId64 "\n", params->ec);
     LOGI("vid header offset  = %d\n", params->vid_hdr_offs);
     LOGI("ubi version  = %d\n", params->ubi_ver);
     LOGI("ui address: %p\n", params->ui);
@@ -175,8 +181,8 @@ static int get_bad_peb_limit(struct ubi_params *params)
 }
 
 static int consecutive_bad_check(int eb) {
-    static int consecutive_bad_blocks = 1;
-    static int prev_bb = -1;
+    static __thread int consecutive_bad_blocks = 1;
+    static __thread int prev_bb = -1;
 
     if (prev_bb == -1)
         prev_bb = eb;
@@ -272,7 +278,7 @@ static int ubi_generate_vi_info(struct ubi_params *params, int64_t image_length)
     vi->data_pad = ui->leb_size % vi->alignment;
     vi->usable_leb_size = ui->leb_size - vi->data_pad;
     if (image_length % vi->usable_leb_size) {
-        LOGE("image length must be leb size alignment,  pass length is %lld, leb size is %d\n",
+        LOGE("image length must be leb size alignment,  pass length is %" PRId64 ", leb size is %d\n",
              image_length, vi->usable_leb_size);
         goto out;
     }
@@ -431,7 +437,7 @@ static int ubi_mtd_part_check(struct filesystem* fs,
     }
 
     if (ubi_params->override_ec)
-        LOGI("Use erase counter %lld for all eraseblocks\n", ubi_params->ec);
+        LOGI("Use erase counter %" PRId64 " for all eraseblocks\n", ubi_params->ec);
 
     ubi_params->si = si;
 #ifdef UBI_OPEN_DEBUG
@@ -461,6 +467,10 @@ static void ubi_params_free(struct ubi_params **params) {
         free((*params)->outbuf);
         (*params)->outbuf = NULL;
     }
+    if ((*params)->blankbuf) {
+        free((*params)->blankbuf);
+        (*params)->blankbuf = NULL;
+    }
     if ((*params)->vi) {
         free((*params)->vi);
         (*params)->vi = NULL;
@@ -550,7 +560,7 @@ static int ubi_bypass_layout_vol(struct filesystem *fs,
         goto out;
     }
 
-    LOGI("Bypass start at eb %lld, bypass layout eb count is %d\n",
+    LOGI("Bypass start at eb %" PRId64 ", bypass layout eb count is %d\n",
          eb, volume_table_cnt);
     while (eb < mtd->eb_cnt) {
         if (si->ec[eb] == EB_BAD) {
@@ -559,9 +569,9 @@ static int ubi_bypass_layout_vol(struct filesystem *fs,
         }
         err = mtd_erase(libmtd, mtd, mtd_fd, eb);
         if (err) {
-            LOGE("failed to erase eraseblock %lld\n", eb);
+            LOGE("failed to erase eraseblock %" PRId64 "\n", eb);
             if (errno != EIO) {
-                LOGE("fatal error on eraseblock %lld\n", eb);
+                LOGE("fatal error on eraseblock %" PRId64 "\n", eb);
                 goto out;
             }
 
@@ -573,11 +583,11 @@ static int ubi_bypass_layout_vol(struct filesystem *fs,
         err = mtd_write(libmtd, mtd, mtd_fd, eb, 0, tmp_buf,
                         ui->peb_size, NULL, 0, 0);
         if (err) {
-            LOGE("cannot write data (%d bytes buffer) to eraseblock %lld\n",
+            LOGE("cannot write data (%d bytes buffer) to eraseblock %" PRId64 "\n",
                  ui->peb_size, eb);
 
             if (errno != EIO) {
-                LOGE("fatal error on writeblock %lld\n", eb);
+                LOGE("fatal error on writeblock %" PRId64 "\n", eb);
                 goto out;
             }
             err = mtd_torture(libmtd, mtd, mtd_fd, eb);
@@ -590,9 +600,9 @@ static int ubi_bypass_layout_vol(struct filesystem *fs,
         }
         err = mtd_erase(libmtd, mtd, mtd_fd, eb);
         if (err) {
-            LOGE("failed to erase eraseblock %lld\n", eb);
+            LOGE("failed to erase eraseblock %" PRId64 "\n", eb);
             if (errno != EIO) {
-                LOGE("fatal error on eraseblock %lld\n", eb);
+                LOGE("fatal error on eraseblock %" PRId64 "\n", eb);
                 goto out;
             }
 
@@ -612,7 +622,7 @@ static int ubi_bypass_layout_vol(struct filesystem *fs,
         goto out;
     }
     ubi->layout_volume_start_eb = eb;
-    LOGI("Volume will be writen start at eb %lld\n",
+    LOGI("Volume will be writen start at eb %" PRId64 "\n",
          ubi->layout_volume_start_eb);
 
     if (tmp_buf)
@@ -650,19 +660,37 @@ static int change_ech(struct ubi_ec_hdr *hdr, uint32_t image_seq, long long ec)
 }
 
 static int drop_ffs(const struct mtd_dev_info *mtd, const void *buf, int len) {
-    int i;
-
-    for (i = len - 1; i >= 0; i--)
-        if (((const uint8_t *) buf)[i] != 0xFF)
-            break;
+    len = memscan_strip_ff(buf, len);
 
     /* The resulting length must be aligned to the minimum flash I/O size */
-    len = i + 1;
     len = (len + mtd->min_io_size - 1) / mtd->min_io_size;
     len *= mtd->min_io_size;
     return len;
 }
 
+/*
+ * With FS_FLAG_SKIPERASED, an eraseblock the scan found empty is read
+ * whole and needs no erase when it is all 0xFF
+ */
+static int ubi_peb_is_blank(struct filesystem *fs, struct mtd_dev_info *mtd,
+                            struct ubi_scan_info *si, int64_t eb) {
+    struct block_manager *bm = FS_GET_BM(fs);
+
+    if (!FS_FLAG_IS_SET(fs, SKIPERASED) || si->ec[eb] != EB_EMPTY)
+        return false;
+
+    if (ubi->blankbuf == NULL) {
+        ubi->blankbuf = malloc(mtd->eb_size);
+        if (ubi->blankbuf == NULL) {
+            LOGE("cannot allocate %d bytes of memory\n", mtd->eb_size);
+            return false;
+        }
+    }
+
+    return mtd_block_is_blank(BM_GET_MTD_DESC(bm), mtd,
+                              MTD_DEV_INFO_TO_FD(mtd), eb, ubi->blankbuf);
+}
+
 int64_t ubi_write_one_peb(struct filesystem *fs,
                           libmtd_t libmtd, struct mtd_dev_info *mtd,
                           struct ubigen_info *ui, struct ubi_scan_info *si,
@@ -675,20 +703,21 @@ int64_t ubi_write_one_peb(struct filesystem *fs,
 
     while (eb < mtd->eb_cnt) {
         if (si->ec[eb] == EB_BAD) {
-            LOGI("block %lld is bad on mtd(%d) \n", eb, mtd->mtd_num);
+            LOGI("block %" PRId64 " is bad on mtd(%d) \n", eb, mtd->mtd_num);
             eb++;
             continue;
         }
 
-        err = mtd_erase(libmtd, mtd, mtd_fd, eb);
+        err = ubi_peb_is_blank(fs, mtd, si, eb) ? 0
+              : mtd_erase(libmtd, mtd, mtd_fd, eb);
         if (err) {
-            LOGE("failed to erase eraseblock %lld\n", eb);
+            LOGE("failed to erase eraseblock %" PRId64 "\n", eb);
             if (errno != EIO) {
-                LOGE("fatal error occured on %lld\n", eb);
+                LOGE("fatal error occured on %" PRId64 "\n", eb);
                 return -1;
             }
             if (mark_bad(mtd, si, eb)) {
-                LOGE("mark bad block failed on %lld\n", eb);
+                LOGE("mark bad block failed on %" PRId64 "\n", eb);
                 return -1;
             }
             eb++;
@@ -707,25 +736,25 @@ int64_t ubi_write_one_peb(struct filesystem *fs,
 
         err = change_ech((struct ubi_ec_hdr *) buf, ui->image_seq, ec);
         if (err) {
-            LOGI("bad EC header at eraseblock %lld\n", eb);
+            LOGI("bad EC header at eraseblock %" PRId64 "\n", eb);
             return -1;
         }
         write_len = drop_ffs(mtd, buf, mtd->eb_size);
-        LOGI("write eb %lld with ec %lld\n", eb, ec);
+        LOGI("write eb %" PRId64 " with ec %lld\n", eb, ec);
         err = mtd_write(libmtd, mtd, mtd_fd, eb, 0, buf, write_len, NULL,
                         0, 0);
         if (err) {
-            LOGE("cannot write eraseblock %lld\n", eb);
+            LOGE("cannot write eraseblock %" PRId64 "\n", eb);
 
             if (errno != EIO) {
-                LOGE("fatal error occured on %lld\n", eb);
+                LOGE("fatal error occured on %" PRId64 "\n", eb);
                 return -1;
             }
 
             err = mtd_torture(libmtd, mtd, mtd_fd, eb);
             if (err) {
                 if (mark_bad(mtd, si, eb)) {
-                    LOGE("mark bad block failed on %lld\n", eb);
+                    LOGE("mark bad block failed on %" PRId64 "\n", eb);
                     return -1;
                 }
             }
@@ -738,7 +767,7 @@ int64_t ubi_write_one_peb(struct filesystem *fs,
     }
 
     if (eb > mtd->eb_cnt) {
-        LOGE("write size is overflowed, eb = %lld, mtd eb total: %d\n", eb, mtd->eb_cnt);
+        LOGE("write size is overflowed, eb = %" PRId64 ", mtd eb total: %d\n", eb, mtd->eb_cnt);
         return -1;
     }
 
@@ -845,18 +874,18 @@ int ubi_write_layout_vol(struct filesystem *fs,
     ubigen_init_ec_hdr(ui, (struct ubi_ec_hdr *)outbuf, ec1);
     ubigen_init_vid_hdr(ui, &vi, vid_hdr, 0, NULL, 0);
 
-    LOGI("write layout volume0 to eb%lld\n", start_eb);
+    LOGI("write layout volume0 to eb%" PRId64 "\n", start_eb);
     if ((ret = ubi_write_one_peb(fs, libmtd, mtd, ui, si, start_eb, outbuf)) < 0) {
-        LOGE("cannot write %d bytes to eb %lld\n", ui->peb_size, start_eb);
+        LOGE("cannot write %d bytes to eb %" PRId64 "\n", ui->peb_size, start_eb);
         goto out_free;
     }
 
     start_eb = ret;
     ubigen_init_ec_hdr(ui, (struct ubi_ec_hdr *)outbuf, ec2);
     ubigen_init_vid_hdr(ui, &vi, vid_hdr, 1, NULL, 0);
-    LOGI("write layout volume1 to eb%lld\n", start_eb);
+    LOGI("write layout volume1 to eb%" PRId64 "\n", start_eb);
     if ((ret = ubi_write_one_peb(fs, libmtd, mtd, ui, si, start_eb, outbuf)) < 0) {
-        LOGE("cannot write %d bytes to eb %lld\n", ui->peb_size, start_eb);
+        LOGE("cannot write %d bytes to eb %" PRId64 "\n", ui->peb_size, start_eb);
         goto out_free;
     }
     if (outbuf)
@@ -887,12 +916,12 @@ static int64_t format(struct filesystem *fs, libmtd_t libmtd,
 
     hdr = malloc(write_size);
     if (hdr == NULL) {
-        LOGE("cannot allocate %lld bytes of memory\n", write_size);
+        LOGE("cannot allocate %" PRId64 " bytes of memory\n", write_size);
         return -1;
     }
     memset(hdr, 0xFF, write_size);
 
-    LOGI("MTD \"%s\"  volume tailing format from eb %lld to eb %d\n",
+    LOGI("MTD \"%s\"  volume tailing format from eb %" PRId64 " to eb %d\n",
          MTD_DEV_INFO_TO_PATH(mtd), start_eb, mtd->eb_cnt);
     for (eb = start_eb; eb < mtd->eb_cnt; eb++) {
         int64_t ec;
@@ -900,7 +929,7 @@ static int64_t format(struct filesystem *fs, libmtd_t libmtd,
         set_process_info(fs, BM_OPERATION_FORMAT,
                          eb - start_eb, mtd->eb_cnt - start_eb);
         if (si->ec[eb] == EB_BAD) {
-            LOGI("MTD \"%s\"  volume format bypass bad eb %lld\n",
+            LOGI("MTD \"%s\"  volume format bypass bad eb %" PRId64 "\n",
                  MTD_DEV_INFO_TO_PATH(mtd), eb);
             continue;
         }
@@ -912,11 +941,12 @@ static int64_t format(struct filesystem *fs, libmtd_t libmtd,
             ec = si->mean_ec;
         ubigen_init_ec_hdr(ui, hdr, ec);
 
-        err = mtd_erase(libmtd, mtd, mtd_fd, eb);
+        err = ubi_peb_is_blank(fs, mtd, si, eb) ? 0
+              : mtd_erase(libmtd, mtd, mtd_fd, eb);
         if (err) {
-            LOGE("failed to erase eraseblock %lld\n", eb);
+            LOGE("failed to erase eraseblock %" PRId64 "\n", eb);
             if (errno != EIO) {
-                LOGE("fatal error on eraseblock %lld\n", eb);
+                LOGE("fatal error on eraseblock %" PRId64 "\n", eb);
                 goto out_free;
             }
 
@@ -940,15 +970,15 @@ static int64_t format(struct filesystem *fs, libmtd_t libmtd,
             continue;
         }
 
-        LOGI("write eb %lld with ec %lld\n", eb, ec);
+        LOGI("write eb %" PRId64 " with ec %" PRId64 "\n", eb, ec);
         err = mtd_write(libmtd, mtd, mtd_fd, eb, 0, hdr,
                         write_size, NULL, 0, 0);
         if (err) {
-            LOGE("cannot write EC header (%lld bytes buffer) to eraseblock %lld\n",
+            LOGE("cannot write EC header (%" PRId64 " bytes buffer) to eraseblock %" PRId64 "\n",
                  write_size, eb);
 
             if (errno != EIO) {
-                LOGE("fatal error on writeblock %lld\n", eb);
+                LOGE("fatal error on writeblock %" PRId64 "\n", eb);
                 goto out_free;
             }
             err = mtd_torture(libmtd, mtd, mtd_fd, eb);
@@ -1060,6 +1090,7 @@ static int64_t ubifs_done(struct filesystem *fs) {
     struct ubi_scan_info *si = ubi->si;
     int64_t start_eb = ubi->start_eb;
     int64_t retval;
+    uint64_t start;
 
     if ((ubi == NULL)
             || (ubi->ui == NULL)) {
@@ -1071,7 +1102,11 @@ static int64_t ubifs_done(struct filesystem *fs) {
         goto out;
     }
 
-    if ((retval = format(fs, libmtd, mtd, ui, si, ubi->format_eb, 1)) < 0) {
+    start = update_stats_now();
+    retval = format(fs, libmtd, mtd, ui, si, ubi->format_eb, 1);
+    update_stats_add(UPDATE_STAGE_FORMAT,
+            (uint64_t) (mtd->eb_cnt - ubi->format_eb) * mtd->eb_size, start);
+    if (retval < 0) {
         LOGE("Cannot format the tailing ebs in mtd \"%s\"\n", mtd->name);
         goto out;
     }
@@ -1081,7 +1116,7 @@ static int64_t ubifs_done(struct filesystem *fs) {
 
     retval *= ui->peb_size;
 
-    LOGI("Total lnum is %d, Next mtd partition write start at 0x%llx\n",
+    LOGI("Total lnum is %d, Next mtd partition write start at 0x%" PRIx64 "\n",
          ubi->vid_hdr_lnum, retval);
     ubi_params_free(&ubi);
     return retval;
@@ -1114,8 +1149,8 @@ static int64_t ubifs_get_operate_start_address(struct filesystem *fs) {
     ubi->vid_hdr_lnum = 0;
     ubi->start_eb = eb;
     ubi->layout_volume_start_eb = err;
-    LOGI("ubifs start at eb %lld, bypassed layout eb count is %lld"
-         " volume layout will start at eb %lld\n",
+    LOGI("ubifs start at eb %" PRId64 ", bypassed layout eb count is %" PRId64
+         " volume layout will start at eb %" PRId64 "\n",
          ubi->start_eb, err - eb,
          ubi->layout_volume_start_eb);
 
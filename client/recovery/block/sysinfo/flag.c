@@ -29,6 +29,8 @@
  */
 static struct sysinfo_flag_layout layout[] = {
     {SYSINFO_FLAG_UPDATE_DONE_OFFSET,  SYSINFO_FLAG_UPDATE_DONE_SIZE},
+    {SYSINFO_FLAG_UPDATE_JOURNAL_OFFSET,  SYSINFO_FLAG_UPDATE_JOURNAL_SIZE},
+    {SYSINFO_FLAG_BAD_BLOCK_TABLE_OFFSET,  SYSINFO_FLAG_BAD_BLOCK_TABLE_SIZE},
 };
 
 static void dump_data(int64_t offset, unsigned char *buf, int length) {
@@ -46,7 +48,7 @@ static void dump_data(int64_t offset, unsigned char *buf, int length) {
     for (i = 0; i < length / 2; i += 2) {
         unsigned short s = 0;
         if ((i % 16) == 0)
-            sprintf(unit, "%08llx: ", addr + i);
+            sprintf(unit, "%08" PRIx64 ": ", addr + i);
 
         s = ((buf[i]) & 0xff) + ((buf[i + 1] & 0xff) << 8);
 
@@ -88,7 +88,7 @@ static int sysinfo_get_value(struct sysinfo_manager *this,
     if (*data == NULL) {
         *data = calloc(1, len);
         if (*data == NULL) {
-            LOGE("Cannot alloc any memory space, requested length %lld\n", len);
+            LOGE("Cannot alloc any memory space, requested length %" PRId64 "\n", len);
             goto out;
         }
     }
@@ -107,7 +107,7 @@ static int sysinfo_get_value(struct sysinfo_manager *this,
         }
         mtd = mtd_get_dev_info_by_offset(bm, offset);
         if (mtd == NULL) {
-            LOGE("offset 0x%llx cannot be recognised by mtd\n", offset);
+            LOGE("offset 0x%" PRIx64 " cannot be recognised by mtd\n", offset);
             goto out;
         }
 
@@ -120,7 +120,7 @@ static int sysinfo_get_value(struct sysinfo_manager *this,
                 goto out;
             }
             if (fs->read(fs) < 0) {
-                LOGE("Cannot read at offset 0x%llx by length %lld\n", offset, len);
+                LOGE("Cannot read at offset 0x%" PRIx64 " by length %" PRId64 "\n", offset, len);
                 goto out;
             }
         } else if (!strcmp(bm->name, BM_BLOCK_TYPE_MMC)) {
@@ -148,6 +148,7 @@ static int sysinfo_set_value(struct sysinfo_manager *this,
                              int id, char *buf, char flag)
 {
     struct filesystem* fs = NULL;
+    pthread_mutex_t *lock = NULL;
     char** data = NULL;
     char *tmpbuf = NULL;
     int64_t offset, len;
@@ -162,7 +163,7 @@ static int sysinfo_set_value(struct sysinfo_manager *this,
     if (*data == NULL) {
         *data = calloc(1, len);
         if (*data == NULL) {
-            LOGE("Cannot alloc any memory space, requested length %lld\n", len);
+            LOGE("Cannot alloc any memory space, requested length %" PRId64 "\n", len);
             goto out;
         }
     }
@@ -186,7 +187,7 @@ static int sysinfo_set_value(struct sysinfo_manager *this,
         if (!strcmp(bm->name, BM_BLOCK_TYPE_MTD)) {
             mtd = mtd_get_dev_info_by_offset(bm, offset);
             if (mtd == NULL) {
-                LOGE("offset 0x%llx cannot be recognised by mtd\n", offset);
+                LOGE("offset 0x%" PRIx64 " cannot be recognised by mtd\n", offset);
                 goto out;
             }
             tmpbuf = calloc(1, mtd->eb_size);
@@ -196,10 +197,20 @@ static int sysinfo_set_value(struct sysinfo_manager *this,
             }
 
             if (len > mtd->eb_size) {
-                LOGE("Max write size cannot be more than %lld bytes\n", len);
+                LOGE("Max write size cannot be more than %" PRId64 " bytes\n", len);
                 goto out;
             }
             blkaligned_addr = offset & (~(mtd->eb_size - 1));
+
+            /*
+             * The block is read, erased and written back as a whole, no
+             * other thread may program the chip in between
+             */
+            lock = bm->get_device_lock(bm, offset);
+            if (lock == NULL)
+                goto out;
+            pthread_mutex_lock(lock);
+
             fs->set_params(fs, tmpbuf, blkaligned_addr,
                        mtd->eb_size, BM_OPERATION_METHOD_RANDOM, mtd, bm);
             if (fs->get_max_mapped_size_in_partition(fs) <= 0) {
@@ -207,22 +218,24 @@ static int sysinfo_set_value(struct sysinfo_manager *this,
                 goto out;
             }
             if (fs->read(fs) < 0) {
-                LOGE("Cannot read at offset 0x%llx by length %d\n",
+                LOGE("Cannot read at offset 0x%" PRIx64 " by length %d\n",
                         offset, mtd->eb_size);
                 goto out;
             }
             memcpy(tmpbuf + offset - blkaligned_addr, *data, len);
             if (fs->erase(fs) < 0) {
-                LOGE("Cannot erase at offset 0x%llx by length %d\n",
+                LOGE("Cannot erase at offset 0x%" PRIx64 " by length %d\n",
                         offset, mtd->eb_size);
                 goto out;
             }
             fs_set_params_process(fs, mtd->eb_size);
             if (fs->write(fs) < 0) {
-                LOGE("Cannot write at offset 0x%llx by length %d\n",
+                LOGE("Cannot write at offset 0x%" PRIx64 " by length %d\n",
                         offset, mtd->eb_size);
                 goto out;
             }
+            pthread_mutex_unlock(lock);
+            lock = NULL;
             free(tmpbuf);
         } else if (!strcmp(bm->name, BM_BLOCK_TYPE_MMC)) {
 
@@ -239,6 +252,9 @@ static int sysinfo_set_value(struct sysinfo_manager *this,
 
     return 0;
 out:
+    if (lock) {
+        pthread_mutex_unlock(lock);
+    }
     if (tmpbuf) {
         free(tmpbuf);
     }
@@ -359,14 +375,14 @@ static int sysinfo_traversal_merge(struct sysinfo_manager *this,
             goto out;
         }
         if (overlap <= 0) {
-            LOGE("Should not come here, overlap = %lld\n", overlap);
+            LOGE("Should not come here, overlap = %" PRId64 "\n", overlap);
             goto out;
         }
         t_buf += (l_start > start) ? l_start - start : 0;
         l_buf += (l_start < start) ? start - l_start : 0;
 
         offset += (l_start > start) ? l_start - start : 0;
-        LOGI("offset 0x%llx will be merged, merged size %lld\n", offset, overlap);
+        LOGI("offset 0x%" PRIx64 " will be merged, merged size %" PRId64 "\n", offset, overlap);
         memcpy(t_buf, l_buf, overlap);
     }
     return 0;
@@ -374,6 +390,29 @@ out:
     return -1;
 }
 
+/*
+ * Whether a reserved item lies in the range, what is written there is
+ * not what the image holds
+ */
+static int sysinfo_traversal_reserved(struct sysinfo_manager *this,
+                                      int64_t offset, int64_t length) {
+    int64_t start = offset;
+    int64_t end = start + length;
+
+    for (int i = 0;  i < ARRAY_SIZE(layout); i++) {
+        struct sysinfo_layout *l = &layout[i];
+        int64_t l_start = l->offset;
+        int64_t l_end = l_start + l->length;
+        if (l->reserve != SYSINFO_RESERVED) {
+            continue;
+        }
+        if ((end <= l_start) || (start >= l_end))
+            continue;
+        return 1;
+    }
+    return 0;
+}
+
 void sysinfo_manager_bind(struct sysinfo_manager *this, void *target) {
     struct block_manager *bm = (struct block_manager *)target;
     this->binder = bm;
@@ -389,6 +428,7 @@ struct sysinfo_manager sysinfo = {
     .set_reserve = sysinfo_set_reserve,
     .traversal_save = sysinfo_traversal_save,
     .traversal_merge = sysinfo_traversal_merge,
+    .traversal_reserved = sysinfo_traversal_reserved,
     .init = sysinfo_init,
     .exit = sysinfo_exit,
 };
\ No newline at end of file
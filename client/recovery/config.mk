@@ -33,6 +33,16 @@ $(shell [ -d $(OUTDIR) ] || mkdir -p $(OUTDIR))
 OUTDIR := $(shell cd $(OUTDIR) && /bin/pwd)
 $(if $(OUTDIR),,$(error output directory "$(OUTDIR)" does not exist))
 
+#
+# Host build: make HOST=1
+#
+# The native compiler, the file-backed MTD emulator in place of libmtd.
+# Objects are built in place for either, make clean when switching.
+#
+ifdef HOST
+CROSS_COMPILE :=
+endif
+
 #
 # Cross compiler
 #
@@ -53,6 +63,10 @@ INCLUDES := -I$(TOPDIR)/include                                                \
 CFLAGS := -std=gnu11 $(INCLUDES)
 CHECKFLAGS := -Wall -Wuninitialized -Wundef
 
+ifdef HOST
+CFLAGS += -DHOST_BUILD
+endif
+
 ifndef DEBUG
 CFLAGS += -O2
 else
@@ -71,6 +85,13 @@ endif
 #
 #CFLAGS += -D_FILE_OFFSET_BITS=64 -D_LARGE_FILE
 
+#
+# For CRC32 of UBI, JFFS2 and sysinfo
+#
+# open to go back to the byte-at-a-time table loop, 8K of tables less
+#
+#CFLAGS += -DCRC32_BYTEWISE
+
 LDLIBS += -pthread -lm
 override CFLAGS := $(CHECKFLAGS) $(CFLAGS)
 
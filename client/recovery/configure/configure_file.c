@@ -23,6 +23,7 @@
 #include <utils/assert.h>
 #include <configure/configure_file.h>
 #include <utils/file_ops.h>
+#include <utils/hash.h>
 #include <lib/config/libconfig.h>
 #include <version.h>
 
@@ -33,6 +34,46 @@ static const char* prefix_version = "Version";
 static const char* prefix_server_setting = "Server";
 static const char* prefix_server_ip = "ip";
 static const char* prefix_server_url = "url";
+static const char* prefix_update_setting = "Update";
+static const char* prefix_update_stream = "stream";
+static const char* prefix_update_prefetch_depth = "prefetch_depth";
+static const char* prefix_update_prefetch_memory = "prefetch_memory";
+static const char* prefix_update_connections = "connections";
+static const char* prefix_update_compare_skip = "compare_skip";
+static const char* prefix_update_parallel_flash = "parallel_flash";
+static const char* prefix_update_stats_to_storage = "stats_to_storage";
+static const char* prefix_update_skip_erased = "skip_erased";
+static const char* prefix_update_erase_ahead = "erase_ahead";
+static const char* prefix_update_verify_readback = "verify_readback";
+static const char* prefix_update_hash_offload = "hash_offload";
+static const char* prefix_update_journal_part = "journal_part";
+static const char* default_journal_part = "journal";
+
+/*
+ * "sha1,sha256": the hashes to hand to the kernel crypto API
+ */
+static int parse_hash_offload(const char* list) {
+    char* names = strdup(list);
+    char* save = NULL;
+    int mask = 0;
+
+    if (names == NULL)
+        return 0;
+
+    for (char* name = strtok_r(names, ", ", &save); name;
+            name = strtok_r(NULL, ", ", &save)) {
+        int type = hash_type(name);
+
+        if (type < 0)
+            LOGW("Unknown hash \"%s\" to offload\n", name);
+        else
+            mask |= HASH_MASK(type);
+    }
+
+    free(names);
+
+    return mask;
+}
 
 static void dump(struct configure_file* this) {
     LOGI("=========================\n");
@@ -40,6 +81,22 @@ static void dump(struct configure_file* this) {
     LOGI("Version:    %s\n", this->version);
     LOGI("Server IP:  %s\n", this->server_ip);
     LOGI("Server URL: %s\n", this->server_url);
+    LOGI("Streaming:  %s\n", this->update_stream ? "yes" : "no");
+    LOGI("Prefetch:   %d chunks, %d KB\n", this->prefetch_depth,
+            this->prefetch_memory);
+    LOGI("Connections: %d\n", this->connections ? this->connections : 1);
+    LOGI("Compare skip: %s\n", this->compare_skip ? "yes" : "no");
+    LOGI("Parallel flash: %s\n", this->parallel_flash ? "yes" : "no");
+    LOGI("Stats to storage: %s\n", this->stats_to_storage ? "yes" : "no");
+    LOGI("Skip erased: %s\n", this->skip_erased ? "yes" : "no");
+    LOGI("Erase ahead: %d blocks\n", this->erase_ahead);
+    LOGI("Verify readback: %s\n", this->verify_readback ? "yes" : "no");
+    LOGI("Hash offload: %s%s%s%s\n",
+            this->hash_offload & HASH_MASK(HASH_MD5) ? " md5" : "",
+            this->hash_offload & HASH_MASK(HASH_SHA1) ? " sha1" : "",
+            this->hash_offload & HASH_MASK(HASH_SHA256) ? " sha256" : "",
+            this->hash_offload ? "" : " none");
+    LOGI("Journal partition: %s\n", this->journal_part);
     LOGI("=========================\n");
 }
 
@@ -95,6 +152,80 @@ static int parse(struct configure_file* this, const char* path) {
     free(buf);
     buf = NULL;
 
+    /*
+     * Update settings are optional
+     */
+    asprintf(&buf, "%s.%s", prefix_application, prefix_update_setting);
+    setting = config_lookup(&cfg, buf);
+    if (setting != NULL) {
+        int stream = 0;
+        int compare_skip = 0;
+        int parallel_flash = 0;
+        int stats_to_storage = 0;
+        int skip_erased = 0;
+        int verify_readback = 0;
+        const char* hash_offload = NULL;
+        const char* journal_part = NULL;
+
+        int depth = 0;
+        int memory = 0;
+        int connections = 0;
+        int erase_ahead = 0;
+
+        if (config_setting_lookup_bool(setting, prefix_update_stream, &stream))
+            this->update_stream = stream;
+
+        if (config_setting_lookup_int(setting, prefix_update_prefetch_depth,
+                &depth) && depth > 0)
+            this->prefetch_depth = depth;
+
+        if (config_setting_lookup_int(setting, prefix_update_prefetch_memory,
+                &memory) && memory > 0)
+            this->prefetch_memory = memory;
+
+        if (config_setting_lookup_int(setting, prefix_update_connections,
+                &connections) && connections > 0)
+            this->connections = connections;
+
+        if (config_setting_lookup_bool(setting, prefix_update_compare_skip,
+                &compare_skip))
+            this->compare_skip = compare_skip;
+
+        if (config_setting_lookup_bool(setting, prefix_update_parallel_flash,
+                &parallel_flash))
+            this->parallel_flash = parallel_flash;
+
+        if (config_setting_lookup_bool(setting, prefix_update_stats_to_storage,
+                &stats_to_storage))
+            this->stats_to_storage = stats_to_storage;
+
+        if (config_setting_lookup_bool(setting, prefix_update_skip_erased,
+                &skip_erased))
+            this->skip_erased = skip_erased;
+
+        if (config_setting_lookup_int(setting, prefix_update_erase_ahead,
+                &erase_ahead) && erase_ahead >= 0)
+            this->erase_ahead = erase_ahead;
+
+        if (config_setting_lookup_bool(setting, prefix_update_verify_readback,
+                &verify_readback))
+            this->verify_readback = verify_readback;
+
+        if (config_setting_lookup_string(setting, prefix_update_hash_offload,
+                &hash_offload))
+            this->hash_offload = parse_hash_offload(hash_offload);
+
+        if (config_setting_lookup_string(setting, prefix_update_journal_part,
+                &journal_part))
+            this->journal_part = strdup(journal_part);
+    }
+
+    if (this->journal_part == NULL)
+        this->journal_part = strdup(default_journal_part);
+
+    free(buf);
+    buf = NULL;
+
     config_destroy(&cfg);
 
     return 0;
@@ -108,6 +239,8 @@ error:
         free(this->server_ip);
     if (this->server_url)
         free(this->server_url);
+    if (this->journal_part)
+        free(this->journal_part);
 
     config_destroy(&cfg);
 
@@ -126,6 +259,8 @@ void destruct_configure_file(struct configure_file* this) {
         free(this->server_ip);
     if (this->server_url)
         free(this->server_url);
+    if (this->journal_part)
+        free(this->journal_part);
 
     this->parse = NULL;
     this->dump = NULL;
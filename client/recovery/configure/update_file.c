@@ -14,6 +14,7 @@
  *
  */
 
+#include <inttypes.h>
 #include <utils/log.h>
 #include <utils/assert.h>
 #include <utils/file_ops.h>
@@ -41,6 +42,7 @@ static void free_update_info_list(struct update_file* this,
         struct image_info* info = list_entry(pos, struct image_info, head);
 
         list_del(&info->head);
+        hashtree_destroy(&info->hashtree);
         free(info);
     }
 }
@@ -339,7 +341,8 @@ static int parse_update_xml(struct update_file* this, const char* path,
             image->update_mode = mxmlGetInteger(sub_node);
         }
 
-        if (image->update_mode == UPDATE_MODE_CHUNK) {
+        if (image->update_mode == UPDATE_MODE_CHUNK
+                || image->update_mode == UPDATE_MODE_DELTA) {
             sub_node = mxmlGetParent(sub_node);
             sub_node = mxmlFindElement(sub_node, sub_node, "chunksize", NULL, NULL,
                     MXML_DESCEND);
@@ -375,6 +378,80 @@ static int parse_update_xml(struct update_file* this, const char* path,
             image->chunkcount = 1;
         }
 
+        if (image->update_mode == UPDATE_MODE_DELTA) {
+            sub_node = mxmlGetParent(sub_node);
+            sub_node = mxmlFindElement(sub_node, sub_node, "srcsize", NULL, NULL,
+                    MXML_DESCEND);
+            if (sub_node == NULL) {
+                LOGE("Failed to find \"srcsize\" element in %s\n", path);
+                free(image);
+                break;
+            }
+            const char* src_size_str = mxmlGetText(sub_node, 0);
+            image->src_size = strtoull(src_size_str, NULL, 0);
+
+            sub_node = mxmlGetParent(sub_node);
+            sub_node = mxmlFindElement(sub_node, sub_node, "srcsha1", NULL, NULL,
+                    MXML_DESCEND);
+            if (sub_node == NULL) {
+                LOGE("Failed to find \"srcsha1\" element in %s\n", path);
+                free(image);
+                break;
+            }
+            const char* src_sha1 = mxmlGetOpaque(sub_node);
+            if (src_sha1 == NULL)
+                src_sha1 = mxmlGetText(sub_node, 0);
+            if (src_sha1 == NULL || strlen(src_sha1) != IMAGE_SHA1_STR_LEN) {
+                LOGE("Bad \"srcsha1\" value in %s\n", path);
+                free(image);
+                break;
+            }
+            memcpy(image->src_sha1, src_sha1, IMAGE_SHA1_STR_LEN);
+        }
+
+        /*
+         * get optional erase node
+         */
+        image->erase = IMAGE_ERASE_PARTITION;
+        sub_node = mxmlFindElement(node, node, "erase", NULL, NULL,
+                MXML_DESCEND);
+        if (sub_node != NULL) {
+            const char* erase = mxmlGetOpaque(sub_node);
+            if (erase == NULL)
+                erase = mxmlGetText(sub_node, 0);
+
+            if (erase == NULL) {
+                LOGE("Bad \"erase\" value in %s\n", path);
+                free(image);
+                break;
+            } else if (!strcmp(erase, "deferred")) {
+                image->erase = IMAGE_ERASE_DEFERRED;
+            } else if (!strcmp(erase, "image")) {
+                image->erase = IMAGE_ERASE_IMAGE;
+            } else if (strcmp(erase, "partition")) {
+                LOGE("Bad \"erase\" value %s in %s\n", erase, path);
+                free(image);
+                break;
+            }
+        }
+
+        /*
+         * get optional hashtree node, the root of <name>.hashtree
+         */
+        sub_node = mxmlFindElement(node, node, "hashtree", NULL, NULL,
+                MXML_DESCEND);
+        if (sub_node != NULL) {
+            const char* root = mxmlGetOpaque(sub_node);
+            if (root == NULL)
+                root = mxmlGetText(sub_node, 0);
+            if (root == NULL || strlen(root) != HASHTREE_ROOT_STR_LEN) {
+                LOGE("Bad \"hashtree\" value in %s\n", path);
+                free(image);
+                break;
+            }
+            memcpy(image->hashtree_root, root, HASHTREE_ROOT_STR_LEN);
+        }
+
         count++;
         list_add_tail(&image->head, &update_info->list);
     }
@@ -412,10 +489,17 @@ static void dump_update_info(struct update_file* this,
         LOGD("image name:        %s\n", image->name);
         LOGD("image fs type:     %s\n", image->fs_type);
         LOGD("image offset:      0x%x\n", (uint32_t) image->offset);
-        LOGD("image size:        %llu\n", image->size);
+        LOGD("image size:        %" PRIu64 "\n", image->size);
         LOGD("image update mode: 0x%x\n", image->update_mode);
         LOGD("image chunksize:   %u\n", image->chunksize);
         LOGD("image chunkcount:  %u\n", image->chunkcount);
+        if (image->update_mode == UPDATE_MODE_DELTA) {
+            LOGD("image src size:    %" PRIu64 "\n", image->src_size);
+            LOGD("image src sha1:    %s\n", image->src_sha1);
+        }
+        LOGD("image erase:       %u\n", image->erase);
+        if (image->hashtree_root[0])
+            LOGD("image hashtree:    %s\n", image->hashtree_root);
     }
 
     LOGD("===================================\n");
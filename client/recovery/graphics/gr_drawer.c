@@ -190,7 +190,7 @@ static void text_blend(uint8_t* src_p, int src_row_bytes, uint8_t* dst_p,
                     px[x] = pixel >> (fb_bits_per_pixel
                             - (fb_bytes_per_pixel -x) * 8);
 
-                px += fb_bytes_per_pixel;
+            px += fb_bytes_per_pixel;
         }
 
         src_p += src_row_bytes;
@@ -17,8 +17,10 @@
 #define BLOCK_MANAGER_H
 
 #include <inttypes.h>
+#include <pthread.h>
 #include <lib/libmtd.h>
 #include <types.h>
+#include <block/mmc/mmc.h>
 
 #define BM_BLOCK_TYPE_MTD   "mtd"
 #define BM_BLOCK_TYPE_MTD_NAND "nand"
@@ -64,6 +66,10 @@ enum bm_operation_method {
         BM_OPERATION_METHOD_RANDOM,     \
     }
 
+/*
+ * A prepared operation belongs to the thread which issued prepare(), the
+ * erase/write/read/format/finish calls of that thread go through it
+ */
 struct bm_operate_prepare_info {
     pid_t tid;
     int64_t write_start;
@@ -73,9 +79,23 @@ struct bm_operate_prepare_info {
     void *context_handle;
 };
 
+/*
+ * Operations prepared by the threads of one block manager type, one per
+ * thread at most
+ */
+#define BM_PREPARED_MAX     8
+
+struct bm_prepared_table {
+    struct bm_operate_prepare_info info[BM_PREPARED_MAX];
+    pthread_mutex_t lock;
+};
+
+#define BM_PREPARED_TABLE_INITIALIZER { .lock = PTHREAD_MUTEX_INITIALIZER }
+
 struct bm_operation_option {
     int method;         /* one in block_operation_method*/
     char filetype[20];  /* one in BM_FILE_TYPE_INIT*/
+    int skip_erased;    /* read blocks first, leave the all 0xFF ones unerased */
 };
 
 struct bm_event {
@@ -91,6 +111,7 @@ typedef void (*bm_event_listener_t)(struct block_manager *bm,
 
 union bm_dev_info {
     struct mtd_dev_info mtd_dev_info;
+    struct mmc_dev_info mmc_dev_info;
 };
 struct bm_part_info {
     union bm_dev_info part;
@@ -98,17 +119,27 @@ struct bm_part_info {
     int fd;
     char path[16];
     int id;
+    int device;     /* physical device the partition lives on */
+    void *erase_ahead;  /* struct mtd_erase_ahead, see block/mtd/erase_ahead.h */
+    int erase_single;   /* the driver turned down a multi-block erase */
 };
 
 struct bm_mtd_info {
     libmtd_t mtd_desc;
     struct mtd_info mtd_info;
     void *map;
-    bm_event_listener_t event_listener;
+    pthread_mutex_t *device_lock;
+    int device_count;
+};
+
+struct bm_mmc_info {
+    struct mmc_info mmc_info;
+    pthread_mutex_t *device_lock;
 };
 
 union bm_info {
     struct bm_mtd_info mtd;
+    struct bm_mmc_info mmc;
 };
 
 struct block_manager {
@@ -127,17 +158,21 @@ struct block_manager {
     int (*chip_erase)(struct block_manager* this);
     int64_t (*erase)(struct block_manager* this, int64_t offset,
                      int64_t length);
+    int (*erase_ahead)(struct block_manager* this, int64_t offset,
+                       int64_t length, int window);
     int64_t (*write)(struct block_manager* this, int64_t offset,
                      char* buf, int64_t length);
     int64_t (*read)(struct block_manager* this, int64_t offset, char* buf,
                     int64_t length);
     int (*format)(struct block_manager* this);
+    int (*save_bad_block_table)(struct block_manager* this);
 
     uint32_t (*get_prepare_io_size)(struct block_manager* this);
     uint32_t (*get_prepare_leb_size)(struct block_manager* this);
     int64_t (*get_prepare_write_start)(struct block_manager* this);
     int64_t (*get_prepare_max_mapped_size)(struct block_manager* this);
     int64_t (*finish)(struct block_manager* this);
+    int (*sync)(struct block_manager* this);
 
     int64_t (*get_partition_size_by_offset)(struct block_manager* this,
                                             int64_t offset);
@@ -152,9 +187,12 @@ struct block_manager {
     int (*get_blocksize)(struct block_manager* this, int64_t offset);
     int (*get_iosize)(struct block_manager* this, int64_t offset);
     char* (*get_block_type)(struct block_manager* this, int64_t offset);
+    int (*get_device_id)(struct block_manager* this, int64_t offset);
+    pthread_mutex_t* (*get_device_lock)(struct block_manager* this,
+                                        int64_t offset);
     struct bm_operation_option operate_option;
-    struct bm_operate_prepare_info *prepared;
     union bm_info desc;
+    bm_event_listener_t event_listener;
     struct bm_part_info *part_info;
 #ifdef BM_SYSINFO_SUPPORT
     struct sysinfo_manager *sysinfo;
@@ -168,15 +206,17 @@ struct block_manager {
 #define BM_GET_MTD_DESC(bm) ((bm->desc.mtd.mtd_desc))
 #define BM_GET_MTD_INFO(bm) (&(bm->desc.mtd.mtd_info))
 #define BM_GET_MTD_BLOCK_MAP(bm, type) ((type**)(&bm->desc.mtd.map))
-#define BM_GET_LISTENER(bm) (bm->desc.mtd.event_listener)
+#define BM_GET_MMC_INFO(bm) (&(bm->desc.mmc.mmc_info))
+#define BM_GET_LISTENER(bm) (bm->event_listener)
 #define BM_GET_PARTINFO(bm) (bm->part_info)
 #define BM_GET_PARTINFO_START(bm, i) (bm->part_info[i].start)
 #define BM_GET_PARTINFO_FD(bm, i) (&(bm->part_info[i].fd))
 #define BM_GET_PARTINFO_PATH(bm, i) (bm->part_info[i].path)
 #define BM_GET_PARTINFO_ID(bm, i) (bm->part_info[i].id)
+#define BM_GET_PARTINFO_DEVICE(bm, i) (bm->part_info[i].device)
+#define BM_GET_DEVICE_LOCK(bm, i) (&(bm->desc.mtd.device_lock[i]))
 #define BM_GET_PARTINFO_MTD_DEV(bm, i)  (&(bm->part_info[i].part.mtd_dev_info))
-#define BM_GET_PREPARE_INFO(bm)   (bm->prepared)
-#define BM_GET_PREPARE_INFO_CONTEXT(bm) (bm->prepared->context_handle)
+#define BM_GET_PARTINFO_MMC_DEV(bm, i)  (&(bm->part_info[i].part.mmc_dev_info))
 
 void construct_block_manager(struct block_manager* this, const char *blockname,
                              bm_event_listener_t listener, void* param);
@@ -185,4 +225,9 @@ void destruct_block_manager(struct block_manager* this);
 int register_block_manager(struct block_manager *this);
 int unregister_block_manager(struct block_manager* this);
 
+struct bm_operate_prepare_info* bm_find_prepare_info(
+        struct bm_prepared_table *table, int alloc);
+void bm_drop_prepare_info(struct bm_prepared_table *table,
+        struct bm_operate_prepare_info *prepared);
+
 #endif /* block_manager_H */
@@ -19,6 +19,9 @@ enum {
     FS_FLAG_PAD,
     FS_FLAG_MARKBAD,
     FS_FLAG_NOSKIPBAD,
+    FS_FLAG_PAGEWRITE,
+    FS_FLAG_BLOCKERASE,
+    FS_FLAG_SKIPERASED,
 };
 
 #define FS_FLAG_BITS(N) (1<<FS_FLAG_##N)
@@ -41,6 +41,7 @@ struct ubi_params {
     int64_t layout_volume_start_eb;
     int64_t format_eb;
     char *outbuf;
+    char *blankbuf;
     struct ubi_mtd_device_info devinfo;
     struct ubigen_info *ui;
     struct ubi_scan_info *si;
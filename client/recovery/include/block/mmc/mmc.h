@@ -0,0 +1,47 @@
+#ifndef MMC_H
+#define MMC_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define MMC_DEFAULT_DEVICE  "/dev/mmcblk0"
+#define MMC_SYSFS_BLOCK     "/sys/class/block"
+
+#define MMC_SECTOR_SIZE     512             /* unit of sysfs start and size */
+#define MMC_DIRECT_ALIGN    4096            /* buffer alignment for O_DIRECT */
+#define MMC_IO_SIZE         (1024 * 1024)   /* prepared unit, one write */
+
+/*
+ * eMMC/SD block device
+ *
+ * The whole device is opened once, with O_DIRECT when the device takes
+ * it, and the partitions are addressed by their byte offset on it, as
+ * found in sysfs. A device without partitions is one partition, and so
+ * is a plain file standing in for the device in tests.
+ *
+ * There is nothing to erase before writing: erase discards the range,
+ * chip erase discards the whole device securely when it can. A plain
+ * file gets holes punched instead.
+ */
+struct mmc_dev_info {
+    char name[32];
+    int64_t size;
+};
+
+struct mmc_info {
+    char path[PATH_MAX];
+    int fd;
+    int is_file;
+    int direct;                     /* opened with O_DIRECT */
+    int discard;                    /* BLKDISCARD supported */
+    int part_cnt;
+    int64_t size;
+    uint32_t sector_size;           /* logical block size */
+    uint32_t io_size;
+    char *bounce;                   /* aligned, for unaligned requests */
+};
+
+int mmc_manager_set_device(const char *path);
+
+#endif /* MMC_H */
@@ -0,0 +1,47 @@
+#ifndef ERASE_AHEAD_H
+#define ERASE_AHEAD_H
+
+#include <pthread.h>
+
+/*
+ * Erase-ahead
+ *
+ * Instead of erasing a whole range before the first write, a worker
+ * thread keeps a window of good blocks erased in front of the write
+ * cursor of the partition, skipping and marking bad blocks as it goes.
+ * A write that gets in front of the worker erases what it needs itself,
+ * so a block is never erased once written.
+ *
+ * When the operation is finished, whatever is left of the range is
+ * erased in the background, until mtd_erase_ahead_sync() is called.
+ *
+ * The worker and the writer both erase under the device lock, the range
+ * state is only moved forward with that lock held.
+ */
+struct mtd_erase_ahead {
+    struct block_manager *bm;
+    struct filesystem *fs;      /* instance of the worker */
+    struct mtd_dev_info *mtd;
+    pthread_mutex_t *device_lock;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int64_t start;
+    int64_t blocks;             /* good blocks the range has to hold */
+    int64_t next;               /* first block not erased yet */
+    int64_t end;                /* moves on as blocks turn bad */
+    int64_t cursor;             /* block the writer is at */
+    int window;                 /* good blocks kept erased ahead */
+    int tail;                   /* operation over, erase the rest */
+    int error;
+};
+
+int mtd_erase_ahead_start(struct block_manager *bm, struct filesystem *fs,
+                          pthread_mutex_t *device_lock, int64_t offset,
+                          int64_t length, int window);
+int mtd_erase_ahead_ensure(struct filesystem *fs, int64_t offset);
+void mtd_erase_ahead_detach(struct filesystem *fs);
+int mtd_erase_ahead_sync(struct block_manager *bm);
+
+#endif /* ERASE_AHEAD_H */
@@ -4,21 +4,52 @@
 #define MTD_OPEN_DEBUG
 #define MTD_CHAR_HEAD "/dev/mtd"
 
+/*
+ * Eraseblock states, two bits each in the block map
+ */
 enum {
-    MTD_BLK_PREFIX = 0x5A5A5A00,
+    MTD_BLK_UNKNOWN,
     MTD_BLK_SCAN,
     MTD_BLK_BAD,
     MTD_BLK_ERASED,
-    MTD_BLK_WRITEN,
 };
 
+#define MTD_BLK_STATE_BITS      2
+#define MTD_BLK_PER_BYTE        (8 / MTD_BLK_STATE_BITS)
+
 struct mtd_block_map {
     char *name;
-    unsigned int *es;
+    uint8_t *es;
     int64_t eb_start;
     int64_t eb_cnt;
     int64_t bad_cnt;
     int write_eio;
+    uint32_t eb_size;
+    uint32_t generation;    /* of the bad block table it was loaded from */
+    int dirty;              /* bad or scanned blocks differ from that table */
+};
+
+#define MTD_BBT_MAGIC       0x54424244  /* "DBBT" */
+
+/*
+ * Bad block table cache
+ *
+ * The scanned and bad states of the block map are kept in the sysinfo
+ * flag area across updates, so the next update only asks the driver
+ * about the blocks the table does not cover. Erased blocks are stored
+ * as scanned: the system writes them after the update.
+ *
+ * The table is dropped when the geometry changes or when the bad block
+ * count reported by the kernel differs from the one it was saved with.
+ */
+struct mtd_bad_block_table {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t eb_size;
+    uint32_t eb_cnt;        /* blocks covered by map */
+    uint32_t kernel_bad;    /* sum of ECCGETSTATS badblocks */
+    uint32_t crc;           /* header up to crc, then map */
+    uint8_t map[];
 };
 
 struct mtd_part_char {
@@ -28,6 +59,7 @@ struct mtd_part_char {
 
 void set_process_info(struct filesystem *fs, int type, int64_t eboff, int64_t ebcnt);
 int mtd_bm_block_map_set(struct filesystem *fs, int64_t eb, int status);
+int mtd_bm_block_map_is_known_bad(struct filesystem *fs, int64_t eb);
 int mtd_type_is_nand(struct mtd_dev_info *mtd);
 int mtd_type_is_mlc_nand(struct mtd_dev_info *mtd);
 int mtd_type_is_nor(struct mtd_dev_info *mtd);
@@ -35,7 +67,10 @@ int mtd_is_block_scaned(struct block_manager* this, int64_t offset);
 void mtd_scan_dump(struct filesystem *fs);
 int64_t mtd_block_scan(struct filesystem *fs);
 int mtd_basic_chiperase_preset(struct filesystem *fs);
+int mtd_block_is_blank(libmtd_t mtd_desc, struct mtd_dev_info *mtd, int fd,
+                       int64_t eb, void *buf);
 void mtd_bm_block_map_destroy(struct block_manager *bm) ;
+int mtd_bm_block_map_save(struct block_manager *bm);
 int64_t mtd_basic_erase(struct filesystem *fs);
 int64_t mtd_basic_write(struct filesystem *fs);
 int64_t mtd_basic_read(struct filesystem *fs);
@@ -46,6 +81,9 @@ struct mtd_dev_info* mtd_get_dev_info_by_offset(struct block_manager* this,
 #define MTD_DEV_INFO_TO_START(mtd)  container_of(mtd, struct bm_part_info, part.mtd_dev_info)->start
 #define MTD_DEV_INFO_TO_ID(mtd)     container_of(mtd, struct bm_part_info, part.mtd_dev_info)->id
 #define MTD_DEV_INFO_TO_PATH(mtd)     container_of(mtd, struct bm_part_info, part.mtd_dev_info)->path
+#define MTD_DEV_INFO_TO_DEVICE(mtd)   container_of(mtd, struct bm_part_info, part.mtd_dev_info)->device
+#define MTD_DEV_INFO_TO_ERASE_AHEAD(mtd)   container_of(mtd, struct bm_part_info, part.mtd_dev_info)->erase_ahead
+#define MTD_DEV_INFO_TO_ERASE_SINGLE(mtd)  container_of(mtd, struct bm_part_info, part.mtd_dev_info)->erase_single
 #define MTD_OFFSET_TO_EB_INDEX(mtd, off)   ((off)/mtd->eb_size)
 #define MTD_IS_BLOCK_ALIGNED(mtd, off)  (((off)&(~mtd->eb_size + 1)) == (off))
 #define MTD_BLOCK_ALIGN(mtd, off)   ((off)&(~mtd->eb_size + 1))
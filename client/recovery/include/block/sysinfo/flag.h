@@ -3,6 +3,8 @@
 
 enum sysinfo_flag_id {
     SYSINFO_FLAG_ID_UPDATE_DONE,   //0x3c00: flash parameters and partition infomation is stored in
+    SYSINFO_FLAG_ID_UPDATE_JOURNAL,   //update journal without a partition of its own, see ota/update_journal.h
+    SYSINFO_FLAG_ID_BAD_BLOCK_TABLE,  //bad block table cache, see block/mtd/mtd.h
 };
 
 struct sysinfo_flag_layout {
@@ -15,6 +17,10 @@ struct sysinfo_flag_layout {
 #define SYSINFO_FLAG_UPDATE_DONE_SIZE             4
 #define SYSINFO_FLAG_VALUE_UPDATE_START         0x5A5A5A5A
 #define SYSINFO_FLAG_VALUE_UPDATE_DONE          0xA5A5A5A5
+#define SYSINFO_FLAG_UPDATE_JOURNAL_OFFSET     0x10
+#define SYSINFO_FLAG_UPDATE_JOURNAL_SIZE          0x40
+#define SYSINFO_FLAG_BAD_BLOCK_TABLE_OFFSET    0x60
+#define SYSINFO_FLAG_BAD_BLOCK_TABLE_SIZE         0x3a0
 
 struct sysinfo_flag {
     int64_t (*get_size)(int id);
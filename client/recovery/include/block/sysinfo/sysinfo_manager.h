@@ -40,6 +40,7 @@ struct sysinfo_manager {
     int (*set_reserve)(struct sysinfo_manager *this, int id, int reserve);
     int (*traversal_save)(struct sysinfo_manager *this, int64_t offset, int64_t length);
     int (*traversal_merge)(struct sysinfo_manager *this, char *buf, int64_t offset, int64_t length);
+    int (*traversal_reserved)(struct sysinfo_manager *this, int64_t offset, int64_t length);
     int (*init)(struct sysinfo_manager *this);
     int (*exit)(struct sysinfo_manager *this);
     void *binder;
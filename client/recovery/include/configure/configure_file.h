@@ -25,6 +25,18 @@ struct configure_file {
     char *version;
     char *server_ip;
     char *server_url;
+    int update_stream;
+    int prefetch_depth;     /* chunks fetched ahead of the writer, 0 = off */
+    int prefetch_memory;    /* KB the prefetched chunks may pin, 0 = auto */
+    int connections;        /* parallel connections per download, 0 = 1 */
+    int compare_skip;       /* leave erase blocks already up to date alone */
+    int parallel_flash;     /* one writer per flash device at once */
+    int stats_to_storage;   /* copy the update statistics to the volume */
+    int skip_erased;        /* read blocks before erasing, skip the blank ones */
+    int erase_ahead;        /* blocks erased in front of the writer, 0 = off */
+    int verify_readback;    /* read each chunk back against its hash tree */
+    int hash_offload;       /* HASH_MASK()s hashed by the kernel crypto API */
+    char *journal_part;     /* partition of the update journal */
 };
 
 void construct_configure_file(struct configure_file* this);
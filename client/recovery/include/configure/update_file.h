@@ -19,9 +19,20 @@
 
 #include <limits.h>
 #include <utils/list.h>
+#include <utils/hashtree.h>
 
 #define UPDATE_MODE_FULL    0x200
 #define UPDATE_MODE_CHUNK   0x201
+#define UPDATE_MODE_DELTA   0x202
+
+/*
+ * How much of its partition a normal image erases
+ */
+#define IMAGE_ERASE_PARTITION   0   /* all of it before writing */
+#define IMAGE_ERASE_DEFERRED    1   /* the image, the rest at the very end */
+#define IMAGE_ERASE_IMAGE       2   /* the image only */
+
+#define IMAGE_SHA1_STR_LEN  40
 
 
 struct image_info {
@@ -32,6 +43,11 @@ struct image_info {
     uint32_t update_mode;
     uint32_t chunksize;
     uint32_t chunkcount;
+    uint64_t src_size;      /* image the delta applies to */
+    char src_sha1[IMAGE_SHA1_STR_LEN + 1];
+    uint32_t erase;         /* IMAGE_ERASE_* */
+    char hashtree_root[HASHTREE_ROOT_STR_LEN + 1];  /* empty without one */
+    struct hashtree hashtree;   /* loaded from update000, see hashtree.h */
     struct list_head head;
     struct list_head head_part;
 };
@@ -37,6 +37,7 @@ typedef void * libmtd_t;
 
 /* Forward decls */
 struct region_info_user;
+struct mtd_ecc_stats;
 
 /**
  * @mtd_dev_cnt: count of MTD devices in system
@@ -185,6 +186,21 @@ int mtd_unlock(const struct mtd_dev_info *mtd, int fd, int eb);
  */
 int mtd_erase(libmtd_t desc, const struct mtd_dev_info *mtd, int fd, int eb);
 
+/**
+ * mtd_erase_multi - erase multiple eraseblocks.
+ * @desc: MTD library descriptor
+ * @mtd: MTD device description object
+ * @fd: MTD device node file descriptor
+ * @eb: index of first eraseblock to erase
+ * @blocks: number of eraseblocks to erase
+ *
+ * This function erases @blocks eraseblocks of MTD device described by @fd,
+ * starting at eraseblock @eb, in a single request. Returns %0 in case of
+ * success and %-1 in case of failure.
+ */
+int mtd_erase_multi(libmtd_t desc, const struct mtd_dev_info *mtd, int fd,
+		    int eb, int blocks);
+
 /**
  * mtd_regioninfo - get information about an erase region.
  * @fd: MTD device node file descriptor
@@ -345,6 +361,30 @@ int mtd_write_img(const struct mtd_dev_info *mtd, int fd, int eb, int offs,
  */
 int mtd_probe_node(libmtd_t desc, const char *node);
 
+/**
+ * mtd_dev_open - open the device node of an MTD device.
+ * @desc: MTD library descriptor
+ * @mtd: MTD device description object
+ * @flags: flags for open(2)
+ *
+ * This function opens the character device node of @mtd and returns its
+ * file descriptor, or %-1 in case of failure.
+ */
+int mtd_dev_open(libmtd_t desc, const struct mtd_dev_info *mtd, int flags);
+
+/**
+ * mtd_get_ecc_stats - get ECC statistics of an MTD device.
+ * @mtd: MTD device description object
+ * @fd: MTD device node file descriptor
+ * @stats: the statistics are returned here
+ *
+ * This function gets the corrected and failed ECC counts and the number of
+ * bad eraseblocks of @mtd. Returns %0 in case of success and %-1 in case of
+ * failure.
+ */
+int mtd_get_ecc_stats(const struct mtd_dev_info *mtd, int fd,
+		      struct mtd_ecc_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,126 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef LIBMTD_EMU_H
+#define LIBMTD_EMU_H
+
+#include <limits.h>
+
+/*
+ * File-backed MTD emulator
+ *
+ * lib/mtd/libmtd_emu.o stands in for libmtd.o and libmtd_legacy.o: it
+ * implements the libmtd API on top of a sparse data file and an OOB
+ * sidecar file (<image>.oob), so that the block manager and filesystem
+ * writers run on a host without any flash.
+ *
+ * Bytes are stored inverted, so that a hole reads back as erased 0xff
+ * and an erase is a punched hole. Programming ANDs the new data into the
+ * page like a real flash does, the bad block marker is the first OOB
+ * byte of the first page of a block, and a bad block refuses to erase.
+ * Data programs also store an ECC in the tail of each page's OOB, which
+ * is never all 0xff, not even for a page of 0xff.
+ *
+ * Operations go one at a time, like on a single chip, each taking the
+ * latency configured for it.
+ *
+ * Without mtd_emu_setup(), libmtd_open() sets the emulator up from the
+ * MTD_EMU environment variable, words like
+ *
+ *   MTD_EMU="type=nand size=64M eb=128K page=2K oob=64
+ *            parts=1M(boot),4M(kernel),-(rootfs) bad=17,300
+ *            latency=25,250,2000 image=/tmp/mtd_emu.img"
+ *
+ * or from the defaults of mtd_emu_default_config().
+ *
+ * mtd_emu_set_power_cut() cuts the power in the middle of a program or
+ * erase to come: half of the page is programmed or half of the block
+ * erased, the callback is told with the chip lock held and every
+ * operation fails with EIO from then on, until the next mtd_emu_setup().
+ * A callback ending the process there leaves the image as a power cut
+ * would.
+ */
+
+#define MTD_EMU_MAX_PARTS   16
+#define MTD_EMU_MAX_BAD     64
+#define MTD_EMU_MAX_FAULTS  16
+
+enum mtd_emu_op {
+    MTD_EMU_OP_READ = 0,
+    MTD_EMU_OP_PROGRAM,
+    MTD_EMU_OP_ERASE,
+    MTD_EMU_OP_MAX,
+};
+
+struct mtd_emu_part {
+    char name[32];
+    long long size;             /* 0: up to the end of the chip */
+};
+
+struct mtd_emu_config {
+    char image[PATH_MAX];
+    int type;                   /* MTD_NANDFLASH, MTD_MLCNANDFLASH or MTD_NORFLASH */
+    long long size;
+    int eb_size;
+    int page_size;
+    int subpage_size;
+    int oob_size;
+    int part_cnt;
+    struct mtd_emu_part parts[MTD_EMU_MAX_PARTS];
+    int bad_cnt;
+    int bad[MTD_EMU_MAX_BAD];   /* factory bad blocks of the chip */
+    int latency_us[MTD_EMU_OP_MAX]; /* per page read/program, per block erase */
+};
+
+/*
+ * Fails the operations of a kind, on one block of the chip or any
+ */
+struct mtd_emu_fault {
+    int op;                     /* enum mtd_emu_op */
+    int eb;                     /* eraseblock of the chip, -1 for any */
+    long long skip;             /* matching operations let through first */
+    int count;                  /* failures, -1 for ever */
+    int error;                  /* EIO, or EBADMSG/EUCLEAN on read */
+};
+
+struct mtd_emu_stats {
+    long long ops[MTD_EMU_OP_MAX];
+    long long bytes[MTD_EMU_OP_MAX];
+    long long faults;
+    long long marked_bad;
+    long long reprograms;       /* pages programmed again without an erase */
+    long long busy_ns;          /* latency modelled */
+};
+
+typedef void (*mtd_emu_power_cut_t)(const struct mtd_emu_stats *stats);
+
+void mtd_emu_default_config(struct mtd_emu_config *cfg);
+int mtd_emu_parse_config(struct mtd_emu_config *cfg, const char *spec);
+int mtd_emu_setup(const struct mtd_emu_config *cfg);
+void mtd_emu_teardown(void);
+
+int mtd_emu_add_fault(const struct mtd_emu_fault *fault);
+void mtd_emu_clear_faults(void);
+
+/*
+ * after counts programs (OOB ones too) and erased blocks, 0 for no cut
+ */
+void mtd_emu_set_power_cut(long long after, mtd_emu_power_cut_t cut);
+
+void mtd_emu_get_stats(struct mtd_emu_stats *stats);
+void mtd_emu_reset_stats(void);
+
+#endif /* LIBMTD_EMU_H */
@@ -32,6 +32,7 @@ extern "C" {
 
 #define SYSFS_MTD        "class/mtd"
 #define MTD_NAME_PATT    "mtd%d"
+#define MTD_DEV_NODE_PATT "/dev/mtd%d"
 #define MTD_DEV          "dev"
 #define MTD_NAME         "name"
 #define MTD_TYPE         "type"
@@ -45,10 +45,16 @@ typedef struct RSAPublicKey {
     int exponent;             /* 3 or 65537 */
 } RSAPublicKey;
 
+/*
+ * Verifies a PKCS1.5 signature of len bytes against hash, hash_len bytes
+ * long: SHA_DIGEST_SIZE for SHA-1, SHA256_DIGEST_SIZE for SHA-256.
+ * Returns 0 on failure, 1 on success.
+ */
 int RSA_verify(const RSAPublicKey *key,
                const uint8_t* signature,
                const int len,
-               const uint8_t* sha);
+               const uint8_t* hash,
+               const int hash_len);
 
 #ifdef __cplusplus
 }
@@ -37,14 +37,7 @@ extern "C" {
 typedef struct SHA_CTX {
     uint64_t count;
     uint32_t state[5];
-#if defined(HAVE_ENDIAN_H) && defined(HAVE_LITTLE_ENDIAN)
-    union {
-        uint8_t b[64];
-        uint32_t w[16];
-    } buf;
-#else
     uint8_t buf[64];
-#endif
 } SHA_CTX;
 
 void SHA_init(SHA_CTX* ctx);
@@ -0,0 +1,105 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef HTTP_CLIENT_H
+#define HTTP_CLIENT_H
+
+#include <types.h>
+
+#define HTTP_DEFAULT_TIMEOUT_MS     (120 * 1000)
+#define HTTP_DEFAULT_RETRIES        5
+#define HTTP_DEFAULT_BACKOFF_MS     500
+#define HTTP_MAX_BACKOFF_MS         (16 * 1000)
+
+#define HTTP_MAX_REDIRECTS          5
+
+#define HTTP_HOST_MAX               128
+#define HTTP_URL_MAX                1024
+#define HTTP_BUFFER_SIZE            (16 * 1024)
+
+/*
+ * Receives body bytes in order, returns -1 to abort the transfer
+ */
+typedef int (*http_data_cb_t)(const void* buf, uint32_t len, void* param);
+
+struct http_response {
+    int status;
+    int64_t content_length;     /* -1 if unknown */
+    int64_t range_start;        /* first byte carried by a 206 response */
+    int64_t total_length;       /* whole resource size, -1 if unknown */
+    int accept_ranges;
+    int chunked;
+    int keep_alive;
+};
+
+struct http_stats {
+    uint32_t requests;
+    uint32_t connects;
+    uint32_t retries;
+    uint32_t resumes;
+    uint64_t bytes;
+};
+
+/*
+ * Minimal HTTP/1.1 client
+ *
+ * One persistent connection per instance, reused for as long as the
+ * requests go to the same host and the server keeps it open. Failed
+ * transfers are retried with exponential backoff and resumed with a
+ * Range request from the last byte handed to the callback, falling back
+ * to skipping the already delivered bytes when the server ignores the
+ * range. 301/302/303/307/308 responses are followed up to
+ * HTTP_MAX_REDIRECTS hops.
+ */
+struct http_client {
+    void (*construct)(struct http_client* this);
+    void (*destruct)(struct http_client* this);
+    void (*set_timeout)(struct http_client* this, int timeout_ms);
+    void (*set_retry)(struct http_client* this, int retries, int backoff_ms);
+    int (*head)(struct http_client* this, const char* url,
+            struct http_response* response);
+    int (*get)(struct http_client* this, const char* url, int64_t offset,
+            int64_t length, http_data_cb_t cb, void* param);
+    int (*download)(struct http_client* this, const char* url,
+            const char* path);
+    void (*disconnect)(struct http_client* this);
+
+    int socket;
+    char host[HTTP_HOST_MAX];
+    int port;
+    int timeout_ms;
+    int retries;
+    int backoff_ms;
+
+    char* buffer;
+    uint32_t buffer_pos;
+    uint32_t buffer_len;
+
+    struct http_response response;  /* of the last request */
+    char location[HTTP_URL_MAX];    /* redirect target of the last request */
+    struct http_stats stats;
+};
+
+void construct_http_client(struct http_client* this);
+void destruct_http_client(struct http_client* this);
+
+/*
+ * http_data_cb_t writing the body to the file descriptor pointed to
+ * by param
+ */
+int http_write_fd_cb(const void* buf, uint32_t len, void* param);
+
+#endif /* HTTP_CLIENT_H */
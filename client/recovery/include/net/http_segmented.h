@@ -0,0 +1,69 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+
+#ifndef HTTP_SEGMENTED_H
+#define HTTP_SEGMENTED_H
+
+#include <pthread.h>
+#include <types.h>
+#include <net/http_client.h>
+
+#define HTTP_SEGMENTED_MAX_CONNECTIONS  16
+#define HTTP_SEGMENT_MIN_SIZE           (256 * 1024)
+#define HTTP_SEGMENT_MAX_SIZE           (4 * 1024 * 1024)
+
+struct http_segment;
+
+/*
+ * Multi-connection downloader
+ *
+ * A resource is split in byte ranges which are fetched on up to
+ * "connections" parallel keep-alive connections, one http_client per
+ * connection, and handed to the callback strictly in order. Each
+ * connection owns one segment buffer, so at most "connections" segments
+ * are held in memory at a time. When the server does not answer a range
+ * request with 206, or the resource is too small to be worth splitting,
+ * the download falls back to a single plain GET.
+ */
+struct http_segmented {
+    void (*construct)(struct http_segmented* this);
+    void (*destruct)(struct http_segmented* this);
+    void (*set_connections)(struct http_segmented* this, int connections);
+    int (*get)(struct http_segmented* this, const char* url,
+            http_data_cb_t cb, void* param);
+    int (*download)(struct http_segmented* this, const char* url,
+            const char* path);
+    void (*get_stats)(struct http_segmented* this, struct http_stats* stats);
+
+    int connections;
+    struct http_client* clients[HTTP_SEGMENTED_MAX_CONNECTIONS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct http_segment* segments;
+    const char* url;
+    int64_t total;
+    uint32_t segment_size;
+    uint32_t segment_count;
+    uint32_t next_segment;
+    int error;
+};
+
+void construct_http_segmented(struct http_segmented* this);
+void destruct_http_segmented(struct http_segmented* this);
+
+#endif /* HTTP_SEGMENTED_H */
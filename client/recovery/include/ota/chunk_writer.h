@@ -0,0 +1,140 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef CHUNK_WRITER_H
+#define CHUNK_WRITER_H
+
+#include <pthread.h>
+
+#include <types.h>
+#include <utils/list.h>
+#include <utils/delta_patch.h>
+#include <ota/update_journal.h>
+
+enum update_wbuffer_alloc_size_method{
+    UPDATE_WBUFFER_ALLOWABLE_MINIMUM_SIZE,
+    UPDATE_WBUFFER_FIXED_WITH_CHUCK_SIZE,
+};
+
+struct configure_file;
+struct block_manager;
+struct part_info;
+struct image_info;
+struct hashtree;
+struct chunk_writer;
+
+/*
+ * What the writers of one update share: the journal, saved under its
+ * lock, and the partition tails raw images leave to be erased once
+ * everything is written
+ */
+struct flash_session {
+    struct configure_file* cf;
+    struct update_journal journal;
+    struct update_journal_store journal_store;
+    pthread_mutex_t journal_lock;
+    struct list_head deferred_erase_list;
+    pthread_mutex_t deferred_erase_lock;
+};
+
+void flash_session_init(struct flash_session* s, struct configure_file* cf);
+void flash_session_destroy(struct flash_session* s);
+int flash_session_erase_deferred(struct flash_session* s, int drop);
+
+/*
+ * Old image a delta image is rebuilt from, a few of its blocks cached
+ */
+#define DELTA_CACHE_BLOCKS      4
+
+struct delta_block {
+    int64_t index;          /* old block held, -1 when free */
+    int pinned;             /* its flash copy may be gone */
+    uint32_t stamp;
+    char* data;
+};
+
+struct delta_source {
+    struct block_manager* bm;
+    int64_t* map;           /* physical offset of each old block */
+    uint32_t count;
+    uint32_t block_size;
+    uint64_t size;
+    int64_t written_end;    /* flash below holds new data */
+    uint32_t stamp;
+    struct delta_block cache[DELTA_CACHE_BLOCKS];
+};
+
+/*
+ * What one writing thread keeps across the chunks of a partition, devices
+ * flashed in parallel each have their own. The buffers are released once
+ * the last chunk of a partition is written, or when a chunk fails.
+ *
+ * A chunk is committed to the journal of the session, unless commit is
+ * set to take it instead.
+ */
+struct flash_context {
+    struct flash_session* session;
+    int (*commit)(struct chunk_writer* w, void* param);
+    void* commit_param;
+    char* write_buffer;
+    uint32_t write_buffer_size;
+    uint32_t write_media_leap;
+    int64_t next_write_offset;
+    struct delta_source delta_source;
+    int compare_skip;
+    char* compare_buffer;
+    uint32_t blocks_skipped;
+    uint32_t blocks_written;
+};
+
+void flash_context_init(struct flash_context* ctx,
+        struct flash_session* session);
+void flash_context_destroy(struct flash_context* ctx);
+
+/*
+ * Chunk writer
+ *
+ * Accumulates the data of one image chunk into the write buffer of its
+ * context and hands it to the block manager one write buffer at a time,
+ * whatever the data source is (an unzipped file or a streamed package).
+ */
+struct chunk_writer {
+    struct flash_context* ctx;
+    struct block_manager* bm;
+    struct part_info* part_info;
+    struct image_info* image_info;
+    uint32_t chunk_index;
+    uint32_t package;
+    int64_t cur_write_offset;
+    int64_t start_offset;   /* where the chunk went, for the readback */
+    uint32_t fill;
+    uint32_t total;
+    int is_delta;
+    struct delta_patch delta;
+    const struct hashtree* hashtree;    /* NULL when its leaves are unused */
+};
+
+uint32_t get_chunk_size(struct image_info* image_info, uint32_t chunk_index);
+int chunk_writer_begin(struct chunk_writer* w, struct flash_context* ctx,
+        struct block_manager* bm, struct part_info* part_info,
+        struct image_info* image_info, uint32_t chunk_index,
+        uint32_t package);
+int chunk_writer_flush(struct chunk_writer* w);
+int chunk_writer_feed(struct chunk_writer* w, const void* buf, uint32_t len);
+int chunk_writer_end(struct chunk_writer* w);
+void chunk_writer_abort(struct chunk_writer* w);
+
+#endif /* CHUNK_WRITER_H */
@@ -26,11 +26,6 @@
 #include <net/net_interface.h>
 #include <graphics/gui.h>
 
-enum update_wbuffer_alloc_size_method{
-    UPDATE_WBUFFER_ALLOWABLE_MINIMUM_SIZE,
-    UPDATE_WBUFFER_FIXED_WITH_CHUCK_SIZE,
-};
-
 struct storage_dev {
     char name[64];
     char dev_name[64];
@@ -45,8 +40,10 @@ struct ota_manager {
     int (*stop)(struct ota_manager* this);
     void (*load_configure)(struct ota_manager* this, struct configure_file* cf);
     void (*load_signal_handler)(struct ota_manager* this, struct signal_handler* sh);
+    int (*update_from_network)(struct ota_manager* this);
     struct netlink_handler* nh;
     struct block_manager* mtd_bm;
+    struct block_manager* mmc_bm;
     struct mount_manager* mm;
     struct configure_file* cf;
     struct signal_handler* sh;
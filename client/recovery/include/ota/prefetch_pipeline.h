@@ -0,0 +1,84 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef PREFETCH_PIPELINE_H
+#define PREFETCH_PIPELINE_H
+
+#include <types.h>
+#include <utils/list.h>
+#include <utils/blocking_queue.h>
+#include <ota/chunk_writer.h>
+
+struct prefetch_job {
+    struct list_head head;
+    struct part_info* part_info;
+    struct image_info* image_info;
+    uint32_t chunk_index;
+    uint32_t package;
+    uint32_t size;      /* reserved for data */
+    uint32_t length;
+    char* data;
+    char* source;
+    int device;         /* physical device the partition lives on */
+    int last_in_part;
+    int done;
+    int64_t write_end;
+};
+
+/*
+ * Fetches, verifies and inflates the chunk of a job into its data, which
+ * holds job->size bytes. Sets job->length to what it got.
+ */
+typedef int (*prefetch_fetch_cb_t)(struct prefetch_job* job, void* param);
+
+struct flash_scheduler;
+
+/*
+ * Prefetch pipeline
+ *
+ * A fetcher thread fetches the chunks of the jobs into memory in package
+ * order while the calling thread programs the previous ones, so the
+ * update takes about max(fetch, flash) rather than their sum. Chunks are
+ * verified before they are queued, the number of chunks ahead of the
+ * writer is bounded by Update.prefetch_depth and the memory they pin by
+ * max_weight.
+ *
+ * With Update.parallel_flash set, the jobs are split by device and each
+ * device gets a pipeline and a flash context of its own.
+ */
+struct prefetch_pipeline {
+    struct flash_session* session;
+    struct block_manager* bm;
+    prefetch_fetch_cb_t fetch;
+    void* param;
+    struct prefetch_job* jobs;
+    uint32_t job_count;
+    uint64_t max_weight;
+
+    /*
+     * Set up by prefetch_pipeline_run()
+     */
+    struct flash_scheduler* scheduler;
+    struct flash_context ctx;
+    struct blocking_queue queue;
+    int device;         /* the one device the jobs are taken for, -1 = all */
+    uint32_t device_jobs;
+    int error;
+};
+
+int prefetch_pipeline_run(struct prefetch_pipeline* pipeline);
+
+#endif /* PREFETCH_PIPELINE_H */
@@ -0,0 +1,106 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+
+#ifndef UPDATE_JOURNAL_H
+#define UPDATE_JOURNAL_H
+
+#include <types.h>
+
+#define UPDATE_JOURNAL_MAGIC        0x4c4e524a  /* "JRNL" */
+#define UPDATE_JOURNAL_MAX_DEVICES  4
+
+/*
+ * Update progress journal
+ *
+ * Saved after every package that has been durably programmed, so an
+ * update interrupted by a power cut picks up after the last committed
+ * package instead of starting over.
+ * Each device type is identified by the checksum of its update000.zip,
+ * a journal left by a different package is ignored.
+ *
+ * Raw partitions are resumed at the write offset recorded after the last
+ * committed package; partitions that cannot be continued half way (ubifs)
+ * are only committed once complete, so they restart from their first
+ * package.
+ */
+struct update_journal {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t device;            /* index in the device type list */
+    uint32_t package;           /* last committed package, 0 = none */
+    uint32_t fingerprint[UPDATE_JOURNAL_MAX_DEVICES];
+    int64_t part_offset;        /* partition of the last committed package */
+    int64_t write_offset;       /* next write offset in that partition */
+    uint32_t crc;
+    uint32_t reserved;
+};
+
+void update_journal_reset(struct update_journal* j);
+int update_journal_load(struct update_journal* j, const void* buf);
+void update_journal_begin_device(struct update_journal* j, uint32_t device,
+        uint32_t fingerprint);
+int update_journal_is_done(struct update_journal* j, uint32_t device,
+        uint32_t package);
+int update_journal_resume_offset(struct update_journal* j, uint32_t package,
+        int64_t part_offset, int64_t* offset);
+void update_journal_commit(struct update_journal* j, uint32_t package,
+        int64_t part_offset, int64_t write_offset);
+int update_journal_is_resumable(const char* fs_type);
+int update_journal_fingerprint(const char* path, uint32_t* fingerprint);
+
+struct block_manager;
+
+/*
+ * Where the journal is saved
+ *
+ * In a partition of its own (Update.journal_part), away from the boot
+ * loader: each save appends a record, one page with a sequence number
+ * and a CRC, to the first of two erase blocks. A full block stays as it
+ * is until the other one, erased, holds the next record, so a power cut
+ * at any point leaves the last complete record readable, and a block
+ * only gets erased once every so many saves.
+ *
+ * Without that partition the journal falls back on its sysinfo flag
+ * slot, rewritten with the whole first block of the chip, and is then
+ * saved at partition boundaries only.
+ */
+struct update_journal_store {
+    struct block_manager* bm;
+    int part;                   /* journal partition, -1 for the flag slot */
+    int eb[2];                  /* its two erase blocks */
+    int cur;                    /* the one holding the last record */
+    int slot;                   /* next free record in it */
+    int slots;                  /* records per erase block */
+    int slot_size;
+    uint32_t sequence;          /* of the last record */
+    char* buf;
+};
+
+int update_journal_store_open(struct update_journal_store* s,
+        struct block_manager* bm, const char* part_name);
+void update_journal_store_close(struct update_journal_store* s);
+int update_journal_store_load(struct update_journal_store* s,
+        struct update_journal* j);
+int update_journal_store_save(struct update_journal_store* s,
+        struct update_journal* j);
+int update_journal_restore(struct update_journal_store* s,
+        struct update_journal* j, int interrupted);
+int update_journal_commit_package(struct update_journal_store* s,
+        struct update_journal* j, uint32_t package, int64_t part_offset,
+        int64_t write_offset, int last_in_part, int resumable);
+
+#endif /* UPDATE_JOURNAL_H */
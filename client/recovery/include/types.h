@@ -19,6 +19,15 @@
 
 #include <stdbool.h>
 
+#ifdef HOST_BUILD
+/*
+ * The typedefs below are those of the 32-bit target, a host has its own
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/types.h>
+#else
 typedef __signed__ char __s8;
 typedef unsigned char __u8;
 
@@ -46,6 +55,7 @@ typedef     __u32       uint32_t;
 typedef     __u64       uint64_t;
 
 typedef unsigned int        size_t;
+#endif /* HOST_BUILD */
 
 struct list_head {
     struct list_head *next, *prev;
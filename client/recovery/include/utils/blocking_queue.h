@@ -0,0 +1,57 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef BLOCKING_QUEUE_H
+#define BLOCKING_QUEUE_H
+
+#include <pthread.h>
+
+#include <types.h>
+#include <utils/list.h>
+
+/*
+ * Bounded single producer/single consumer queue
+ *
+ * The producer reserves a slot and its memory weight before it starts to
+ * build an item, so both the number of items ahead of the consumer and
+ * the memory they pin are bounded. The weight is given back by the
+ * consumer once it is done with the item, a single item is always
+ * admitted when nothing else is in flight so an oversized item can not
+ * dead lock the pipeline.
+ */
+struct blocking_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct list_head list;
+    uint32_t depth;
+    uint32_t slots;
+    uint64_t max_weight;
+    uint64_t weight;
+    int closed;
+    int aborted;
+};
+
+void blocking_queue_init(struct blocking_queue* q, uint32_t depth,
+        uint64_t max_weight);
+void blocking_queue_destroy(struct blocking_queue* q);
+int blocking_queue_reserve(struct blocking_queue* q, uint64_t weight);
+void blocking_queue_push(struct blocking_queue* q, struct list_head* item);
+struct list_head* blocking_queue_pop(struct blocking_queue* q);
+void blocking_queue_release(struct blocking_queue* q, uint64_t weight);
+void blocking_queue_close(struct blocking_queue* q);
+void blocking_queue_abort(struct blocking_queue* q);
+
+#endif /* BLOCKING_QUEUE_H */
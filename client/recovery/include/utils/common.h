@@ -57,11 +57,21 @@ enum system_platform_t {
 
 extern const char* public_key_path;
 
+#define DOWNLOAD_STREAM_BUFSIZE (64 * 1024)
+
+/*
+ * Receives downloaded bytes in order, returns -1 to abort the transfer
+ */
+typedef int (*download_cb_t)(const void* buf, uint32_t len, void* param);
+
 void msleep(uint64_t msec);
+void set_download_connections(int connections);
 int download_file(const char* file, const char* path);
+int download_file_stream(const char* file, download_cb_t cb, void* param);
 void msleep(uint64_t msec);
 void cold_boot(const char *path);
 enum system_platform_t get_system_platform(void);
+uint64_t get_available_memory(void);
 
 #if 0
 int get_multiplier(const char *str);
@@ -0,0 +1,105 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+
+#ifndef DELTA_PATCH_H
+#define DELTA_PATCH_H
+
+#include <types.h>
+
+#define DELTA_PATCH_MAGIC       0x544c4452  /* "RDLT" */
+#define DELTA_PATCH_VERSION     1
+#define DELTA_PATCH_HEADER_SIZE 24
+#define DELTA_PATCH_COPY_SIZE   (16 * 1024)
+
+/*
+ * Patch opcodes, all integers are little endian
+ *
+ *   END                                   end of patch
+ *   COPY  u32 source offset, u32 length   copy from the old image
+ *   DATA  u32 length, length bytes        literal data
+ */
+#define DELTA_OP_END            0
+#define DELTA_OP_COPY           1
+#define DELTA_OP_DATA           2
+
+/*
+ * Reads len bytes of the old image at offset (relative to image start)
+ */
+typedef int (*delta_source_cb_t)(uint64_t offset, void* buf, uint32_t len,
+        void* param);
+
+/*
+ * Receives the patched image in order, returns -1 to abort
+ */
+typedef int (*delta_output_cb_t)(const void* buf, uint32_t len, void* param);
+
+/*
+ * Streaming decoder of one delta chunk
+ *
+ * A chunk patch rebuilds out_size bytes of the new image starting at
+ * out_offset from the old image, which is being overwritten in place one
+ * erase window at a time. So that nothing is read after it has been
+ * overwritten, every COPY must stay within one window of the output and
+ * read from the old image at or after the start of that window; patches
+ * breaking the rule are rejected. The output is checked against the CRC32
+ * carried in the header.
+ *
+ * Header: u32 magic, u16 version, u16 flags, u32 out_offset,
+ *         u32 out_size, u32 window, u32 out_crc
+ */
+struct delta_patch {
+    int state;
+
+    uint8_t hdr[DELTA_PATCH_HEADER_SIZE];
+    uint32_t hdr_len;
+    uint32_t need;
+    uint8_t op;
+
+    uint32_t out_offset;
+    uint32_t out_size;
+    uint32_t window;
+    uint32_t out_crc;
+
+    uint64_t out_pos;
+    uint32_t remain;
+    uint32_t crc;
+
+    uint8_t* copybuf;
+
+    delta_source_cb_t source_cb;
+    delta_output_cb_t output_cb;
+    void* param;
+};
+
+/*
+ * Largest patch the packager emits for out_size bytes: it falls back to
+ * one literal per window rather than growing past it
+ */
+static inline uint32_t delta_patch_max_size(uint32_t out_size,
+        uint32_t window) {
+    return DELTA_PATCH_HEADER_SIZE + out_size
+            + 5 * ((out_size + window - 1) / window) + 1;
+}
+
+int delta_patch_init(struct delta_patch* dp, uint32_t out_offset,
+        uint32_t out_size, uint32_t window, delta_source_cb_t source_cb,
+        delta_output_cb_t output_cb, void* param);
+int delta_patch_feed(struct delta_patch* dp, const void* buf, uint32_t len);
+int delta_patch_finish(struct delta_patch* dp);
+void delta_patch_destroy(struct delta_patch* dp);
+
+#endif /* DELTA_PATCH_H */
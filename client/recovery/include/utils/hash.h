@@ -0,0 +1,108 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <types.h>
+#include <lib/md5/libmd5.h>
+#include <mincrypt/sha.h>
+#include <mincrypt/sha256.h>
+
+#define HASH_MD5                0
+#define HASH_SHA1               1
+#define HASH_SHA256             2
+#define HASH_TYPES              3
+
+#define HASH_MASK(type)         (1 << (type))
+
+#define HASH_BACKEND_SOFT       0
+#define HASH_BACKEND_KERNEL     1
+#define HASH_MAX_DIGEST_SIZE    SHA256_DIGEST_SIZE
+#define HASH_MAX_STR_LEN        (HASH_MAX_DIGEST_SIZE * 2)
+
+/*
+ * Files are hashed through mmap() windows of this size, pread() into a
+ * buffer of HASH_FILE_BUF_SIZE when the file cannot be mapped
+ */
+#define HASH_FILE_WINDOW        (4 << 20)
+#define HASH_FILE_BUF_SIZE      (256 * 1024)
+
+/*
+ * Incremental hash of any of the types above
+ *
+ * Data may be fed in pieces of any size and alignment from anywhere in a
+ * pipeline: whole blocks are hashed where they lie, only a partial block
+ * is copied. The digest is held in the context after hash_final().
+ *
+ * A type set to HASH_BACKEND_KERNEL is hashed by the kernel crypto API
+ * through an AF_ALG socket of the context, by a hash engine of the SoC
+ * where its driver registers one. Without AF_ALG or the algorithm in the
+ * kernel the type goes back to software for good.
+ */
+struct hash_ctx {
+    int type;
+    int fd;     /* AF_ALG operation socket, -1 when hashed in software */
+    int error;
+    union {
+        MD5_CTX md5;
+        SHA_CTX sha1;
+        SHA256_CTX sha256;
+    };
+    uint8_t digest[HASH_MAX_DIGEST_SIZE];
+};
+
+int hash_init(struct hash_ctx* ctx, int type);
+void hash_update(struct hash_ctx* ctx, const void* data, uint32_t len);
+
+/*
+ * Returns the digest, or NULL if the kernel failed to take the data
+ */
+const uint8_t* hash_final(struct hash_ctx* ctx);
+
+/*
+ * Releases a context that will not be finalized
+ */
+void hash_destroy(struct hash_ctx* ctx);
+
+void hash_set_backend(int type, int backend);
+int hash_backend(int type);
+
+int hash_digest_size(int type);
+const char* hash_name(int type);
+int hash_type(const char* name);
+
+/*
+ * Writes digest as a lower case hex string to str, 2 * len + 1 bytes
+ */
+char* hash_to_hex(const uint8_t* digest, int len, char* str);
+
+/*
+ * Feeds length bytes of the file at path from offset, or all of the rest
+ * when length is -1, to count initialized contexts in a single pass. A
+ * lone kernel context has the file spliced to its socket, no copy made.
+ * Returns 0, or -1 if the file cannot be read or is short.
+ */
+int hash_file(const char* path, uint64_t offset, int64_t length,
+        struct hash_ctx* ctxs, int count);
+
+/*
+ * Checks the file at path against an expected hex digest of type
+ */
+int hash_check_file(const char* path, int type, const char* expected);
+
+#endif /* HASH_H */
@@ -0,0 +1,94 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+
+#ifndef HASHTREE_H
+#define HASHTREE_H
+
+#include <types.h>
+#include <mincrypt/sha.h>
+
+#define HASHTREE_MAGIC          0x45525448  /* "HTRE" */
+#define HASHTREE_VERSION        1
+#define HASHTREE_HEADER_SIZE    24
+#define HASHTREE_HASH_SHA1      1
+#define HASHTREE_ROOT_STR_LEN   (SHA_DIGEST_SIZE * 2)
+
+/*
+ * Hash tree manifest of an image
+ *
+ * The packager cuts each image into leaves of one erase block (one LEB
+ * for UBI images) and ships the SHA-1 of every leaf in <image>.hashtree
+ * of update000.zip, the root in update.xml: both are covered by the
+ * whole-file signature of that package. The root is rebuilt from the
+ * leaves on load, so that any block can be checked on its own against
+ * its leaf, as it streams through or read back from flash, in any order
+ * and in parallel.
+ *
+ *   leaf:   SHA-1(0x00, leaf data), the last leaf is short
+ *   node:   SHA-1(0x01, left, right), an odd node out moves up as is
+ *
+ * Header: u32 magic, u16 version, u16 hash, u32 leaf_size,
+ *         u32 leaf_count, u64 image_size, then the leaves. Integers
+ *         are little endian.
+ */
+struct hashtree {
+    uint32_t leaf_size;
+    uint32_t leaf_count;
+    uint64_t image_size;
+    uint8_t* leaves;
+    uint8_t root[SHA_DIGEST_SIZE];
+};
+
+/*
+ * Reads the leaf at index into buf, len bytes. Returns 0, 1 when the leaf
+ * is not meant to match (the device keeps data of its own there), or -1
+ * to abort. Calls come in leaf order, one at a time.
+ */
+typedef int (*hashtree_read_cb_t)(uint32_t index, void* buf, uint32_t len,
+        void* param);
+
+/*
+ * Loads the manifest at path and checks it against the root given as a
+ * hex string and the size of its image
+ */
+int hashtree_load(struct hashtree* ht, const char* path, const char* root,
+        uint64_t image_size);
+void hashtree_destroy(struct hashtree* ht);
+
+static inline uint32_t hashtree_leaf_len(const struct hashtree* ht,
+        uint32_t index) {
+    uint64_t left = ht->image_size - (uint64_t)index * ht->leaf_size;
+
+    return left < ht->leaf_size ? left : ht->leaf_size;
+}
+
+/*
+ * Checks the image data at offset, leaf aligned, leaf by leaf. Returns 0,
+ * or -1 naming the first leaf that does not match.
+ */
+int hashtree_verify(const struct hashtree* ht, uint64_t offset,
+        const void* buf, uint32_t len);
+
+/*
+ * Checks count leaves from first, read by read_cb and hashed by up to
+ * threads threads (0 for one per CPU)
+ */
+int hashtree_verify_blocks(const struct hashtree* ht, uint32_t first,
+        uint32_t count, hashtree_read_cb_t read_cb, void* param,
+        int threads);
+
+#endif /* HASHTREE_H */
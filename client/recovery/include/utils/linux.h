@@ -17,7 +17,9 @@
 #ifndef LINUX_H
 #define LINUX_H
 
-#define offsetof(TYPE, MEMBER) ((int) &((TYPE *)0)->MEMBER)
+#ifndef offsetof
+#define offsetof(TYPE, MEMBER) __builtin_offsetof(TYPE, MEMBER)
+#endif
 
 #define container_of(ptr, type, member) ({      \
     const typeof( ((type *)0)->member ) *__mptr = (ptr);    \
@@ -0,0 +1,41 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+
+
+#ifndef MEMSCAN_H
+#define MEMSCAN_H
+
+#include <types.h>
+
+/*
+ * Scanners for erased (all 0xFF) flash content
+ *
+ * Both go a machine word at a time, four words per test, and fall back
+ * to bytes for the unaligned head and tail only.
+ */
+
+/*
+ * Returns 1 if every byte of buf is 0xFF
+ */
+int memscan_is_ff(const void* buf, uint32_t len);
+
+/*
+ * Returns the length of buf once its trailing 0xFF bytes are dropped
+ */
+uint32_t memscan_strip_ff(const void* buf, uint32_t len);
+
+#endif /* MEMSCAN_H */
@@ -17,7 +17,42 @@
 #ifndef MINIZIP_H
 #define MINIZIP_H
 
+#include <types.h>
+
+/*
+ * Zip entry reader
+ *
+ * Reads one entry of a zip file straight into the caller's buffer, the
+ * block manager write buffer typically, instead of extracting it to a
+ * file and reading that back. Deflated entries are inflated by minizip;
+ * stored ones are pread() from the zip file, bypassing zlib, and checked
+ * against the CRC from the zip directory on close.
+ */
+struct unzip_entry {
+    void* uf;
+    int fd;                 /* zip file, for stored entries */
+    int stored;
+    uint64_t offset;        /* of the data of a stored entry */
+    uint64_t size;          /* uncompressed */
+    uint64_t pos;
+    uint32_t crc;
+    uint32_t expected_crc;
+};
+
 int unzip(const char* path, const char* dir, const char* password,
         int junk_path);
 
+/*
+ * The entry is looked up by name without its path, as unzip() with
+ * junk_path extracts it
+ */
+int unzip_entry_open(struct unzip_entry* entry, const char* path,
+        const char* name);
+
+/*
+ * Fills buf with up to len bytes, less only at the end of the entry
+ */
+int64_t unzip_entry_read(struct unzip_entry* entry, void* buf, uint32_t len);
+int unzip_entry_close(struct unzip_entry* entry);
+
 #endif
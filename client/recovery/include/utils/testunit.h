@@ -0,0 +1,47 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+
+
+#ifndef TESTUNIT_H
+#define TESTUNIT_H
+
+#include <utils/log.h>
+
+/*
+ * Pass/fail bookkeeping of the unit test programs
+ *
+ * Included once per program, by the file holding main(), after LOG_TAG
+ * is defined.
+ */
+static int failures;
+
+static inline void report(const char* name, int ok) {
+    LOGI("%-40s %s\n", name, ok ? "PASS" : "FAIL");
+    if (!ok)
+        failures++;
+}
+
+/*
+ * Logs the outcome, returns the exit code of the program
+ */
+static inline int report_summary(void) {
+    LOGI("%s\n", failures ? "FAILED" : "ALL PASSED");
+
+    return failures ? -1 : 0;
+}
+
+#endif /* TESTUNIT_H */
@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef UPDATE_STATS_H
+#define UPDATE_STATS_H
+
+#include <types.h>
+
+/*
+ * Update statistics
+ *
+ * Bytes, time spent and number of calls of each stage of the update,
+ * taken on the monotonic clock and collected per chunk, plus the bad
+ * blocks run into and the download retries. A thread accounts into the
+ * chunk it last began, or to the update as a whole before any. Stages may
+ * nest: a streamed download includes the inflate and the flash writes it
+ * feeds, the UBI format is part of its partition's finish.
+ */
+enum update_stage {
+    UPDATE_STAGE_DOWNLOAD,
+    UPDATE_STAGE_VERIFY,
+    UPDATE_STAGE_UNZIP,
+    UPDATE_STAGE_READ,
+    UPDATE_STAGE_ERASE,
+    UPDATE_STAGE_WRITE,
+    UPDATE_STAGE_FINISH,
+    UPDATE_STAGE_FORMAT,
+    UPDATE_STAGE_COUNT,
+};
+
+enum update_counter {
+    UPDATE_COUNTER_BAD_BLOCKS,
+    UPDATE_COUNTER_RETRIES,
+    UPDATE_COUNTER_COUNT,
+};
+
+/*
+ * Monotonic time in ns, the start argument of update_stats_add()
+ */
+uint64_t update_stats_now(void);
+
+void update_stats_add(enum update_stage stage, uint64_t bytes, uint64_t start);
+void update_stats_count(enum update_counter counter, uint32_t n);
+
+/*
+ * Beginning a chunk already seen, e.g. by the prefetch thread, accounts
+ * into the same record
+ */
+void update_stats_begin_chunk(const char* partition, const char* image,
+        uint32_t chunk_index);
+void update_stats_end_chunk(void);
+
+/*
+ * Totals of a stage over the whole update so far
+ */
+void update_stats_get_stage(enum update_stage stage, uint64_t* bytes,
+        uint64_t* ns);
+const char* update_stats_stage_name(enum update_stage stage);
+
+/*
+ * JSON summary, per partition and per chunk
+ */
+int update_stats_write(const char* path, int error);
+void update_stats_reset(void);
+
+#endif /* UPDATE_STATS_H */
@@ -19,12 +19,35 @@
 
 #include "mincrypt/rsa.h"
 
+/* A public key and the size of the hash its signatures are made over, by
+ * the key version in the keys file: SHA-1 for v1 (e=3) and v2 (e=65537),
+ * SHA-256 for v3 (e=3) and v4 (e=65537).
+ */
+typedef struct Certificate {
+    int hash_len;
+    RSAPublicKey public_key;
+} Certificate;
+
 /* Look in the file for a signature footer, and verify that it
  * matches one of the given keys.  Return one of the constants below.
  */
-int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKeys);
+int verify_file(const char* path, const Certificate *pKeys, unsigned int numKeys);
+
+/* Check the whole-file signature footer held in an end-of-central-directory
+ * record (comment included) against the SHA-1 and SHA-256 of the signed part
+ * of the archive, for callers that hashed the archive themselves while
+ * streaming. Either hash may be NULL if none of the keys needs it.
+ */
+int verify_eocd_signature(const unsigned char* eocd, size_t eocd_size,
+        const uint8_t* sha1, const uint8_t* sha256, const Certificate *pKeys,
+        unsigned int numKeys);
+
+/* The hashes (HASH_MASK() of utils/hash.h) signatures must be checked
+ * against for the given keys.
+ */
+int keys_hash_mask(const Certificate *pKeys, unsigned int numKeys);
 
-RSAPublicKey* load_keys(const char* filename, int* numKeys);
+Certificate* load_keys(const char* filename, int* numKeys);
 
 #define VERIFY_SUCCESS        0
 #define VERIFY_FAILURE        1
@@ -0,0 +1,100 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef ZIP_STREAM_H
+#define ZIP_STREAM_H
+
+#include <types.h>
+#include "zlib.h"
+#include <utils/hash.h>
+#include <utils/verifier.h>
+
+#define ZIP_STREAM_NAME_MAX     256
+#define ZIP_STREAM_OUTBUF_SIZE  (32 * 1024)
+
+struct zip_stream;
+
+/*
+ * Called for each local file header. Return 1 to receive the entry data,
+ * 0 to discard it, or -1 to abort the stream.
+ */
+typedef int (*zip_stream_entry_cb_t)(struct zip_stream* zs, const char* name,
+        void* param);
+
+/*
+ * Called with inflated entry data, in order. Return -1 to abort the stream.
+ */
+typedef int (*zip_stream_data_cb_t)(struct zip_stream* zs, const void* buf,
+        uint32_t len, void* param);
+
+/*
+ * Sequential reader of a whole-file signed zip archive. Entries are
+ * inflated to the data callback as bytes are fed in, and the signed part
+ * is hashed on the way for zip_stream_verify().
+ */
+struct zip_stream {
+    int state;
+    int hashing;
+
+    uint8_t hdr[64];
+    uint32_t hdr_len;
+    uint32_t need;
+    uint32_t skip;
+
+    char name[ZIP_STREAM_NAME_MAX];
+    uint32_t name_len;
+
+    uint16_t flag;
+    uint16_t method;
+    uint32_t crc;
+    uint32_t csize;
+    uint32_t usize;
+    uint32_t remain;
+    uint32_t crc_calc;
+    uint32_t usize_calc;
+    int wanted;
+    int entries;
+
+    z_stream strm;
+    int strm_inited;
+    uint8_t* outbuf;
+
+    uint8_t* eocd;
+    uint32_t eocd_size;
+
+    uint64_t consumed;
+    struct hash_ctx hashes[2];
+    int nhashes;
+    const uint8_t* sha1;
+    const uint8_t* sha256;
+
+    Certificate* keys;
+    int nkeys;
+
+    zip_stream_entry_cb_t entry_cb;
+    zip_stream_data_cb_t data_cb;
+    void* param;
+};
+
+int zip_stream_init(struct zip_stream* zs, const char* key_path,
+        zip_stream_entry_cb_t entry_cb, zip_stream_data_cb_t data_cb,
+        void* param);
+int zip_stream_feed(struct zip_stream* zs, const void* buf, uint32_t len);
+int zip_stream_finish(struct zip_stream* zs);
+int zip_stream_verify(struct zip_stream* zs);
+void zip_stream_destroy(struct zip_stream* zs);
+
+#endif /* ZIP_STREAM_H */
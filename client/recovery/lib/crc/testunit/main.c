@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <utils/log.h>
+#include <lib/crc/libcrc.h>
+#include <lib/mtd/ubi-media.h>
+#include <lib/ubi/libubigen.h>
+#include <lib/zlib/zlib.h>
+
+#define LOG_TAG "test_crc"
+
+#include <utils/testunit.h>
+
+/*
+ * Checks local_crc32() against a byte loop over a table built here and
+ * against zlib, over every alignment and length of a buffer and split at
+ * any point, then times them on UBI headers, pages and erase blocks and
+ * on the headers ubi_write_volume() makes for each LEB.
+ */
+
+#define MAX_LEN         160
+#define MAX_ALIGN       16
+#define PEB_SIZE        (128 * 1024)
+#define PAGE_SIZE       2048
+#define BENCH_BYTES     (64 << 20)
+#define BENCH_LEBS      4096
+
+static uint32_t byte_table[256];
+static uint8_t buf[MAX_ALIGN + MAX_LEN];
+
+static void byte_table_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+
+        for (int k = 0; k < 8; k++)
+            c = (c >> 1) ^ (c & 1 ? 0xedb88320 : 0);
+        byte_table[i] = c;
+    }
+}
+
+static uint32_t byte_crc32(uint32_t val, const uint8_t* s, int32_t len) {
+    while (--len >= 0)
+        val = byte_table[(val ^ *s++) & 0xff] ^ (val >> 8);
+    return val;
+}
+
+/*
+ * zlib inverts the CRC on the way in and out, local_crc32() leaves it to
+ * the caller
+ */
+static uint32_t zlib_crc32(uint32_t val, const uint8_t* s, int32_t len) {
+    return ~crc32(~val, s, len);
+}
+
+static void fill_random(uint8_t* p, int len) {
+    for (int i = 0; i < len; i++)
+        p[i] = rand();
+}
+
+static void test_check_value(void) {
+    const char* s = "123456789";
+
+    report("check value of \"123456789\"",
+            ~local_crc32(~0, s, strlen(s)) == 0xcbf43926
+            && local_crc32(UBI_CRC32_INIT, s, 0) == UBI_CRC32_INIT);
+}
+
+static void test_lengths(void) {
+    int ok = 1;
+
+    fill_random(buf, sizeof(buf));
+    for (int align = 0; align < MAX_ALIGN; align++) {
+        for (int len = 0; len <= MAX_LEN; len++) {
+            uint32_t crc = local_crc32(UBI_CRC32_INIT, buf + align, len);
+
+            ok &= crc == byte_crc32(UBI_CRC32_INIT, buf + align, len);
+            ok &= crc == zlib_crc32(UBI_CRC32_INIT, buf + align, len);
+            ok &= local_crc32(0, buf + align, len)
+                    == byte_crc32(0, buf + align, len);
+        }
+    }
+
+    report("every alignment and length", ok);
+}
+
+static void test_split(void) {
+    uint32_t whole = local_crc32(UBI_CRC32_INIT, buf, MAX_LEN);
+    int ok = 1;
+
+    for (int at = 0; at <= MAX_LEN; at++) {
+        uint32_t crc = local_crc32(UBI_CRC32_INIT, buf, at);
+
+        ok &= local_crc32(crc, buf + at, MAX_LEN - at) == whole;
+    }
+
+    report("split at every byte", ok);
+}
+
+static void test_block(void) {
+    uint8_t* block = malloc(PEB_SIZE);
+    int ok;
+
+    if (block == NULL) {
+        LOGE("Cannot allocate %d bytes of memory\n", PEB_SIZE);
+        failures++;
+        return;
+    }
+
+    fill_random(block, PEB_SIZE);
+    ok = local_crc32(UBI_CRC32_INIT, block, PEB_SIZE)
+            == zlib_crc32(UBI_CRC32_INIT, block, PEB_SIZE);
+
+    memset(block, 0xff, PEB_SIZE);
+    ok &= local_crc32(0, block, PEB_SIZE) == byte_crc32(0, block, PEB_SIZE);
+
+    report("erase block, random and blank", ok);
+    free(block);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double bench_one(uint32_t (*fn)(uint32_t, const uint8_t*, int32_t),
+        const uint8_t* block, int size) {
+    volatile uint32_t sink = 0;
+    int rounds = BENCH_BYTES / size;
+    double t = now_ms();
+
+    for (int i = 0; i < rounds; i++)
+        sink += fn(UBI_CRC32_INIT, block, size);
+
+    return (double)rounds * size / 1048576.0 / ((now_ms() - t) / 1e3);
+}
+
+static uint32_t slice_crc32(uint32_t val, const uint8_t* s, int32_t len) {
+    return local_crc32(val, s, len);
+}
+
+/*
+ * The CPU side of ubi_write_volume() per LEB: the VID header, with the
+ * CRC of the whole LEB for a static volume
+ */
+static void bench_vid_hdr(const uint8_t* block) {
+    struct ubigen_info ui;
+    struct ubigen_vol_info vi;
+    struct ubi_vid_hdr hdr;
+    double t, dynamic_ms, static_ms;
+
+    ubigen_info_init(&ui, PEB_SIZE, PAGE_SIZE, PAGE_SIZE, 0, UBI_VERSION, 0);
+
+    memset(&vi, 0, sizeof(vi));
+    vi.usable_leb_size = ui.leb_size;
+    vi.used_ebs = BENCH_LEBS;
+
+    vi.type = UBI_VID_DYNAMIC;
+    t = now_ms();
+    for (int lnum = 0; lnum < BENCH_LEBS; lnum++)
+        ubigen_init_vid_hdr(&ui, &vi, &hdr, lnum, block, ui.leb_size);
+    dynamic_ms = now_ms() - t;
+
+    vi.type = UBI_VID_STATIC;
+    t = now_ms();
+    for (int lnum = 0; lnum < BENCH_LEBS; lnum++)
+        ubigen_init_vid_hdr(&ui, &vi, &hdr, lnum, block, ui.leb_size);
+    static_ms = now_ms() - t;
+
+    LOGI("vid_hdr:  dynamic %.2f us/LEB, static %.2f us/LEB (%d bytes)\n",
+            dynamic_ms * 1e3 / BENCH_LEBS, static_ms * 1e3 / BENCH_LEBS,
+            ui.leb_size);
+}
+
+static void bench(void) {
+    static const int sizes[] = {UBI_VID_HDR_SIZE, PAGE_SIZE, PEB_SIZE};
+    uint8_t* block = malloc(PEB_SIZE);
+
+    if (block == NULL) {
+        LOGE("Cannot allocate %d bytes of memory\n", PEB_SIZE);
+        failures++;
+        return;
+    }
+    fill_random(block, PEB_SIZE);
+
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        LOGI("%6d B:  byte loop %.1f MB/s, local_crc32 %.1f MB/s, "
+                "zlib %.1f MB/s\n", sizes[i],
+                bench_one(byte_crc32, block, sizes[i]),
+                bench_one(slice_crc32, block, sizes[i]),
+                bench_one(zlib_crc32, block, sizes[i]));
+
+    bench_vid_hdr(block);
+
+    free(block);
+}
+
+int main(int argc, char* argv[]) {
+    byte_table_init();
+
+    test_check_value();
+    test_lengths();
+    test_split();
+    test_block();
+
+    bench();
+
+    return report_summary();
+}
@@ -18,11 +18,14 @@
 
 #include <lib/md5/libmd5.h>
 
-#define F(x,y,z) ((x & y) | (~x & z))
-#define G(x,y,z) ((x & z) | (y & ~z))
-#define H(x,y,z) (x^y^z)
-#define I(x,y,z) (y ^ (x | ~z))
-#define ROTATE_LEFT(x,n) ((x << n) | (x >> (32-n)))
+/*
+ * F and G in their select forms, one operation less than the and/or ones
+ */
+#define F(x,y,z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x,y,z) ((y) ^ ((z) & ((x) ^ (y))))
+#define H(x,y,z) ((x) ^ (y) ^ (z))
+#define I(x,y,z) ((y) ^ ((x) | ~(z)))
+#define ROTATE_LEFT(x,n) (((x) << (n)) | ((x) >> (32-(n))))
 
 #define FF(a, b, c, d, x, s, ac)        \
 {                                       \
@@ -135,9 +138,13 @@ void MD5Transform(unsigned int state[4], unsigned char block[64]) {
     unsigned int b = state[1];
     unsigned int c = state[2];
     unsigned int d = state[3];
-    unsigned int x[64];
+    unsigned int x[16];
 
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(x, block, 64);
+#else
     MD5Decode(x, block, 64);
+#endif
 
     FF(a, b, c, d, x[0], 7, 0xd76aa478);    /* 1 */
     FF(d, a, b, c, x[1], 12, 0xe8c7b756);   /* 2 */
@@ -26,27 +26,83 @@
 */
 
 #include "mincrypt/rsa.h"
+#include "mincrypt/sha.h"
+#include "mincrypt/sha256.h"
 
 int RSA_e_f4_verify(const RSAPublicKey* key,
                     const uint8_t* signature,
                     const int len,
-                    const uint8_t* sha);
+                    const uint8_t* hash,
+                    const int hash_len);
 
 int RSA_e_3_verify(const RSAPublicKey *key,
                    const uint8_t *signature,
                    const int len,
-                   const uint8_t *sha);
+                   const uint8_t *hash,
+                   const int hash_len);
+
+// SHA-1 of PKCS1.5 signature padding for 2048 bit with a SHA-1 DigestInfo.
+// At the location of the bytes of the hash all 00 are hashed.
+static const uint8_t kExpectedPadSha1Rsa2048[SHA_DIGEST_SIZE] = {
+  0xdc, 0xbd, 0xbe, 0x42, 0xd5, 0xf5, 0xa7, 0x2e, 0x6e, 0xfc,
+  0xf5, 0x5d, 0xaf, 0x9d, 0xea, 0x68, 0x7c, 0xfb, 0xf1, 0x67
+};
+
+// SHA-1 of PKCS1.5 signature padding for 2048 bit with a SHA-256
+// DigestInfo (30 31 30 0d 06 09 60 86 48 01 65 03 04 02 01 05 00 04 20),
+// the hash bytes hashed as 00 as above.
+static const uint8_t kExpectedPadSha256Rsa2048[SHA_DIGEST_SIZE] = {
+  0x15, 0x70, 0xcf, 0xc8, 0x64, 0x1b, 0xf6, 0x19, 0xed, 0xab,
+  0x0e, 0x2f, 0x1a, 0x4d, 0xaf, 0x20, 0x4c, 0x27, 0x45, 0x48
+};
+
+// Check the PKCS1.5 padding of a decrypted signature in buf against an
+// expected SHA-1 or SHA-256 hash. Xors the hash into the tail, so it all
+// becomes 00 iff equal, and compares the SHA-1 of the whole buffer with
+// that of the expected padding. Clobbers buf. Returns 0 on failure, 1 on
+// success.
+int RSA_check_padding(uint8_t* buf, const int len, const uint8_t* hash,
+                      const int hash_len) {
+  const uint8_t* expected;
+  int i;
+
+  switch (hash_len) {
+    case SHA_DIGEST_SIZE:
+      expected = kExpectedPadSha1Rsa2048;
+      break;
+    case SHA256_DIGEST_SIZE:
+      expected = kExpectedPadSha256Rsa2048;
+      break;
+    default:
+      return 0;  // Unknown hash.
+  }
+
+  for (i = len - hash_len; i < len; ++i) {
+    buf[i] ^= *hash++;
+  }
+
+  SHA(buf, len, buf);
+
+  for (i = 0; i < SHA_DIGEST_SIZE; ++i) {
+    if (buf[i] != expected[i]) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
 
 int RSA_verify(const RSAPublicKey *key,
                const uint8_t *signature,
                const int len,
-               const uint8_t *sha) {
+               const uint8_t *hash,
+               const int hash_len) {
     switch (key->exponent) {
         case 3:
-            return RSA_e_3_verify(key, signature, len, sha);
+            return RSA_e_3_verify(key, signature, len, hash, hash_len);
             break;
         case 65537:
-            return RSA_e_f4_verify(key, signature, len, sha);
+            return RSA_e_f4_verify(key, signature, len, hash, hash_len);
             break;
         default:
             return 0;
@@ -25,273 +25,161 @@
 ** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-#include "mincrypt/sha.h"
-
-// Some machines lack byteswap.h and endian.h.  These have to use the
-// slower code, even if they're little-endian.
-
-#if defined(HAVE_ENDIAN_H) && defined(HAVE_LITTLE_ENDIAN)
+#include <string.h>
 
-#include <byteswap.h>
-#include <memory.h>
+#include "mincrypt/sha.h"
 
-// This version is about 28% faster than the generic version below,
-// but assumes little-endianness.
+#define rol(bits, value) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
-static inline uint32_t ror27(uint32_t val) {
-    return (val >> 27) | (val << 5);
-}
-static inline uint32_t ror2(uint32_t val) {
-    return (val >> 2) | (val << 30);
+// Big endian word at any alignment: memcpy makes it a plain load where
+// the CPU allows (lwl/lwr on MIPS), the swap a single instruction on
+// most.
+static inline uint32_t load_be32(const uint8_t* p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
 }
-static inline uint32_t ror31(uint32_t val) {
-    return (val >> 31) | (val << 1);
-}
-
-static void SHA1_Transform(SHA_CTX* ctx) {
-    uint32_t W[80];
-    register uint32_t A, B, C, D, E;
-    int t;
-
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
-
-#define SHA_F1(A,B,C,D,E,t)                     \
-    E += ror27(A) +                             \
-        (W[t] = bswap_32(ctx->buf.w[t])) +      \
-        (D^(B&(C^D))) + 0x5A827999;             \
-    B = ror2(B);
-
-    for (t = 0; t < 15; t += 5) {
-        SHA_F1(A,B,C,D,E,t + 0);
-        SHA_F1(E,A,B,C,D,t + 1);
-        SHA_F1(D,E,A,B,C,t + 2);
-        SHA_F1(C,D,E,A,B,t + 3);
-        SHA_F1(B,C,D,E,A,t + 4);
-    }
-    SHA_F1(A,B,C,D,E,t + 0);  // 16th one, t == 15
-
-#undef SHA_F1
-
-#define SHA_F1(A,B,C,D,E,t)                                     \
-    E += ror27(A) +                                             \
-        (W[t] = ror31(W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16])) +   \
-        (D^(B&(C^D))) + 0x5A827999;                             \
-    B = ror2(B);
-
-    SHA_F1(E,A,B,C,D,t + 1);
-    SHA_F1(D,E,A,B,C,t + 2);
-    SHA_F1(C,D,E,A,B,t + 3);
-    SHA_F1(B,C,D,E,A,t + 4);
-
-#undef SHA_F1
-
-#define SHA_F2(A,B,C,D,E,t)                                     \
-    E += ror27(A) +                                             \
-        (W[t] = ror31(W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16])) +   \
-        (B^C^D) + 0x6ED9EBA1;                                   \
-    B = ror2(B);
-
-    for (t = 20; t < 40; t += 5) {
-        SHA_F2(A,B,C,D,E,t + 0);
-        SHA_F2(E,A,B,C,D,t + 1);
-        SHA_F2(D,E,A,B,C,t + 2);
-        SHA_F2(C,D,E,A,B,t + 3);
-        SHA_F2(B,C,D,E,A,t + 4);
-    }
-
-#undef SHA_F2
-
-#define SHA_F3(A,B,C,D,E,t)                                     \
-    E += ror27(A) +                                             \
-        (W[t] = ror31(W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16])) +   \
-        ((B&C)|(D&(B|C))) + 0x8F1BBCDC;                         \
-    B = ror2(B);
-
-    for (; t < 60; t += 5) {
-        SHA_F3(A,B,C,D,E,t + 0);
-        SHA_F3(E,A,B,C,D,t + 1);
-        SHA_F3(D,E,A,B,C,t + 2);
-        SHA_F3(C,D,E,A,B,t + 3);
-        SHA_F3(B,C,D,E,A,t + 4);
-    }
-
-#undef SHA_F3
 
-#define SHA_F4(A,B,C,D,E,t)                                     \
-    E += ror27(A) +                                             \
-        (W[t] = ror31(W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16])) +   \
-        (B^C^D) + 0xCA62C1D6;                                   \
-    B = ror2(B);
+static inline void store_be32(uint8_t* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
 
-    for (; t < 80; t += 5) {
-        SHA_F4(A,B,C,D,E,t + 0);
-        SHA_F4(E,A,B,C,D,t + 1);
-        SHA_F4(D,E,A,B,C,t + 2);
-        SHA_F4(C,D,E,A,B,t + 3);
-        SHA_F4(B,C,D,E,A,t + 4);
-    }
+// The message schedule is kept to the 16 words still needed, W(t) holds
+// W[t - 16] until it is expanded in place.
+#define W(t) W[(t) & 15]
+#define LOAD(t) (W(t) = load_be32(p + 4 * (t)))
+#define EXPAND(t) (W(t) = rol(1, W((t) - 3) ^ W((t) - 8) ^ W((t) - 14) ^ W(t)))
+
+#define F1(B,C,D) (D ^ (B & (C ^ D)))
+#define F2(B,C,D) (B ^ C ^ D)
+#define F3(B,C,D) ((B & C) | (D & (B | C)))
+
+#define ROUND(A,B,C,D,E,F,K,w)                  \
+    E += rol(5, A) + F(B,C,D) + K + (w);        \
+    B = rol(30, B);
+
+// Five rounds bring the names back where they started, so the variables
+// rotate by name rather than by moves.
+#define ROUNDS5(F,K,X,t)                        \
+    ROUND(A,B,C,D,E,F,K,X(t))                   \
+    ROUND(E,A,B,C,D,F,K,X((t) + 1))             \
+    ROUND(D,E,A,B,C,F,K,X((t) + 2))             \
+    ROUND(C,D,E,A,B,F,K,X((t) + 3))             \
+    ROUND(B,C,D,E,A,F,K,X((t) + 4))
+
+// One 64 byte block, straight from the caller's data, fully unrolled so
+// that every schedule index is a constant.
+static void SHA1_transform(uint32_t* state, const uint8_t* p) {
+    uint32_t W[16];
+    uint32_t A, B, C, D, E;
 
-#undef SHA_F4
+    A = state[0];
+    B = state[1];
+    C = state[2];
+    D = state[3];
+    E = state[4];
+
+    ROUNDS5(F1, 0x5A827999, LOAD, 0)
+    ROUNDS5(F1, 0x5A827999, LOAD, 5)
+    ROUNDS5(F1, 0x5A827999, LOAD, 10)
+    ROUND(A,B,C,D,E,F1,0x5A827999,LOAD(15))
+    ROUND(E,A,B,C,D,F1,0x5A827999,EXPAND(16))
+    ROUND(D,E,A,B,C,F1,0x5A827999,EXPAND(17))
+    ROUND(C,D,E,A,B,F1,0x5A827999,EXPAND(18))
+    ROUND(B,C,D,E,A,F1,0x5A827999,EXPAND(19))
+
+    ROUNDS5(F2, 0x6ED9EBA1, EXPAND, 20)
+    ROUNDS5(F2, 0x6ED9EBA1, EXPAND, 25)
+    ROUNDS5(F2, 0x6ED9EBA1, EXPAND, 30)
+    ROUNDS5(F2, 0x6ED9EBA1, EXPAND, 35)
+
+    ROUNDS5(F3, 0x8F1BBCDC, EXPAND, 40)
+    ROUNDS5(F3, 0x8F1BBCDC, EXPAND, 45)
+    ROUNDS5(F3, 0x8F1BBCDC, EXPAND, 50)
+    ROUNDS5(F3, 0x8F1BBCDC, EXPAND, 55)
+
+    ROUNDS5(F2, 0xCA62C1D6, EXPAND, 60)
+    ROUNDS5(F2, 0xCA62C1D6, EXPAND, 65)
+    ROUNDS5(F2, 0xCA62C1D6, EXPAND, 70)
+    ROUNDS5(F2, 0xCA62C1D6, EXPAND, 75)
+
+    state[0] += A;
+    state[1] += B;
+    state[2] += C;
+    state[3] += D;
+    state[4] += E;
+}
 
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
+void SHA_init(SHA_CTX* ctx) {
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xEFCDAB89;
+    ctx->state[2] = 0x98BADCFE;
+    ctx->state[3] = 0x10325476;
+    ctx->state[4] = 0xC3D2E1F0;
+    ctx->count = 0;
 }
 
+// Whole blocks are hashed where they lie, only a partial block at either
+// end goes through ctx->buf.
 void SHA_update(SHA_CTX* ctx, const void* data, int len) {
     int i = ctx->count % sizeof(ctx->buf);
     const uint8_t* p = (const uint8_t*)data;
 
+    if (len <= 0)
+        return;
+
     ctx->count += len;
 
-    while (len > sizeof(ctx->buf) - i) {
-        memcpy(&ctx->buf.b[i], p, sizeof(ctx->buf) - i);
-        len -= sizeof(ctx->buf) - i;
-        p += sizeof(ctx->buf) - i;
-        SHA1_Transform(ctx);
-        i = 0;
-    }
+    if (i) {
+        int n = sizeof(ctx->buf) - i;
 
-    while (len--) {
-        ctx->buf.b[i++] = *p++;
-        if (i == sizeof(ctx->buf)) {
-            SHA1_Transform(ctx);
-            i = 0;
+        if (len < n) {
+            memcpy(ctx->buf + i, p, len);
+            return;
         }
+        memcpy(ctx->buf + i, p, n);
+        SHA1_transform(ctx->state, ctx->buf);
+        p += n;
+        len -= n;
     }
-}
-
-
-const uint8_t* SHA_final(SHA_CTX* ctx) {
-    uint64_t cnt = ctx->count * 8;
-    int i;
 
-    SHA_update(ctx, (uint8_t*)"\x80", 1);
-    while ((ctx->count % sizeof(ctx->buf)) != (sizeof(ctx->buf) - 8)) {
-        SHA_update(ctx, (uint8_t*)"\0", 1);
+    for (; len >= (int)sizeof(ctx->buf); len -= sizeof(ctx->buf)) {
+        SHA1_transform(ctx->state, p);
+        p += sizeof(ctx->buf);
     }
-    for (i = 0; i < 8; ++i) {
-        uint8_t tmp = cnt >> ((7 - i) * 8);
-        SHA_update(ctx, &tmp, 1);
-    }
-
-    for (i = 0; i < 5; i++) {
-        ctx->buf.w[i] = bswap_32(ctx->state[i]);
-    }
-
-    return ctx->buf.b;
-}
-
-#else   // #if defined(HAVE_ENDIAN_H) && defined(HAVE_LITTLE_ENDIAN)
-
-#define rol(bits, value) (((value) << (bits)) | ((value) >> (32 - (bits))))
-
-static void SHA1_transform(SHA_CTX *ctx) {
-    uint32_t W[80];
-    uint32_t A, B, C, D, E;
-    uint8_t *p = ctx->buf;
-    int t;
 
-    for(t = 0; t < 16; ++t) {
-        uint32_t tmp =  *p++ << 24;
-        tmp |= *p++ << 16;
-        tmp |= *p++ << 8;
-        tmp |= *p++;
-        W[t] = tmp;
-    }
-
-    for(; t < 80; t++) {
-        W[t] = rol(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
-    }
-
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
-
-    for(t = 0; t < 80; t++) {
-        uint32_t tmp = rol(5,A) + E + W[t];
-
-        if (t < 20)
-            tmp += (D^(B&(C^D))) + 0x5A827999;
-        else if ( t < 40)
-            tmp += (B^C^D) + 0x6ED9EBA1;
-        else if ( t < 60)
-            tmp += ((B&C)|(D&(B|C))) + 0x8F1BBCDC;
-        else
-            tmp += (B^C^D) + 0xCA62C1D6;
-
-        E = D;
-        D = C;
-        C = rol(30,B);
-        B = A;
-        A = tmp;
-    }
-
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
+    memcpy(ctx->buf, p, len);
 }
 
-void SHA_update(SHA_CTX *ctx, const void *data, int len) {
-    int i = ctx->count % sizeof(ctx->buf);
-    const uint8_t* p = (const uint8_t*)data;
-
-    ctx->count += len;
-
-    while (len--) {
-        ctx->buf[i++] = *p++;
-        if (i == sizeof(ctx->buf)) {
-            SHA1_transform(ctx);
-            i = 0;
-        }
-    }
-}
-const uint8_t *SHA_final(SHA_CTX *ctx) {
-    uint8_t *p = ctx->buf;
+const uint8_t* SHA_final(SHA_CTX* ctx) {
     uint64_t cnt = ctx->count * 8;
-    int i;
+    int i = ctx->count % sizeof(ctx->buf);
 
-    SHA_update(ctx, (uint8_t*)"\x80", 1);
-    while ((ctx->count % sizeof(ctx->buf)) != (sizeof(ctx->buf) - 8)) {
-        SHA_update(ctx, (uint8_t*)"\0", 1);
-    }
-    for (i = 0; i < 8; ++i) {
-        uint8_t tmp = cnt >> ((7 - i) * 8);
-        SHA_update(ctx, &tmp, 1);
+    ctx->buf[i++] = 0x80;
+    if (i > (int)sizeof(ctx->buf) - 8) {
+        memset(ctx->buf + i, 0, sizeof(ctx->buf) - i);
+        SHA1_transform(ctx->state, ctx->buf);
+        i = 0;
     }
+    memset(ctx->buf + i, 0, sizeof(ctx->buf) - 8 - i);
+    store_be32(ctx->buf + 56, cnt >> 32);
+    store_be32(ctx->buf + 60, cnt);
+    SHA1_transform(ctx->state, ctx->buf);
 
     for (i = 0; i < 5; i++) {
-        uint32_t tmp = ctx->state[i];
-        *p++ = tmp >> 24;
-        *p++ = tmp >> 16;
-        *p++ = tmp >> 8;
-        *p++ = tmp >> 0;
+        store_be32(ctx->buf + 4 * i, ctx->state[i]);
     }
 
     return ctx->buf;
 }
 
-#endif // endianness
-
-void SHA_init(SHA_CTX* ctx) {
-    ctx->state[0] = 0x67452301;
-    ctx->state[1] = 0xEFCDAB89;
-    ctx->state[2] = 0x98BADCFE;
-    ctx->state[3] = 0x10325476;
-    ctx->state[4] = 0xC3D2E1F0;
-    ctx->count = 0;
-}
-
 /* Convenience function */
 const uint8_t* SHA(const void *data, int len, uint8_t *digest) {
     const uint8_t *p;
@@ -0,0 +1,195 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <string.h>
+
+#include "mincrypt/sha256.h"
+
+/*
+ * SHA-256 (FIPS 180-4), with the same layout as sha.c: whole blocks are
+ * hashed where they lie, the rounds are unrolled eight at a time so the
+ * working variables rotate by name, and the schedule keeps the 16 words
+ * still needed.
+ */
+
+#define ror(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t load_be32(const uint8_t* p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline void store_be32(uint8_t* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+#define S0(x) (ror(x, 2) ^ ror(x, 13) ^ ror(x, 22))
+#define S1(x) (ror(x, 6) ^ ror(x, 11) ^ ror(x, 25))
+#define s0(x) (ror(x, 7) ^ ror(x, 18) ^ ((x) >> 3))
+#define s1(x) (ror(x, 17) ^ ror(x, 19) ^ ((x) >> 10))
+#define CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+
+#define W(t) W[(t) & 15]
+#define LOAD(t) (W(t) = load_be32(p + 4 * (t)))
+#define EXPAND(t) (W(t) += s1(W((t) - 2)) + W((t) - 7) + s0(W((t) - 15)))
+
+#define ROUND(a, b, c, d, e, f, g, h, t, w)                 \
+    h += S1(e) + CH(e, f, g) + K[t] + (w);                  \
+    d += h;                                                 \
+    h += S0(a) + MAJ(a, b, c);
+
+#define ROUNDS8(X, t)                                       \
+    ROUND(A, B, C, D, E, F, G, H, (t), X(t))                \
+    ROUND(H, A, B, C, D, E, F, G, (t) + 1, X((t) + 1))      \
+    ROUND(G, H, A, B, C, D, E, F, (t) + 2, X((t) + 2))      \
+    ROUND(F, G, H, A, B, C, D, E, (t) + 3, X((t) + 3))      \
+    ROUND(E, F, G, H, A, B, C, D, (t) + 4, X((t) + 4))      \
+    ROUND(D, E, F, G, H, A, B, C, (t) + 5, X((t) + 5))      \
+    ROUND(C, D, E, F, G, H, A, B, (t) + 6, X((t) + 6))      \
+    ROUND(B, C, D, E, F, G, H, A, (t) + 7, X((t) + 7))
+
+static void SHA256_transform(uint32_t* state, const uint8_t* p) {
+    uint32_t W[16];
+    uint32_t A, B, C, D, E, F, G, H;
+
+    A = state[0];
+    B = state[1];
+    C = state[2];
+    D = state[3];
+    E = state[4];
+    F = state[5];
+    G = state[6];
+    H = state[7];
+
+    ROUNDS8(LOAD, 0)
+    ROUNDS8(LOAD, 8)
+    ROUNDS8(EXPAND, 16)
+    ROUNDS8(EXPAND, 24)
+    ROUNDS8(EXPAND, 32)
+    ROUNDS8(EXPAND, 40)
+    ROUNDS8(EXPAND, 48)
+    ROUNDS8(EXPAND, 56)
+
+    state[0] += A;
+    state[1] += B;
+    state[2] += C;
+    state[3] += D;
+    state[4] += E;
+    state[5] += F;
+    state[6] += G;
+    state[7] += H;
+}
+
+void SHA256_init(SHA256_CTX* ctx) {
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+    ctx->count = 0;
+}
+
+void SHA256_update(SHA256_CTX* ctx, const void* data, int len) {
+    int i = ctx->count % sizeof(ctx->buf);
+    const uint8_t* p = (const uint8_t*)data;
+
+    if (len <= 0)
+        return;
+
+    ctx->count += len;
+
+    if (i) {
+        int n = sizeof(ctx->buf) - i;
+
+        if (len < n) {
+            memcpy(ctx->buf + i, p, len);
+            return;
+        }
+        memcpy(ctx->buf + i, p, n);
+        SHA256_transform(ctx->state, ctx->buf);
+        p += n;
+        len -= n;
+    }
+
+    for (; len >= (int)sizeof(ctx->buf); len -= sizeof(ctx->buf)) {
+        SHA256_transform(ctx->state, p);
+        p += sizeof(ctx->buf);
+    }
+
+    memcpy(ctx->buf, p, len);
+}
+
+const uint8_t* SHA256_final(SHA256_CTX* ctx) {
+    uint64_t cnt = ctx->count * 8;
+    int i = ctx->count % sizeof(ctx->buf);
+
+    ctx->buf[i++] = 0x80;
+    if (i > (int)sizeof(ctx->buf) - 8) {
+        memset(ctx->buf + i, 0, sizeof(ctx->buf) - i);
+        SHA256_transform(ctx->state, ctx->buf);
+        i = 0;
+    }
+    memset(ctx->buf + i, 0, sizeof(ctx->buf) - 8 - i);
+    store_be32(ctx->buf + 56, cnt >> 32);
+    store_be32(ctx->buf + 60, cnt);
+    SHA256_transform(ctx->state, ctx->buf);
+
+    for (i = 0; i < 8; i++)
+        store_be32(ctx->buf + 4 * i, ctx->state[i]);
+
+    return ctx->buf;
+}
+
+const uint8_t* SHA256_hash(const void* data, int len, uint8_t* digest) {
+    SHA256_CTX ctx;
+
+    SHA256_init(&ctx);
+    SHA256_update(&ctx, data, len);
+    memcpy(digest, SHA256_final(&ctx), SHA256_DIGEST_SIZE);
+
+    return digest;
+}
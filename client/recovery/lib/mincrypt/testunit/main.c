@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <utils/log.h>
+#include <utils/hash.h>
+
+#define LOG_TAG "test_hash"
+
+#include <utils/testunit.h>
+
+/*
+ * Checks MD5, SHA-1 and SHA-256 against the FIPS and RFC 1321 vectors,
+ * fed whole, split at every byte and from every alignment, and hash_file()
+ * over windows of a file against the same data in memory, in software and
+ * again with the kernel crypto API selected (software where the kernel has
+ * no AF_ALG), then times the kernels and hash_file() against the 1 KB
+ * read() loop it replaces, and the kernel against software.
+ */
+
+#define MAX_LEN         300
+#define MAX_ALIGN       16
+#define FILE_SIZE       (HASH_FILE_WINDOW + HASH_FILE_WINDOW / 2 + 1234)
+#define BENCH_SIZE      (64 << 20)
+#define TEST_FILE       "/tmp/test_hash.bin"
+
+struct vector {
+    const char* msg;
+    int repeat;
+    const char* digest[HASH_TYPES];
+};
+
+static const struct vector vectors[] = {
+    {"", 1, {
+        "d41d8cd98f00b204e9800998ecf8427e",
+        "da39a3ee5e6b4b0d3255bfef95601890afd80709",
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"}},
+    {"abc", 1, {
+        "900150983cd24fb0d6963f7d28e17f72",
+        "a9993e364706816aba3e25717850c26c9cd0d89d",
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"}},
+    {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1, {
+        "8215ef0796a20bcaaae116d3876c664a",
+        "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"}},
+    {"a", 1000000, {
+        "7707d6ae4e027c70eea2a935c2296f21",
+        "34aa973cd4c4daa4f61eeb2bdbad27316534016f",
+        "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"}},
+};
+
+static uint8_t buf[MAX_ALIGN + MAX_LEN];
+
+/*
+ * The backend in effect, known once a context has been opened
+ */
+static const char* label(int type, char* buf, const char* what) {
+    sprintf(buf, "%s%s %s", hash_name(type),
+            hash_backend(type) == HASH_BACKEND_KERNEL ? " kernel" : "", what);
+    return buf;
+}
+
+static void fill_random(uint8_t* p, int len) {
+    for (int i = 0; i < len; i++)
+        p[i] = rand();
+}
+
+static void digest_of(int type, const uint8_t* p, int len, uint8_t* digest) {
+    struct hash_ctx ctx;
+    const uint8_t* d;
+
+    hash_init(&ctx, type);
+    hash_update(&ctx, p, len);
+    d = hash_final(&ctx);
+    if (d)
+        memcpy(digest, d, hash_digest_size(type));
+    else
+        memset(digest, 0, hash_digest_size(type));
+}
+
+static void test_vectors(void) {
+    char str[HASH_MAX_STR_LEN + 1];
+    char name[64];
+
+    for (int type = 0; type < HASH_TYPES; type++) {
+        int ok = 1;
+
+        for (int i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+            struct hash_ctx ctx;
+            const uint8_t* digest;
+
+            hash_init(&ctx, type);
+            for (int n = 0; n < vectors[i].repeat; n++)
+                hash_update(&ctx, vectors[i].msg, strlen(vectors[i].msg));
+
+            digest = hash_final(&ctx);
+            ok &= digest && !strcmp(hash_to_hex(digest,
+                    hash_digest_size(type), str), vectors[i].digest[type]);
+        }
+
+        report(label(type, name, "vectors"), ok);
+    }
+}
+
+static void test_lengths(void) {
+    uint8_t whole[HASH_MAX_DIGEST_SIZE];
+    uint8_t digest[HASH_MAX_DIGEST_SIZE];
+    char name[64];
+
+    fill_random(buf, sizeof(buf));
+
+    for (int type = 0; type < HASH_TYPES; type++) {
+        int size = hash_digest_size(type);
+        int ok = 1;
+
+        /*
+         * A copy at every alignment hashes as the aligned original
+         */
+        for (int len = 0; len <= MAX_LEN; len++) {
+            digest_of(type, buf, len, whole);
+            for (int align = 1; align < MAX_ALIGN; align++) {
+                uint8_t copy[MAX_ALIGN + MAX_LEN];
+
+                memcpy(copy + align, buf, len);
+                digest_of(type, copy + align, len, digest);
+                ok &= !memcmp(digest, whole, size);
+            }
+        }
+
+        digest_of(type, buf, MAX_LEN, whole);
+        for (int at = 0; at <= MAX_LEN; at++) {
+            struct hash_ctx ctx;
+            const uint8_t* d;
+
+            hash_init(&ctx, type);
+            hash_update(&ctx, buf, at);
+            hash_update(&ctx, buf + at, MAX_LEN - at);
+            d = hash_final(&ctx);
+            ok &= d && !memcmp(d, whole, size);
+        }
+
+        report(label(type, name, "alignments and splits"), ok);
+    }
+}
+
+static int write_file(const char* path, const uint8_t* p, int len) {
+    FILE* f = fopen(path, "wb");
+    int ok;
+
+    if (f == NULL)
+        return -1;
+
+    ok = fwrite(p, 1, len, f) == len;
+    fclose(f);
+
+    return ok ? 0 : -1;
+}
+
+static int file_matches(const uint8_t* data, uint64_t offset, int64_t length) {
+    struct hash_ctx ctxs[HASH_TYPES];
+    uint8_t digest[HASH_MAX_DIGEST_SIZE];
+    uint64_t len = length < 0 ? FILE_SIZE - offset : length;
+    int ok = 1;
+
+    for (int type = 0; type < HASH_TYPES; type++)
+        hash_init(&ctxs[type], type);
+
+    if (hash_file(TEST_FILE, offset, length, ctxs, HASH_TYPES) < 0) {
+        for (int type = 0; type < HASH_TYPES; type++)
+            hash_destroy(&ctxs[type]);
+        return 0;
+    }
+
+    for (int type = 0; type < HASH_TYPES; type++) {
+        const uint8_t* d = hash_final(&ctxs[type]);
+
+        digest_of(type, data + offset, len, digest);
+        ok &= d && !memcmp(d, digest, hash_digest_size(type));
+    }
+
+    /*
+     * On its own, a kernel context has the file spliced to it
+     */
+    for (int type = 0; type < HASH_TYPES; type++) {
+        struct hash_ctx ctx;
+        const uint8_t* d;
+
+        hash_init(&ctx, type);
+        if (hash_file(TEST_FILE, offset, length, &ctx, 1) < 0) {
+            hash_destroy(&ctx);
+            return 0;
+        }
+
+        d = hash_final(&ctx);
+        digest_of(type, data + offset, len, digest);
+        ok &= d && !memcmp(d, digest, hash_digest_size(type));
+    }
+
+    return ok;
+}
+
+static void test_file(void) {
+    uint8_t* data = malloc(FILE_SIZE);
+    char str[HASH_MAX_STR_LEN + 1];
+    struct hash_ctx ctx;
+    int ok;
+
+    if (data == NULL || (fill_random(data, FILE_SIZE),
+            write_file(TEST_FILE, data, FILE_SIZE) < 0)) {
+        report("hash file", 0);
+        free(data);
+        return;
+    }
+
+    ok = file_matches(data, 0, -1)
+            && file_matches(data, 0, FILE_SIZE)
+            && file_matches(data, 1, FILE_SIZE - 22)
+            && file_matches(data, 4095, HASH_FILE_WINDOW + 3)
+            && file_matches(data, HASH_FILE_WINDOW + 77, -1)
+            && file_matches(data, FILE_SIZE, 0);
+    report("hash file windows", ok);
+
+    hash_init(&ctx, HASH_MD5);
+    ok = hash_file(TEST_FILE, 1, FILE_SIZE, &ctx, 1) < 0
+            && hash_file(TEST_FILE, FILE_SIZE + 1, -1, &ctx, 1) < 0
+            && hash_file("/nonexistent", 0, -1, &ctx, 1) < 0;
+    hash_destroy(&ctx);
+    report("hash file short and missing", ok);
+
+    digest_of(HASH_MD5, data, FILE_SIZE, ctx.digest);
+    hash_to_hex(ctx.digest, 16, str);
+    ok = hash_check_file(TEST_FILE, HASH_MD5, str) == 0;
+    str[0] = str[0] == '0' ? '1' : '0';
+    ok &= hash_check_file(TEST_FILE, HASH_MD5, str) < 0;
+    report("check file md5", ok);
+
+    free(data);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double mb_s(uint64_t bytes, double ms) {
+    return bytes / 1048576.0 / (ms / 1e3);
+}
+
+static double bench_update(int type, const uint8_t* p, int chunk) {
+    struct hash_ctx ctx;
+    double t = now_ms();
+
+    hash_init(&ctx, type);
+    for (int done = 0; done < BENCH_SIZE; done += chunk)
+        hash_update(&ctx, p + done, chunk);
+    if (hash_final(&ctx) == NULL)
+        return 0;
+
+    return mb_s(BENCH_SIZE, now_ms() - t);
+}
+
+/*
+ * What check_file_md5() did before hash_file()
+ */
+static double bench_read_loop(void) {
+    unsigned char block[1024];
+    unsigned char digest[16];
+    MD5_CTX md5;
+    double t = now_ms();
+    int fd = open(TEST_FILE, O_RDONLY);
+    int n;
+
+    if (fd < 0)
+        return 0;
+
+    MD5Init(&md5);
+    while ((n = read(fd, block, sizeof(block))) > 0)
+        MD5Update(&md5, block, n);
+    MD5Final(&md5, digest);
+    close(fd);
+
+    return mb_s(BENCH_SIZE, now_ms() - t);
+}
+
+static double bench_file(int mask) {
+    struct hash_ctx ctxs[HASH_TYPES];
+    double t = now_ms();
+    int count = 0;
+
+    for (int type = 0; type < HASH_TYPES; type++)
+        if (mask & HASH_MASK(type))
+            hash_init(&ctxs[count++], type);
+
+    if (hash_file(TEST_FILE, 0, -1, ctxs, count) < 0) {
+        for (int i = 0; i < count; i++)
+            hash_destroy(&ctxs[i]);
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++)
+        if (hash_final(&ctxs[i]) == NULL)
+            return 0;
+
+    return mb_s(BENCH_SIZE, now_ms() - t);
+}
+
+static void bench(void) {
+    uint8_t* data = malloc(BENCH_SIZE);
+
+    if (data == NULL) {
+        LOGE("Cannot allocate %d bytes of memory\n", BENCH_SIZE);
+        failures++;
+        return;
+    }
+    fill_random(data, BENCH_SIZE);
+
+    for (int type = 0; type < HASH_TYPES; type++)
+        LOGI("%-6s 64 B %.1f MB/s, 4 KB %.1f MB/s, 1 MB %.1f MB/s\n",
+                hash_name(type), bench_update(type, data, 64),
+                bench_update(type, data + 1, 4096),
+                bench_update(type, data, 1 << 20));
+
+    if (write_file(TEST_FILE, data, BENCH_SIZE) < 0) {
+        report("bench file", 0);
+        free(data);
+        return;
+    }
+
+    /*
+     * Warm, the page cache is the same for all of them
+     */
+    bench_file(HASH_MASK(HASH_MD5));
+    LOGI("md5 of %d MB file: 1 KB read() %.1f MB/s, hash_file %.1f MB/s\n",
+            BENCH_SIZE >> 20, bench_read_loop(),
+            bench_file(HASH_MASK(HASH_MD5)));
+    LOGI("sha1 %.1f MB/s, sha256 %.1f MB/s, both in one pass %.1f MB/s\n",
+            bench_file(HASH_MASK(HASH_SHA1)),
+            bench_file(HASH_MASK(HASH_SHA256)),
+            bench_file(HASH_MASK(HASH_SHA1) | HASH_MASK(HASH_SHA256)));
+
+    /*
+     * The same through the kernel crypto API, the file spliced
+     */
+    for (int type = 0; type < HASH_TYPES; type++) {
+        struct hash_ctx ctx;
+
+        hash_set_backend(type, HASH_BACKEND_KERNEL);
+        hash_init(&ctx, type);
+        hash_destroy(&ctx);
+
+        if (hash_backend(type) != HASH_BACKEND_KERNEL) {
+            LOGI("%-6s no kernel hash, software only\n", hash_name(type));
+            continue;
+        }
+
+        LOGI("%-6s kernel 4 KB %.1f MB/s, 1 MB %.1f MB/s, file %.1f MB/s\n",
+                hash_name(type), bench_update(type, data, 4096),
+                bench_update(type, data, 1 << 20),
+                bench_file(HASH_MASK(type)));
+        hash_set_backend(type, HASH_BACKEND_SOFT);
+    }
+
+    free(data);
+}
+
+static void set_backends(int backend) {
+    for (int type = 0; type < HASH_TYPES; type++)
+        hash_set_backend(type, backend);
+}
+
+int main(int argc, char* argv[]) {
+    test_vectors();
+    test_lengths();
+    test_file();
+
+    set_backends(HASH_BACKEND_KERNEL);
+    test_vectors();
+    test_lengths();
+    test_file();
+    set_backends(HASH_BACKEND_SOFT);
+
+    bench();
+
+    unlink(TEST_FILE);
+
+    return report_summary();
+}
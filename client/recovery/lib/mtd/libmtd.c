@@ -856,7 +856,8 @@ int mtd_unlock(const struct mtd_dev_info *mtd, int fd, int eb)
 	return mtd_xlock(mtd, fd, eb, MEMUNLOCK);
 }
 
-int mtd_erase(libmtd_t desc, const struct mtd_dev_info *mtd, int fd, int eb)
+int mtd_erase_multi(libmtd_t desc, const struct mtd_dev_info *mtd, int fd,
+		    int eb, int blocks)
 {
 	int ret;
 	struct libmtd *lib = (struct libmtd *)desc;
@@ -867,8 +868,15 @@ int mtd_erase(libmtd_t desc, const struct mtd_dev_info *mtd, int fd, int eb)
 	if (ret)
 		return ret;
 
+	if (blocks < 1 || eb + blocks > mtd->eb_cnt) {
+		LOGE("bad eraseblock count %d from %d, mtd%d has %d eraseblocks",
+		     blocks, eb, mtd->mtd_num, mtd->eb_cnt);
+		errno = EINVAL;
+		return -1;
+	}
+
 	ei64.start = (__u64)eb * mtd->eb_size;
-	ei64.length = mtd->eb_size;
+	ei64.length = (__u64)blocks * mtd->eb_size;
 
 	if (lib->offs64_ioctls == OFFS64_IOCTLS_SUPPORTED ||
 	        lib->offs64_ioctls == OFFS64_IOCTLS_UNKNOWN) {
@@ -903,6 +911,11 @@ int mtd_erase(libmtd_t desc, const struct mtd_dev_info *mtd, int fd, int eb)
 	return 0;
 }
 
+int mtd_erase(libmtd_t desc, const struct mtd_dev_info *mtd, int fd, int eb)
+{
+	return mtd_erase_multi(desc, mtd, fd, eb, 1);
+}
+
 int mtd_regioninfo(int fd, int regidx, struct region_info_user *reginfo)
 {
 	int ret;
@@ -1078,16 +1091,10 @@ int mtd_read(const struct mtd_dev_info *mtd, int fd, int eb, int offs,
 		return -1;
 	}
 
-	/* Seek to the beginning of the eraseblock */
 	seek = (off_t)eb * mtd->eb_size + offs;
-	if (lseek(fd, seek, SEEK_SET) != seek) {
-		LOGE("cannot seek mtd%d to offset %"PRIdoff_t,
-		     mtd->mtd_num, seek);
-		return -1;
-	}
 
 	while (rd < len) {
-		ret = read(fd, buf + rd, len - rd);
+		ret = pread(fd, buf + rd, len - rd, seek + rd);
 		if (ret < 0) {
 			LOGE("cannot read %d bytes from mtd%d (eraseblock %d, offset %d)",
 			     len - rd, mtd->mtd_num, eb, offs + rd);
@@ -1195,14 +1202,10 @@ int mtd_write(libmtd_t desc, const struct mtd_dev_info *mtd, int fd, int eb,
 		}
 	}
 	if (data) {
-		/* Seek to the beginning of the eraseblock */
-		if (lseek(fd, seek, SEEK_SET) != seek) {
-			LOGE("cannot seek mtd%d to offset %"PRIdoff_t,
-			     mtd->mtd_num, seek);
-			return -1;
-		}
-		ret = write(fd, data, len);
+		ret = pwrite(fd, data, len, seek);
 		if (ret != len) {
+			if (ret >= 0)
+				errno = EIO;
 			LOGE("cannot write %d bytes to mtd%d "
 			     "(eraseblock %d, offset %d)",
 			     len, mtd->mtd_num, eb, offs);
@@ -1449,3 +1452,19 @@ int mtd_probe_node(libmtd_t desc, const char *node)
 	errno = 0;
 	return -1;
 }
+
+int mtd_dev_open(libmtd_t desc, const struct mtd_dev_info *mtd, int flags)
+{
+	char node[sizeof(MTD_DEV_NODE_PATT) + 20];
+
+	sprintf(node, MTD_DEV_NODE_PATT, mtd->mtd_num);
+	return open(node, flags);
+}
+
+int mtd_get_ecc_stats(const struct mtd_dev_info *mtd, int fd,
+		      struct mtd_ecc_stats *stats)
+{
+	if (ioctl(fd, ECCGETSTATS, stats) < 0)
+		return mtd_ioctl_error(mtd, 0, "ECCGETSTATS");
+	return 0;
+}
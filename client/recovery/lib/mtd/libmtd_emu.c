@@ -0,0 +1,1129 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#define _GNU_SOURCE /* for fallocate */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <linux/falloc.h>
+#include <utils/log.h>
+#include <lib/libcommon.h>
+#include <lib/mtd/mtd-user.h>
+#include <lib/libmtd.h>
+#include <lib/libmtd_emu.h>
+
+#define LOG_TAG "libmtd_emu"
+
+#define EMU_OOB_SUFFIX      ".oob"
+#define EMU_BAD_MARKER_POS  0
+#define EMU_AUTO_OOB_POS    2       /* past the bad block marker */
+#define EMU_ECC_BYTES(oob)  ((oob) * 3 / 8)     /* at the tail of the OOB */
+
+struct emu_part {
+    char name[MTD_NAME_MAX + 1];
+    long long start;
+    long long size;
+    uint32_t corrected;
+    uint32_t failed;
+};
+
+static struct {
+    pthread_mutex_t lock;           /* the chip, one operation at a time */
+    int ready;
+    struct mtd_emu_config cfg;
+    int fd;
+    int oob_fd;
+    int part_cnt;
+    struct emu_part parts[MTD_EMU_MAX_PARTS];
+    struct mtd_emu_fault faults[MTD_EMU_MAX_FAULTS];
+    int fault_cnt;
+    struct mtd_emu_stats stats;
+    long long power_cut;            /* programs and erases left, 0: none */
+    mtd_emu_power_cut_t cut;
+    int powered_off;
+    uint8_t *page;
+    uint8_t *oob;
+} emu = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+    .oob_fd = -1,
+};
+
+void mtd_emu_default_config(struct mtd_emu_config *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+
+    strcpy(cfg->image, "/tmp/mtd_emu.img");
+    cfg->type = MTD_NANDFLASH;
+    cfg->size = 64 << 20;
+    cfg->eb_size = 128 << 10;
+    cfg->page_size = 2048;
+    cfg->subpage_size = 2048;
+    cfg->oob_size = 64;
+}
+
+static int emu_parse_size(const char *s, char **end, long long *size) {
+    long long val = strtoll(s, end, 0);
+
+    if (*end == s || val < 0)
+        return -1;
+
+    switch (**end) {
+    case 'G':
+        val <<= 10;
+    case 'M':
+        val <<= 10;
+    case 'K':
+        val <<= 10;
+        (*end)++;
+    default:
+        break;
+    }
+
+    *size = val;
+
+    return 0;
+}
+
+/*
+ * Partitions in the mtdparts syntax of the kernel, "1M(boot),-(rootfs)"
+ */
+static int emu_parse_parts(struct mtd_emu_config *cfg, const char *s) {
+    char *end;
+
+    cfg->part_cnt = 0;
+
+    while (*s) {
+        struct mtd_emu_part *part = &cfg->parts[cfg->part_cnt];
+        const char *close;
+
+        if (cfg->part_cnt == MTD_EMU_MAX_PARTS)
+            return -1;
+
+        if (*s == '-') {
+            part->size = 0;
+            end = (char *)s + 1;
+        } else if (emu_parse_size(s, &end, &part->size) < 0 || !part->size) {
+            return -1;
+        }
+
+        if (*end != '(' || (close = strchr(end, ')')) == NULL
+                || close - end - 1 >= (int)sizeof(part->name))
+            return -1;
+
+        memcpy(part->name, end + 1, close - end - 1);
+        part->name[close - end - 1] = '\0';
+        cfg->part_cnt++;
+
+        s = close + 1;
+        if (*s == ',')
+            s++;
+        else if (*s)
+            return -1;
+    }
+
+    return 0;
+}
+
+int mtd_emu_parse_config(struct mtd_emu_config *cfg, const char *spec) {
+    char *copy = strdup(spec), *save = NULL, *word, *end;
+    long long val;
+    int retval = -1;
+
+    if (copy == NULL)
+        return -1;
+
+    for (word = strtok_r(copy, " \t\n", &save); word;
+            word = strtok_r(NULL, " \t\n", &save)) {
+        char *value = strchr(word, '=');
+
+        if (value == NULL)
+            goto out;
+        *value++ = '\0';
+
+        if (!strcmp(word, "image")) {
+            if (strlen(value) >= sizeof(cfg->image))
+                goto out;
+            strcpy(cfg->image, value);
+
+        } else if (!strcmp(word, "type")) {
+            if (!strcmp(value, "nand"))
+                cfg->type = MTD_NANDFLASH;
+            else if (!strcmp(value, "mlc"))
+                cfg->type = MTD_MLCNANDFLASH;
+            else if (!strcmp(value, "nor"))
+                cfg->type = MTD_NORFLASH;
+            else
+                goto out;
+
+        } else if (!strcmp(word, "parts")) {
+            if (emu_parse_parts(cfg, value) < 0)
+                goto out;
+
+        } else if (!strcmp(word, "bad")) {
+            for (cfg->bad_cnt = 0; *value; cfg->bad_cnt++) {
+                if (cfg->bad_cnt == MTD_EMU_MAX_BAD)
+                    goto out;
+                cfg->bad[cfg->bad_cnt] = strtol(value, &end, 0);
+                if (end == value || (*end && *end != ','))
+                    goto out;
+                value = *end ? end + 1 : end;
+            }
+
+        } else if (!strcmp(word, "latency")) {
+            for (int i = 0; i < MTD_EMU_OP_MAX; i++) {
+                cfg->latency_us[i] = strtol(value, &end, 0);
+                if (end == value || (*end && *end != ','))
+                    goto out;
+                value = *end ? end + 1 : end;
+            }
+
+        } else {
+            if (emu_parse_size(value, &end, &val) < 0 || *end)
+                goto out;
+
+            if (!strcmp(word, "size"))
+                cfg->size = val;
+            else if (!strcmp(word, "eb"))
+                cfg->eb_size = val;
+            else if (!strcmp(word, "page"))
+                cfg->page_size = cfg->subpage_size = val;
+            else if (!strcmp(word, "subpage"))
+                cfg->subpage_size = val;
+            else if (!strcmp(word, "oob"))
+                cfg->oob_size = val;
+            else
+                goto out;
+        }
+    }
+
+    retval = 0;
+
+out:
+    if (retval < 0)
+        LOGE("Bad emulator configuration at \"%s\"\n", word);
+    free(copy);
+    return retval;
+}
+
+static int emu_is_nand(void) {
+    return emu.cfg.type == MTD_NANDFLASH || emu.cfg.type == MTD_MLCNANDFLASH;
+}
+
+static void emu_invert(uint8_t *buf, long long len) {
+    while (len && ((uintptr_t)buf & (sizeof(uint64_t) - 1))) {
+        *buf = ~*buf;
+        buf++;
+        len--;
+    }
+
+    for (; len >= (long long)sizeof(uint64_t); len -= sizeof(uint64_t)) {
+        *(uint64_t *)buf = ~*(uint64_t *)buf;
+        buf += sizeof(uint64_t);
+    }
+
+    while (len--) {
+        *buf = ~*buf;
+        buf++;
+    }
+}
+
+static int emu_pread(int fd, void *buf, long long len, long long offset) {
+    uint8_t *p = buf;
+    long long left = len;
+
+    while (left > 0) {
+        ssize_t n = pread(fd, p, left, offset);
+
+        if (n <= 0) {
+            if (n == 0)
+                errno = EIO;
+            return -1;
+        }
+        p += n;
+        left -= n;
+        offset += n;
+    }
+
+    emu_invert(buf, len);
+
+    return 0;
+}
+
+/*
+ * Stores buf, which is inverted in place
+ */
+static int emu_pwrite(int fd, void *buf, long long len, long long offset) {
+    uint8_t *p = buf;
+
+    emu_invert(buf, len);
+
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+
+        if (n <= 0) {
+            if (n == 0)
+                errno = EIO;
+            return -1;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+static int emu_punch(int fd, long long offset, long long len) {
+    static const uint8_t zero[4096];
+
+    if (!fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset,
+            len))
+        return 0;
+
+    for (; len > 0; len -= MIN(len, (long long)sizeof(zero))) {
+        if (pwrite(fd, zero, MIN(len, (long long)sizeof(zero)), offset)
+                < 0)
+            return -1;
+        offset += sizeof(zero);
+    }
+
+    return 0;
+}
+
+static void emu_busy(int op, long long units) {
+    long long ns = units * emu.cfg.latency_us[op] * 1000LL;
+    struct timespec ts;
+
+    if (ns <= 0)
+        return;
+
+    emu.stats.busy_ns += ns;
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+/*
+ * Error injected into an operation on chip block eb, 0 if none
+ */
+static int emu_fault(int op, long long eb) {
+    for (int i = 0; i < emu.fault_cnt; i++) {
+        struct mtd_emu_fault *f = &emu.faults[i];
+
+        if (f->op != op || (f->eb >= 0 && f->eb != eb) || !f->count)
+            continue;
+
+        if (f->skip > 0) {
+            f->skip--;
+            continue;
+        }
+
+        if (f->count > 0)
+            f->count--;
+        emu.stats.faults++;
+
+        return f->error;
+    }
+
+    return 0;
+}
+
+/*
+ * Counts a program or erase down to the power cut, 1 if it is the one
+ * cut, with the chip lock held
+ */
+static int emu_power_cut_due(void) {
+    return emu.power_cut > 0 && !--emu.power_cut;
+}
+
+/*
+ * What the cut operation got done stays on the chip, the chip is dead
+ * from then on
+ */
+static void emu_power_off(void) {
+    emu.powered_off = 1;
+    if (emu.cut)
+        emu.cut(&emu.stats);
+}
+
+static struct emu_part* emu_get_part(const struct mtd_dev_info *mtd) {
+    if (emu.powered_off) {
+        errno = EIO;
+        return NULL;
+    }
+
+    if (!emu.ready || mtd->mtd_num < 0 || mtd->mtd_num >= emu.part_cnt) {
+        errno = ENODEV;
+        return NULL;
+    }
+
+    return &emu.parts[mtd->mtd_num];
+}
+
+static int emu_valid_erase_block(const struct mtd_dev_info *mtd, int eb) {
+    if (eb < 0 || eb >= mtd->eb_cnt) {
+        LOGE("bad eraseblock number %d, mtd%d has %d eraseblocks\n",
+             eb, mtd->mtd_num, mtd->eb_cnt);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int emu_valid_range(const struct mtd_dev_info *mtd, int eb, int offs,
+        int len) {
+    if (emu_valid_erase_block(mtd, eb) < 0)
+        return -1;
+
+    if (offs < 0 || len < 0 || offs + len > mtd->eb_size) {
+        LOGE("bad offset %d or length %d, mtd%d eraseblock size is %d\n",
+             offs, len, mtd->mtd_num, mtd->eb_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static long long emu_oob_offset(long long addr) {
+    return addr / emu.cfg.page_size * emu.cfg.oob_size;
+}
+
+/*
+ * Chip block eb reads as bad, with the chip lock held
+ */
+static int emu_block_is_bad(long long eb) {
+    uint8_t marker;
+
+    if (!emu_is_nand() || emu.oob_fd < 0)
+        return 0;
+
+    if (emu_pread(emu.oob_fd, &marker, 1,
+            emu_oob_offset(eb * emu.cfg.eb_size) + EMU_BAD_MARKER_POS) < 0)
+        return -1;
+
+    return marker != 0xff;
+}
+
+static int emu_block_mark_bad(long long eb) {
+    uint8_t marker = 0;
+
+    return emu_pwrite(emu.oob_fd, &marker, 1,
+            emu_oob_offset(eb * emu.cfg.eb_size) + EMU_BAD_MARKER_POS);
+}
+
+/*
+ * ANDs data into what lies at offset, like programming flash cells
+ */
+static int emu_program(int fd, uint8_t *scratch, const uint8_t *data,
+        long long len, long long offset, int *dirty) {
+    if (emu_pread(fd, scratch, len, offset) < 0)
+        return -1;
+
+    for (long long i = 0; i < len; i++) {
+        if (scratch[i] != 0xff)
+            *dirty = 1;
+        scratch[i] &= data[i];
+    }
+
+    return emu_pwrite(fd, scratch, len, offset);
+}
+
+/*
+ * Stores the controller's ECC of the pages of data in their OOB. Like on
+ * most controllers, an all-0xFF page does not get an all-0xFF ECC.
+ */
+static int emu_program_ecc(const uint8_t *data, long long len,
+        long long offset) {
+    int ecc_len = EMU_ECC_BYTES(emu.cfg.oob_size);
+    uint8_t ecc[ecc_len];
+    int dirty;
+
+    for (long long done = 0; done < len; done += emu.cfg.page_size) {
+        long long n = MIN(len - done, (long long)emu.cfg.page_size);
+        uint8_t sum = 0xa5;
+
+        for (long long i = 0; i < n; i++)
+            sum ^= data[done + i];
+        memset(ecc, sum, ecc_len);
+
+        if (emu_program(emu.oob_fd, emu.oob, ecc, ecc_len,
+                emu_oob_offset(offset + done) + emu.cfg.oob_size - ecc_len,
+                &dirty) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void emu_close(void) {
+    if (emu.fd >= 0)
+        close(emu.fd);
+    if (emu.oob_fd >= 0)
+        close(emu.oob_fd);
+    emu.fd = emu.oob_fd = -1;
+
+    free(emu.page);
+    free(emu.oob);
+    emu.page = emu.oob = NULL;
+    emu.ready = 0;
+}
+
+static int emu_open_file(const char *path, long long size) {
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        LOGE("Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    /*
+     * An image of another size starts erased
+     */
+    if (fstat(fd, &st) < 0 || (st.st_size != size
+            && (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0))) {
+        LOGE("Cannot size %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int mtd_emu_setup(const struct mtd_emu_config *cfg) {
+    char path[PATH_MAX + sizeof(EMU_OOB_SUFFIX)];
+    long long start = 0;
+    int i;
+
+    if (cfg->eb_size <= 0 || cfg->page_size <= 0 || cfg->subpage_size <= 0
+            || cfg->eb_size % cfg->page_size
+            || cfg->page_size % cfg->subpage_size
+            || cfg->size <= 0 || cfg->size % cfg->eb_size
+            || (cfg->type != MTD_NORFLASH && cfg->oob_size <= 0)
+            || cfg->part_cnt > MTD_EMU_MAX_PARTS
+            || cfg->bad_cnt > MTD_EMU_MAX_BAD) {
+        LOGE("Bad emulator geometry\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&emu.lock);
+
+    emu_close();
+    memcpy(&emu.cfg, cfg, sizeof(*cfg));
+    if (emu.cfg.type == MTD_NORFLASH)
+        emu.cfg.oob_size = 0;
+
+    emu.part_cnt = 0;
+    for (i = 0; i < cfg->part_cnt || (!i && !cfg->part_cnt); i++) {
+        struct emu_part *part = &emu.parts[i];
+        long long size = cfg->part_cnt ? cfg->parts[i].size : 0;
+
+        if (!size)
+            size = cfg->size - start;
+
+        if (size <= 0 || size % cfg->eb_size || start + size > cfg->size) {
+            LOGE("Partition %d does not fit the chip\n", i);
+            goto error;
+        }
+
+        memset(part, 0, sizeof(*part));
+        snprintf(part->name, sizeof(part->name), "%s",
+                 cfg->part_cnt ? cfg->parts[i].name : "emu");
+        part->start = start;
+        part->size = size;
+        start += size;
+        emu.part_cnt++;
+    }
+
+    emu.page = malloc(cfg->eb_size);
+    emu.oob = malloc(cfg->eb_size / cfg->page_size * (cfg->oob_size + 1));
+    if (emu.page == NULL || emu.oob == NULL) {
+        LOGE("Cannot allocate emulator buffers\n");
+        goto error;
+    }
+
+    emu.fd = emu_open_file(cfg->image, cfg->size);
+    if (emu.fd < 0)
+        goto error;
+
+    if (emu.cfg.oob_size) {
+        snprintf(path, sizeof(path), "%s%s", cfg->image, EMU_OOB_SUFFIX);
+        emu.oob_fd = emu_open_file(path,
+                cfg->size / cfg->page_size * cfg->oob_size);
+        if (emu.oob_fd < 0)
+            goto error;
+
+        for (i = 0; i < cfg->bad_cnt; i++) {
+            if (cfg->bad[i] < 0 || (long long)cfg->bad[i] * cfg->eb_size
+                    >= cfg->size || emu_block_mark_bad(cfg->bad[i]) < 0) {
+                LOGE("Cannot make block %d bad\n", cfg->bad[i]);
+                goto error;
+            }
+        }
+    }
+
+    emu.fault_cnt = 0;
+    memset(&emu.stats, 0, sizeof(emu.stats));
+    emu.power_cut = 0;
+    emu.cut = NULL;
+    emu.powered_off = 0;
+    emu.ready = 1;
+
+    pthread_mutex_unlock(&emu.lock);
+
+    LOGI("%s: %lld bytes, eb %d, page %d, oob %d, %d partitions\n",
+         cfg->image, cfg->size, cfg->eb_size, cfg->page_size,
+         emu.cfg.oob_size, emu.part_cnt);
+
+    return 0;
+
+error:
+    emu_close();
+    pthread_mutex_unlock(&emu.lock);
+    return -1;
+}
+
+void mtd_emu_teardown(void) {
+    pthread_mutex_lock(&emu.lock);
+    emu_close();
+    pthread_mutex_unlock(&emu.lock);
+}
+
+int mtd_emu_add_fault(const struct mtd_emu_fault *fault) {
+    int retval = -1;
+
+    if (fault->op < 0 || fault->op >= MTD_EMU_OP_MAX || !fault->error)
+        return -1;
+
+    pthread_mutex_lock(&emu.lock);
+    if (emu.fault_cnt < MTD_EMU_MAX_FAULTS) {
+        emu.faults[emu.fault_cnt++] = *fault;
+        retval = 0;
+    }
+    pthread_mutex_unlock(&emu.lock);
+
+    return retval;
+}
+
+void mtd_emu_clear_faults(void) {
+    pthread_mutex_lock(&emu.lock);
+    emu.fault_cnt = 0;
+    pthread_mutex_unlock(&emu.lock);
+}
+
+void mtd_emu_set_power_cut(long long after, mtd_emu_power_cut_t cut) {
+    pthread_mutex_lock(&emu.lock);
+    emu.power_cut = after > 0 ? after : 0;
+    emu.cut = cut;
+    pthread_mutex_unlock(&emu.lock);
+}
+
+void mtd_emu_get_stats(struct mtd_emu_stats *stats) {
+    pthread_mutex_lock(&emu.lock);
+    *stats = emu.stats;
+    pthread_mutex_unlock(&emu.lock);
+}
+
+void mtd_emu_reset_stats(void) {
+    pthread_mutex_lock(&emu.lock);
+    memset(&emu.stats, 0, sizeof(emu.stats));
+    pthread_mutex_unlock(&emu.lock);
+}
+
+/*
+ * libmtd
+ */
+libmtd_t libmtd_open(void) {
+    struct mtd_emu_config cfg;
+    const char *spec = getenv("MTD_EMU");
+
+    if (emu.ready)
+        return &emu;
+
+    mtd_emu_default_config(&cfg);
+    if (spec && mtd_emu_parse_config(&cfg, spec) < 0)
+        return NULL;
+
+    if (mtd_emu_setup(&cfg) < 0)
+        return NULL;
+
+    return &emu;
+}
+
+void libmtd_close(libmtd_t desc) {
+    /*
+     * The image stays until mtd_emu_teardown(), for the next user
+     */
+}
+
+int mtd_dev_present(libmtd_t desc, int mtd_num) {
+    return emu.ready && mtd_num >= 0 && mtd_num < emu.part_cnt;
+}
+
+int mtd_get_info(libmtd_t desc, struct mtd_info *info) {
+    if (!emu.ready) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    memset(info, 0, sizeof(*info));
+    info->mtd_dev_cnt = emu.part_cnt;
+    info->lowest_mtd_num = 0;
+    info->highest_mtd_num = emu.part_cnt - 1;
+    info->sysfs_supported = 1;
+
+    return 0;
+}
+
+int mtd_get_dev_info1(libmtd_t desc, int mtd_num, struct mtd_dev_info *mtd) {
+    struct emu_part *part;
+
+    if (!mtd_dev_present(desc, mtd_num)) {
+        errno = ENODEV;
+        return -1;
+    }
+    part = &emu.parts[mtd_num];
+
+    memset(mtd, 0, sizeof(*mtd));
+    mtd->mtd_num = mtd_num;
+    mtd->major = 90;
+    mtd->minor = mtd_num * 2;
+    mtd->type = emu.cfg.type;
+    strcpy((char *)mtd->type_str, emu.cfg.type == MTD_NORFLASH ? "nor"
+           : emu.cfg.type == MTD_MLCNANDFLASH ? "mlc-nand" : "nand");
+    strcpy((char *)mtd->name, part->name);
+    mtd->size = part->size;
+    mtd->eb_size = emu.cfg.eb_size;
+    mtd->eb_cnt = part->size / emu.cfg.eb_size;
+    mtd->min_io_size = emu.cfg.type == MTD_NORFLASH ? 1 : emu.cfg.page_size;
+    mtd->subpage_size = emu.cfg.type == MTD_NORFLASH ? 1 : emu.cfg.subpage_size;
+    mtd->oob_size = emu.cfg.oob_size;
+    mtd->writable = 1;
+    mtd->bb_allowed = emu_is_nand();
+
+    return 0;
+}
+
+int mtd_get_dev_info(libmtd_t desc, const char *node, struct mtd_dev_info *mtd) {
+    int mtd_num;
+
+    if (sscanf(node, "/dev/mtd%d", &mtd_num) != 1) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    return mtd_get_dev_info1(desc, mtd_num, mtd);
+}
+
+int mtd_probe_node(libmtd_t desc, const char *node) {
+    int mtd_num;
+
+    if (sscanf(node, "/dev/mtd%d", &mtd_num) == 1
+            && mtd_dev_present(desc, mtd_num))
+        return 1;
+
+    errno = ENODEV;
+    return -1;
+}
+
+/*
+ * Any descriptor will do, the operations go by mtd->mtd_num
+ */
+int mtd_dev_open(libmtd_t desc, const struct mtd_dev_info *mtd, int flags) {
+    if (emu_get_part(mtd) == NULL)
+        return -1;
+
+    return dup(emu.fd);
+}
+
+int mtd_lock(const struct mtd_dev_info *mtd, int fd, int eb) {
+    return emu_valid_erase_block(mtd, eb);
+}
+
+int mtd_unlock(const struct mtd_dev_info *mtd, int fd, int eb) {
+    return emu_valid_erase_block(mtd, eb);
+}
+
+int mtd_is_locked(const struct mtd_dev_info *mtd, int fd, int eb) {
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+int mtd_regioninfo(int fd, int regidx, struct region_info_user *reginfo) {
+    errno = ENODEV;
+    return -1;
+}
+
+int mtd_erase_multi(libmtd_t desc, const struct mtd_dev_info *mtd, int fd,
+                    int eb, int blocks) {
+    struct emu_part *part = emu_get_part(mtd);
+    int error = 0;
+
+    if (part == NULL || emu_valid_erase_block(mtd, eb) < 0)
+        return -1;
+
+    if (blocks < 1 || eb + blocks > mtd->eb_cnt) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&emu.lock);
+
+    /*
+     * Block by block like the kernel does, the ones before a failure stay
+     * erased
+     */
+    for (int i = 0; i < blocks && !error; i++) {
+        long long offset = part->start + (long long)(eb + i) * mtd->eb_size;
+        long long chip_eb = offset / mtd->eb_size;
+        int bad = emu_block_is_bad(chip_eb);
+
+        emu_busy(MTD_EMU_OP_ERASE, 1);
+        emu.stats.ops[MTD_EMU_OP_ERASE]++;
+
+        if (emu_power_cut_due()) {
+            emu_punch(emu.fd, offset, mtd->eb_size / 2);
+            if (emu.oob_fd >= 0)
+                emu_punch(emu.oob_fd, emu_oob_offset(offset),
+                          emu_oob_offset(mtd->eb_size / 2));
+            emu_power_off();
+            error = EIO;
+            break;
+        }
+
+        error = bad ? EIO : emu_fault(MTD_EMU_OP_ERASE, chip_eb);
+        if (bad < 0)
+            error = errno;
+        if (error)
+            break;
+
+        if (emu_punch(emu.fd, offset, mtd->eb_size) < 0
+                || (emu.oob_fd >= 0 && emu_punch(emu.oob_fd,
+                    emu_oob_offset(offset), emu_oob_offset(mtd->eb_size)) < 0))
+            error = errno;
+        else
+            emu.stats.bytes[MTD_EMU_OP_ERASE] += mtd->eb_size;
+    }
+
+    pthread_mutex_unlock(&emu.lock);
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+int mtd_erase(libmtd_t desc, const struct mtd_dev_info *mtd, int fd, int eb) {
+    return mtd_erase_multi(desc, mtd, fd, eb, 1);
+}
+
+int mtd_read(const struct mtd_dev_info *mtd, int fd, int eb, int offs,
+             void *buf, int len) {
+    struct emu_part *part = emu_get_part(mtd);
+    long long offset;
+    int error;
+
+    if (part == NULL || emu_valid_range(mtd, eb, offs, len) < 0)
+        return -1;
+
+    offset = part->start + (long long)eb * mtd->eb_size + offs;
+
+    pthread_mutex_lock(&emu.lock);
+
+    emu_busy(MTD_EMU_OP_READ, (len + emu.cfg.page_size - 1)
+             / emu.cfg.page_size);
+    emu.stats.ops[MTD_EMU_OP_READ]++;
+
+    error = emu_fault(MTD_EMU_OP_READ, offset / mtd->eb_size);
+    if (error != EIO && emu_pread(emu.fd, buf, len, offset) < 0)
+        error = errno;
+    else if (error != EIO)
+        emu.stats.bytes[MTD_EMU_OP_READ] += len;
+
+    /*
+     * Corrected bitflips only show in the ECC stats
+     */
+    if (error == EUCLEAN) {
+        part->corrected++;
+        error = 0;
+    } else if (error == EBADMSG) {
+        part->failed++;
+    }
+
+    pthread_mutex_unlock(&emu.lock);
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+int mtd_write(libmtd_t desc, const struct mtd_dev_info *mtd, int fd, int eb,
+              int offs, void *data, int len, void *oob, int ooblen,
+              uint8_t mode) {
+    struct emu_part *part = emu_get_part(mtd);
+    long long offset, oob_offset;
+    int error, dirty = 0;
+
+    if (part == NULL || emu_valid_range(mtd, eb, offs, len) < 0)
+        return -1;
+
+    if (offs % mtd->subpage_size || len % mtd->subpage_size) {
+        LOGE("write offset %d or length %d is not aligned to mtd%d "
+             "min. I/O size %d\n", offs, len, mtd->mtd_num,
+             mtd->subpage_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    offset = part->start + (long long)eb * mtd->eb_size + offs;
+    oob_offset = emu_oob_offset(offset)
+            + (mode == MTD_OPS_AUTO_OOB ? EMU_AUTO_OOB_POS : 0);
+
+    if (oob && (emu.oob_fd < 0 || oob_offset + ooblen
+            > emu_oob_offset(offset) + mtd->oob_size)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&emu.lock);
+
+    emu_busy(MTD_EMU_OP_PROGRAM, (len + emu.cfg.page_size - 1)
+             / emu.cfg.page_size);
+    emu.stats.ops[MTD_EMU_OP_PROGRAM]++;
+
+    if (emu_power_cut_due()) {
+        if (data)
+            emu_program(emu.fd, emu.page, data, len / 2, offset, &dirty);
+        emu_power_off();
+        error = EIO;
+    } else {
+        error = emu_fault(MTD_EMU_OP_PROGRAM, offset / mtd->eb_size);
+    }
+    if (!error && data && emu_program(emu.fd, emu.page, data, len, offset,
+            &dirty) < 0)
+        error = errno;
+    if (!error && data && emu.oob_fd >= 0 && mode != MTD_OPS_RAW
+            && emu_program_ecc(data, len, offset) < 0)
+        error = errno;
+    if (!error && oob && emu_program(emu.oob_fd, emu.oob, oob, ooblen,
+            oob_offset, &dirty) < 0)
+        error = errno;
+
+    if (!error) {
+        emu.stats.bytes[MTD_EMU_OP_PROGRAM] += data ? len : 0;
+        emu.stats.reprograms += dirty;
+    }
+
+    pthread_mutex_unlock(&emu.lock);
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int emu_oob_op(const struct mtd_dev_info *mtd, uint64_t start,
+        uint64_t length, void *data, int write) {
+    struct emu_part *part = emu_get_part(mtd);
+    long long offset, oob_offset;
+    int ooboffs, error = 0, dirty = 0;
+
+    if (part == NULL)
+        return -1;
+
+    ooboffs = start % emu.cfg.page_size;
+    offset = part->start + start - ooboffs;
+    if (emu.oob_fd < 0 || start >= (uint64_t)mtd->size
+            || ooboffs + length > (uint64_t)mtd->oob_size) {
+        errno = EINVAL;
+        return -1;
+    }
+    oob_offset = emu_oob_offset(offset) + ooboffs;
+
+    pthread_mutex_lock(&emu.lock);
+
+    if (write) {
+        emu_busy(MTD_EMU_OP_PROGRAM, 1);
+        emu.stats.ops[MTD_EMU_OP_PROGRAM]++;
+        if (emu_power_cut_due()) {
+            emu_power_off();
+            error = EIO;
+        } else {
+            error = emu_fault(MTD_EMU_OP_PROGRAM, offset / mtd->eb_size);
+        }
+        if (!error && emu_program(emu.oob_fd, emu.oob, data, length,
+                oob_offset, &dirty) < 0)
+            error = errno;
+    } else {
+        emu_busy(MTD_EMU_OP_READ, 1);
+        emu.stats.ops[MTD_EMU_OP_READ]++;
+        if (emu_pread(emu.oob_fd, data, length, oob_offset) < 0)
+            error = errno;
+    }
+
+    pthread_mutex_unlock(&emu.lock);
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+int mtd_read_oob(libmtd_t desc, const struct mtd_dev_info *mtd, int fd,
+                 uint64_t start, uint64_t length, void *data) {
+    return emu_oob_op(mtd, start, length, data, 0);
+}
+
+int mtd_write_oob(libmtd_t desc, const struct mtd_dev_info *mtd, int fd,
+                  uint64_t start, uint64_t length, void *data) {
+    return emu_oob_op(mtd, start, length, data, 1);
+}
+
+int mtd_write_img(const struct mtd_dev_info *mtd, int fd, int eb, int offs,
+                  const char *img_name) {
+    LOGE("mtd_write_img() is not emulated\n");
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+int mtd_is_bad(const struct mtd_dev_info *mtd, int fd, int eb) {
+    struct emu_part *part = emu_get_part(mtd);
+    int retval;
+
+    if (part == NULL || emu_valid_erase_block(mtd, eb) < 0)
+        return -1;
+
+    if (!mtd->bb_allowed)
+        return 0;
+
+    pthread_mutex_lock(&emu.lock);
+    retval = emu_block_is_bad(part->start / mtd->eb_size + eb);
+    pthread_mutex_unlock(&emu.lock);
+
+    return retval;
+}
+
+int mtd_mark_bad(const struct mtd_dev_info *mtd, int fd, int eb) {
+    struct emu_part *part = emu_get_part(mtd);
+    int retval;
+
+    if (!mtd->bb_allowed) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (part == NULL || emu_valid_erase_block(mtd, eb) < 0)
+        return -1;
+
+    pthread_mutex_lock(&emu.lock);
+    retval = emu_block_mark_bad(part->start / mtd->eb_size + eb);
+    if (!retval)
+        emu.stats.marked_bad++;
+    pthread_mutex_unlock(&emu.lock);
+
+    return retval;
+}
+
+/*
+ * Erases, programs and checks the block with a few patterns, returns 0
+ * if it went through all of them
+ */
+int mtd_torture(libmtd_t desc, const struct mtd_dev_info *mtd, int fd, int eb) {
+    static const uint8_t patterns[] = {0xa5, 0x5a, 0x0};
+    uint8_t *buf = malloc(mtd->eb_size);
+    int retval = -1;
+
+    if (buf == NULL)
+        return -1;
+
+    LOGW("run torture test for PEB %d\n", eb);
+
+    for (unsigned int i = 0; i < sizeof(patterns); i++) {
+        if (mtd_erase(desc, mtd, fd, eb)
+                || mtd_read(mtd, fd, eb, 0, buf, mtd->eb_size))
+            goto out;
+
+        for (int j = 0; j < mtd->eb_size; j++)
+            if (buf[j] != 0xff)
+                goto bad;
+
+        memset(buf, patterns[i], mtd->eb_size);
+        if (mtd_write(desc, mtd, fd, eb, 0, buf, mtd->eb_size, NULL, 0, 0)
+                || mtd_read(mtd, fd, eb, 0, buf, mtd->eb_size))
+            goto out;
+
+        for (int j = 0; j < mtd->eb_size; j++)
+            if (buf[j] != patterns[i])
+                goto bad;
+    }
+
+    retval = mtd_erase(desc, mtd, fd, eb);
+    goto out;
+
+bad:
+    LOGE("PEB %d failed torture test\n", eb);
+    errno = EIO;
+out:
+    free(buf);
+    return retval;
+}
+
+int mtd_get_ecc_stats(const struct mtd_dev_info *mtd, int fd,
+                      struct mtd_ecc_stats *stats) {
+    struct emu_part *part = emu_get_part(mtd);
+    long long first;
+    int bad;
+
+    if (part == NULL)
+        return -1;
+
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&emu.lock);
+
+    stats->corrected = part->corrected;
+    stats->failed = part->failed;
+    first = part->start / mtd->eb_size;
+    for (long long eb = first; eb < first + mtd->eb_cnt; eb++) {
+        bad = emu_block_is_bad(eb);
+        if (bad > 0)
+            stats->badblocks++;
+    }
+
+    pthread_mutex_unlock(&emu.lock);
+
+    return 0;
+}
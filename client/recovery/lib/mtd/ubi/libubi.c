@@ -32,6 +32,7 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/sysmacros.h>
 #include <lib/ubi/libubi.h>
 #include <lib/ubi/libubi_int.h>
 #include <lib/libcommon.h>
@@ -114,10 +114,8 @@ static struct mounted_volume*
     list_for_each(pos, &this->list) {
         struct mounted_volume* volume = list_entry(pos,
                 struct mounted_volume, head);
-        if (volume->device != NULL) {
-            if (!strcmp(volume->device, device))
-                return volume;
-        }
+        if (!strcmp(volume->device, device))
+            return volume;
     }
 
     return NULL;
@@ -133,10 +131,8 @@ static struct mounted_volume*
 
         struct mounted_volume* volume = list_entry(pos,
                 struct mounted_volume, head);
-        if (volume->mount_point != NULL) {
-            if (!strcmp(volume->mount_point, mount_point))
-                return volume;
-        }
+        if (!strcmp(volume->mount_point, mount_point))
+            return volume;
     }
 
     return NULL;
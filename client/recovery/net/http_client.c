@@ -0,0 +1,801 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include <version.h>
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <net/http_client.h>
+
+#define LOG_TAG "http_client"
+
+#define HTTP_LINE_MAX       1024
+
+/*
+ * Return values of one request attempt
+ */
+#define HTTP_OK             0
+#define HTTP_RETRY          -1
+#define HTTP_FATAL          -2
+#define HTTP_REDIRECT       -3
+
+struct http_transfer {
+    http_data_cb_t cb;
+    void* param;
+    int64_t skip;           /* leading body bytes to drop */
+    int64_t want;           /* bytes to deliver, -1 for all */
+    int64_t delivered;
+    int partial;            /* stopped before the end of the body */
+};
+
+static int parse_url(const char* url, char* host, int* port,
+        const char** path) {
+    const char* p;
+    const char* end;
+    size_t len;
+
+    if (strncasecmp(url, "http://", 7)) {
+        LOGE("Unsupported url: %s\n", url);
+        return -1;
+    }
+
+    p = url + 7;
+    end = p + strcspn(p, ":/");
+    len = end - p;
+    if (!len || len >= HTTP_HOST_MAX) {
+        LOGE("Bad host in url: %s\n", url);
+        return -1;
+    }
+
+    memcpy(host, p, len);
+    host[len] = '\0';
+
+    *port = 80;
+    if (*end == ':') {
+        *port = strtol(end + 1, (char **)&end, 10);
+        if (*port <= 0 || *port > 65535) {
+            LOGE("Bad port in url: %s\n", url);
+            return -1;
+        }
+    }
+
+    *path = *end ? end : "/";
+
+    return 0;
+}
+
+static void disconnect(struct http_client* this) {
+    if (this->socket >= 0)
+        close(this->socket);
+
+    this->socket = -1;
+    this->buffer_pos = 0;
+    this->buffer_len = 0;
+}
+
+static int connect_with_timeout(int sock, const struct sockaddr* addr,
+        socklen_t addrlen, int timeout_ms) {
+    int flags = fcntl(sock, F_GETFL, 0);
+    int error = 0;
+    socklen_t len = sizeof(error);
+    struct pollfd pfd;
+
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+
+    if (connect(sock, addr, addrlen) < 0) {
+        if (errno != EINPROGRESS)
+            return -1;
+
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+
+        if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+            return -1;
+
+        if (error) {
+            errno = error;
+            return -1;
+        }
+    }
+
+    fcntl(sock, F_SETFL, flags);
+
+    return 0;
+}
+
+static int do_connect(struct http_client* this, const char* host, int port) {
+    char service[8];
+    struct addrinfo hints;
+    struct addrinfo* result;
+    struct addrinfo* rp;
+    struct timeval tv;
+    int error;
+
+    if (this->socket >= 0 && this->port == port && !strcmp(this->host, host))
+        return 0;
+
+    disconnect(this);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", port);
+
+    error = getaddrinfo(host, service, &hints, &result);
+    if (error) {
+        LOGE("Failed to resolve %s: %s\n", host, gai_strerror(error));
+        return -1;
+    }
+
+    for (rp = result; rp != NULL; rp = rp->ai_next) {
+        int sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (sock < 0)
+            continue;
+
+        if (!connect_with_timeout(sock, rp->ai_addr, rp->ai_addrlen,
+                this->timeout_ms)) {
+            this->socket = sock;
+            break;
+        }
+
+        close(sock);
+    }
+
+    freeaddrinfo(result);
+
+    if (this->socket < 0) {
+        LOGE("Failed to connect %s:%d: %s\n", host, port, strerror(errno));
+        return -1;
+    }
+
+    tv.tv_sec = this->timeout_ms / 1000;
+    tv.tv_usec = (this->timeout_ms % 1000) * 1000;
+    setsockopt(this->socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(this->socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    strcpy(this->host, host);
+    this->port = port;
+    this->stats.connects++;
+
+    return 0;
+}
+
+static int send_all(struct http_client* this, const char* buf, size_t len) {
+    while (len) {
+        ssize_t n = send(this->socket, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return -1;
+
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int fill_buffer(struct http_client* this) {
+    ssize_t n;
+
+    for (;;) {
+        n = recv(this->socket, this->buffer, HTTP_BUFFER_SIZE, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        break;
+    }
+
+    if (n < 0) {
+        LOGE("Failed to receive from %s: %s\n", this->host, strerror(errno));
+        return -1;
+    }
+
+    this->buffer_pos = 0;
+    this->buffer_len = n;
+
+    return n;
+}
+
+static int read_line(struct http_client* this, char* line, size_t max) {
+    size_t len = 0;
+
+    for (;;) {
+        if (this->buffer_pos == this->buffer_len && fill_buffer(this) <= 0)
+            return -1;
+
+        char c = this->buffer[this->buffer_pos++];
+        if (c == '\n')
+            break;
+
+        if (len + 1 < max)
+            line[len++] = c;
+    }
+
+    if (len && line[len - 1] == '\r')
+        len--;
+
+    line[len] = '\0';
+
+    return len;
+}
+
+static int deliver(struct http_client* this, struct http_transfer* xfer,
+        const char* buf, uint32_t len) {
+    if (xfer->skip) {
+        uint32_t n = MIN((int64_t)len, xfer->skip);
+
+        xfer->skip -= n;
+        buf += n;
+        len -= n;
+    }
+
+    if (xfer->want >= 0)
+        len = MIN((int64_t)len, xfer->want - xfer->delivered);
+
+    if (!len)
+        return HTTP_OK;
+
+    if (xfer->cb(buf, len, xfer->param) < 0)
+        return HTTP_FATAL;
+
+    xfer->delivered += len;
+    this->stats.bytes += len;
+
+    return HTTP_OK;
+}
+
+static inline int transfer_done(struct http_transfer* xfer) {
+    return xfer->want >= 0 && xfer->delivered == xfer->want;
+}
+
+/*
+ * Pass up to @length body bytes (-1 for until close) to the transfer
+ */
+static int read_body(struct http_client* this, struct http_transfer* xfer,
+        int64_t length) {
+    int error;
+
+    while (length) {
+        if (this->buffer_pos == this->buffer_len) {
+            int n = fill_buffer(this);
+            if (n < 0)
+                return HTTP_RETRY;
+
+            if (n == 0)
+                return length < 0 ? HTTP_OK : HTTP_RETRY;
+        }
+
+        uint32_t avail = this->buffer_len - this->buffer_pos;
+        if (length > 0)
+            avail = MIN((int64_t)avail, length);
+
+        error = deliver(this, xfer, this->buffer + this->buffer_pos, avail);
+        if (error != HTTP_OK)
+            return error;
+
+        this->buffer_pos += avail;
+        if (length > 0)
+            length -= avail;
+
+        /*
+         * Got everything asked for, the rest of the body is not needed
+         */
+        if (transfer_done(xfer) && length) {
+            xfer->partial = 1;
+            return HTTP_OK;
+        }
+    }
+
+    return HTTP_OK;
+}
+
+static int read_chunked_body(struct http_client* this,
+        struct http_transfer* xfer) {
+    char line[HTTP_LINE_MAX];
+    int error;
+
+    for (;;) {
+        if (read_line(this, line, sizeof(line)) < 0)
+            return HTTP_RETRY;
+
+        int64_t size = strtoll(line, NULL, 16);
+        if (size < 0)
+            return HTTP_RETRY;
+
+        if (size == 0)
+            break;
+
+        error = read_body(this, xfer, size);
+        if (error != HTTP_OK)
+            return error;
+
+        if (transfer_done(xfer)) {
+            xfer->partial = 1;
+            return HTTP_OK;
+        }
+
+        if (read_line(this, line, sizeof(line)) != 0)
+            return HTTP_RETRY;
+    }
+
+    /*
+     * Trailers
+     */
+    do {
+        error = read_line(this, line, sizeof(line));
+        if (error < 0)
+            return HTTP_RETRY;
+    } while (error > 0);
+
+    return HTTP_OK;
+}
+
+static int read_response_header(struct http_client* this,
+        struct http_response* response) {
+    char line[HTTP_LINE_MAX];
+    int minor = 0;
+
+    memset(response, 0, sizeof(*response));
+    response->content_length = -1;
+    response->total_length = -1;
+    this->location[0] = '\0';
+
+    if (read_line(this, line, sizeof(line)) < 0)
+        return HTTP_RETRY;
+
+    if (sscanf(line, "HTTP/1.%d %d", &minor, &response->status) != 2) {
+        LOGE("Bad status line: %s\n", line);
+        return HTTP_RETRY;
+    }
+
+    response->keep_alive = minor >= 1;
+
+    for (;;) {
+        int len = read_line(this, line, sizeof(line));
+        if (len < 0)
+            return HTTP_RETRY;
+
+        if (len == 0)
+            break;
+
+        char* value = strchr(line, ':');
+        if (value == NULL)
+            continue;
+
+        *value++ = '\0';
+        while (*value == ' ' || *value == '\t')
+            value++;
+
+        if (!strcasecmp(line, "Content-Length")) {
+            response->content_length = strtoll(value, NULL, 10);
+
+        } else if (!strcasecmp(line, "Transfer-Encoding")) {
+            response->chunked = strcasestr(value, "chunked") != NULL;
+
+        } else if (!strcasecmp(line, "Connection")) {
+            if (!strcasecmp(value, "close"))
+                response->keep_alive = 0;
+            else if (!strcasecmp(value, "keep-alive"))
+                response->keep_alive = 1;
+
+        } else if (!strcasecmp(line, "Location")) {
+            snprintf(this->location, sizeof(this->location), "%s", value);
+
+        } else if (!strcasecmp(line, "Accept-Ranges")) {
+            response->accept_ranges = !strcasecmp(value, "bytes");
+
+        } else if (!strcasecmp(line, "Content-Range")) {
+            long long start = 0, end = 0, total = -1;
+
+            if (sscanf(value, "bytes %lld-%lld/%lld", &start, &end, &total) >= 2) {
+                response->range_start = start;
+                response->total_length = total;
+                response->accept_ranges = 1;
+            }
+        }
+    }
+
+    if (response->status == 200)
+        response->total_length = response->content_length;
+
+    return HTTP_OK;
+}
+
+static inline int is_redirect(int status) {
+    return status == 301 || status == 302 || status == 303
+            || status == 307 || status == 308;
+}
+
+/*
+ * Turns the Location of a redirect into an absolute url, a bare path
+ * is taken relative to the host it came from
+ */
+static int resolve_location(struct http_client* this, const char* host,
+        int port) {
+    char path[HTTP_URL_MAX];
+
+    if (!strncasecmp(this->location, "http://", 7))
+        return 0;
+
+    if (this->location[0] != '/') {
+        LOGE("Unsupported redirect to \"%s\"\n", this->location);
+        return -1;
+    }
+
+    strcpy(path, this->location);
+    if (snprintf(this->location, sizeof(this->location), "http://%s:%d%s",
+            host, port, path) >= (int)sizeof(this->location)) {
+        LOGE("Redirect url too long\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * One request/response exchange on the (possibly reused) connection.
+ * Body bytes from @start on are handed to @xfer, @end is inclusive or -1.
+ */
+static int do_request(struct http_client* this, const char* method,
+        const char* url, int64_t start, int64_t end,
+        struct http_response* response, struct http_transfer* xfer) {
+    char host[HTTP_HOST_MAX];
+    char request[HTTP_LINE_MAX * 2];
+    char range[64] = {0};
+    const char* path;
+    int port;
+    int error;
+    int reused;
+
+    if (parse_url(url, host, &port, &path) < 0)
+        return HTTP_FATAL;
+
+    if (start > 0 || end >= 0) {
+        if (end >= 0)
+            snprintf(range, sizeof(range), "Range: bytes=%" PRId64 "-%" PRId64 "\r\n",
+                    start, end);
+        else
+            snprintf(range, sizeof(range), "Range: bytes=%" PRId64 "-\r\n", start);
+    }
+
+    snprintf(request, sizeof(request),
+            "%s %s HTTP/1.1\r\n"
+            "Host: %s:%d\r\n"
+            "User-Agent: recovery/%s\r\n"
+            "Accept: */*\r\n"
+            "Connection: keep-alive\r\n"
+            "%s"
+            "\r\n", method, path, host, port, VERSION, range);
+
+    for (int attempt = 0; ; attempt++) {
+        reused = this->socket >= 0 && this->port == port
+                && !strcmp(this->host, host);
+
+        if (do_connect(this, host, port) < 0)
+            return HTTP_RETRY;
+
+        this->stats.requests++;
+
+        error = send_all(this, request, strlen(request));
+        if (!error)
+            error = read_response_header(this, response);
+
+        if (!error) {
+            memcpy(&this->response, response, sizeof(*response));
+            break;
+        }
+
+        disconnect(this);
+
+        /*
+         * The server may have dropped an idle keep-alive connection
+         */
+        if (!reused || attempt)
+            return HTTP_RETRY;
+    }
+
+    if (is_redirect(response->status)) {
+        disconnect(this);
+
+        return resolve_location(this, host, port) < 0 ? HTTP_FATAL
+                : HTTP_REDIRECT;
+    }
+
+    if (!strcmp(method, "HEAD")) {
+        if (!response->keep_alive)
+            disconnect(this);
+
+        return response->status / 100 == 2 ? HTTP_OK : HTTP_FATAL;
+    }
+
+    if (response->status != 200 && response->status != 206) {
+        LOGE("%s %s: HTTP %d\n", method, url, response->status);
+        disconnect(this);
+
+        return response->status >= 500 ? HTTP_RETRY : HTTP_FATAL;
+    }
+
+    if (response->status == 206 && response->range_start != start) {
+        LOGE("Server returned range from %" PRId64 " instead of %" PRId64 "\n",
+                response->range_start, start);
+        disconnect(this);
+        return HTTP_FATAL;
+    }
+
+    /*
+     * Server ignored our range, drop what we already have
+     */
+    xfer->skip = response->status == 200 ? start : 0;
+    xfer->partial = 0;
+
+    if (response->chunked)
+        error = read_chunked_body(this, xfer);
+    else if (response->content_length >= 0)
+        error = read_body(this, xfer, response->content_length);
+    else {
+        response->keep_alive = 0;
+        error = read_body(this, xfer, -1);
+    }
+
+    /*
+     * Keep the connection only if the whole body was consumed
+     */
+    if (error != HTTP_OK || !response->keep_alive || xfer->partial
+            || this->buffer_pos != this->buffer_len)
+        disconnect(this);
+
+    if (error == HTTP_OK && xfer->want >= 0 && !transfer_done(xfer)) {
+        LOGE("Short body from %s: %" PRId64 " of %" PRId64 "\n", url, xfer->delivered,
+                xfer->want);
+        return HTTP_RETRY;
+    }
+
+    return error;
+}
+
+/*
+ * do_request() following redirects, each attempt starts over from @url
+ */
+static int request(struct http_client* this, const char* method,
+        const char* url, int64_t start, int64_t end,
+        struct http_response* response, struct http_transfer* xfer) {
+    char target[HTTP_URL_MAX];
+    int error;
+
+    for (int hops = 0; ; hops++) {
+        error = do_request(this, method, url, start, end, response, xfer);
+        if (error != HTTP_REDIRECT)
+            return error;
+
+        if (hops == HTTP_MAX_REDIRECTS) {
+            LOGE("Too many redirects from %s\n", url);
+            return HTTP_FATAL;
+        }
+
+        LOGI("%s: HTTP %d to %s\n", url, response->status, this->location);
+
+        strcpy(target, this->location);
+        url = target;
+    }
+}
+
+static void backoff(struct http_client* this, int attempt) {
+    uint64_t delay = (uint64_t)this->backoff_ms << MIN(attempt, 16);
+
+    msleep(MIN(delay, (uint64_t)HTTP_MAX_BACKOFF_MS));
+}
+
+static int head(struct http_client* this, const char* url,
+        struct http_response* response) {
+    struct http_transfer xfer;
+    int error = HTTP_RETRY;
+
+    memset(&xfer, 0, sizeof(xfer));
+
+    for (int attempt = 0; attempt <= this->retries; attempt++) {
+        if (attempt) {
+            this->stats.retries++;
+            backoff(this, attempt - 1);
+        }
+
+        error = request(this, "HEAD", url, 0, -1, response, &xfer);
+        if (error != HTTP_RETRY)
+            break;
+    }
+
+    return error == HTTP_OK ? 0 : -1;
+}
+
+static int get(struct http_client* this, const char* url, int64_t offset,
+        int64_t length, http_data_cb_t cb, void* param) {
+    assert_die_if(url == NULL, "url is NULL\n");
+    assert_die_if(cb == NULL, "cb is NULL\n");
+
+    struct http_transfer xfer;
+    struct http_response response;
+    int error = HTTP_RETRY;
+
+    memset(&xfer, 0, sizeof(xfer));
+    xfer.cb = cb;
+    xfer.param = param;
+    xfer.want = length;
+
+    for (int attempt = 0; attempt <= this->retries; attempt++) {
+        if (attempt) {
+            this->stats.retries++;
+            if (xfer.delivered)
+                this->stats.resumes++;
+
+            LOGW("Retry %d/%d of %s from byte %" PRId64 "\n", attempt, this->retries,
+                    url, offset + xfer.delivered);
+            backoff(this, attempt - 1);
+        }
+
+        int64_t start = offset + xfer.delivered;
+        int64_t end = length >= 0 ? offset + length - 1 : -1;
+
+        if (length == 0)
+            return 0;
+
+        error = request(this, "GET", url, start, end, &response, &xfer);
+        if (error != HTTP_RETRY)
+            break;
+    }
+
+    if (error != HTTP_OK) {
+        LOGE("Failed to get %s\n", url);
+        return -1;
+    }
+
+    return 0;
+}
+
+int http_write_fd_cb(const void* buf, uint32_t len, void* param) {
+    int fd = *(int *)param;
+    const char* p = (const char *)buf;
+
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0) {
+            LOGE("Failed to write: %s\n", strerror(errno));
+            return -1;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Like wget -c, a file left by an earlier download is continued from its
+ * size rather than fetched again, and a failed download keeps what it got
+ */
+static int download(struct http_client* this, const char* url,
+        const char* path) {
+    struct http_response response;
+    struct stat st;
+    int64_t offset = 0;
+    int error = 0;
+    int fd;
+
+    if (!stat(path, &st) && st.st_size > 0) {
+        if (head(this, url, &response) < 0)
+            return -1;
+
+        if (response.total_length == st.st_size) {
+            LOGI("%s is already complete\n", path);
+            return 0;
+        }
+
+        /*
+         * Anything else than a shorter copy is refetched from scratch
+         */
+        if (response.total_length > st.st_size)
+            offset = st.st_size;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | (offset ? O_APPEND : O_TRUNC), 0644);
+    if (fd < 0) {
+        LOGE("Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (offset)
+        LOGI("Resuming %s from byte %" PRId64 "\n", path, offset);
+
+    error = get(this, url, offset, -1, http_write_fd_cb, &fd);
+
+    if (close(fd) < 0)
+        error = -1;
+
+    if (error < 0 && !stat(path, &st) && st.st_size == 0)
+        unlink(path);
+
+    return error;
+}
+
+static void set_timeout(struct http_client* this, int timeout_ms) {
+    this->timeout_ms = timeout_ms;
+
+    disconnect(this);
+}
+
+static void set_retry(struct http_client* this, int retries, int backoff_ms) {
+    this->retries = retries;
+    this->backoff_ms = backoff_ms;
+}
+
+void construct_http_client(struct http_client* this) {
+    this->set_timeout = set_timeout;
+    this->set_retry = set_retry;
+    this->head = head;
+    this->get = get;
+    this->download = download;
+    this->disconnect = disconnect;
+
+    this->socket = -1;
+    this->timeout_ms = HTTP_DEFAULT_TIMEOUT_MS;
+    this->retries = HTTP_DEFAULT_RETRIES;
+    this->backoff_ms = HTTP_DEFAULT_BACKOFF_MS;
+
+    this->buffer = (char *) malloc(HTTP_BUFFER_SIZE);
+    assert_die_if(this->buffer == NULL, "Failed to alloc http buffer\n");
+
+    memset(&this->response, 0, sizeof(this->response));
+    memset(&this->stats, 0, sizeof(this->stats));
+}
+
+void destruct_http_client(struct http_client* this) {
+    disconnect(this);
+
+    free(this->buffer);
+    this->buffer = NULL;
+
+    this->set_timeout = NULL;
+    this->set_retry = NULL;
+    this->head = NULL;
+    this->get = NULL;
+    this->download = NULL;
+    this->disconnect = NULL;
+}
@@ -0,0 +1,347 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <net/http_segmented.h>
+
+#define LOG_TAG "http_segmented"
+
+enum {
+    SEGMENT_FREE,
+    SEGMENT_BUSY,
+    SEGMENT_READY,
+};
+
+/*
+ * One per connection
+ */
+struct http_segment {
+    struct http_segmented* owner;
+    struct http_client* client;
+    pthread_t tid;
+    char* buffer;
+    uint32_t capacity;
+    uint32_t len;
+    uint32_t index;
+    int state;
+};
+
+static int fill_segment_cb(const void* buf, uint32_t len, void* param) {
+    struct http_segment* seg = (struct http_segment *) param;
+
+    if (len > seg->capacity - seg->len) {
+        LOGE("Segment %u overflow\n", seg->index);
+        return -1;
+    }
+
+    memcpy(seg->buffer + seg->len, buf, len);
+    seg->len += len;
+
+    return 0;
+}
+
+static void* segment_worker(void* param) {
+    struct http_segment* seg = (struct http_segment *) param;
+    struct http_segmented* this = seg->owner;
+
+    for (;;) {
+        pthread_mutex_lock(&this->lock);
+        while (!this->error && seg->state != SEGMENT_FREE)
+            pthread_cond_wait(&this->cond, &this->lock);
+
+        if (this->error || this->next_segment >= this->segment_count) {
+            pthread_mutex_unlock(&this->lock);
+            break;
+        }
+
+        seg->index = this->next_segment++;
+        seg->state = SEGMENT_BUSY;
+        seg->len = 0;
+        pthread_mutex_unlock(&this->lock);
+
+        int64_t offset = (int64_t) seg->index * this->segment_size;
+        int64_t length = MIN((int64_t) this->segment_size,
+                this->total - offset);
+
+        int error = seg->client->get(seg->client, this->url, offset, length,
+                fill_segment_cb, seg);
+        if (!error && seg->len != length) {
+            LOGE("Short segment %u: %u/%" PRId64 "\n", seg->index, seg->len,
+                    length);
+            error = -1;
+        }
+
+        pthread_mutex_lock(&this->lock);
+        if (error)
+            this->error = -1;
+        else
+            seg->state = SEGMENT_READY;
+        pthread_cond_broadcast(&this->cond);
+        pthread_mutex_unlock(&this->lock);
+    }
+
+    return NULL;
+}
+
+static struct http_segment* wait_segment(struct http_segmented* this,
+        uint32_t workers, uint32_t index) {
+    struct http_segment* seg = NULL;
+
+    pthread_mutex_lock(&this->lock);
+    while (!this->error && seg == NULL) {
+        for (uint32_t i = 0; i < workers; i++) {
+            if (this->segments[i].state == SEGMENT_READY &&
+                    this->segments[i].index == index) {
+                seg = &this->segments[i];
+                break;
+            }
+        }
+
+        if (seg == NULL)
+            pthread_cond_wait(&this->cond, &this->lock);
+    }
+    pthread_mutex_unlock(&this->lock);
+
+    return seg;
+}
+
+static void release_segment(struct http_segmented* this,
+        struct http_segment* seg, int error) {
+    pthread_mutex_lock(&this->lock);
+    if (error)
+        this->error = -1;
+    seg->state = SEGMENT_FREE;
+    pthread_cond_broadcast(&this->cond);
+    pthread_mutex_unlock(&this->lock);
+}
+
+static int probe_cb(const void* buf, uint32_t len, void* param) {
+    return 0;
+}
+
+static int get_segmented(struct http_segmented* this, const char* url,
+        http_data_cb_t cb, void* param) {
+    uint32_t workers;
+    uint32_t started = 0;
+    int error = 0;
+
+    this->segment_size = MIN(MAX((this->total + this->connections * 2 - 1)
+            / (this->connections * 2), (int64_t) HTTP_SEGMENT_MIN_SIZE),
+            (int64_t) HTTP_SEGMENT_MAX_SIZE);
+    this->segment_count = (this->total + this->segment_size - 1)
+            / this->segment_size;
+    this->next_segment = 0;
+    this->url = url;
+    this->error = 0;
+
+    workers = MIN((uint32_t) this->connections, this->segment_count);
+
+    LOGD("Fetch %s: %" PRId64 " bytes in %u segments over %u connections\n", url,
+            this->total, this->segment_count, workers);
+
+    for (uint32_t i = 0; i < workers; i++) {
+        struct http_segment* seg = &this->segments[i];
+
+        if (seg->capacity < this->segment_size) {
+            free(seg->buffer);
+            seg->buffer = (char *) malloc(this->segment_size);
+            seg->capacity = seg->buffer ? this->segment_size : 0;
+            if (seg->buffer == NULL) {
+                LOGE("Failed to alloc segment buffer\n");
+                this->error = -1;
+                break;
+            }
+        }
+
+        seg->owner = this;
+        seg->client = this->clients[i];
+        seg->state = SEGMENT_FREE;
+        seg->len = 0;
+
+        if (pthread_create(&seg->tid, NULL, segment_worker, seg)) {
+            LOGE("Failed to create segment worker: %s\n", strerror(errno));
+            this->error = -1;
+            break;
+        }
+
+        started++;
+    }
+
+    for (uint32_t i = 0; started && !error && i < this->segment_count; i++) {
+        struct http_segment* seg = wait_segment(this, started, i);
+        if (seg == NULL) {
+            error = -1;
+            break;
+        }
+
+        error = cb(seg->buffer, seg->len, param);
+        release_segment(this, seg, error);
+    }
+
+    /*
+     * Once every segment went out the workers leave on their own, on
+     * error they have to be told
+     */
+    if (error || !started) {
+        pthread_mutex_lock(&this->lock);
+        this->error = -1;
+        pthread_cond_broadcast(&this->cond);
+        pthread_mutex_unlock(&this->lock);
+    }
+
+    for (uint32_t i = 0; i < started; i++)
+        pthread_join(this->segments[i].tid, NULL);
+
+    if (this->error) {
+        LOGE("Failed to get %s\n", url);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int get(struct http_segmented* this, const char* url,
+        http_data_cb_t cb, void* param) {
+    assert_die_if(url == NULL, "url is NULL\n");
+    assert_die_if(cb == NULL, "cb is NULL\n");
+
+    struct http_client* client = this->clients[0];
+    struct http_response* response = &client->response;
+
+    if (this->connections < 2)
+        return client->get(client, url, 0, -1, cb, param);
+
+    /*
+     * A one byte range request tells both the size and whether the
+     * server honours ranges at all
+     */
+    if (client->get(client, url, 0, 1, probe_cb, NULL) < 0)
+        return -1;
+
+    if (response->status != 206 || response->total_length < 0) {
+        LOGW("%s: no range support, using a single connection\n", url);
+        return client->get(client, url, 0, -1, cb, param);
+    }
+
+    this->total = response->total_length;
+    if (this->total <= HTTP_SEGMENT_MIN_SIZE)
+        return client->get(client, url, 0, -1, cb, param);
+
+    return get_segmented(this, url, cb, param);
+}
+
+static int download(struct http_segmented* this, const char* url,
+        const char* path) {
+    int error = 0;
+    int fd;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOGE("Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    error = get(this, url, http_write_fd_cb, &fd);
+
+    if (close(fd) < 0)
+        error = -1;
+
+    if (error < 0)
+        unlink(path);
+
+    return error;
+}
+
+static void set_connections(struct http_segmented* this, int connections) {
+    connections = MIN(MAX(connections, 1), HTTP_SEGMENTED_MAX_CONNECTIONS);
+
+    for (int i = 0; i < HTTP_SEGMENTED_MAX_CONNECTIONS; i++) {
+        if (i < connections && this->clients[i] == NULL)
+            this->clients[i] = _new(struct http_client, http_client);
+
+        if (i >= connections && this->clients[i] != NULL) {
+            _delete(this->clients[i]);
+            this->clients[i] = NULL;
+        }
+    }
+
+    this->connections = connections;
+}
+
+static void get_stats(struct http_segmented* this, struct http_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    for (int i = 0; i < this->connections; i++) {
+        struct http_stats* s = &this->clients[i]->stats;
+
+        stats->requests += s->requests;
+        stats->connects += s->connects;
+        stats->retries += s->retries;
+        stats->resumes += s->resumes;
+        stats->bytes += s->bytes;
+    }
+}
+
+void construct_http_segmented(struct http_segmented* this) {
+    this->set_connections = set_connections;
+    this->get = get;
+    this->download = download;
+    this->get_stats = get_stats;
+
+    memset(this->clients, 0, sizeof(this->clients));
+    this->connections = 0;
+
+    this->segments = (struct http_segment *) calloc(
+            HTTP_SEGMENTED_MAX_CONNECTIONS, sizeof(struct http_segment));
+    assert_die_if(this->segments == NULL, "Failed to alloc segments\n");
+
+    pthread_mutex_init(&this->lock, NULL);
+    pthread_cond_init(&this->cond, NULL);
+
+    set_connections(this, 1);
+}
+
+void destruct_http_segmented(struct http_segmented* this) {
+    for (int i = 0; i < HTTP_SEGMENTED_MAX_CONNECTIONS; i++) {
+        if (this->clients[i])
+            _delete(this->clients[i]);
+        this->clients[i] = NULL;
+
+        free(this->segments[i].buffer);
+    }
+
+    free(this->segments);
+    this->segments = NULL;
+
+    pthread_mutex_destroy(&this->lock);
+    pthread_cond_destroy(&this->cond);
+
+    this->set_connections = NULL;
+    this->get = NULL;
+    this->download = NULL;
+    this->get_stats = NULL;
+}
@@ -0,0 +1,86 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <utils/log.h>
+#include <utils/common.h>
+#include <net/http_segmented.h>
+#include "http_server.h"
+
+#define LOG_TAG "bench_http_segmented"
+
+/*
+ * Throughput of one download versus the number of connections, against a
+ * loopback server throttled per connection to look like a slow link.
+ *
+ * usage: bench_http_segmented [size MB] [rate KB/s per connection]
+ *                             [latency ms]
+ */
+
+static struct http_server server;
+
+static int discard_cb(const void* buf, uint32_t len, void* param) {
+    *(uint64_t *)param += len;
+
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+    static const int connections[] = {1, 2, 4, 8};
+    char url[128];
+
+    memset(&server, 0, sizeof(server));
+    server.size = (argc > 1 ? atoi(argv[1]) : 16) * 1024 * 1024;
+    server.rate_kbps = argc > 2 ? atoi(argv[2]) : 2048;
+    server.latency_ms = argc > 3 ? atoi(argv[3]) : 20;
+    server.accept_ranges = 1;
+    server.keep_alive = 1;
+
+    if (http_server_start(&server) < 0)
+        return -1;
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/pattern", server.port);
+
+    LOGI("%" PRIu64 " bytes, %d KB/s per connection, %d ms latency\n",
+            server.size, server.rate_kbps, server.latency_ms);
+
+    for (int i = 0; i < sizeof(connections) / sizeof(connections[0]); i++) {
+        struct http_segmented* segmented = _new(struct http_segmented,
+                http_segmented);
+        struct http_stats stats;
+        uint64_t received = 0;
+
+        segmented->set_connections(segmented, connections[i]);
+
+        double start = now();
+        int error = segmented->get(segmented, url, discard_cb, &received);
+        double elapsed = now() - start;
+
+        segmented->get_stats(segmented, &stats);
+        _delete(segmented);
+
+        if (error || received != server.size) {
+            LOGE("%d connections: download failed\n", connections[i]);
+            http_server_stop(&server);
+            return -1;
+        }
+
+        LOGI("%d connections: %6.2f s, %7.2f MB/s, %u requests\n",
+                connections[i], elapsed, received / elapsed / (1024 * 1024),
+                stats.requests);
+    }
+
+    http_server_stop(&server);
+
+    return 0;
+}
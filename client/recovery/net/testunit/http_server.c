@@ -0,0 +1,362 @@
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <utils/log.h>
+#include <utils/common.h>
+#include "http_server.h"
+
+#define LOG_TAG "http_server"
+
+struct connection {
+    struct http_server* server;
+    int fd;
+};
+
+static int send_all(int fd, const void* buf, size_t len) {
+    const char* p = (const char *)buf;
+
+    while (len) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int recv_request(int fd, char* buf, size_t max) {
+    size_t len = 0;
+
+    while (len + 1 < max) {
+        ssize_t n = recv(fd, buf + len, 1, 0);
+        if (n <= 0)
+            return -1;
+
+        len += n;
+        buf[len] = '\0';
+        if (len >= 4 && !strcmp(buf + len - 4, "\r\n\r\n"))
+            return len;
+    }
+
+    return -1;
+}
+
+/*
+ * Throttled body sender, returns -1 once the connection should be cut
+ */
+static int send_body(struct http_server* server, int fd, int src_fd,
+        uint64_t start, uint64_t len, int drop, int chunked) {
+    char buf[8192];
+    char line[32];
+    uint64_t sent = 0;
+    struct timeval begin, now;
+
+    gettimeofday(&begin, NULL);
+
+    while (sent < len) {
+        uint32_t n = MIN((uint64_t)sizeof(buf), len - sent);
+
+        if (drop && sent + n > server->drop_after)
+            n = server->drop_after - sent;
+
+        if (src_fd >= 0) {
+            if (pread(src_fd, buf, n, start + sent) != (ssize_t)n)
+                return -1;
+        } else {
+            for (uint32_t i = 0; i < n; i++)
+                buf[i] = http_server_pattern(start + sent + i);
+        }
+
+        if (chunked) {
+            snprintf(line, sizeof(line), "%x\r\n", n);
+            if (send_all(fd, line, strlen(line)) < 0)
+                return -1;
+        }
+
+        if (send_all(fd, buf, n) < 0)
+            return -1;
+
+        if (chunked && send_all(fd, "\r\n", 2) < 0)
+            return -1;
+
+        sent += n;
+
+        if (drop && sent >= server->drop_after)
+            return -1;
+
+        if (server->rate_kbps) {
+            gettimeofday(&now, NULL);
+            int64_t elapsed = (now.tv_sec - begin.tv_sec) * 1000000LL
+                    + (now.tv_usec - begin.tv_usec);
+            int64_t expected = sent * 1000000LL / (server->rate_kbps * 1024LL);
+            if (expected > elapsed)
+                usleep(expected - elapsed);
+        }
+    }
+
+    if (chunked && send_all(fd, "0\r\n\r\n", 5) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int handle_request(struct http_server* server, int fd, char* request) {
+    char method[16] = {0};
+    char path[512] = {0};
+    char header[512];
+    char file[1024];
+    int src_fd = -1;
+    int drop = 0;
+    int chunked = 0;
+    int keep_alive = server->keep_alive;
+    uint64_t size;
+    int64_t start = 0, end = -1;
+    int ranged = 0;
+
+    if (sscanf(request, "%15s %511s", method, path) != 2)
+        return -1;
+
+    char* range = strcasestr(request, "\r\nRange: bytes=");
+    if (range) {
+        long long s = 0, e = -1;
+
+        __sync_fetch_and_add(&server->range_requests, 1);
+        if (sscanf(range + 15, "%lld-%lld", &s, &e) >= 1
+                && server->accept_ranges) {
+            start = s;
+            end = e;
+            ranged = 1;
+        }
+    }
+
+    /*
+     * "/redirect/<n>" takes n hops to "/pattern", cycling through the
+     * redirect codes and alternating absolute and bare path targets
+     */
+    int hops;
+    if (sscanf(path, "/redirect/%d", &hops) == 1 && hops > 0) {
+        static const int codes[] = { 301, 302, 303, 307, 308 };
+        char location[128];
+
+        if (hops == 1)
+            snprintf(location, sizeof(location), "/pattern");
+        else if (hops % 2)
+            snprintf(location, sizeof(location), "/redirect/%d", hops - 1);
+        else
+            snprintf(location, sizeof(location),
+                    "http://127.0.0.1:%d/redirect/%d", server->port, hops - 1);
+
+        snprintf(header, sizeof(header), "HTTP/1.1 %d Redirect\r\n"
+                "Location: %s\r\n"
+                "Content-Length: 0\r\n"
+                "Connection: %s\r\n\r\n", codes[hops % 5], location,
+                keep_alive ? "keep-alive" : "close");
+        if (send_all(fd, header, strlen(header)) < 0)
+            return -1;
+
+        return keep_alive ? 0 : -1;
+    }
+
+    if (!strcmp(path, "/pattern")) {
+        size = server->size;
+        chunked = server->chunked && !ranged;
+
+    } else if (server->root) {
+        struct stat st;
+
+        snprintf(file, sizeof(file), "%s%s", server->root, path);
+        src_fd = open(file, O_RDONLY);
+        if (src_fd < 0 || fstat(src_fd, &st) < 0) {
+            if (src_fd >= 0)
+                close(src_fd);
+
+            snprintf(header, sizeof(header), "HTTP/1.1 404 Not Found\r\n"
+                    "Content-Length: 0\r\n\r\n");
+            return send_all(fd, header, strlen(header));
+        }
+        size = st.st_size;
+
+    } else {
+        snprintf(header, sizeof(header), "HTTP/1.1 404 Not Found\r\n"
+                "Content-Length: 0\r\n\r\n");
+        return send_all(fd, header, strlen(header));
+    }
+
+    if (end < 0 || end >= (int64_t)size)
+        end = size - 1;
+
+    pthread_mutex_lock(&server->lock);
+    if (server->drops > 0 && strcmp(method, "HEAD")) {
+        server->drops--;
+        drop = 1;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (server->latency_ms)
+        msleep(server->latency_ms);
+
+    uint64_t len = end >= start ? end - start + 1 : 0;
+
+    if (ranged)
+        snprintf(header, sizeof(header), "HTTP/1.1 206 Partial Content\r\n"
+                "Content-Range: bytes %" PRId64 "-%" PRId64 "/%" PRIu64 "\r\n"
+                "Content-Length: %" PRIu64 "\r\n"
+                "Accept-Ranges: bytes\r\n"
+                "Connection: %s\r\n\r\n", start, end, size, len,
+                keep_alive ? "keep-alive" : "close");
+    else if (chunked)
+        snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n"
+                "Transfer-Encoding: chunked\r\n"
+                "%s"
+                "Connection: %s\r\n\r\n",
+                server->accept_ranges ? "Accept-Ranges: bytes\r\n" : "",
+                keep_alive ? "keep-alive" : "close");
+    else
+        snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n"
+                "Content-Length: %" PRIu64 "\r\n"
+                "%s"
+                "Connection: %s\r\n\r\n", size,
+                server->accept_ranges ? "Accept-Ranges: bytes\r\n" : "",
+                keep_alive ? "keep-alive" : "close");
+
+    if (send_all(fd, header, strlen(header)) < 0)
+        goto close_src;
+
+    if (!strcmp(method, "HEAD")) {
+        if (src_fd >= 0)
+            close(src_fd);
+        return keep_alive ? 0 : -1;
+    }
+
+    if (send_body(server, fd, src_fd, start, ranged ? len : size,
+            drop, chunked) < 0)
+        goto close_src;
+
+    if (src_fd >= 0)
+        close(src_fd);
+
+    return keep_alive ? 0 : -1;
+
+close_src:
+    if (src_fd >= 0)
+        close(src_fd);
+    return -1;
+}
+
+static void* connection_task(void* param) {
+    struct connection* conn = (struct connection *)param;
+    struct http_server* server = conn->server;
+    char request[4096];
+
+    while (!server->stopped) {
+        if (recv_request(conn->fd, request, sizeof(request)) < 0)
+            break;
+
+        __sync_fetch_and_add(&server->requests, 1);
+
+        if (handle_request(server, conn->fd, request) < 0)
+            break;
+    }
+
+    close(conn->fd);
+    free(conn);
+
+    return NULL;
+}
+
+static void* accept_task(void* param) {
+    struct http_server* server = (struct http_server *)param;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while (!server->stopped) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        __sync_fetch_and_add(&server->connections, 1);
+
+        struct connection* conn = calloc(1, sizeof(*conn));
+        conn->server = server;
+        conn->fd = fd;
+
+        pthread_t tid;
+        if (pthread_create(&tid, &attr, connection_task, conn)) {
+            close(fd);
+            free(conn);
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+
+    return NULL;
+}
+
+int http_server_start(struct http_server* server) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int on = 1;
+
+    pthread_mutex_init(&server->lock, NULL);
+
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listen_fd < 0)
+        return -1;
+
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(server->port);
+
+    if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+            || listen(server->listen_fd, 16) < 0
+            || getsockname(server->listen_fd, (struct sockaddr *)&addr, &len) < 0) {
+        LOGE("Failed to listen on loopback: %s\n", strerror(errno));
+        close(server->listen_fd);
+        return -1;
+    }
+
+    server->port = ntohs(addr.sin_port);
+    server->stopped = 0;
+
+    if (pthread_create(&server->tid, NULL, accept_task, server)) {
+        close(server->listen_fd);
+        return -1;
+    }
+
+    LOGI("Listening on 127.0.0.1:%d\n", server->port);
+
+    return 0;
+}
+
+void http_server_stop(struct http_server* server) {
+    server->stopped = 1;
+    shutdown(server->listen_fd, SHUT_RDWR);
+    close(server->listen_fd);
+    pthread_join(server->tid, NULL);
+}
@@ -0,0 +1,45 @@
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include <pthread.h>
+#include <types.h>
+
+/*
+ * Loopback HTTP/1.1 server for the http_client tests
+ *
+ * "/pattern" serves http_server_pattern() bytes of the given size,
+ * "/redirect/<n>" reaches "/pattern" after n redirects, any other path
+ * is served from root (if set). The behaviour knobs may be changed
+ * between test cases.
+ */
+struct http_server {
+    int port;
+    const char* root;
+    uint64_t size;
+
+    int accept_ranges;      /* honour Range requests */
+    int chunked;            /* chunked transfer encoding for /pattern */
+    int keep_alive;         /* keep connections open */
+    int drops;              /* responses to cut short */
+    uint64_t drop_after;    /* body bytes sent before cutting */
+    int rate_kbps;          /* per connection throughput, 0 = unlimited */
+    int latency_ms;         /* delay before each response */
+
+    volatile uint32_t connections;
+    volatile uint32_t requests;
+    volatile uint32_t range_requests;
+
+    int listen_fd;
+    volatile int stopped;
+    pthread_t tid;
+    pthread_mutex_t lock;
+};
+
+static inline uint8_t http_server_pattern(uint64_t offset) {
+    return (uint8_t)((offset * 31) ^ (offset >> 9));
+}
+
+int http_server_start(struct http_server* server);
+void http_server_stop(struct http_server* server);
+
+#endif
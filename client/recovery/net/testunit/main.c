@@ -0,0 +1,357 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <utils/log.h>
+#include <utils/common.h>
+#include <net/http_client.h>
+#include <net/http_segmented.h>
+#include "http_server.h"
+
+#define LOG_TAG "test_http_client"
+
+#include <utils/testunit.h>
+
+#define PATTERN_SIZE    (1024 * 1024 + 123)
+
+static struct http_server server;
+static char url[128];
+
+struct check {
+    uint64_t offset;
+    uint64_t received;
+    int mismatch;
+};
+
+static int check_cb(const void* buf, uint32_t len, void* param) {
+    struct check* check = (struct check *)param;
+    const uint8_t* p = (const uint8_t *)buf;
+
+    for (uint32_t i = 0; i < len; i++) {
+        if (p[i] != http_server_pattern(check->offset + check->received + i))
+            check->mismatch = 1;
+    }
+
+    check->received += len;
+
+    return 0;
+}
+
+static int abort_cb(const void* buf, uint32_t len, void* param) {
+    struct check* check = (struct check *)param;
+
+    check->received++;
+
+    return -1;
+}
+
+static int get_pattern(struct http_client* client, int64_t offset,
+        int64_t length, struct check* check) {
+    memset(check, 0, sizeof(*check));
+    check->offset = offset;
+
+    return client->get(client, url, offset, length, check_cb, check);
+}
+
+static void test_keep_alive(struct http_client* client) {
+    struct check check;
+    int ok = 1;
+    uint32_t connections = server.connections;
+
+    for (int i = 0; i < 4; i++) {
+        ok &= !get_pattern(client, 0, -1, &check);
+        ok &= check.received == PATTERN_SIZE && !check.mismatch;
+    }
+
+    report("keep-alive reuse", ok && server.connections - connections == 1);
+}
+
+static void test_range(struct http_client* client) {
+    struct check check;
+    int ok = 1;
+
+    ok &= !get_pattern(client, 4096, 100000, &check);
+    ok &= check.received == 100000 && !check.mismatch;
+
+    ok &= !get_pattern(client, PATTERN_SIZE - 10, -1, &check);
+    ok &= check.received == 10 && !check.mismatch;
+
+    report("range get", ok);
+}
+
+static void test_chunked(struct http_client* client) {
+    struct check check;
+    int ok;
+
+    server.chunked = 1;
+    ok = !get_pattern(client, 0, -1, &check);
+    ok &= check.received == PATTERN_SIZE && !check.mismatch;
+    server.chunked = 0;
+
+    report("chunked body", ok);
+}
+
+static void test_resume(struct http_client* client) {
+    struct check check;
+    uint32_t ranges = server.range_requests;
+    int ok;
+
+    server.drops = 2;
+    server.drop_after = 300000;
+
+    ok = !get_pattern(client, 0, -1, &check);
+    ok &= check.received == PATTERN_SIZE && !check.mismatch;
+    ok &= server.range_requests - ranges == 2;
+    ok &= client->stats.resumes >= 2;
+
+    report("resume with range", ok);
+}
+
+static void test_resume_without_range(struct http_client* client) {
+    struct check check;
+    int ok;
+
+    server.accept_ranges = 0;
+    server.drops = 1;
+    server.drop_after = 500000;
+
+    ok = !get_pattern(client, 0, -1, &check);
+    ok &= check.received == PATTERN_SIZE && !check.mismatch;
+
+    server.accept_ranges = 1;
+
+    report("resume, range ignored", ok);
+}
+
+static void test_connection_close(struct http_client* client) {
+    struct check check;
+    int ok = 1;
+
+    server.keep_alive = 0;
+    for (int i = 0; i < 2; i++) {
+        ok &= !get_pattern(client, 0, -1, &check);
+        ok &= check.received == PATTERN_SIZE && !check.mismatch;
+    }
+    server.keep_alive = 1;
+
+    report("connection close", ok);
+}
+
+static void test_not_found(struct http_client* client) {
+    struct check check;
+    char missing[128];
+    uint32_t retries = client->stats.retries;
+
+    snprintf(missing, sizeof(missing), "http://127.0.0.1:%d/missing",
+            server.port);
+
+    memset(&check, 0, sizeof(check));
+    int error = client->get(client, missing, 0, -1, check_cb, &check);
+
+    report("404 is not retried", error < 0 && client->stats.retries == retries);
+}
+
+static void test_redirect(struct http_client* client) {
+    struct check check;
+    char redirect[128];
+    uint32_t retries = client->stats.retries;
+    int ok;
+
+    snprintf(redirect, sizeof(redirect), "http://127.0.0.1:%d/redirect/%d",
+            server.port, HTTP_MAX_REDIRECTS);
+
+    memset(&check, 0, sizeof(check));
+    ok = !client->get(client, redirect, 0, -1, check_cb, &check);
+    ok &= check.received == PATTERN_SIZE && !check.mismatch;
+
+    report("redirects followed", ok);
+
+    snprintf(redirect, sizeof(redirect), "http://127.0.0.1:%d/redirect/%d",
+            server.port, HTTP_MAX_REDIRECTS + 1);
+
+    memset(&check, 0, sizeof(check));
+    int error = client->get(client, redirect, 0, -1, check_cb, &check);
+
+    report("redirect hop limit", error < 0 && check.received == 0
+            && client->stats.retries == retries);
+}
+
+static int check_file(const char* path) {
+    struct stat st;
+    int ok;
+
+    ok = !stat(path, &st) && st.st_size == PATTERN_SIZE;
+
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        uint8_t buf[4096];
+        uint64_t off = 0;
+        ssize_t n;
+
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            for (ssize_t i = 0; i < n; i++)
+                ok &= buf[i] == http_server_pattern(off + i);
+            off += n;
+        }
+        close(fd);
+    }
+
+    return ok;
+}
+
+static void test_download(struct http_client* client) {
+    const char* path = "/tmp/test_http_client.bin";
+    int ok;
+
+    server.drops = 1;
+    server.drop_after = 65536;
+
+    ok = !client->download(client, url, path);
+    ok &= check_file(path);
+    unlink(path);
+
+    report("download to file", ok);
+}
+
+static void test_download_resume(struct http_client* client) {
+    const char* path = "/tmp/test_http_client.bin";
+    uint8_t buf[4096];
+    uint32_t ranges = server.range_requests;
+    uint32_t requests;
+    int ok = 1;
+
+    /*
+     * The head of the file left by an interrupted download
+     */
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    for (uint64_t off = 0; off < 100 * sizeof(buf); off += sizeof(buf)) {
+        for (uint32_t i = 0; i < sizeof(buf); i++)
+            buf[i] = http_server_pattern(off + i);
+        ok &= write(fd, buf, sizeof(buf)) == sizeof(buf);
+    }
+    close(fd);
+
+    ok &= !client->download(client, url, path);
+    ok &= check_file(path);
+    ok &= server.range_requests - ranges == 1;
+
+    /*
+     * Nothing is fetched again once the file is complete
+     */
+    requests = server.requests;
+    ok &= !client->download(client, url, path);
+    ok &= check_file(path);
+    ok &= server.requests - requests == 1;
+    unlink(path);
+
+    report("download resumes a partial file", ok);
+}
+
+static void test_segmented(struct http_segmented* segmented) {
+    struct check check;
+    uint32_t ranges = server.range_requests;
+    int ok;
+
+    memset(&check, 0, sizeof(check));
+    ok = !segmented->get(segmented, url, check_cb, &check);
+    ok &= check.received == PATTERN_SIZE && !check.mismatch;
+    ok &= server.range_requests - ranges > 2;
+
+    report("segmented in order", ok);
+}
+
+static void test_segmented_resume(struct http_segmented* segmented) {
+    struct check check;
+    int ok;
+
+    server.drops = 2;
+    server.drop_after = 100000;
+
+    memset(&check, 0, sizeof(check));
+    ok = !segmented->get(segmented, url, check_cb, &check);
+    ok &= check.received == PATTERN_SIZE && !check.mismatch;
+
+    report("segmented resume", ok);
+}
+
+static void test_segmented_without_range(struct http_segmented* segmented) {
+    struct check check;
+    uint32_t requests = server.requests;
+    int ok;
+
+    server.accept_ranges = 0;
+
+    memset(&check, 0, sizeof(check));
+    ok = !segmented->get(segmented, url, check_cb, &check);
+    ok &= check.received == PATTERN_SIZE && !check.mismatch;
+    ok &= server.requests - requests == 2;
+
+    server.accept_ranges = 1;
+
+    report("segmented, range ignored", ok);
+}
+
+static void test_segmented_abort(struct http_segmented* segmented) {
+    struct check check;
+
+    memset(&check, 0, sizeof(check));
+    int error = segmented->get(segmented, url, abort_cb, &check);
+
+    report("segmented abort", error < 0 && check.received == 1);
+}
+
+int main(int argc, char* argv[]) {
+    memset(&server, 0, sizeof(server));
+    server.size = PATTERN_SIZE;
+    server.accept_ranges = 1;
+    server.keep_alive = 1;
+
+    if (http_server_start(&server) < 0)
+        return -1;
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/pattern", server.port);
+
+    struct http_client* client = _new(struct http_client, http_client);
+    client->set_timeout(client, 5000);
+    client->set_retry(client, 3, 10);
+
+    test_keep_alive(client);
+    test_range(client);
+    test_chunked(client);
+    test_resume(client);
+    test_resume_without_range(client);
+    test_connection_close(client);
+    test_not_found(client);
+    test_redirect(client);
+    test_download(client);
+    test_download_resume(client);
+
+    LOGI("requests %u, connects %u, retries %u, resumes %u, bytes %" PRIu64 "\n",
+            client->stats.requests, client->stats.connects,
+            client->stats.retries, client->stats.resumes,
+            client->stats.bytes);
+
+    _delete(client);
+
+    struct http_segmented* segmented = _new(struct http_segmented,
+            http_segmented);
+    segmented->set_connections(segmented, 4);
+    for (int i = 0; i < segmented->connections; i++) {
+        segmented->clients[i]->set_timeout(segmented->clients[i], 5000);
+        segmented->clients[i]->set_retry(segmented->clients[i], 3, 10);
+    }
+
+    test_segmented(segmented);
+    test_segmented_resume(segmented);
+    test_segmented_without_range(segmented);
+    test_segmented_abort(segmented);
+
+    _delete(segmented);
+    http_server_stop(&server);
+
+    return report_summary();
+}
@@ -144,7 +144,7 @@ static void *thread_loop(void *param) {
             event->destruct = destruct_netlink_event;
             event->construct(event);
 
-            if (event->decode(event, this->buffer, count, this->format) < 0) {
+            if (!event->decode(event, this->buffer, count, this->format)) {
                 LOGE("Error decoding netlink_event\n");
                 event->destruct(event);
                 free(event);
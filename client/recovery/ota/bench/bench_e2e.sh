@@ -0,0 +1,35 @@
+#!/bin/bash
+#
+# End-to-end update benchmark on the host: random images packed by
+# server/otapackage (make_packages.sh), served and flashed by bench_update
+# (make HOST=1 bench_update) onto the MTD emulator.
+#
+# usage: bench_e2e.sh [bench_update options]
+#
+#   OUTDIR         where bench_update is, default out
+#   BENCH_DIR      work directory, default $OUTDIR/bench_e2e
+#   BENCH_LATENCY  flash latency in us: page read, page program, block erase
+#
+# and the image settings of make_packages.sh
+#
+
+set -e
+
+TOPDIR=$(cd $(dirname $0)/../.. && pwd)
+OUTDIR=${OUTDIR:-$TOPDIR/out}
+BENCH_DIR=${BENCH_DIR:-$OUTDIR/bench_e2e}
+BENCH_LATENCY=${BENCH_LATENCY:-25,250,2000}
+
+$TOPDIR/ota/bench/make_packages.sh $BENCH_DIR
+
+export MTD_EMU="type=nand size=64M eb=128K page=2K oob=64
+        parts=1M(uboot),4M(kernel),24M(rootfs),1M(journal),-(data)
+        latency=$BENCH_LATENCY image=$BENCH_DIR/flash.img"
+
+#
+# The report on its own, the flag area dumps itself on stdout
+#
+$OUTDIR/bench_update -d $BENCH_DIR/packages -k $BENCH_DIR/testkey.pub \
+        -j $BENCH_DIR/update_stats.json -w $BENCH_DIR/report "$@" \
+        > $BENCH_DIR/bench_update.log 2>&1
+cat $BENCH_DIR/report
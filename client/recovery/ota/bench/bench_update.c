@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <utils/log.h>
+#include <utils/common.h>
+#include <utils/update_stats.h>
+#include <utils/signal_handler.h>
+#include <ota/ota_manager.h>
+#include <configure/configure_file.h>
+#include <configure/update_file.h>
+#include "update_server.h"
+
+#define LOG_TAG "bench_update"
+
+/*
+ * End-to-end update benchmark: the packages server/otapackage made are
+ * served from a loopback HTTP server and update_from_network() of the
+ * ota_manager flashes them, through the block manager of the host build
+ * (make HOST=1) onto the MTD emulator set up from $MTD_EMU.
+ *
+ * Reports the total update time, the bytes, time and throughput of each
+ * stage and the peak RSS of the updater; the server runs in a child
+ * process to stay out of that figure. Stages nest (a streamed download
+ * takes in the writes it feeds), they do not add up to the total.
+ *
+ * Like the recovery, it pings the server first and so needs a raw socket
+ * (root or CAP_NET_RAW).
+ */
+
+#define BENCH_CSV_HEADER    "metric,bytes,seconds,mb_s\n"
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s -d <dir> [options]\n"
+            "  -d <dir>     output directory of server/otapackage to serve\n"
+            "  -k <file>    public key, default %s\n"
+            "  -c <file>    recovery.conf for the Update settings, its Server is replaced\n"
+            "  -r <KB/s>    server throughput per connection, default unlimited\n"
+            "  -l <ms>      server latency per response, default 0\n"
+            "  -j <file>    update statistics per partition and chunk, JSON\n"
+            "  -o csv|json  output format, default csv\n"
+            "  -w <file>    output file, default stdout\n",
+            name, g_data.public_key_path);
+}
+
+static void report(FILE* out, int json, uint64_t ns, long peak_rss_kb) {
+    uint64_t bytes, stage_ns;
+
+    if (json)
+        fprintf(out, "{\n  \"seconds\": %.6f,\n  \"peak_rss_kb\": %ld,\n"
+                "  \"stages\": {\n", ns / 1e9, peak_rss_kb);
+    else
+        fprintf(out, BENCH_CSV_HEADER);
+
+    for (int i = 0; i < UPDATE_STAGE_COUNT; i++) {
+        double seconds;
+
+        update_stats_get_stage(i, &bytes, &stage_ns);
+        seconds = stage_ns / 1e9;
+
+        if (json)
+            fprintf(out, "    \"%s\": {\"bytes\": %llu, \"seconds\": %.6f, "
+                    "\"mb_s\": %.3f}%s\n", update_stats_stage_name(i),
+                    (unsigned long long)bytes, seconds,
+                    seconds > 0 ? bytes / seconds / (1024 * 1024) : 0.0,
+                    i + 1 < UPDATE_STAGE_COUNT ? "," : "");
+        else
+            fprintf(out, "%s,%llu,%.6f,%.3f\n", update_stats_stage_name(i),
+                    (unsigned long long)bytes, seconds,
+                    seconds > 0 ? bytes / seconds / (1024 * 1024) : 0.0);
+    }
+
+    if (json)
+        fprintf(out, "  }\n}\n");
+    else
+        fprintf(out, "total,,%.6f,\npeak_rss,%ld,,\n", ns / 1e9,
+                peak_rss_kb * 1024);
+
+    fflush(out);
+}
+
+int main(int argc, char* argv[]) {
+    struct configure_file* cf;
+    struct ota_manager* om;
+    struct rusage usage_self;
+    const char* dir = NULL;
+    const char* conf = NULL;
+    const char* stats = NULL;
+    const char* path = NULL;
+    FILE* out = stdout;
+    int rate_kbps = 0, latency_ms = 0;
+    int json = 0;
+    int port;
+    pid_t server;
+    uint64_t start, ns;
+    int error;
+    int c;
+
+    while ((c = getopt(argc, argv, "d:k:c:r:l:j:o:w:h")) != -1) {
+        switch (c) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'k':
+            g_data.public_key_path = optarg;
+            break;
+        case 'c':
+            conf = optarg;
+            break;
+        case 'r':
+            rate_kbps = atoi(optarg);
+            break;
+        case 'l':
+            latency_ms = atoi(optarg);
+            break;
+        case 'j':
+            stats = optarg;
+            break;
+        case 'o':
+            if (!strcmp(optarg, "json"))
+                json = 1;
+            else if (strcmp(optarg, "csv"))
+                goto usage;
+            break;
+        case 'w':
+            path = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (dir == NULL)
+        goto usage;
+
+    g_data.has_fb = 0;
+
+    if (path) {
+        out = fopen(path, "w");
+        if (out == NULL) {
+            LOGE("Cannot open %s\n", path);
+            return 1;
+        }
+    }
+
+    /*
+     * Before any thread of the updater
+     */
+    port = update_server_start(dir, rate_kbps, latency_ms, &server);
+    if (port < 0) {
+        LOGE("Cannot serve %s\n", dir);
+        return 1;
+    }
+
+    cf = update_server_configure(conf, port);
+    if (cf == NULL) {
+        error = -1;
+        goto out;
+    }
+
+    om = _new(struct ota_manager, ota_manager);
+    om->load_configure(om, cf);
+    om->uf = _new(struct update_file, update_file);
+
+    update_stats_reset();
+
+    start = update_stats_now();
+    error = om->update_from_network(om);
+    ns = update_stats_now() - start;
+
+    getrusage(RUSAGE_SELF, &usage_self);
+
+    if (error < 0)
+        LOGE("Update FAILED\n");
+    else
+        report(out, json, ns, usage_self.ru_maxrss);
+
+    if (stats && update_stats_write(stats, error) < 0)
+        LOGW("Cannot write %s\n", stats);
+
+    _delete(om->uf);
+    om->uf = NULL;
+    _delete(om);
+
+out:
+    update_server_stop(server);
+    if (path)
+        fclose(out);
+
+    return error < 0 ? 1 : 0;
+
+usage:
+    usage(argv[0]);
+    return 2;
+}
@@ -0,0 +1,102 @@
+#!/bin/bash
+#
+# Random images packed by server/otapackage for the update programs of the
+# host build, laid out for the MTD emulator spec below.
+#
+# usage: make_packages.sh <dir>
+#
+#   <dir>/image/nand  the images: u-boot.bin, uImage and rootfs.ubi
+#   <dir>/packages    the packages, to be served
+#   <dir>/testkey.pub the public key checking them
+#
+#   BENCH_KERNEL   kernel image size in bytes, sliced, default 3M
+#   BENCH_ROOTFS   rootfs (ubifs) image size in LEBs, default 160
+#   BENCH_DIGEST   digest of the package signatures, sha1 (default) or
+#                  sha256 with the test key as a v4 key
+#   PYTHON2        python of server/otapackage, default python2
+#
+# 64M of NAND, the flash of the emulator is
+#
+#   type=nand size=64M eb=128K page=2K oob=64
+#   parts=1M(uboot),4M(kernel),24M(rootfs),1M(journal),-(data)
+#
+
+set -e
+
+DIR=$1
+TOPDIR=$(cd $(dirname $0)/../.. && pwd)
+REPODIR=$(cd $TOPDIR/../.. && pwd)
+BENCH_KERNEL=${BENCH_KERNEL:-$((3 << 20))}
+BENCH_ROOTFS=${BENCH_ROOTFS:-160}
+BENCH_DIGEST=${BENCH_DIGEST:-sha1}
+PYTHON2=${PYTHON2:-python2}
+KEYDIR=$REPODIR/resource/security
+
+if [ -z "$DIR" ]; then
+    echo "usage: $0 <dir>" >&2
+    exit 2
+fi
+
+PARTITIONS="uboot,0x0,0x100000,mtdblock0
+kernel,0x100000,0x400000,mtdblock1
+rootfs,0x500000,0x1800000,mtdblock2
+journal,0x1d00000,0x100000,mtdblock3
+data,0x1e00000,0x2200000,mtdblock4"
+UBI_LEB_SIZE=126976
+
+rm -rf $DIR
+mkdir -p $DIR/image/nand $DIR/packages
+cp -r $REPODIR/server/otapackage $DIR
+
+head -c $((256 << 10)) /dev/urandom > $DIR/image/nand/u-boot.bin
+head -c $BENCH_KERNEL /dev/urandom > $DIR/image/nand/uImage
+head -c $((BENCH_ROOTFS * UBI_LEB_SIZE)) /dev/urandom \
+        > $DIR/image/nand/rootfs.ubi
+
+GENERATED=$DIR/otapackage/customer/generated
+{
+    echo "[storageinfo]"
+    echo "mediumtype=nand"
+    echo "capacity=64MB"
+    echo "[partition]"
+    i=1
+    for p in $PARTITIONS; do
+        echo "item$i=$p"
+        i=$((i + 1))
+    done
+} > $GENERATED/partition_nand.conf
+
+cat > $GENERATED/customization_nand.conf <<EOC
+[update]
+mediumtype=nand
+imgcnt=3
+[image1]
+name=u-boot.bin
+type=normal
+offset=0x0
+updatemode=full
+[image2]
+name=uImage
+type=normal
+offset=0x100000
+updatemode=slice
+[image3]
+name=rootfs.ubi
+type=ubifs
+offset=0x500000
+updatemode=slice
+EOC
+
+(cd $DIR && $PYTHON2 -m otapackage --output=$DIR/packages \
+        --imgpath=$DIR/image --publickey=$KEYDIR/testkey.x509.pem \
+        --privatekey=$KEYDIR/testkey.pk8 --digest=$BENCH_DIGEST \
+        > $DIR/otapackage.log 2>&1)
+
+#
+# The same key signs SHA-256 for a device holding it as a v4 key
+#
+if [ $BENCH_DIGEST = sha256 ]; then
+    sed 's/^v2 /v4 /' $KEYDIR/testkey.pub > $DIR/testkey.pub
+else
+    cp $KEYDIR/testkey.pub $DIR/testkey.pub
+fi
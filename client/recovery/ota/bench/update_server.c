@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <version.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <configure/configure_file.h>
+#include "../../net/testunit/http_server.h"
+#include "update_server.h"
+
+#define LOG_TAG "update_server"
+
+static const char* default_conf = "/tmp/update_server.conf";
+
+int update_server_start(const char* root, int rate_kbps, int latency_ms,
+        pid_t* pid) {
+    struct http_server server;
+    int fds[2];
+    int port = -1;
+
+    if (pipe(fds) < 0)
+        return -1;
+
+    *pid = fork();
+    if (*pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (*pid == 0) {
+        close(fds[0]);
+
+        memset(&server, 0, sizeof(server));
+        server.root = root;
+        server.accept_ranges = 1;
+        server.keep_alive = 1;
+        server.rate_kbps = rate_kbps;
+        server.latency_ms = latency_ms;
+
+        if (http_server_start(&server) == 0)
+            port = server.port;
+        if (write(fds[1], &port, sizeof(port)) != sizeof(port) || port < 0)
+            _exit(1);
+
+        for (;;)
+            pause();
+    }
+
+    close(fds[1]);
+    if (read(fds[0], &port, sizeof(port)) != sizeof(port) || port < 0) {
+        close(fds[0]);
+        waitpid(*pid, NULL, 0);
+        return -1;
+    }
+    close(fds[0]);
+
+    return port;
+}
+
+void update_server_stop(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+struct configure_file* update_server_configure(const char* conf, int port) {
+    struct configure_file* cf;
+    char url[64];
+    FILE* fp;
+    int error;
+
+    if (conf == NULL) {
+        fp = fopen(default_conf, "w");
+        if (fp == NULL) {
+            LOGE("Cannot create %s: %s\n", default_conf, strerror(errno));
+            return NULL;
+        }
+        fprintf(fp, "Version=\"%s\";\n\nApplication:\n{\n    Server:\n    {\n"
+                "        ip=\"127.0.0.1\";\n        url=\"\";\n    };\n};\n",
+                VERSION);
+        fclose(fp);
+        conf = default_conf;
+    }
+
+    cf = _new(struct configure_file, configure_file);
+    error = cf->parse(cf, conf);
+    if (conf == default_conf)
+        unlink(default_conf);
+    if (error < 0) {
+        LOGE("Failed to parse %s\n", conf);
+        _delete(cf);
+        return NULL;
+    }
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d", port);
+    free(cf->server_ip);
+    free(cf->server_url);
+    cf->server_ip = strdup("127.0.0.1");
+    cf->server_url = strdup(url);
+
+    return cf;
+}
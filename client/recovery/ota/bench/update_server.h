@@ -0,0 +1,28 @@
+#ifndef UPDATE_SERVER_H
+#define UPDATE_SERVER_H
+
+#include <sys/types.h>
+#include <configure/configure_file.h>
+
+/*
+ * Host side of an update over the network, for the programs driving
+ * update_from_network() on the host build (make HOST=1)
+ *
+ * The packages server/otapackage made are served by the loopback HTTP
+ * server of the net testunit from a child process, so that neither its
+ * threads nor its memory count against the updater.
+ */
+
+/*
+ * Serves root in a child until update_server_stop(), returns the port
+ */
+int update_server_start(const char* root, int rate_kbps, int latency_ms,
+        pid_t* pid);
+void update_server_stop(pid_t pid);
+
+/*
+ * The Update settings of conf if any, the server at the loopback port
+ */
+struct configure_file* update_server_configure(const char* conf, int port);
+
+#endif /* UPDATE_SERVER_H */
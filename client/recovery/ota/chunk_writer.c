@@ -0,0 +1,1078 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <utils/hashtree.h>
+#include <utils/update_stats.h>
+#include <utils/memscan.h>
+#include <configure/configure_file.h>
+#include <configure/update_file.h>
+#include <block/block_manager.h>
+#include <block/sysinfo/sysinfo_manager.h>
+#include <ota/chunk_writer.h>
+
+#define LOG_TAG "chunk_writer"
+
+static const int update_wbuffer_method = UPDATE_WBUFFER_ALLOWABLE_MINIMUM_SIZE;
+
+/*
+ * Partition tails raw images leave to be erased once everything is written
+ */
+struct deferred_erase {
+    struct block_manager* bm;
+    int64_t offset;
+    int64_t length;
+    struct list_head head;
+};
+
+void flash_session_init(struct flash_session* s, struct configure_file* cf) {
+    memset(s, 0, sizeof(*s));
+
+    s->cf = cf;
+    pthread_mutex_init(&s->journal_lock, NULL);
+    INIT_LIST_HEAD(&s->deferred_erase_list);
+    pthread_mutex_init(&s->deferred_erase_lock, NULL);
+}
+
+void flash_session_destroy(struct flash_session* s) {
+    flash_session_erase_deferred(s, 1);
+    update_journal_store_close(&s->journal_store);
+    pthread_mutex_destroy(&s->deferred_erase_lock);
+    pthread_mutex_destroy(&s->journal_lock);
+}
+
+uint32_t get_chunk_size(struct image_info* image_info, uint32_t chunk_index) {
+    if (image_info->chunkcount == 1)
+        return image_info->size;
+
+    if (chunk_index != image_info->chunkcount)
+        return image_info->chunksize;
+
+    return image_info->size
+            - (uint64_t)image_info->chunksize * (image_info->chunkcount - 1);
+}
+
+/*
+ * Delta images
+ *
+ * A delta image is rebuilt in place from the image already in its
+ * partition. Each write buffer (one erase block) of new data is produced
+ * from the patch and the old blocks at or after it, then only that block
+ * is erased and programmed, so nothing but a few blocks is ever held in
+ * memory. The old blocks are located by the physical offsets recorded
+ * while the old image is hashed, before the first block is touched.
+ *
+ * Old blocks an erase or a write may land on, the next one included in
+ * case a block turns bad on the way, are copied into the cache and pinned
+ * there beforehand.
+ */
+static void delta_source_close(struct delta_source* ds) {
+    for (int i = 0; i < DELTA_CACHE_BLOCKS; i++)
+        free(ds->cache[i].data);
+    free(ds->map);
+
+    memset(ds, 0, sizeof(*ds));
+}
+
+static struct delta_block* delta_source_load(struct delta_source* ds,
+        uint32_t index) {
+    struct delta_block* slot = NULL;
+    uint32_t len;
+
+    for (int i = 0; i < DELTA_CACHE_BLOCKS; i++) {
+        if (ds->cache[i].index == index) {
+            ds->cache[i].stamp = ++ds->stamp;
+            return &ds->cache[i];
+        }
+    }
+
+    if (ds->map[index] < ds->written_end) {
+        LOGE("Old block %u at 0x%" PRIx64 " is already overwritten\n", index,
+                ds->map[index]);
+        return NULL;
+    }
+
+    for (int i = 0; i < DELTA_CACHE_BLOCKS; i++) {
+        struct delta_block* b = &ds->cache[i];
+
+        if (b->pinned)
+            continue;
+
+        if (slot == NULL || b->index < 0 || b->stamp < slot->stamp)
+            slot = b;
+
+        if (b->index < 0)
+            break;
+    }
+
+    if (slot == NULL) {
+        LOGE("No room left to cache old block %u\n", index);
+        return NULL;
+    }
+
+    len = MIN(ds->block_size, ds->size - (uint64_t)index * ds->block_size);
+    slot->index = -1;
+    if (ds->bm->read(ds->bm, ds->map[index], slot->data, len) < 0) {
+        LOGE("Failed to read old block at 0x%" PRIx64 "\n", ds->map[index]);
+        return NULL;
+    }
+
+    slot->index = index;
+    slot->stamp = ++ds->stamp;
+
+    return slot;
+}
+
+static int delta_source_read(uint64_t offset, void* buf, uint32_t len,
+        void* param) {
+    struct chunk_writer* w = (struct chunk_writer *)param;
+    struct delta_source* ds = &w->ctx->delta_source;
+    char* p = (char *)buf;
+
+    if (offset + len > ds->size) {
+        LOGE("Patch reads 0x%" PRIx64 " past the old image\n", offset + len);
+        return -1;
+    }
+
+    while (len) {
+        uint32_t index = offset / ds->block_size;
+        uint32_t start = offset % ds->block_size;
+        uint32_t n = MIN(len, ds->block_size - start);
+        struct delta_block* b = delta_source_load(ds, index);
+
+        if (b == NULL)
+            return -1;
+
+        memcpy(p, b->data + start, n);
+        p += n;
+        offset += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Pins the old blocks from index on which lie within the two blocks at
+ * offset, before they get erased
+ */
+static int delta_source_protect(struct delta_source* ds, int64_t offset,
+        uint32_t index) {
+
+    for (; index < ds->count
+            && ds->map[index] < offset + 2 * ds->block_size; index++) {
+        struct delta_block* b;
+
+        if (ds->map[index] < offset)
+            continue;
+
+        b = delta_source_load(ds, index);
+        if (b == NULL)
+            return -1;
+
+        b->pinned = 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Old blocks up to index are not read any more
+ */
+static void delta_source_release(struct delta_source* ds, uint32_t index) {
+
+    for (int i = 0; i < DELTA_CACHE_BLOCKS; i++) {
+        if (ds->cache[i].index >= 0 && ds->cache[i].index <= index) {
+            ds->cache[i].index = -1;
+            ds->cache[i].pinned = 0;
+        }
+    }
+}
+
+/*
+ * Maps the old image and checks it is the one the patches were made
+ * against
+ */
+static int delta_source_open(struct chunk_writer* w) {
+    struct flash_context* ctx = w->ctx;
+    struct delta_source* ds = &ctx->delta_source;
+    struct block_manager* bm = w->bm;
+    struct image_info* image_info = w->image_info;
+    char sha1[IMAGE_SHA1_STR_LEN + 1];
+    const uint8_t* digest;
+    int64_t offset;
+    SHA_CTX sha;
+
+    delta_source_close(ds);
+
+    if (strcmp(image_info->fs_type, BM_FILE_TYPE_NORMAL)
+            || w->part_info->image_count != 1) {
+        LOGE("Delta image %s must be the only %s image of \"%s\"\n",
+                image_info->name, BM_FILE_TYPE_NORMAL, w->part_info->name);
+        return -1;
+    }
+
+    if (ctx->write_buffer_size != ctx->write_media_leap
+            || (image_info->chunksize % ctx->write_buffer_size)) {
+        LOGE("Delta image %s cannot be written one erase block at a time\n",
+                image_info->name);
+        return -1;
+    }
+
+    ds->bm = bm;
+    ds->block_size = ctx->write_buffer_size;
+    ds->size = image_info->src_size;
+    ds->count = (ds->size + ds->block_size - 1) / ds->block_size;
+    ds->written_end = w->cur_write_offset;
+
+    ds->map = (int64_t *) calloc(ds->count ? ds->count : 1, sizeof(int64_t));
+    if (ds->map == NULL)
+        goto out;
+
+    for (int i = 0; i < DELTA_CACHE_BLOCKS; i++) {
+        ds->cache[i].index = -1;
+        ds->cache[i].data = (char *) malloc(ds->block_size);
+        if (ds->cache[i].data == NULL)
+            goto out;
+    }
+
+    LOGI("Checking the image %s is patched against\n", image_info->name);
+
+    SHA_init(&sha);
+    offset = w->cur_write_offset;
+    for (uint32_t i = 0; i < ds->count; i++) {
+        uint32_t len = MIN(ds->block_size,
+                ds->size - (uint64_t)i * ds->block_size);
+
+        offset = bm->read(bm, offset, ds->cache[0].data, len);
+        if (offset < 0) {
+            LOGE("Failed to read old image %s\n", image_info->name);
+            goto error;
+        }
+
+        ds->map[i] = offset - len;
+        SHA_update(&sha, ds->cache[0].data, len);
+    }
+
+    digest = SHA_final(&sha);
+    for (int i = 0; i < SHA_DIGEST_SIZE; i++)
+        sprintf(sha1 + 2 * i, "%02x", digest[i]);
+
+    if (strcasecmp(sha1, image_info->src_sha1)) {
+        LOGE("\"%s\" does not hold the image the delta applies to, "
+                "a full update is needed\n", w->part_info->name);
+        goto error;
+    }
+
+    return 0;
+
+out:
+    LOGE("Failed to alloc delta source: %s\n", strerror(errno));
+error:
+    delta_source_close(ds);
+    return -1;
+}
+
+/*
+ * Erases the block at cur_write_offset and programs the write buffer into
+ * that block alone, for partitions not erased up front
+ */
+static int chunk_writer_flush_block(struct chunk_writer* w,
+        int64_t* erase_end) {
+    struct flash_context* ctx = w->ctx;
+    struct block_manager* bm = w->bm;
+
+    *erase_end = bm->erase(bm, w->cur_write_offset, ctx->write_buffer_size);
+    if (*erase_end < 0) {
+        LOGE("Failed to erase, offset=0x%" PRIx64 "\n", w->cur_write_offset);
+        return -1;
+    }
+
+    ctx->next_write_offset = bm->write(bm, w->cur_write_offset,
+            ctx->write_buffer, w->fill);
+    if (ctx->next_write_offset < 0) {
+        LOGE("Failed to write, offset=0x%" PRIx64 "\n", w->cur_write_offset);
+        return -1;
+    }
+
+    /*
+     * The write stepped over a block gone bad onto one never erased
+     */
+    if (ctx->next_write_offset > *erase_end) {
+        LOGE("Write at 0x%" PRIx64 " overran its erase block\n",
+                w->cur_write_offset);
+        return -1;
+    }
+
+    w->cur_write_offset = *erase_end;
+    w->fill = 0;
+
+    return 0;
+}
+
+static int chunk_writer_flush_delta(struct chunk_writer* w) {
+    struct delta_source* ds = &w->ctx->delta_source;
+    uint64_t pos = (uint64_t)(w->chunk_index - 1) * w->image_info->chunksize
+            + w->total - 1;
+    uint32_t index = pos / ds->block_size;
+    int64_t erase_end = 0;
+
+    if (delta_source_protect(ds, w->cur_write_offset, index + 1) < 0)
+        return -1;
+
+    if (chunk_writer_flush_block(w, &erase_end) < 0) {
+        if (erase_end > 0)
+            LOGE("Old image partly overwritten, a full update is needed\n");
+        return -1;
+    }
+
+    ds->written_end = erase_end;
+    delta_source_release(ds, index);
+
+    return 0;
+}
+
+/*
+ * Read-compare-skip
+ *
+ * With Update.compare_skip set, partitions holding only normal images are
+ * not erased up front. Each erase block is read back first and is only
+ * erased and programmed when it differs from the data going in, so that
+ * re-running an update, or flashing an image mostly like the one in
+ * place, costs reads rather than erase cycles.
+ */
+static int can_compare_skip(struct flash_context* ctx,
+        struct block_manager* bm, struct part_info* part_info) {
+    struct list_head* pos;
+
+    if (!ctx->session->cf->compare_skip
+            || ctx->write_buffer_size != ctx->write_media_leap)
+        return 0;
+
+    /*
+     * A discarded mmc block does not read back as 0xff
+     */
+    if (strcmp(bm->name, BM_BLOCK_TYPE_MTD))
+        return 0;
+
+    list_for_each(pos, &part_info->list) {
+        struct image_info* image_info = list_entry(pos, struct image_info,
+                head_part);
+
+        if (strcmp(image_info->fs_type, BM_FILE_TYPE_NORMAL)
+                || image_info->update_mode == UPDATE_MODE_DELTA)
+            return 0;
+    }
+
+    return 1;
+}
+
+static int chunk_writer_flush_compare(struct chunk_writer* w) {
+    struct flash_context* ctx = w->ctx;
+    struct block_manager* bm = w->bm;
+    int64_t end, start;
+    uint32_t iosize;
+    int64_t erase_end;
+
+    end = bm->read(bm, w->cur_write_offset, ctx->compare_buffer,
+            ctx->write_buffer_size);
+    if (end < 0) {
+        LOGE("Failed to read back, offset=0x%" PRIx64 "\n", w->cur_write_offset);
+        return -1;
+    }
+
+    /*
+     * Past the data, a full update leaves the block erased
+     */
+    if (memcmp(ctx->compare_buffer, ctx->write_buffer, w->fill)
+            || !memscan_is_ff(ctx->compare_buffer + w->fill,
+            ctx->write_buffer_size - w->fill)) {
+        ctx->blocks_written++;
+        return chunk_writer_flush_block(w, &erase_end);
+    }
+
+    ctx->blocks_skipped++;
+
+    start = end - ctx->write_buffer_size;
+    iosize = bm->get_iosize(bm, start);
+    ctx->next_write_offset = start + (w->fill + iosize - 1) / iosize * iosize;
+
+    w->cur_write_offset = end;
+    w->fill = 0;
+
+    return 0;
+}
+
+/*
+ * Erases the blocks between offset and end which are not blank yet, the
+ * ones a full update would have erased and nothing gets written to
+ */
+static int compare_skip_erase(struct chunk_writer* w, int64_t offset,
+        int64_t end) {
+    struct flash_context* ctx = w->ctx;
+    struct block_manager* bm = w->bm;
+    uint32_t size = ctx->write_buffer_size;
+
+    offset += (size - offset % size) % size;
+
+    while (offset < end) {
+        int64_t next = bm->read(bm, offset, ctx->compare_buffer, size);
+
+        /*
+         * Nothing left but bad blocks
+         */
+        if (next < 0)
+            break;
+
+        if (!memscan_is_ff(ctx->compare_buffer, size)) {
+            if (bm->erase(bm, next - size, size) < 0) {
+                LOGE("Failed to erase, offset=0x%" PRIx64 "\n", next - size);
+                return -1;
+            }
+            ctx->blocks_written++;
+        } else {
+            ctx->blocks_skipped++;
+        }
+
+        offset = next;
+    }
+
+    return 0;
+}
+
+static int chunk_writer_fill(const void* buf, uint32_t len, void* param);
+
+static inline int is_first_chunk_in_part(struct chunk_writer* w) {
+    struct image_info* first_image = list_entry(w->part_info->list.next,
+            struct image_info, head_part);
+
+    return !strcmp(first_image->name, w->image_info->name)
+            && (w->chunk_index == 1);
+}
+
+static inline int is_last_chunk_in_part(struct chunk_writer* w) {
+    struct image_info* last_image = list_entry(w->part_info->list.prev,
+            struct image_info, head_part);
+
+    return !strcmp(last_image->name, w->image_info->name)
+            && (w->chunk_index == w->image_info->chunkcount);
+}
+
+void flash_context_init(struct flash_context* ctx,
+        struct flash_session* session) {
+    memset(ctx, 0, sizeof(*ctx));
+
+    ctx->session = session;
+}
+
+/*
+ * Releases the buffers, the context carries on with the next partition
+ */
+void flash_context_destroy(struct flash_context* ctx) {
+    free(ctx->write_buffer);
+    ctx->write_buffer = NULL;
+
+    free(ctx->compare_buffer);
+    ctx->compare_buffer = NULL;
+
+    delta_source_close(&ctx->delta_source);
+}
+
+void chunk_writer_abort(struct chunk_writer* w) {
+    if (w->is_delta) {
+        delta_patch_destroy(&w->delta);
+        w->is_delta = 0;
+    }
+
+    if (w->ctx)
+        flash_context_destroy(w->ctx);
+}
+
+static int defer_erase(struct flash_session* s, struct block_manager* bm,
+        int64_t offset, int64_t length) {
+    struct deferred_erase* d = calloc(1, sizeof(*d));
+
+    if (d == NULL) {
+        LOGE("Failed to alloc deferred erase\n");
+        return -1;
+    }
+
+    d->bm = bm;
+    d->offset = offset;
+    d->length = length;
+
+    pthread_mutex_lock(&s->deferred_erase_lock);
+    list_add_tail(&d->head, &s->deferred_erase_list);
+    pthread_mutex_unlock(&s->deferred_erase_lock);
+
+    return 0;
+}
+
+/*
+ * Erases the partition from offset to end before it is written. Raw
+ * images may ask for the span they map to only, the rest of the partition
+ * being erased at the very end or left alone.
+ */
+static int erase_partition(struct chunk_writer* w,
+        struct image_info* first_image, int64_t offset, int64_t end) {
+    struct flash_session* s = w->ctx->session;
+    struct block_manager* bm = w->bm;
+    struct image_info* last_image = list_entry(w->part_info->list.prev,
+            struct image_info, head_part);
+    uint32_t policy = first_image->erase;
+    int64_t part_end = end, next;
+
+    if (strcmp(first_image->fs_type, BM_FILE_TYPE_NORMAL))
+        policy = IMAGE_ERASE_PARTITION;
+
+    if (policy != IMAGE_ERASE_PARTITION) {
+        offset = MAX(offset, (int64_t)first_image->offset);
+        end = MIN(end, (int64_t)(last_image->offset + last_image->size));
+        if (end <= offset)
+            return 0;
+    }
+
+    /*
+     * The erase-ahead tail already runs in the background
+     */
+    if (s->cf->erase_ahead > 0 && bm->erase_ahead) {
+        if (policy == IMAGE_ERASE_DEFERRED)
+            end = part_end;
+
+        if (bm->erase_ahead(bm, offset, end - offset,
+                s->cf->erase_ahead) < 0)
+            goto out;
+
+        return 0;
+    }
+
+    next = bm->erase(bm, offset, end - offset);
+    if (next < 0)
+        goto out;
+
+    if (policy == IMAGE_ERASE_DEFERRED && next < part_end)
+        return defer_erase(s, bm, next, part_end - next);
+
+    return 0;
+
+out:
+    LOGE("Failed to erase, offset=0x%" PRIx64 ", length=0x%" PRIx64 "\n", offset,
+            end - offset);
+    return -1;
+}
+
+/*
+ * Erases the tails deferred by raw images, a failed update only drops
+ * them
+ */
+int flash_session_erase_deferred(struct flash_session* s, int drop) {
+    struct bm_operation_option option;
+    struct list_head *pos, *n;
+    int error = 0;
+
+    list_for_each_safe(pos, n, &s->deferred_erase_list) {
+        struct deferred_erase* d = list_entry(pos, struct deferred_erase,
+                head);
+        struct block_manager* bm = d->bm;
+
+        if (!drop && !error) {
+            LOGI("Erasing deferred 0x%" PRIx64 ", length 0x%" PRIx64 "\n", d->offset,
+                    d->length);
+
+            bm->set_operation_option(bm, &option,
+                    BM_OPERATION_METHOD_PARTITION, BM_FILE_TYPE_NORMAL);
+            option.skip_erased = s->cf->skip_erased;
+
+            if (bm->prepare(bm, d->offset, d->length, &option) == NULL) {
+                LOGE("Failed to perpare, offset=0x%" PRIx64 "\n", d->offset);
+                error = -1;
+            } else {
+                if (bm->erase(bm, d->offset, d->length) < 0) {
+                    LOGE("Failed to erase, offset=0x%" PRIx64 ", length=0x%" PRIx64 "\n",
+                            d->offset, d->length);
+                    error = -1;
+                }
+                bm->finish(bm);
+            }
+        }
+
+        list_del(&d->head);
+        free(d);
+    }
+
+    return error;
+}
+
+/*
+ * Hash tree
+ *
+ * With a hash tree shipped for the image, every write buffer is checked
+ * against its leaves before it is programmed, so a chunk corrupted after
+ * the signature check (in memory, on the storage it was unzipped to) never
+ * reaches the flash. Write buffers are whole leaves but for the last one
+ * of an image, unless the medium has bigger leaves than erase blocks, in
+ * which case only the signature covers the image.
+ */
+static inline uint64_t chunk_image_offset(struct chunk_writer* w) {
+    return (uint64_t)(w->chunk_index - 1) * w->image_info->chunksize;
+}
+
+static const struct hashtree* get_chunk_hashtree(struct chunk_writer* w) {
+    struct flash_context* ctx = w->ctx;
+    const struct hashtree* ht = &w->image_info->hashtree;
+
+    if (ht->leaves == NULL)
+        return NULL;
+
+    if (ctx->write_buffer_size % ht->leaf_size
+            || chunk_image_offset(w) % ht->leaf_size) {
+        LOGW("Leaves of %u bytes do not fit write buffers of %u, "
+                "\"%s\" is not checked by leaf\n", ht->leaf_size,
+                ctx->write_buffer_size, w->image_info->name);
+        return NULL;
+    }
+
+    return ht;
+}
+
+static int verify_write_buffer(struct chunk_writer* w) {
+    uint64_t offset = chunk_image_offset(w) + w->total - w->fill;
+    uint64_t start = update_stats_now();
+    int error;
+
+    error = hashtree_verify(w->hashtree, offset, w->ctx->write_buffer, w->fill);
+    update_stats_add(UPDATE_STAGE_VERIFY, w->fill, start);
+    if (error < 0) {
+        LOGE("Chunk %d of %s is corrupted at 0x%" PRIx64 "\n", w->chunk_index,
+                w->image_info->name, offset);
+        return -1;
+    }
+
+    return 0;
+}
+
+struct readback {
+    struct block_manager* bm;
+    int64_t offset;
+};
+
+static int readback_leaf(uint32_t index, void* buf, uint32_t len,
+        void* param) {
+    struct readback* rb = (struct readback *)param;
+    int64_t end;
+
+    end = rb->bm->read(rb->bm, rb->offset, buf, len);
+    if (end < 0) {
+        LOGE("Failed to read back, offset=0x%" PRIx64 "\n", rb->offset);
+        return -1;
+    }
+
+    rb->offset = end;
+
+    /*
+     * The system info kept over the image
+     */
+#ifdef BM_SYSINFO_SUPPORT
+    if (rb->bm->sysinfo && rb->bm->sysinfo->traversal_reserved(
+            rb->bm->sysinfo, end - len, len)) {
+        LOGI("Leaf %u holds system info, not checked\n", index);
+        return 1;
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * Reads the chunk just written back from the flash, from where its first
+ * write started and over the same bad blocks, and checks it leaf by leaf.
+ * The leaves are hashed on all CPUs as the next ones are read. Only plain
+ * images read back as they were shipped, UBI and yaffs2 ones are laid out
+ * on the flash differently, and the system info merged into a plain one
+ * is left out.
+ */
+static int verify_chunk_readback(struct chunk_writer* w) {
+    const struct hashtree* ht = w->hashtree;
+    struct readback rb;
+    uint64_t start;
+    int error;
+
+    if (strcmp(w->image_info->fs_type, BM_FILE_TYPE_NORMAL)) {
+        if (w->chunk_index == 1)
+            LOGI("\"%s\" is %s, not read back\n", w->image_info->name,
+                    w->image_info->fs_type);
+        return 0;
+    }
+
+    rb.bm = w->bm;
+    rb.offset = w->start_offset;
+
+    start = update_stats_now();
+    error = hashtree_verify_blocks(ht, chunk_image_offset(w) / ht->leaf_size,
+            (w->total + ht->leaf_size - 1) / ht->leaf_size, readback_leaf,
+            &rb, 0);
+    update_stats_add(UPDATE_STAGE_VERIFY, w->total, start);
+    if (error < 0) {
+        LOGE("Chunk %d of %s does not read back as written\n",
+                w->chunk_index, w->image_info->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+int chunk_writer_begin(struct chunk_writer* w, struct flash_context* ctx,
+        struct block_manager* bm, struct part_info* part_info,
+        struct image_info* image_info, uint32_t chunk_index,
+        uint32_t package) {
+    struct flash_session* s = ctx->session;
+    int error = 0;
+
+    memset(w, 0, sizeof(*w));
+    w->ctx = ctx;
+    w->bm = bm;
+    w->part_info = part_info;
+    w->image_info = image_info;
+    w->chunk_index = chunk_index;
+    w->package = package;
+
+    if (list_empty(&part_info->list)) {
+        LOGE("Cannot get first or last image from partition\n");
+        goto out;
+    }
+
+    if (bm != NULL) {
+        struct image_info* first_image = list_entry(part_info->list.next,
+                struct image_info, head_part);
+        int64_t resume_offset = 0;
+
+        /*
+         * An interrupted update resumes in the middle of a partition
+         * nothing has been prepared for yet in this run
+         */
+        if (!is_first_chunk_in_part(w) && ctx->write_buffer == NULL) {
+            pthread_mutex_lock(&s->journal_lock);
+            if (update_journal_resume_offset(&s->journal, package,
+                    part_info->offset, &resume_offset))
+                LOGI("Resuming \"%s\" at 0x%" PRIx64 "\n", part_info->name,
+                        resume_offset);
+            pthread_mutex_unlock(&s->journal_lock);
+        }
+
+        if (is_first_chunk_in_part(w) || resume_offset) {
+            struct bm_operation_option option;
+            int64_t erase_offset, erase_length;
+
+            error = bm->set_operation_option(bm, &option,
+                    BM_OPERATION_METHOD_PARTITION, first_image->fs_type);
+            if (error < 0) {
+                LOGE("Failed to get operation option\n");
+                goto out;
+            }
+            option.skip_erased = s->cf->skip_erased;
+
+            struct bm_operate_prepare_info* prepare_info =
+                    bm->prepare(bm, first_image->offset, first_image->size,
+                    &option);
+            if (prepare_info == NULL) {
+                LOGE("Failed to perpare, offset=0x%" PRIx64 "\n",
+                        first_image->offset);
+                goto out;
+            }
+
+            if (bm->get_prepare_leb_size(bm) < 0) {
+                LOGE("Failed to get leb size, image write offset at %" PRId64 "\n",
+                        first_image->offset);
+                goto out;
+            }
+
+            if (ctx->write_buffer == NULL) {
+                if (update_wbuffer_method ==
+                        UPDATE_WBUFFER_ALLOWABLE_MINIMUM_SIZE) {
+                    ctx->write_buffer_size = bm->get_prepare_leb_size(bm);
+                    ctx->write_media_leap = bm->get_blocksize(bm,
+                            first_image->offset);
+
+                } else if (update_wbuffer_method ==
+                        UPDATE_WBUFFER_FIXED_WITH_CHUCK_SIZE) {
+                    ctx->write_buffer_size = first_image->chunksize;
+                    ctx->write_media_leap =
+                            (first_image->chunksize / bm->get_prepare_leb_size(bm))
+                            * bm->get_blocksize(bm, first_image->offset);
+                }
+
+                ctx->write_buffer = malloc(ctx->write_buffer_size);
+                if (ctx->write_buffer == NULL) {
+                    LOGE("Failed to alloc any more memory, requested size %d",
+                        ctx->write_buffer_size);
+                    goto out;
+                }
+            }
+
+            if ((option.method != BM_OPERATION_METHOD_PARTITION)
+                && ((bm->get_prepare_max_mapped_size(bm) + first_image->offset)
+                > (part_info->offset + part_info->size))) {
+                LOGE("Overstep the boundary at 0x%" PRIx64 ", image write offset 0x%" PRIx64 ", size %" PRId64 "\n",
+                        part_info->offset + part_info->size, first_image->offset,
+                        bm->get_prepare_max_mapped_size(bm));
+                goto out;
+            }
+
+            /*
+             * A resumed partition keeps what was committed and only loses
+             * the interrupted package, a delta one is erased block by
+             * block as it is rewritten
+             */
+            erase_offset = bm->get_partition_start_by_offset(bm,
+                    first_image->offset);
+            erase_length = bm->get_partition_size_by_offset(bm,
+                    first_image->offset);
+            if (resume_offset) {
+                erase_length = erase_offset + erase_length - resume_offset;
+                erase_offset = resume_offset;
+            }
+
+            ctx->compare_skip = can_compare_skip(ctx, bm, part_info);
+            if (ctx->compare_skip && ctx->compare_buffer == NULL) {
+                ctx->compare_buffer = malloc(ctx->write_buffer_size);
+                if (ctx->compare_buffer == NULL) {
+                    LOGE("Failed to alloc compare buffer\n");
+                    goto out;
+                }
+            }
+            ctx->blocks_skipped = ctx->blocks_written = 0;
+
+            if (first_image->update_mode != UPDATE_MODE_DELTA
+                    && !ctx->compare_skip
+                    && erase_partition(w, first_image, erase_offset,
+                            erase_offset + erase_length) < 0)
+                goto out;
+
+            if (resume_offset) {
+                ctx->next_write_offset = resume_offset;
+            } else {
+                w->cur_write_offset = bm->get_prepare_write_start(bm);
+                if (w->cur_write_offset < 0) {
+                    LOGE("Failed to get write offset, gotten 0x%" PRIx64 "\n",
+                            w->cur_write_offset);
+                    goto out;
+                }
+            }
+        }
+
+        if (ctx->write_buffer == NULL) {
+            LOGE("Chunk %d of %s is written before its partition is prepared\n",
+                    chunk_index, image_info->name);
+            goto out;
+        }
+
+        if (ctx->next_write_offset > (part_info->offset + part_info->size)) {
+            LOGE("Bad write offset at %" PRId64 "\n",  ctx->next_write_offset);
+            goto out;
+        }
+
+        if (ctx->next_write_offset && !w->cur_write_offset) {
+            w->cur_write_offset = MAX(ctx->next_write_offset,
+                    image_info->offset);
+        }
+
+        /*
+         * Whatever lies in front of an image would have been erased too
+         */
+        if (ctx->compare_skip && chunk_index == 1) {
+            int64_t gap = is_first_chunk_in_part(w)
+                    ? (int64_t)part_info->offset : ctx->next_write_offset;
+
+            if (compare_skip_erase(w, gap, w->cur_write_offset) < 0)
+                goto out;
+        }
+
+        if (image_info->update_mode == UPDATE_MODE_DELTA) {
+            if (is_first_chunk_in_part(w) && delta_source_open(w) < 0)
+                goto out;
+
+            if (ctx->delta_source.map == NULL) {
+                LOGE("Chunk %d of delta image %s cannot be applied alone\n",
+                        chunk_index, image_info->name);
+                goto out;
+            }
+
+            if (delta_patch_init(&w->delta,
+                    (chunk_index - 1) * image_info->chunksize,
+                    get_chunk_size(image_info, chunk_index),
+                    ctx->write_buffer_size, delta_source_read,
+                    chunk_writer_fill, w) < 0)
+                goto out;
+
+            w->is_delta = 1;
+        }
+
+        w->hashtree = get_chunk_hashtree(w);
+        w->start_offset = w->cur_write_offset;
+
+    } else
+        assert_die_if(1, "No block manager for \"%s\"\n", part_info->name);
+
+    return 0;
+
+out:
+    chunk_writer_abort(w);
+    return -1;
+}
+
+int chunk_writer_flush(struct chunk_writer* w) {
+    struct flash_context* ctx = w->ctx;
+    struct block_manager* bm = w->bm;
+
+    if (!w->fill)
+        return 0;
+
+    if (w->hashtree && verify_write_buffer(w) < 0)
+        return -1;
+
+    if (w->is_delta)
+        return chunk_writer_flush_delta(w);
+
+    if (ctx->compare_skip)
+        return chunk_writer_flush_compare(w);
+
+    ctx->next_write_offset = bm->write(bm, w->cur_write_offset,
+            ctx->write_buffer, w->fill);
+    if (ctx->next_write_offset < 0) {
+        LOGE("Failed to write, offset=0x%" PRIx64 ", lenght=0x%" PRIx64 "\n",
+                w->cur_write_offset, w->image_info->size);
+        return -1;
+    }
+
+    /*
+     * Carries on where the write ended, past the bad blocks it stepped
+     * over rather than into the block that took their data
+     */
+    w->cur_write_offset = ctx->next_write_offset;
+    w->fill = 0;
+
+    return 0;
+}
+
+static int chunk_writer_fill(const void* buf, uint32_t len, void* param) {
+    struct chunk_writer* w = (struct chunk_writer *)param;
+    struct flash_context* ctx = w->ctx;
+    const char* p = (const char *)buf;
+
+    while (len) {
+        uint32_t n = MIN(len, ctx->write_buffer_size - w->fill);
+
+        memcpy(ctx->write_buffer + w->fill, p, n);
+        w->fill += n;
+        w->total += n;
+        p += n;
+        len -= n;
+
+        if (w->fill == ctx->write_buffer_size && chunk_writer_flush(w) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Image data, or the patch rebuilding it for delta images
+ */
+int chunk_writer_feed(struct chunk_writer* w, const void* buf, uint32_t len) {
+    if (w->is_delta)
+        return delta_patch_feed(&w->delta, buf, len);
+
+    return chunk_writer_fill(buf, len, w);
+}
+
+static int commit_update_journal(struct chunk_writer* w) {
+    struct flash_context* ctx = w->ctx;
+    struct flash_session* s = ctx->session;
+    struct image_info* first_image = list_entry(w->part_info->list.next,
+            struct image_info, head_part);
+    int error;
+
+    if (ctx->commit)
+        return ctx->commit(w, ctx->commit_param);
+
+    /*
+     * Delta partitions are committed whole too, their old content is gone
+     */
+    pthread_mutex_lock(&s->journal_lock);
+    error = update_journal_commit_package(&s->journal_store, &s->journal,
+            w->package, w->part_info->offset, ctx->next_write_offset,
+            is_last_chunk_in_part(w),
+            update_journal_is_resumable(first_image->fs_type)
+            && first_image->update_mode != UPDATE_MODE_DELTA);
+    pthread_mutex_unlock(&s->journal_lock);
+
+    return error;
+}
+
+int chunk_writer_end(struct chunk_writer* w) {
+    struct flash_context* ctx = w->ctx;
+    struct block_manager* bm = w->bm;
+    int error = 0;
+
+    if (w->is_delta && delta_patch_finish(&w->delta) < 0)
+        return -1;
+
+    if (chunk_writer_flush(w) < 0)
+        return -1;
+
+    if (w->is_delta) {
+        delta_patch_destroy(&w->delta);
+        w->is_delta = 0;
+    }
+
+    if (ctx->session->cf->verify_readback && w->hashtree
+            && verify_chunk_readback(w) < 0)
+        return -1;
+
+    if (is_last_chunk_in_part(w)) {
+        if (ctx->compare_skip) {
+            int64_t part_end = w->part_info->offset + w->part_info->size;
+
+            if (compare_skip_erase(w, w->cur_write_offset, part_end) < 0)
+                return -1;
+
+            LOGI("\"%s\": %u erase blocks rewritten, %u already up to date\n",
+                    w->part_info->name, ctx->blocks_written,
+                    ctx->blocks_skipped);
+        }
+
+        error = bm->finish(bm);
+        if (error < 0) {
+            LOGE("Failed to issue bm finish, chunk index is %d\n",
+                    w->chunk_index);
+            return -1;
+        }
+
+        chunk_writer_abort(w);
+    }
+
+    if (commit_update_journal(w) < 0)
+        return -1;
+
+    return 0;
+}
@@ -14,6 +14,8 @@
  *
  */
 
+#define _GNU_SOURCE
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -22,6 +24,7 @@
 #include <fcntl.h>
 #include <sys/reboot.h>
 #include <dirent.h>
+#include <limits.h>
 #include <utils/log.h>
 #include <utils/assert.h>
 #include <utils/linux.h>
@@ -30,9 +33,17 @@
 #include <utils/file_ops.h>
 #include <utils/minizip.h>
 #include <utils/verifier.h>
+#include <utils/zip_stream.h>
+#include <utils/delta_patch.h>
+#include <utils/hashtree.h>
+#include <utils/hash.h>
 #include <utils/signal_handler.h>
+#include <utils/update_stats.h>
 #include <netlink/netlink_event.h>
 #include <ota/ota_manager.h>
+#include <ota/update_journal.h>
+#include <ota/chunk_writer.h>
+#include <ota/prefetch_pipeline.h>
 #include <block/sysinfo/sysinfo_manager.h>
 
 #define LOG_TAG "ota_manager"
@@ -47,9 +58,10 @@ static const char* prefix_volume_device_path = "/dev";
 static const char* prefix_storage_update_path = "recovery-update";
 static const char* prefix_update_pkg = "update";
 static const char* prefix_local_update_path = "/tmp/update";
+static const char* prefix_local_update_stats = "/tmp/update_stats.json";
+static const char* prefix_update_stats = "update_stats.json";
 
-static const int update_wbuffer_method = UPDATE_WBUFFER_ALLOWABLE_MINIMUM_SIZE;
-static int64_t next_write_offset;
+static struct flash_session session;
 static struct gui* gui;
 static void *main_task(void *param);
 
@@ -106,6 +118,17 @@ static inline int ensure_volume_unmounted(struct ota_manager* this,
     return 0;
 }
 
+/*
+ * The MTD emulator of the host build has no device nodes
+ */
+static inline int has_mtd_device(void) {
+#ifdef HOST_BUILD
+    return 1;
+#else
+    return !file_exist("/dev/mtd0");
+#endif
+}
+
 static inline void add_storage_dev(struct ota_manager* this, const char* name) {
 
     struct list_head* pos;
@@ -275,15 +298,21 @@ static void recovery_finish(int error) {
 }
 
 static int verify_update_pkg(struct ota_manager* this, const char* path) {
+    uint64_t start;
     int nkeys = 0;
+    int error;
 
-    RSAPublicKey* keys = load_keys(g_data.public_key_path, &nkeys);
+    Certificate* keys = load_keys(g_data.public_key_path, &nkeys);
     if (keys == NULL) {
         LOGE("Failed to load public keys from: %s\n", g_data.public_key_path);
         return -1;
     }
 
-    if (verify_file(path, keys, nkeys) == VERIFY_FAILURE) {
+    start = update_stats_now();
+    error = verify_file(path, keys, nkeys);
+    update_stats_add(UPDATE_STAGE_VERIFY, get_file_size(path), start);
+    free(keys);
+    if (error != VERIFY_SUCCESS) {
         LOGE("Failed to verify file: %s\n", path);
         return -1;
     }
@@ -301,12 +330,28 @@ static int creat_unzip_dir() {
     return 0;
 }
 
+static struct block_manager* get_block_manager(struct ota_manager* this,
+        const char* devtype) {
+    if (!strcmp(devtype, "nand") || !strcmp(devtype, "nor"))
+        return this->mtd_bm;
+
+    if (!strcmp(devtype, "mmc"))
+        return this->mmc_bm;
+
+    return NULL;
+}
+
 static int check_device_info(struct ota_manager* this,
         struct device_info* device_info) {
 
     if (!strcmp(device_info->type, "nand")
             || !strcmp(device_info->type, "nor")) {
 
+        if (this->mtd_bm == NULL) {
+            LOGE("No mtd device to update\n");
+            return -1;
+        }
+
         if (device_info->part_count !=
                 this->mtd_bm->get_partition_count(this->mtd_bm)) {
             LOGE("Partition count error\n");
@@ -334,7 +379,33 @@ static int check_device_info(struct ota_manager* this,
         }
 
     } else if (!strcmp(device_info->type, "mmc")) {
-        assert_die_if(1, "Unsupport device type: %s\n", device_info->type);
+        struct block_manager* bm = this->mmc_bm;
+
+        if (bm == NULL) {
+            LOGE("No mmc device to update\n");
+            return -1;
+        }
+
+        if (device_info->part_count != bm->get_partition_count(bm)) {
+            LOGE("Partition count error\n");
+            return -1;
+        }
+
+        struct list_head* pos;
+        list_for_each(pos, &device_info->list) {
+            struct part_info *info = list_entry(pos, struct part_info, head);
+            char *blkname = strrchr(info->block_name, '/');
+
+            blkname = blkname ? blkname + 1 : info->block_name;
+
+            int64_t offset = bm->get_partition_start_by_name(bm, blkname);
+            int64_t size = bm->get_partition_size_by_name(bm, blkname);
+
+            if ((offset != info->offset) || (size != info->size)) {
+                LOGE("Failed to check partition: %s\n", info->name);
+                return -1;
+            }
+        }
 
     } else
         assert_die_if(1, "Unsupport device type: %s\n", device_info->type);
@@ -371,13 +442,11 @@ static int merge_imginfo_into_partinfo(struct ota_manager* this,
                 return 0;
             }
 
-            if (image_info->offset >= part_info_right_boundary) {
-                pos_continue = pos_update;
+            if (image_info->offset >= part_info_right_boundary)
                 break;
-            }
 
             if ((image_info->offset + image_info->size) > part_info_right_boundary) {
-                LOGE("Image offset 0x%llx, length %lld is overlap with current part\n",
+                LOGE("Image offset 0x%" PRIx64 ", length %" PRId64 " is overlap with current part\n",
                         image_info->offset,  image_info->size);
                 goto out;
             }
@@ -387,6 +456,12 @@ static int merge_imginfo_into_partinfo(struct ota_manager* this,
             part_info->image_count++;
             part_info->total_chunks += image_info->chunkcount;
         }
+
+        /*
+         * The next partition goes on from here, with no images left once
+         * they have all been placed
+         */
+        pos_continue = pos_update;
     }
 
     return 0;
@@ -395,11 +470,40 @@ out:
     return -1;
 }
 
+static int load_image_hashtrees(struct update_info* update_info) {
+    char path[PATH_MAX];
+    struct list_head* pos;
+
+    list_for_each(pos, &update_info->list) {
+        struct image_info* image_info = list_entry(pos, struct image_info,
+                head);
+
+        if (!image_info->hashtree_root[0])
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s.hashtree",
+                prefix_local_update_path, image_info->name);
+        if (hashtree_load(&image_info->hashtree, path,
+                image_info->hashtree_root, image_info->size) < 0) {
+            LOGE("Failed to load hash tree of %s\n", image_info->name);
+            return -1;
+        }
+
+        LOGI("Hash tree of %s: %u leaves of %u bytes\n", image_info->name,
+                image_info->hashtree.leaf_count,
+                image_info->hashtree.leaf_size);
+    }
+
+    return 0;
+}
+
 static int check_devive_update_info(struct ota_manager* this,
         const char* path, struct device_info* device_info,
         struct update_info* update_info) {
 
     char local_path[1024] = {0};
+    uint64_t start;
+    int error;
 
     /*
      * Verifier update000.zip
@@ -413,7 +517,10 @@ static int check_devive_update_info(struct ota_manager* this,
      * Un-zip update pkg
      */
     LOGI("Unziping %s\n", path);
-    if (unzip(path, prefix_local_update_path, NULL, 1) < 0) {
+    start = update_stats_now();
+    error = unzip(path, prefix_local_update_path, NULL, 1);
+    update_stats_add(UPDATE_STAGE_UNZIP, 0, start);
+    if (error < 0) {
         LOGE("Failed to unzip %s to %s\n", path, prefix_local_update_path);
         return -1;
     }
@@ -454,6 +561,12 @@ static int check_devive_update_info(struct ota_manager* this,
     }
     this->uf->dump_update_info(this->uf, update_info);
 
+    /*
+     * Load the hash trees, signed along with update.xml
+     */
+    if (load_image_hashtrees(update_info) < 0)
+        return -1;
+
     /*
      * Check relation between device info and image info
      */
@@ -466,179 +579,580 @@ static int check_devive_update_info(struct ota_manager* this,
     return 0;
 }
 
+/*
+ * Waits for the background erase still running behind the last writes
+ */
+static int sync_block_manager(struct ota_manager* this) {
+    struct block_manager* bm = this->mtd_bm;
+
+    if (bm && bm->sync && bm->sync(bm) < 0) {
+        LOGE("Failed to finish background erase\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Only a cache for the next update, a failure here does not fail this one
+ */
+static void save_bad_block_table(struct ota_manager* this) {
+    struct block_manager* bm = this->mtd_bm;
+
+    if (bm && bm->save_bad_block_table && bm->save_bad_block_table(bm) < 0)
+        LOGW("Cannot save bad block table\n");
+}
+
+/*
+ * A fresh update starts with an empty journal, an interrupted one (update
+ * flag still at UPDATE_START) carries on with what it left behind
+ */
+static int load_update_journal(struct ota_manager* this) {
+    uint32_t flag = 0;
+
+    update_journal_store_close(&session.journal_store);
+    if (update_journal_store_open(&session.journal_store, this->mtd_bm,
+            this->cf->journal_part) < 0)
+        return -1;
+
+    if (GET_SYSINFO_FLAG()->read(SYSINFO_FLAG_ID_UPDATE_DONE, &flag) < 0)
+        flag = 0;
+
+    return update_journal_restore(&session.journal_store, &session.journal,
+            flag == SYSINFO_FLAG_VALUE_UPDATE_START);
+}
+
+static int begin_device_journal(uint32_t device, const char* path) {
+    uint32_t fingerprint = 0;
+
+    if (update_journal_fingerprint(path, &fingerprint) < 0)
+        return -1;
+
+    update_journal_begin_device(&session.journal, device, fingerprint);
+
+    return 0;
+}
+
+static inline int is_package_committed(uint32_t device, uint32_t package,
+        const char* path) {
+    if (!update_journal_is_done(&session.journal, device, package))
+        return 0;
+
+    LOGI("Skipping %s, already written\n", path);
+
+    return 1;
+}
+
+/*
+ * Writes the image chunk of an update package read from storage or
+ * downloaded, the entry is read straight out of the zip file
+ */
 static int write_update_pkg(struct ota_manager* this,
-        struct update_info* update_info, struct part_info* part_info,
-        struct image_info* image_info, const char* path,
-        uint32_t chunk_index) {
-    int error = 0;
-    int fd = 0;
-    static uint32_t write_buffer_size, write_media_leap;
-    static char *write_buffer = NULL;
-    struct image_info* first_image, *last_image;
-    uint32_t readsize, filesize;
+        struct flash_context* flash, struct update_info* update_info,
+        struct part_info* part_info, struct image_info* image_info,
+        const char* path, uint32_t chunk_index, uint32_t package) {
+    struct chunk_writer writer;
+    struct unzip_entry entry;
+    char name[NAME_MAX];
+    uint64_t left;
+    uint64_t start;
+    uint32_t readsize;
+    char* patch = NULL;
+    char* buf;
+
+    memset(&writer, 0, sizeof(writer));
+
+    if (image_info->chunkcount == 1)
+        snprintf(name, sizeof(name), "%s", image_info->name);
+    else if (snprintf(name, sizeof(name), "%s_%03d", image_info->name,
+                chunk_index) >= (int) sizeof(name))
+        return -1;
 
-    fd = open(path, O_RDWR);
-    if (fd < 0) {
-        LOGE("Cannot open file at %s\n", path);
+    if (unzip_entry_open(&entry, path, name) < 0)
+        return -1;
+
+    if ((chunk_index != image_info->chunkcount)
+            && (image_info->update_mode != UPDATE_MODE_DELTA)
+            && (entry.size != image_info->chunksize)) {
+        LOGE("Image %s size error\n", image_info->name);
         goto out;
     }
 
-    filesize = get_file_size(path);
-    first_image = list_entry(part_info->list.next, struct image_info, head_part);
-    last_image = list_entry(part_info->list.prev, struct image_info, head_part);
-    if ((first_image == NULL) || (last_image == NULL)) {
-        LOGE("Cannot get first or last image from partition\n");
+    if (chunk_writer_begin(&writer, flash,
+            get_block_manager(this, update_info->devtype), part_info,
+            image_info, chunk_index, package) < 0)
         goto out;
+
+    /*
+     * A patch goes through the decoder rather than straight to flash
+     */
+    buf = flash->write_buffer;
+    if (writer.is_delta) {
+        patch = (char *) malloc(flash->write_buffer_size);
+        if (patch == NULL) {
+            LOGE("Failed to alloc patch buffer\n");
+            goto out;
+        }
+        buf = patch;
     }
 
-    if (!strcmp(update_info->devtype, "nand")
-            || !strcmp(update_info->devtype, "nor")) {
+    for (left = entry.size; left; left -= readsize) {
+        readsize = MIN(left, flash->write_buffer_size);
 
-        struct block_manager* bm = this->mtd_bm;
-        int64_t cur_write_offset = 0;
+        start = update_stats_now();
+        if (unzip_entry_read(&entry, buf, readsize) != readsize)
+            goto out;
+        update_stats_add(UPDATE_STAGE_UNZIP, readsize, start);
 
-        if (!strcmp(first_image->name, image_info->name)
-            && (chunk_index == 1)) {
-            struct bm_operation_option option;
-            error = bm->set_operation_option(bm, &option,
-                    BM_OPERATION_METHOD_PARTITION, image_info->fs_type);
-            if (error < 0) {
-                LOGE("Failed to get operation option\n");
+        if (writer.is_delta) {
+            if (chunk_writer_feed(&writer, patch, readsize) < 0)
                 goto out;
-            }
-
-            struct bm_operate_prepare_info* prepare_info =
-                    bm->prepare(bm, image_info->offset, image_info->size, &option);
-            if (prepare_info == NULL) {
-                LOGE("Failed to perpare, offset=0x%llx\n",
-                        image_info->offset);
+        } else {
+            writer.fill = readsize;
+            writer.total += readsize;
+            if (chunk_writer_flush(&writer) < 0)
                 goto out;
-            }
+        }
+    }
 
-            if (bm->get_prepare_leb_size(bm) < 0) {
-                LOGE("Failed to get leb size, image write offset at %lld\n",
-                        image_info->offset);
-                goto out;
-            }
+    /*
+     * A corrupted entry must not complete the partition
+     */
+    if (unzip_entry_close(&entry) < 0)
+        goto out;
 
-            if (write_buffer == NULL) {
-                if (update_wbuffer_method ==
-                        UPDATE_WBUFFER_ALLOWABLE_MINIMUM_SIZE) {
-                    write_buffer_size = bm->get_prepare_leb_size(bm);
-                    write_media_leap = bm->get_blocksize(bm, image_info->offset);
-
-                } else if (update_wbuffer_method ==
-                        UPDATE_WBUFFER_FIXED_WITH_CHUCK_SIZE) {
-                    write_buffer_size = image_info->chunksize;
-                    write_media_leap =
-                            (image_info->chunksize / bm->get_prepare_leb_size(bm))
-                            * bm->get_blocksize(bm, image_info->offset);
-                }
+    if (chunk_writer_end(&writer) < 0)
+        goto out;
 
-                write_buffer = malloc(write_buffer_size);
-                if (write_buffer == NULL) {
-                    LOGE("Failed to alloc any more memory, requested size %d",
-                        write_buffer_size);
-                    goto out;
-                }
-            }
+    free(patch);
 
-            if ((option.method != BM_OPERATION_METHOD_PARTITION)
-                && ((bm->get_prepare_max_mapped_size(bm) + image_info->offset)
-                > (part_info->offset + part_info->size))) {
-                LOGE("Overstep the boundary at 0x%llx, image write offset 0x%llx, size %lld\n",
-                        part_info->offset + part_info->size, image_info->offset,
-                        bm->get_prepare_max_mapped_size(bm));
-                goto out;
-            }
+    return 0;
 
-            error = bm->erase(bm, image_info->offset,
-                    bm->get_partition_size_by_offset(bm, image_info->offset));
-            if (error < 0) {
-                LOGE("Failed to erase, offset=0x%llx, length=0x%llx\n",
-                        image_info->offset,
-                        bm->get_partition_size_by_offset(bm, image_info->offset));
-                goto out;
-            }
+out:
+    chunk_writer_abort(&writer);
+    unzip_entry_close(&entry);
+    free(patch);
 
-            cur_write_offset = bm->get_prepare_write_start(bm);
-            if (cur_write_offset < 0) {
-                LOGE("Failed to get write offset, gotten 0x%llx\n", cur_write_offset);
-                goto out;
-            }
+    return -1;
+}
+
+/*
+ * Streaming update
+ *
+ * The package is hashed and inflated while it is read from its source, so
+ * neither the package nor the unzipped image ever land in /tmp. The
+ * whole-file signature can only be checked once the end of the package
+ * has been seen, so a write buffer is only programmed straight away when
+ * the chunk writer checks it against the hash tree signed along with
+ * update.xml. Without one, the chunk is held in memory until its package
+ * is verified.
+ */
+struct stream_context {
+    struct chunk_writer writer;
+    struct zip_stream zs;
+    char entry_name[NAME_MAX];
+    int entry_found;
+
+    /*
+     * Collect the chunk in memory rather than writing it out
+     */
+    char* mem;
+    uint32_t mem_size;
+    uint32_t mem_cap;
+};
+
+static int stream_entry_cb(struct zip_stream* zs, const char* name,
+        void* param) {
+    struct stream_context* ctx = (struct stream_context *)param;
+    const char* base = strrchr(name, '/');
+
+    base = base ? base + 1 : name;
+    if (strcmp(base, ctx->entry_name))
+        return 0;
+
+    if (ctx->entry_found) {
+        LOGE("Duplicated entry %s\n", name);
+        return -1;
+    }
+
+    ctx->entry_found = 1;
+
+    return 1;
+}
+
+static int stream_data_cb(struct zip_stream* zs, const void* buf,
+        uint32_t len, void* param) {
+    struct stream_context* ctx = (struct stream_context *)param;
+
+    if (ctx->mem) {
+        if (len > ctx->mem_cap - ctx->mem_size) {
+            LOGE("Entry %s is bigger than %u\n", ctx->entry_name, ctx->mem_cap);
+            return -1;
         }
 
-        if (next_write_offset > (part_info->offset + part_info->size)) {
-            LOGE("Bad write offset at %lld\n",  next_write_offset);
-            goto out;
+        memcpy(ctx->mem + ctx->mem_size, buf, len);
+        ctx->mem_size += len;
+
+        return 0;
+    }
+
+    return chunk_writer_feed(&ctx->writer, buf, len);
+}
+
+static int stream_feed_cb(const void* buf, uint32_t len, void* param) {
+    struct stream_context* ctx = (struct stream_context *)param;
+
+    return zip_stream_feed(&ctx->zs, buf, len);
+}
+
+static int stream_context_init(struct stream_context* ctx,
+        struct image_info* image_info, uint32_t chunk_index) {
+    if (image_info->chunkcount == 1)
+        snprintf(ctx->entry_name, sizeof(ctx->entry_name), "%s",
+                image_info->name);
+    else if (snprintf(ctx->entry_name, sizeof(ctx->entry_name), "%s_%03d",
+                image_info->name, chunk_index) >= (int) sizeof(ctx->entry_name))
+        return -1;
+
+    return zip_stream_init(&ctx->zs, g_data.public_key_path, stream_entry_cb,
+            stream_data_cb, ctx);
+}
+
+static int stream_from_file(const char* path, struct stream_context* ctx) {
+    int fd;
+    ssize_t len;
+    int error = 0;
+    char* buf;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGE("Cannot open file at %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    buf = (char *) malloc(DOWNLOAD_STREAM_BUFSIZE);
+    if (buf == NULL) {
+        LOGE("Failed to alloc stream buffer: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    for (;;) {
+        len = read(fd, buf, DOWNLOAD_STREAM_BUFSIZE);
+        if (len < 0 && errno == EINTR)
+            continue;
+
+        if (len < 0) {
+            LOGE("Failed to read %s: %s\n", path, strerror(errno));
+            error = -1;
+            break;
         }
 
-        if (next_write_offset && !cur_write_offset) {
-            cur_write_offset = MAX(next_write_offset, image_info->offset);
+        if (len == 0)
+            break;
+
+        if (stream_feed_cb(buf, len, ctx) < 0) {
+            error = -1;
+            break;
         }
+    }
 
-        char *buffer = write_buffer;
-        while(filesize) {
-            readsize = MIN(filesize, write_buffer_size);
-            uint32_t already_read = 0;
-            while(already_read != readsize) {
-                error = read(fd, buffer + already_read, readsize - already_read);
-                if (error < 0) {
-                    LOGE("Failed to read %d size\n", readsize - already_read);
-                    goto out;
-                }
+    free(buf);
+    close(fd);
 
-                already_read += error;
-            }
+    return error;
+}
 
-            next_write_offset = bm->write(bm, cur_write_offset, write_buffer, readsize);
-            if (next_write_offset < 0) {
-                LOGE("Failed to write, offset=0x%llx, lenght=0x%llx\n",
-                        cur_write_offset, image_info->size);
-                goto out;
-            }
+/*
+ * Peak memory is the write buffer, one 32 KB inflate buffer and the zip
+ * comment when every write buffer of the chunk is checked by leaf. An
+ * image without a hash tree, or with leaves that do not fit the write
+ * buffers, holds the whole chunk (the patch bound of a delta one) on top
+ * of that until its package is verified.
+ */
+static int stream_update_pkg(struct ota_manager* this,
+        struct flash_context* flash, struct update_info* update_info,
+        struct part_info* part_info, struct image_info* image_info,
+        const char* source, int from_network, uint32_t chunk_index,
+        uint32_t package) {
+    int error = 0;
+    uint64_t start;
+    struct stream_context* ctx;
 
-            filesize -= readsize;
-            cur_write_offset += write_media_leap;
-        }
+    ctx = (struct stream_context *) calloc(1, sizeof(*ctx));
+    if (ctx == NULL) {
+        LOGE("Failed to alloc stream context: %s\n", strerror(errno));
+        return -1;
+    }
 
-        if (!strcmp(last_image->name, image_info->name)
-                && (chunk_index == image_info->chunkcount)) {
-            error = bm->finish(bm);
-            if (error < 0) {
-                LOGE("Failed to issue bm finish, chunk index is %d\n", chunk_index);
-                goto out;
-            }
+    if (stream_context_init(ctx, image_info, chunk_index) < 0) {
+        free(ctx);
+        return -1;
+    }
 
-            if (write_buffer) {
-                free(write_buffer);
-                write_buffer = NULL;
-            }
+    if (chunk_writer_begin(&ctx->writer, flash,
+            get_block_manager(this, update_info->devtype), part_info,
+            image_info, chunk_index, package) < 0)
+        goto out;
+
+    if (ctx->writer.hashtree == NULL) {
+        ctx->mem_cap = get_chunk_size(image_info, chunk_index);
+        if (image_info->update_mode == UPDATE_MODE_DELTA)
+            ctx->mem_cap = delta_patch_max_size(ctx->mem_cap,
+                    ctx->writer.bm->get_blocksize(ctx->writer.bm,
+                            image_info->offset));
+
+        LOGI("\"%s\" is not checked by leaf, holding %u bytes until %s "
+                "is verified\n", image_info->name, ctx->mem_cap, source);
+        ctx->mem = (char *) malloc(ctx->mem_cap ? ctx->mem_cap : 1);
+        if (ctx->mem == NULL) {
+            LOGE("Failed to alloc %u bytes for %s\n", ctx->mem_cap, source);
+            goto out;
         }
+    }
 
-    } else if (!strcmp(update_info->devtype, "mmc")) {
-        assert_die_if(1, "Unsupport device type: %s\n", update_info->devtype);
+    LOGI("Streaming %s\n", source);
+    if (from_network)
+        error = download_file_stream(source, stream_feed_cb, ctx);
+    else
+        error = stream_from_file(source, ctx);
 
-    } else
-        assert_die_if(1, "Unsupport device type: %s\n", update_info->devtype);
+    if (error < 0) {
+        LOGE("Failed to stream %s\n", source);
+        goto out;
+    }
 
-    if (fd > 0) {
-        close(fd);
-        fd = 0;
+    if (zip_stream_finish(&ctx->zs) < 0)
+        goto out;
+
+    LOGI("Verifying %s\n", source);
+    start = update_stats_now();
+    error = zip_stream_verify(&ctx->zs);
+    update_stats_add(UPDATE_STAGE_VERIFY, 0, start);
+    if (error < 0) {
+        LOGE("Failed to verify %s\n", source);
+        goto out;
     }
+
+    if (!ctx->entry_found) {
+        LOGE("Failed to find %s in %s\n", ctx->entry_name, source);
+        goto out;
+    }
+
+    if (ctx->mem && chunk_writer_feed(&ctx->writer, ctx->mem,
+            ctx->mem_size) < 0)
+        goto out;
+
+    if ((chunk_index != image_info->chunkcount)
+            && (ctx->writer.total != image_info->chunksize)) {
+        LOGE("Image %s size error\n", image_info->name);
+        goto out;
+    }
+
+    if (chunk_writer_end(&ctx->writer) < 0)
+        goto out;
+
+    zip_stream_destroy(&ctx->zs);
+    free(ctx->mem);
+    free(ctx);
+
     return 0;
+
 out:
-    if (write_buffer) {
-        free(write_buffer);
-        write_buffer = NULL;
+    chunk_writer_abort(&ctx->writer);
+    zip_stream_destroy(&ctx->zs);
+    free(ctx->mem);
+    free(ctx);
+
+    return -1;
+}
+
+/*
+ * Fetches the chunks of the prefetch pipeline
+ */
+static int prefetch_chunk(struct prefetch_job* job, int from_network) {
+    int error = 0;
+    uint64_t start;
+    struct stream_context* ctx;
+
+    ctx = (struct stream_context *) calloc(1, sizeof(*ctx));
+    if (ctx == NULL) {
+        LOGE("Failed to alloc stream context: %s\n", strerror(errno));
+        return -1;
     }
-    if (fd > 0) {
-        close(fd);
-        fd = 0;
+
+    update_stats_begin_chunk(job->part_info->name, job->image_info->name,
+            job->chunk_index);
+
+    ctx->mem = job->data;
+    ctx->mem_cap = job->size;
+
+    if (stream_context_init(ctx, job->image_info, job->chunk_index) < 0)
+        goto out;
+
+    LOGI("Prefetching %s\n", job->source);
+    if (from_network)
+        error = download_file_stream(job->source, stream_feed_cb, ctx);
+    else
+        error = stream_from_file(job->source, ctx);
+
+    if (error < 0) {
+        LOGE("Failed to fetch %s\n", job->source);
+        goto out;
     }
+
+    if (zip_stream_finish(&ctx->zs) < 0)
+        goto out;
+
+    start = update_stats_now();
+    error = zip_stream_verify(&ctx->zs);
+    update_stats_add(UPDATE_STAGE_VERIFY, 0, start);
+    if (error < 0) {
+        LOGE("Failed to verify %s\n", job->source);
+        goto out;
+    }
+
+    /*
+     * A patch only has an upper bound
+     */
+    if (!ctx->entry_found || (ctx->mem_size != job->size
+            && job->image_info->update_mode != UPDATE_MODE_DELTA)) {
+        LOGE("Image %s size error\n", job->image_info->name);
+        goto out;
+    }
+    job->length = ctx->mem_size;
+
+    update_stats_end_chunk();
+    zip_stream_destroy(&ctx->zs);
+    free(ctx);
+
+    return 0;
+
+out:
+    update_stats_end_chunk();
+    zip_stream_destroy(&ctx->zs);
+    free(ctx);
+
     return -1;
 }
 
+static int prefetch_from_network(struct prefetch_job* job, void* param) {
+    return prefetch_chunk(job, 1);
+}
+
+static int prefetch_from_file(struct prefetch_job* job, void* param) {
+    return prefetch_chunk(job, 0);
+}
+
+static int update_device_pipelined(struct ota_manager* this,
+        struct update_info* update_info, struct device_info* device_info,
+        uint32_t device, const char* source_dir, int from_network) {
+    struct block_manager* bm = get_block_manager(this, update_info->devtype);
+    int error = 0;
+    uint32_t i = 0;
+    uint32_t package = 1;
+    uint32_t count = 0;
+    uint64_t max_weight;
+    struct list_head* pos_devinfo;
+    struct list_head* pos_imageinfo;
+    struct prefetch_pipeline pipeline;
+
+    if (bm == NULL) {
+        LOGE("Unsupport device type: %s\n", update_info->devtype);
+        return -1;
+    }
+
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.session = &session;
+    pipeline.bm = bm;
+    pipeline.fetch = from_network ? prefetch_from_network : prefetch_from_file;
+
+    list_for_each(pos_devinfo, &device_info->list) {
+        struct part_info* part_info = list_entry(pos_devinfo,
+                struct part_info, head);
+        count += part_info->total_chunks;
+    }
+
+    pipeline.jobs = (struct prefetch_job *) calloc(count ? count : 1,
+            sizeof(struct prefetch_job));
+    if (pipeline.jobs == NULL) {
+        LOGE("Failed to alloc prefetch jobs: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /*
+     * Lay out the chunks not committed yet in package order
+     */
+    list_for_each(pos_devinfo, &device_info->list) {
+        struct part_info* part_info = list_entry(pos_devinfo,
+                struct part_info, head);
+        int flash_device = 0;
+
+        if (this->cf->parallel_flash && part_info->image_count > 0
+                && bm->get_device_id)
+            flash_device = MAX(bm->get_device_id(bm, part_info->offset), 0);
+
+        list_for_each(pos_imageinfo, &part_info->list) {
+            struct image_info* image_info = list_entry(pos_imageinfo,
+                    struct image_info, head_part);
+
+            for (int j = 1; j <= image_info->chunkcount && i < count;
+                    j++, package++) {
+                struct prefetch_job* job = &pipeline.jobs[i];
+
+                if (update_journal_is_done(&session.journal, device, package))
+                    continue;
+
+                job->part_info = part_info;
+                job->image_info = image_info;
+                job->chunk_index = j;
+                job->package = package;
+                job->device = flash_device;
+                job->last_in_part = pos_imageinfo->next == &part_info->list
+                        && j == image_info->chunkcount;
+                job->size = get_chunk_size(image_info, j);
+                if (image_info->update_mode == UPDATE_MODE_DELTA)
+                    job->size = delta_patch_max_size(job->size,
+                            bm->get_blocksize(bm, image_info->offset));
+                if (asprintf(&job->source, "%s/%s%03d.zip", source_dir,
+                        prefix_update_pkg, package) < 0) {
+                    job->source = NULL;
+                    error = -1;
+                    goto free_jobs;
+                }
+
+                i++;
+            }
+        }
+    }
+    pipeline.job_count = i;
+
+    if (package - 1 != pipeline.job_count)
+        LOGI("Skipping %u packages, already written\n",
+                package - 1 - pipeline.job_count);
+
+    max_weight = (uint64_t)this->cf->prefetch_memory * 1024;
+    if (!max_weight)
+        max_weight = get_available_memory() / 2;
+    pipeline.max_weight = max_weight;
+
+    LOGI("Prefetching %u chunks, depth %d, memory %" PRIu64 " KB\n",
+            pipeline.job_count, this->cf->prefetch_depth, max_weight / 1024);
+
+    error = prefetch_pipeline_run(&pipeline);
+
+free_jobs:
+    for (i = 0; i < count; i++) {
+        if (pipeline.jobs[i].data)
+            free(pipeline.jobs[i].data);
+        if (pipeline.jobs[i].source)
+            free(pipeline.jobs[i].source);
+    }
+    free(pipeline.jobs);
+
+    return error < 0 ? -1 : 0;
+}
+
 static struct mounted_volume* find_valid_update_volume(struct ota_manager* this) {
     char path[PATH_MAX] = {0};
     struct list_head* pos;
@@ -777,6 +1291,7 @@ static struct mounted_volume* find_valid_update_volume(struct ota_manager* this)
 
 static int update_from_storage(struct ota_manager* this) {
     char path[PATH_MAX] = {0};
+    struct flash_context flash;
     struct mounted_volume *volume= find_valid_update_volume(this);
 
     if (volume == NULL) {
@@ -784,6 +1299,10 @@ static int update_from_storage(struct ota_manager* this) {
         return -1;
     }
 
+    flash_context_init(&flash, &session);
+    if (load_update_journal(this) < 0)
+        goto error;
+
     int sysinfo_write_flag_val = SYSINFO_FLAG_VALUE_UPDATE_START;
     if (GET_SYSINFO_FLAG()->write(SYSINFO_FLAG_ID_UPDATE_DONE, &sysinfo_write_flag_val) < 0) {
         LOGE("Cannot write flag%d\n", SYSINFO_FLAG_ID_UPDATE_DONE);
@@ -800,10 +1319,29 @@ static int update_from_storage(struct ota_manager* this) {
         struct update_info* update_info =
                 this->uf->get_update_info_by_devtype(this->uf, devtype);
 
+        memset(path, 0, sizeof(path));
+        sprintf(path, "%s/%s/%s/%s%s", volume->mount_point,
+                prefix_storage_update_path, devtype, prefix_update_pkg,
+                "000.zip");
+        if (begin_device_journal(i, path) < 0)
+            goto error;
+
         int index = 1;
-        next_write_offset = 0;
+        flash.next_write_offset = 0;
         struct list_head* pos_devinfo;
 
+        if (this->cf->prefetch_depth > 0) {
+            memset(path, 0, sizeof(path));
+            sprintf(path, "%s/%s/%s", volume->mount_point,
+                    prefix_storage_update_path, devtype);
+
+            if (update_device_pipelined(this, update_info, device_info, i,
+                    path, 0) < 0)
+                goto error;
+
+            continue;
+        }
+
         list_for_each(pos_devinfo, &device_info->list){
             struct part_info *part_info = list_entry(pos_devinfo, struct part_info, head);
 
@@ -819,49 +1357,38 @@ static int update_from_storage(struct ota_manager* this) {
                 LOGI("Updating image: \"%s\"\n", image_info->name);
 
                 for (int j = 1; j <= image_info->chunkcount; j++) {
-                    /*
-                     * Create unzip dir
-                     */
-                    if (creat_unzip_dir() < 0)
-                        goto error;
-
                     memset(path, 0, sizeof(path));
                     sprintf(path, "%s/%s/%s/%s%03d.zip", volume->mount_point,
                             prefix_storage_update_path, devtype, prefix_update_pkg,
                             index);
 
-                    LOGI("Verifying %s\n", path);
-                    if (file_exist(path) < 0 || verify_update_pkg(this, path) < 0)
-                        goto error;
-
-                    LOGI( "Unziping %s\n", path);
-                    if (unzip(path, prefix_local_update_path, NULL, 1) < 0) {
-                        LOGE("Failed to unzip %s to %s\n", path,
-                                prefix_local_update_path);
-                        goto error;
+                    if (is_package_committed(i, index, path)) {
+                        index++;
+                        continue;
                     }
 
-                    memset(path, 0, sizeof(path));
-                    if (image_info->chunkcount == 1)
-                        sprintf(path, "%s/%s", prefix_local_update_path, image_info->name);
-                    else
-                        sprintf(path, "%s/%s_%03d", prefix_local_update_path,
-                                image_info->name, j);
-
-                    if (file_exist(path) < 0) {
-                        LOGE("Failed to access %s: %s\n", path, strerror(errno));
-                        goto error;
+                    update_stats_begin_chunk(part_info->name,
+                            image_info->name, j);
+
+                    if (this->cf->update_stream) {
+                        if (stream_update_pkg(this, &flash, update_info,
+                                part_info, image_info, path, 0, j,
+                                index) < 0) {
+                            LOGE("Failed to write %s\n", path);
+                            goto error;
+                        }
+
+                        index++;
+                        continue;
                     }
 
-                    if ((j != image_info->chunkcount)
-                            && (get_file_size(path) != image_info->chunksize)) {
-                        LOGE("Image %s size error\n", image_info->name);
+                    LOGI("Verifying %s\n", path);
+                    if (file_exist(path) < 0 || verify_update_pkg(this, path) < 0)
                         goto error;
-                    }
 
                     LOGI("Updating \"%s\"\n", path);
-                    if (write_update_pkg(this, update_info, part_info,
-                            image_info, path, j) < 0) {
+                    if (write_update_pkg(this, &flash, update_info,
+                            part_info, image_info, path, j, index) < 0) {
                         LOGE("Failed to write %s\n", path);
                         goto error;
                     }
@@ -870,7 +1397,14 @@ static int update_from_storage(struct ota_manager* this) {
                 }
             }
         }
+
+        update_stats_end_chunk();
     }
+    if (flash_session_erase_deferred(&session, 0) < 0
+            || sync_block_manager(this) < 0)
+        goto error;
+    save_bad_block_table(this);
+
     sysinfo_write_flag_val = SYSINFO_FLAG_VALUE_UPDATE_DONE;
     if (GET_SYSINFO_FLAG()->write(SYSINFO_FLAG_ID_UPDATE_DONE, &sysinfo_write_flag_val) < 0) {
         LOGE("Cannot write flag%d\n", SYSINFO_FLAG_ID_UPDATE_DONE);
@@ -881,6 +1415,8 @@ static int update_from_storage(struct ota_manager* this) {
     return 0;
 
 error:
+    flash_context_destroy(&flash);
+    flash_session_erase_deferred(&session, 1);
     dir_delete(prefix_local_update_path);
 
     return -1;
@@ -889,6 +1425,7 @@ error:
 static int update_from_network(struct ota_manager* this) {
     int error = 0;
     char path[PATH_MAX] = {0};
+    struct flash_context flash;
 
     /*
      * Check network
@@ -929,6 +1466,10 @@ static int update_from_network(struct ota_manager* this) {
     }
     this->uf->dump_device_type_list(this->uf);
 
+    flash_context_init(&flash, &session);
+    if (load_update_journal(this) < 0)
+        goto error;
+
     int sysinfo_write_flag_val = SYSINFO_FLAG_VALUE_UPDATE_START;
     if (GET_SYSINFO_FLAG()->write(SYSINFO_FLAG_ID_UPDATE_DONE,
                 &sysinfo_write_flag_val) < 0) {
@@ -973,6 +1514,9 @@ static int update_from_network(struct ota_manager* this) {
                 update_info) < 0)
             goto error;
 
+        if (begin_device_journal(i, path) < 0)
+            goto error;
+
         /*
          * Get package count
          */
@@ -985,8 +1529,20 @@ static int update_from_network(struct ota_manager* this) {
         }
 
         int index = 1;
-        next_write_offset = 0;
+        flash.next_write_offset = 0;
         struct list_head* pos_devinfo;
+
+        if (this->cf->prefetch_depth > 0) {
+            memset(path, 0, sizeof(path));
+            sprintf(path, "%s/%s", this->cf->server_url, devtype);
+
+            if (update_device_pipelined(this, update_info, device_info, i,
+                    path, 1) < 0)
+                goto error;
+
+            continue;
+        }
+
         list_for_each(pos_devinfo, &device_info->list) {
             struct part_info* part_info = list_entry(pos_devinfo,
                     struct part_info, head);
@@ -1003,16 +1559,36 @@ static int update_from_network(struct ota_manager* this) {
                 LOGI("Updating image: \"%s\"\n", image_info->name);
 
                 for (int j = 1; j <= image_info->chunkcount; j++) {
+                    memset(path, 0, sizeof(path));
+                    sprintf(path, "%s/%s/%s%03d.zip", this->cf->server_url,
+                            devtype, prefix_update_pkg, index);
+
+                    if (is_package_committed(i, index, path)) {
+                        index++;
+                        continue;
+                    }
+
+                    update_stats_begin_chunk(part_info->name,
+                            image_info->name, j);
+
+                    if (this->cf->update_stream) {
+                        if (stream_update_pkg(this, &flash, update_info,
+                                part_info, image_info, path, 1, j,
+                                index) < 0) {
+                            LOGE("Failed to write %s\n", path);
+                            goto error;
+                        }
+
+                        index++;
+                        continue;
+                    }
+
                     /*
                      * Create unzip dir
                      */
                     if (creat_unzip_dir() < 0)
                         goto error;
 
-                    memset(path, 0, sizeof(path));
-                    sprintf(path, "%s/%s/%s%03d.zip", this->cf->server_url,
-                            devtype, prefix_update_pkg, index);
-
                     LOGI("Downloading %s\n", path);
                     if (download_file(path, prefix_local_update_path) < 0) {
                         LOGE("Failed to download %s to %s\n", path,
@@ -1027,35 +1603,9 @@ static int update_from_network(struct ota_manager* this) {
                     if (file_exist(path) < 0 || verify_update_pkg(this, path) < 0)
                         goto error;
 
-                    LOGI("Unziping %s\n", path);
-                    if (unzip(path, prefix_local_update_path, NULL, 1) < 0) {
-                        LOGE("Failed to unzip %s to %s\n", path,
-                                prefix_local_update_path);
-                        goto error;
-                    }
-
-                    memset(path, 0, sizeof(path));
-                    if (image_info->chunkcount == 1)
-                        sprintf(path, "%s/%s", prefix_local_update_path,
-                                image_info->name);
-                    else
-                        sprintf(path, "%s/%s_%03d", prefix_local_update_path,
-                                image_info->name, j);
-
-                    if (file_exist(path) < 0) {
-                        LOGE("Failed to access %s: %s\n", path, strerror(errno));
-                        goto error;
-                    }
-
-                    if ((j != image_info->chunkcount)
-                            && (get_file_size(path) != image_info->chunksize)) {
-                        LOGE("Image %s size error\n", image_info->name);
-                        goto error;
-                    }
-
                     LOGI("Updating \"%s\"\n", path);
-                    if (write_update_pkg(this, update_info, part_info,
-                            image_info, path, j) < 0) {
+                    if (write_update_pkg(this, &flash, update_info,
+                            part_info, image_info, path, j, index) < 0) {
                         LOGE("Failed to write %s\n", path);
                         goto error;
                     }
@@ -1064,7 +1614,14 @@ static int update_from_network(struct ota_manager* this) {
                 }
             }
         }
+
+        update_stats_end_chunk();
     }
+    if (flash_session_erase_deferred(&session, 0) < 0
+            || sync_block_manager(this) < 0)
+        goto error;
+    save_bad_block_table(this);
+
     sysinfo_write_flag_val = SYSINFO_FLAG_VALUE_UPDATE_DONE;
     if (GET_SYSINFO_FLAG()->write(SYSINFO_FLAG_ID_UPDATE_DONE,
                 &sysinfo_write_flag_val) < 0) {
@@ -1076,11 +1633,44 @@ static int update_from_network(struct ota_manager* this) {
     return 0;
 
 error:
+    flash_context_destroy(&flash);
+    flash_session_erase_deferred(&session, 1);
     dir_delete(prefix_local_update_path);
 
     return -1;
 }
 
+/*
+ * Next to the recovery log, and onto the update directory of a mounted
+ * volume if there is one and Update.stats_to_storage is set
+ */
+static void save_update_stats(struct ota_manager* this, int error) {
+    char path[PATH_MAX] = {0};
+    struct list_head* pos;
+
+    update_stats_write(prefix_local_update_stats, error);
+
+    if (!this->cf->stats_to_storage)
+        return;
+
+    list_for_each(pos, &this->mm->list) {
+        struct mounted_volume *volume = list_entry(pos, struct mounted_volume,
+                head);
+
+        sprintf(path, "%s/%s", volume->mount_point, prefix_storage_update_path);
+        if (dir_exist(path) < 0)
+            continue;
+
+        sprintf(path, "%s/%s/%s", volume->mount_point,
+                prefix_storage_update_path, prefix_update_stats);
+        if (update_stats_write(path, error) < 0)
+            LOGW("Failed to save update statistics to %s\n",
+                    volume->mount_point);
+
+        return;
+    }
+}
+
 static void signal_handler(int signal) {
     LOGE("Update time out.\n");
     recovery_finish( -1);
@@ -1095,6 +1685,8 @@ static void *main_task(void* param) {
 
     alarm(ALARM_TIME_OUT);
 
+    update_stats_reset();
+
     gui->show_logo(gui, 0, 0);
     msleep(2500);
 
@@ -1131,6 +1723,8 @@ static void *main_task(void* param) {
         error = update_from_network(this);
     }
 
+    save_update_stats(this, error);
+
     umount_all_storage(this);
 
     _delete(this->uf);
@@ -1145,6 +1739,13 @@ static void load_configure(struct ota_manager* this,
     assert_die_if(cf == NULL, "cf is NULL\n");
 
     this->cf = cf;
+    session.cf = cf;
+
+    set_download_connections(cf->connections);
+
+    for (int type = 0; type < HASH_TYPES; type++)
+        hash_set_backend(type, cf->hash_offload & HASH_MASK(type)
+                ? HASH_BACKEND_KERNEL : HASH_BACKEND_SOFT);
 }
 
 static void load_signal_handler(struct ota_manager* this,
@@ -1156,11 +1757,13 @@ static void load_signal_handler(struct ota_manager* this,
 
 void construct_ota_manager(struct ota_manager* this) {
     INIT_LIST_HEAD(&this->storage_dev_list);
+    flash_session_init(&session, NULL);
 
     this->start = start;
     this->stop = stop;
     this->load_configure = load_configure;
     this->load_signal_handler = load_signal_handler;
+    this->update_from_network = update_from_network;
 
     /*
      * Instance netlink handler
@@ -1194,11 +1797,21 @@ void construct_ota_manager(struct ota_manager* this) {
     /*
      * Instance block manager
      */
-    this->mtd_bm = (struct block_manager*) calloc(1, sizeof(struct block_manager));
-    this->mtd_bm->construct = construct_block_manager;
-    this->mtd_bm->destruct = destruct_block_manager;
-    this->mtd_bm->construct(this->mtd_bm, BM_BLOCK_TYPE_MTD, bm_event_listener,
-            (void *)this);
+    if (has_mtd_device()) {
+        this->mtd_bm = (struct block_manager*) calloc(1, sizeof(struct block_manager));
+        this->mtd_bm->construct = construct_block_manager;
+        this->mtd_bm->destruct = destruct_block_manager;
+        this->mtd_bm->construct(this->mtd_bm, BM_BLOCK_TYPE_MTD, bm_event_listener,
+                (void *)this);
+    }
+
+    if (!file_exist(MMC_DEFAULT_DEVICE)) {
+        this->mmc_bm = (struct block_manager*) calloc(1, sizeof(struct block_manager));
+        this->mmc_bm->construct = construct_block_manager;
+        this->mmc_bm->destruct = destruct_block_manager;
+        this->mmc_bm->construct(this->mmc_bm, BM_BLOCK_TYPE_MMC, bm_event_listener,
+                (void *)this);
+    }
 }
 
 void destruct_ota_manager(struct ota_manager* this) {
@@ -1220,6 +1833,7 @@ void destruct_ota_manager(struct ota_manager* this) {
     this->stop = NULL;
     this->load_configure = NULL;
     this->load_signal_handler = NULL;
+    this->update_from_network = NULL;
 
     /*
      * Destruct netlink_handler
@@ -1242,10 +1856,20 @@ void destruct_ota_manager(struct ota_manager* this) {
     _delete(gui);
     gui = NULL;
 
+    flash_session_destroy(&session);
+
     /*
      * Destruct block manager
      */
-    this->mtd_bm->destruct(this->mtd_bm);
-    free(this->mtd_bm);
-    this->mtd_bm = NULL;
+    if (this->mtd_bm) {
+        this->mtd_bm->destruct(this->mtd_bm);
+        free(this->mtd_bm);
+        this->mtd_bm = NULL;
+    }
+
+    if (this->mmc_bm) {
+        this->mmc_bm->destruct(this->mmc_bm);
+        free(this->mmc_bm);
+        this->mmc_bm = NULL;
+    }
 }
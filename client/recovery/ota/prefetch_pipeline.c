@@ -0,0 +1,343 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <utils/log.h>
+#include <utils/common.h>
+#include <utils/update_stats.h>
+#include <configure/configure_file.h>
+#include <configure/update_file.h>
+#include <ota/prefetch_pipeline.h>
+
+#define LOG_TAG "prefetch_pipeline"
+
+static void* prefetch_task(void* param) {
+    struct prefetch_pipeline* pipeline = (struct prefetch_pipeline *)param;
+
+    for (uint32_t i = 0; i < pipeline->job_count; i++) {
+        struct prefetch_job* job = &pipeline->jobs[i];
+
+        if (pipeline->device >= 0 && job->device != pipeline->device)
+            continue;
+
+        if (blocking_queue_reserve(&pipeline->queue, job->size) < 0)
+            return NULL;
+
+        job->data = (char *) malloc(job->size ? job->size : 1);
+        if (job->data == NULL)
+            LOGE("Failed to alloc %u bytes for %s\n", job->size, job->source);
+
+        if (job->data == NULL || pipeline->fetch(job, pipeline->param) < 0) {
+            free(job->data);
+            job->data = NULL;
+            pipeline->error = -1;
+            blocking_queue_abort(&pipeline->queue);
+            return NULL;
+        }
+
+        blocking_queue_push(&pipeline->queue, &job->head);
+    }
+
+    blocking_queue_close(&pipeline->queue);
+
+    return NULL;
+}
+
+/*
+ * Parallel flashing
+ *
+ * The chunks are grouped by the physical device their partition lives on
+ * and each device gets a pipeline of its own, prefetch and writer thread
+ * included, so that e.g. the NOR boot flash and the NAND are programmed
+ * at the same time. The block manager serializes the operations per
+ * device only.
+ *
+ * The chunks complete out of package order, the journal only moves on
+ * over a run of completed packages and only to the end of a partition:
+ * an interrupted update resumes at the first partition which has not been
+ * entirely written. Whichever writer commits the journal takes the lock of
+ * the chip it is saved on, like any other access to it.
+ */
+struct flash_scheduler {
+    pthread_mutex_t lock;
+    struct flash_session* session;
+    struct prefetch_job* jobs;
+    uint32_t job_count;
+    uint32_t committed;     /* jobs done in package order */
+    uint64_t total;
+    uint64_t written;
+    int progress;
+    int error;
+};
+
+static inline int flash_scheduler_failed(struct flash_scheduler* scheduler) {
+    int error;
+
+    pthread_mutex_lock(&scheduler->lock);
+    error = scheduler->error;
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return error < 0;
+}
+
+static inline void flash_scheduler_fail(struct flash_scheduler* scheduler) {
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->error = -1;
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+/*
+ * Commit hook of the device flash contexts
+ */
+static int flash_scheduler_commit(struct chunk_writer* w, void* param) {
+    struct flash_scheduler* scheduler = (struct flash_scheduler *)param;
+    struct flash_session* s = scheduler->session;
+    uint32_t index = w->package - scheduler->jobs[0].package;
+    struct prefetch_job* job;
+    int error = 0;
+    int progress;
+
+    if (index >= scheduler->job_count) {
+        LOGE("Package %u is not scheduled\n", w->package);
+        return -1;
+    }
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    job = &scheduler->jobs[index];
+    job->write_end = w->ctx->next_write_offset;
+    job->done = 1;
+    scheduler->written += get_chunk_size(job->image_info, job->chunk_index);
+
+    pthread_mutex_lock(&s->journal_lock);
+    while (scheduler->committed < scheduler->job_count
+            && scheduler->jobs[scheduler->committed].done) {
+        job = &scheduler->jobs[scheduler->committed++];
+
+        if (!job->last_in_part)
+            continue;
+
+        error = update_journal_commit_package(&s->journal_store, &s->journal,
+                job->package, job->part_info->offset, job->write_end, 1, 0);
+        if (error < 0)
+            break;
+    }
+    pthread_mutex_unlock(&s->journal_lock);
+
+    progress = scheduler->written * 100 / MAX(scheduler->total, 1);
+    if (progress / 10 != scheduler->progress / 10)
+        LOGI("Flashed %d%% of %" PRIu64 " KB\n", progress, scheduler->total / 1024);
+    scheduler->progress = progress;
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return error;
+}
+
+/*
+ * Writes the chunks of the pipeline as they come out of the prefetcher
+ */
+static int run_pipeline(struct prefetch_pipeline* pipeline) {
+    struct flash_context* ctx = &pipeline->ctx;
+    int error = 0;
+    pthread_t tid;
+
+    flash_context_init(ctx, pipeline->session);
+    if (pipeline->scheduler) {
+        ctx->commit = flash_scheduler_commit;
+        ctx->commit_param = pipeline->scheduler;
+    }
+
+    blocking_queue_init(&pipeline->queue, pipeline->session->cf->prefetch_depth,
+            pipeline->max_weight);
+
+    error = pthread_create(&tid, NULL, prefetch_task, pipeline);
+    if (error) {
+        LOGE("pthread_create failed: %s", strerror(error));
+        blocking_queue_destroy(&pipeline->queue);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < pipeline->device_jobs; i++) {
+        struct chunk_writer writer;
+        struct list_head* item;
+
+        if (pipeline->scheduler && flash_scheduler_failed(pipeline->scheduler)) {
+            error = -1;
+            break;
+        }
+
+        item = blocking_queue_pop(&pipeline->queue);
+        if (item == NULL) {
+            LOGE("Failed to fetch chunk %u\n", i + 1);
+            error = -1;
+            break;
+        }
+
+        struct prefetch_job* job = list_entry(item, struct prefetch_job, head);
+
+        LOGI("Updating \"%s\"\n", job->source);
+        update_stats_begin_chunk(job->part_info->name, job->image_info->name,
+                job->chunk_index);
+        error = chunk_writer_begin(&writer, ctx, pipeline->bm, job->part_info,
+                job->image_info, job->chunk_index, job->package);
+        if (!error)
+            error = chunk_writer_feed(&writer, job->data, job->length);
+        if (!error)
+            error = chunk_writer_end(&writer);
+        else
+            chunk_writer_abort(&writer);
+
+        update_stats_end_chunk();
+
+        free(job->data);
+        job->data = NULL;
+        blocking_queue_release(&pipeline->queue, job->size);
+
+        if (error < 0) {
+            LOGE("Failed to write %s\n", job->source);
+            break;
+        }
+    }
+
+    if (error < 0)
+        blocking_queue_abort(&pipeline->queue);
+
+    pthread_join(tid, NULL);
+    blocking_queue_destroy(&pipeline->queue);
+    flash_context_destroy(ctx);
+
+    if (pipeline->error < 0)
+        error = -1;
+
+    return error < 0 ? -1 : 0;
+}
+
+static void* flash_device_task(void* param) {
+    struct prefetch_pipeline* pipeline = (struct prefetch_pipeline *)param;
+
+    if (run_pipeline(pipeline) < 0) {
+        LOGE("Failed to flash device %d\n", pipeline->device);
+        flash_scheduler_fail(pipeline->scheduler);
+    }
+
+    return NULL;
+}
+
+static int flash_in_parallel(struct prefetch_pipeline* all) {
+    struct flash_scheduler scheduler;
+    struct prefetch_pipeline* pipelines;
+    pthread_t* tids;
+    int device_count = 0;
+    int started = 0;
+    int count = 0;
+    int error = 0;
+
+    for (uint32_t i = 0; i < all->job_count; i++)
+        device_count = MAX(device_count, all->jobs[i].device + 1);
+
+    pipelines = (struct prefetch_pipeline *) calloc(device_count + 1,
+            sizeof(*pipelines));
+    tids = (pthread_t *) calloc(device_count + 1, sizeof(*tids));
+    if (pipelines == NULL || tids == NULL) {
+        LOGE("Failed to alloc device pipelines: %s\n", strerror(errno));
+        error = -1;
+        goto out;
+    }
+
+    for (uint32_t i = 0; i < all->job_count; i++)
+        if (!pipelines[all->jobs[i].device].device_jobs++)
+            count++;
+
+    /*
+     * Nothing to run side by side
+     */
+    if (count <= 1) {
+        error = run_pipeline(all);
+        goto out;
+    }
+
+    memset(&scheduler, 0, sizeof(scheduler));
+    pthread_mutex_init(&scheduler.lock, NULL);
+    scheduler.session = all->session;
+    scheduler.jobs = all->jobs;
+    scheduler.job_count = all->job_count;
+    for (uint32_t i = 0; i < all->job_count; i++)
+        scheduler.total += get_chunk_size(all->jobs[i].image_info,
+                all->jobs[i].chunk_index);
+
+    LOGI("Flashing %d devices in parallel\n", count);
+
+    for (int i = 0; i < device_count; i++) {
+        struct prefetch_pipeline* pipeline = &pipelines[i];
+
+        if (!pipeline->device_jobs)
+            continue;
+
+        pipeline->session = all->session;
+        pipeline->bm = all->bm;
+        pipeline->fetch = all->fetch;
+        pipeline->param = all->param;
+        pipeline->scheduler = &scheduler;
+        pipeline->jobs = all->jobs;
+        pipeline->job_count = all->job_count;
+        pipeline->device = i;
+        pipeline->max_weight = all->max_weight / count;
+
+        error = pthread_create(&tids[i], NULL, flash_device_task, pipeline);
+        if (error) {
+            LOGE("pthread_create failed: %s", strerror(error));
+            flash_scheduler_fail(&scheduler);
+            pipeline->device_jobs = 0;
+            break;
+        }
+
+        started++;
+    }
+
+    for (int i = 0; i < device_count && started; i++) {
+        if (!pipelines[i].device_jobs)
+            continue;
+
+        pthread_join(tids[i], NULL);
+        started--;
+    }
+
+    error = scheduler.error;
+    pthread_mutex_destroy(&scheduler.lock);
+
+out:
+    free(pipelines);
+    free(tids);
+
+    return error < 0 ? -1 : 0;
+}
+
+int prefetch_pipeline_run(struct prefetch_pipeline* pipeline) {
+    pipeline->scheduler = NULL;
+    pipeline->device = -1;
+    pipeline->device_jobs = pipeline->job_count;
+    pipeline->error = 0;
+
+    if (pipeline->session->cf->parallel_flash)
+        return flash_in_parallel(pipeline);
+
+    return run_pipeline(pipeline);
+}
@@ -0,0 +1,503 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <utils/log.h>
+#include <types.h>
+#include <lib/libmtd.h>
+#include <lib/libmtd_emu.h>
+#include <block/block_manager.h>
+#include <block/sysinfo/sysinfo_manager.h>
+#include <block/sysinfo/flag.h>
+#include <ota/update_journal.h>
+
+#define LOG_TAG "test_update_journal"
+
+#include <utils/testunit.h>
+
+/*
+ * Replays the package loop of ota_manager against a simulated image
+ * flash, cutting the power at every possible point, then checks the next
+ * run ends with the right flash content and rewrites no more than it has
+ * to. The journal is saved and loaded by the store of ota_manager, on the
+ * file-backed MTD emulator, which cuts the power in the middle of the
+ * journal writes.
+ */
+
+#define TEST_IMAGE      "/tmp/test_update_journal.img"
+#define TEST_SPEC       "type=nand size=4M eb=128K page=2K oob=64 "       \
+                        "parts=1M(boot),1M(journal),-(data) "             \
+                        "latency=0,0,0 image=" TEST_IMAGE
+
+#define PKG_SIZE        16
+#define FLASH_SIZE      (16 * PKG_SIZE)
+#define PKG_MAX         16
+
+struct sim_part {
+    const char* fs_type;
+    int64_t offset;
+    int64_t size;
+};
+
+struct sim_package {
+    int part;
+    int last_in_part;
+};
+
+static const struct sim_part parts[] = {
+    {BM_FILE_TYPE_NORMAL, 0 * PKG_SIZE, 4 * PKG_SIZE},
+    {BM_FILE_TYPE_UBIFS,  4 * PKG_SIZE, 4 * PKG_SIZE},
+    {BM_FILE_TYPE_CRAMFS, 8 * PKG_SIZE, 6 * PKG_SIZE},
+};
+
+/*
+ * Packages 1..9, the last partition holds a bad block
+ */
+static const struct sim_package packages[] = {
+    {0, 0}, {0, 0}, {0, 1},
+    {1, 0}, {1, 0}, {1, 1},
+    {2, 0}, {2, 0}, {2, 1},
+};
+
+#define PKG_COUNT       (sizeof(packages) / sizeof(packages[0]))
+#define BAD_BLOCK       (9 * PKG_SIZE)
+
+enum {
+    CUT_NONE,
+    CUT_WRITE,          /* in the middle of programming a package */
+    CUT_COMMIT,         /* after programming, before the journal write */
+    CUT_JOURNAL,        /* tearing the next journal write */
+    CUT_EVERY,          /* programming the cut_at'th package of each run */
+};
+
+struct sim_device {
+    uint8_t flash[FLASH_SIZE];
+    uint32_t update_flag;
+    int torn_ubifs[sizeof(parts) / sizeof(parts[0])];
+};
+
+struct sim_run {
+    uint32_t fingerprint;
+    int cut_type;
+    int cut_at;         /* package the cut happens on */
+    int cut_package;    /* where it did happen */
+    int written[PKG_MAX];
+};
+
+static struct mtd_emu_config cfg;
+static struct block_manager* bm;
+static struct sim_device device;
+static struct update_journal journal;
+static struct update_journal_store store;
+
+static void bm_event_listener(struct block_manager* bm,
+        struct bm_event* event, void* param) {
+    return;
+}
+
+static void shutdown(void) {
+    if (bm == NULL)
+        return;
+
+    update_journal_store_close(&store);
+    GET_SYSINFO_MANAGER()->exit(GET_SYSINFO_MANAGER());
+    bm->destruct(bm);
+    free(bm);
+    bm = NULL;
+}
+
+/*
+ * Power on, with the journal in part_name
+ */
+static int boot(const char* part_name) {
+    shutdown();
+
+    if (mtd_emu_setup(&cfg) < 0)
+        return -1;
+
+    bm = calloc(1, sizeof(*bm));
+    if (bm == NULL)
+        return -1;
+
+    bm->construct = construct_block_manager;
+    bm->destruct = destruct_block_manager;
+    bm->construct(bm, BM_BLOCK_TYPE_MTD, bm_event_listener, "journal");
+    if (bm->sysinfo == NULL)
+        sysinfo_manager_bind(GET_SYSINFO_MANAGER(), bm);
+
+    return update_journal_store_open(&store, bm, part_name);
+}
+
+static void erase_chip(void) {
+    shutdown();
+    unlink(TEST_IMAGE);
+    unlink(TEST_IMAGE ".oob");
+}
+
+static uint8_t pkg_byte(uint32_t fingerprint, int package, int i) {
+    return (uint8_t)(fingerprint * 7 + package * 31 + i);
+}
+
+static int64_t skip_bad(int64_t offset) {
+    return offset == BAD_BLOCK ? offset + PKG_SIZE : offset;
+}
+
+/*
+ * Returns 1 when the power was cut, 0 when the update completed
+ */
+static int run_update(struct sim_run* run) {
+    int64_t next_write_offset = 0;
+    int prepared = -1;
+    int programmed = 0;
+
+    memset(run->written, 0, sizeof(run->written));
+    run->cut_package = 0;
+
+    if (boot("journal") < 0 || update_journal_restore(&store, &journal,
+            device.update_flag == SYSINFO_FLAG_VALUE_UPDATE_START) < 0) {
+        LOGE("Cannot restore the journal\n");
+        return -1;
+    }
+    device.update_flag = SYSINFO_FLAG_VALUE_UPDATE_START;
+
+    update_journal_begin_device(&journal, 0, run->fingerprint);
+
+    for (int package = 1; package <= PKG_COUNT; package++) {
+        const struct sim_package* pkg = &packages[package - 1];
+        const struct sim_part* part = &parts[pkg->part];
+        int first = package == 1 || packages[package - 2].part != pkg->part;
+        int64_t resume_offset = 0;
+
+        if (update_journal_is_done(&journal, 0, package))
+            continue;
+
+        if (!first && prepared != pkg->part) {
+            if (!update_journal_resume_offset(&journal, package,
+                    part->offset, &resume_offset)) {
+                LOGE("package %d: partition not prepared\n", package);
+                return -1;
+            }
+
+            if (!strcmp(part->fs_type, BM_FILE_TYPE_UBIFS))
+                device.torn_ubifs[pkg->part] = 1;
+        }
+
+        if (first || resume_offset) {
+            int64_t from = first ? part->offset : resume_offset;
+
+            memset(device.flash + from, 0xff, part->offset + part->size - from);
+            next_write_offset = from;
+            prepared = pkg->part;
+            if (first)
+                device.torn_ubifs[pkg->part] = 0;
+        }
+
+        int64_t offset = skip_bad(next_write_offset);
+        int len = PKG_SIZE;
+
+        if ((run->cut_type == CUT_WRITE && run->cut_at == package)
+                || (run->cut_type == CUT_EVERY && ++programmed == run->cut_at))
+            len = PKG_SIZE / 2;
+
+        for (int i = 0; i < len; i++)
+            device.flash[offset + i] = pkg_byte(run->fingerprint, package, i);
+        run->written[package]++;
+
+        if (len != PKG_SIZE) {
+            run->cut_package = package;
+            return 1;
+        }
+
+        next_write_offset = offset + PKG_SIZE;
+
+        if (run->cut_type == CUT_COMMIT && run->cut_at == package) {
+            run->cut_package = package;
+            return 1;
+        }
+
+        if (run->cut_type == CUT_JOURNAL && run->cut_at == package)
+            mtd_emu_set_power_cut(1, NULL);
+
+        if (update_journal_commit_package(&store, &journal, package,
+                part->offset, next_write_offset, pkg->last_in_part,
+                update_journal_is_resumable(part->fs_type)) < 0) {
+            run->cut_package = package;
+            return 1;
+        }
+    }
+
+    mtd_emu_set_power_cut(0, NULL);
+    device.update_flag = SYSINFO_FLAG_VALUE_UPDATE_DONE;
+
+    return 0;
+}
+
+static int flash_is_complete(uint32_t fingerprint) {
+    int64_t offset = 0;
+
+    for (int package = 1; package <= PKG_COUNT; package++) {
+        const struct sim_package* pkg = &packages[package - 1];
+
+        if (package == 1 || packages[package - 2].part != pkg->part)
+            offset = parts[pkg->part].offset;
+
+        offset = skip_bad(offset);
+        for (int i = 0; i < PKG_SIZE; i++)
+            if (device.flash[offset + i] != pkg_byte(fingerprint, package, i))
+                return 0;
+
+        offset += PKG_SIZE;
+    }
+
+    for (int i = 0; i < sizeof(parts) / sizeof(parts[0]); i++)
+        if (device.torn_ubifs[i])
+            return 0;
+
+    return 1;
+}
+
+/*
+ * Packages the run after a cut may have to redo: the interrupted one, or
+ * the whole partition when it cannot be resumed. A torn journal record
+ * leaves the one before it.
+ */
+static int max_rewrites(int cut_at) {
+    const struct sim_package* pkg = &packages[cut_at - 1];
+
+    if (!update_journal_is_resumable(parts[pkg->part].fs_type)) {
+        int n = 0;
+        for (int i = 0; i < PKG_COUNT; i++)
+            n += packages[i].part == pkg->part;
+        return n;
+    }
+
+    return 1;
+}
+
+static void test_cut(int cut_type, const char* name) {
+    int ok = 1;
+
+    for (int cut_at = 1; cut_at <= PKG_COUNT; cut_at++) {
+        struct sim_run run;
+        int rewrites = 0, cut;
+
+        erase_chip();
+        memset(&device, 0, sizeof(device));
+        memset(&run, 0, sizeof(run));
+        run.fingerprint = 0x1234;
+        run.cut_type = cut_type;
+        run.cut_at = cut_at;
+
+        /*
+         * A journal cut on a package without a commit tears the next one
+         */
+        if (run_update(&run) != 1) {
+            ok = 0;
+            continue;
+        }
+        cut = run.cut_package;
+
+        run.cut_type = CUT_NONE;
+        if (run_update(&run) != 0 || !flash_is_complete(run.fingerprint)) {
+            LOGE("%s at package %d: bad flash content\n", name, cut_at);
+            ok = 0;
+            continue;
+        }
+
+        for (int i = 1; i <= PKG_COUNT; i++)
+            rewrites += run.written[i];
+
+        if (rewrites > PKG_COUNT - cut + max_rewrites(cut)) {
+            LOGE("%s at package %d: %d packages rewritten\n", name, cut,
+                    rewrites);
+            ok = 0;
+        }
+    }
+
+    report(name, ok);
+}
+
+static void test_repeated_cuts(void) {
+    struct sim_run run;
+    int runs = 1;
+
+    erase_chip();
+    memset(&device, 0, sizeof(device));
+    memset(&run, 0, sizeof(run));
+    run.fingerprint = 0x1234;
+    run.cut_type = CUT_EVERY;
+    run.cut_at = 4;
+
+    /*
+     * Every run but the last loses power on its fourth package, which
+     * still has to make progress across the ubifs partition
+     */
+    while (run_update(&run) == 1 && runs < PKG_COUNT)
+        runs++;
+
+    report("cut on every run", runs < PKG_COUNT
+            && device.update_flag == SYSINFO_FLAG_VALUE_UPDATE_DONE
+            && flash_is_complete(run.fingerprint));
+}
+
+static void test_other_package(void) {
+    struct sim_run run;
+    int rewrites = 0;
+
+    erase_chip();
+    memset(&device, 0, sizeof(device));
+    memset(&run, 0, sizeof(run));
+    run.fingerprint = 0x1234;
+    run.cut_type = CUT_COMMIT;
+    run.cut_at = 7;
+    run_update(&run);
+
+    run.fingerprint = 0x5678;
+    run.cut_type = CUT_NONE;
+    run_update(&run);
+
+    for (int i = 1; i <= PKG_COUNT; i++)
+        rewrites += run.written[i];
+
+    report("other package starts over", rewrites == PKG_COUNT
+            && flash_is_complete(run.fingerprint));
+}
+
+static void test_completed_update(void) {
+    struct sim_run run;
+    int rewrites = 0;
+
+    erase_chip();
+    memset(&device, 0, sizeof(device));
+    memset(&run, 0, sizeof(run));
+    run.fingerprint = 0x1234;
+    run_update(&run);
+
+    /*
+     * Same package again after a complete update: the stale journal
+     * must not let anything be skipped
+     */
+    run.cut_type = CUT_WRITE;
+    run.cut_at = 2;
+    run_update(&run);
+
+    run.cut_type = CUT_NONE;
+    run_update(&run);
+
+    for (int i = 1; i <= PKG_COUNT; i++)
+        rewrites += run.written[i];
+
+    report("completed update is not resumed", rewrites == PKG_COUNT - 1
+            && flash_is_complete(run.fingerprint));
+}
+
+/*
+ * Records saved one after the other through two switches of erase block,
+ * the power going at each program and erase in turn: the next boot finds
+ * the last record saved, or the one being written if it made it whole,
+ * and carries on past it
+ */
+static void test_store_cuts(void) {
+    int slots, ok = 1;
+
+    erase_chip();
+    if (boot("journal") < 0) {
+        report("journal store cuts", 0);
+        return;
+    }
+    slots = store.slots;
+
+    for (int cut = 1; cut <= 2 * slots + 4 && ok; cut++) {
+        uint32_t saved = 0;
+
+        erase_chip();
+        if (boot("journal") < 0
+                || update_journal_restore(&store, &journal, 0) < 0) {
+            ok = 0;
+            break;
+        }
+
+        mtd_emu_set_power_cut(cut, NULL);
+        for (uint32_t package = 1; package <= 2 * slots + 4; package++) {
+            if (update_journal_commit_package(&store, &journal, package, 0,
+                    package * PKG_SIZE, 1, 1) < 0)
+                break;
+            saved = package;
+        }
+
+        if (boot("journal") < 0
+                || update_journal_store_load(&store, &journal) < 0
+                || journal.package < saved || journal.package > saved + 1) {
+            LOGE("Cut at operation %d: package %u loaded, %u saved\n", cut,
+                    journal.package, saved);
+            ok = 0;
+            break;
+        }
+
+        saved = journal.package + 1;
+        if (update_journal_commit_package(&store, &journal, saved, 0, 0, 1,
+                1) < 0 || boot("journal") < 0
+                || update_journal_store_load(&store, &journal) < 0
+                || journal.package != saved) {
+            LOGE("Cut at operation %d: no save after it\n", cut);
+            ok = 0;
+        }
+    }
+
+    report("journal store cuts", ok);
+}
+
+/*
+ * Without a journal partition, only the end of a partition rewrites the
+ * first block of the chip
+ */
+static void test_flag_fallback(void) {
+    struct mtd_emu_stats before, after;
+    int ok;
+
+    erase_chip();
+    ok = boot("none") == 0 && store.part < 0
+            && update_journal_restore(&store, &journal, 0) == 0;
+
+    mtd_emu_get_stats(&before);
+    ok &= update_journal_commit_package(&store, &journal, 1, 0, PKG_SIZE,
+            0, 1) == 0;
+    mtd_emu_get_stats(&after);
+    ok &= after.ops[MTD_EMU_OP_ERASE] == before.ops[MTD_EMU_OP_ERASE]
+            && after.ops[MTD_EMU_OP_PROGRAM] == before.ops[MTD_EMU_OP_PROGRAM];
+
+    ok &= update_journal_commit_package(&store, &journal, 2, 0,
+            2 * PKG_SIZE, 1, 1) == 0
+            && boot("none") == 0
+            && update_journal_store_load(&store, &journal) == 0
+            && journal.package == 2;
+
+    report("flag area only at partition ends", ok);
+}
+
+static void test_layout(void) {
+    report("journal fits its flag slot",
+            sizeof(struct update_journal) <= SYSINFO_FLAG_UPDATE_JOURNAL_SIZE);
+}
+
+int main(int argc, char* argv[]) {
+    mtd_emu_default_config(&cfg);
+    if (mtd_emu_parse_config(&cfg, TEST_SPEC) < 0)
+        return -1;
+
+    test_layout();
+    test_store_cuts();
+    test_flag_fallback();
+    test_cut(CUT_WRITE, "cut while programming");
+    test_cut(CUT_COMMIT, "cut before journal commit");
+    test_cut(CUT_JOURNAL, "cut tearing the journal");
+    test_repeated_cuts();
+    test_other_package();
+    test_completed_update();
+
+    erase_chip();
+    mtd_emu_teardown();
+
+    return report_summary();
+}
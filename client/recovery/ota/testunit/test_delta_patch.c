@@ -0,0 +1,314 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/log.h>
+#include <utils/delta_patch.h>
+#include "zlib.h"
+
+#define LOG_TAG "test_delta_patch"
+
+#include <utils/testunit.h>
+
+/*
+ * Applies hand-built patches in place on a simulated flash, one window
+ * at a time the way ota_manager does, and checks malformed patches are
+ * refused.
+ */
+
+#define WINDOW          64
+#define WINDOWS         8
+#define IMAGE_SIZE      (WINDOW * WINDOWS)
+#define PATCH_MAX       (4 * IMAGE_SIZE)
+
+struct sim_flash {
+    uint8_t flash[IMAGE_SIZE];
+    uint8_t window[WINDOW];
+    uint32_t fill;
+    uint32_t written;   /* flash before this has been rewritten */
+};
+
+struct patch {
+    uint8_t buf[PATCH_MAX];
+    uint32_t len;
+};
+
+static struct sim_flash sim;
+static uint8_t old_image[IMAGE_SIZE];
+static uint8_t new_image[IMAGE_SIZE];
+
+static void put_le32(struct patch* p, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        p->buf[p->len++] = v >> (8 * i);
+}
+
+static void put_header(struct patch* p, uint32_t offset, uint32_t size,
+        uint32_t crc) {
+    p->len = 0;
+    put_le32(p, DELTA_PATCH_MAGIC);
+    p->buf[p->len++] = DELTA_PATCH_VERSION;
+    p->buf[p->len++] = 0;
+    p->buf[p->len++] = 0;
+    p->buf[p->len++] = 0;
+    put_le32(p, offset);
+    put_le32(p, size);
+    put_le32(p, WINDOW);
+    put_le32(p, crc);
+}
+
+static void put_copy(struct patch* p, uint32_t src, uint32_t len) {
+    p->buf[p->len++] = DELTA_OP_COPY;
+    put_le32(p, src);
+    put_le32(p, len);
+}
+
+static void put_data(struct patch* p, const uint8_t* data, uint32_t len) {
+    p->buf[p->len++] = DELTA_OP_DATA;
+    put_le32(p, len);
+    memcpy(p->buf + p->len, data, len);
+    p->len += len;
+}
+
+static void put_end(struct patch* p) {
+    p->buf[p->len++] = DELTA_OP_END;
+}
+
+static int source_cb(uint64_t offset, void* buf, uint32_t len, void* param) {
+    if (offset < sim.written || offset + len > IMAGE_SIZE) {
+        LOGE("Reading 0x%" PRIx64 ", rewritten up to 0x%x\n", offset, sim.written);
+        return -1;
+    }
+
+    memcpy(buf, sim.flash + offset, len);
+
+    return 0;
+}
+
+/*
+ * Erase and program a window once it is complete
+ */
+static int output_cb(const void* buf, uint32_t len, void* param) {
+    const uint8_t* p = (const uint8_t *)buf;
+
+    while (len) {
+        uint32_t n = WINDOW - sim.fill;
+
+        n = n < len ? n : len;
+        memcpy(sim.window + sim.fill, p, n);
+        sim.fill += n;
+        p += n;
+        len -= n;
+
+        if (sim.fill == WINDOW) {
+            if (sim.written + WINDOW > IMAGE_SIZE)
+                return -1;
+
+            memcpy(sim.flash + sim.written, sim.window, WINDOW);
+            sim.written += WINDOW;
+            sim.fill = 0;
+        }
+    }
+
+    return 0;
+}
+
+static void reset_flash(uint32_t offset) {
+    memcpy(sim.flash, old_image, IMAGE_SIZE);
+    sim.fill = 0;
+    sim.written = offset;
+}
+
+/*
+ * Returns 0 when the patch applied and verified
+ */
+static int apply(struct patch* p, uint32_t offset, uint32_t size,
+        uint32_t step) {
+    struct delta_patch dp;
+    int error = 0;
+
+    if (delta_patch_init(&dp, offset, size, WINDOW, source_cb, output_cb,
+            NULL) < 0)
+        return -1;
+
+    for (uint32_t i = 0; i < p->len && !error; i += step) {
+        uint32_t n = p->len - i < step ? p->len - i : step;
+
+        error = delta_patch_feed(&dp, p->buf + i, n);
+    }
+
+    if (!error)
+        error = delta_patch_finish(&dp);
+
+    delta_patch_destroy(&dp);
+
+    return error;
+}
+
+static uint32_t image_crc(const uint8_t* data, uint32_t len) {
+    return crc32(crc32(0, Z_NULL, 0), data, len);
+}
+
+/*
+ * New image: window 0 partly changed, windows 1-2 unchanged, window 3
+ * taken from old window 5, window 4 shifted by 7 bytes, windows 5-7 new
+ */
+static void build_images(void) {
+    srand(1);
+    for (int i = 0; i < IMAGE_SIZE; i++)
+        old_image[i] = rand();
+
+    memcpy(new_image, old_image, IMAGE_SIZE);
+    memset(new_image + 10, 0x5a, 20);
+    memcpy(new_image + 3 * WINDOW, old_image + 5 * WINDOW, WINDOW);
+    memcpy(new_image + 4 * WINDOW, old_image + 4 * WINDOW + 7, WINDOW - 7);
+    memset(new_image + 5 * WINDOW - 7, 0xa5, 7);
+    for (int i = 5 * WINDOW; i < IMAGE_SIZE; i++)
+        new_image[i] = rand();
+}
+
+static void build_patch(struct patch* p) {
+    put_header(p, 0, IMAGE_SIZE, image_crc(new_image, IMAGE_SIZE));
+    put_copy(p, 0, 10);
+    put_data(p, new_image + 10, 20);
+    put_copy(p, 30, WINDOW - 30);
+    put_copy(p, WINDOW, WINDOW);
+    put_copy(p, 2 * WINDOW, WINDOW);
+    put_copy(p, 5 * WINDOW, WINDOW);
+    put_copy(p, 4 * WINDOW + 7, WINDOW - 7);
+    put_data(p, new_image + 5 * WINDOW - 7, 7);
+    for (int i = 5; i < WINDOWS; i++)
+        put_data(p, new_image + i * WINDOW, WINDOW);
+    put_end(p);
+}
+
+static void test_in_place(void) {
+    struct patch p;
+    int ok = 1;
+
+    build_patch(&p);
+
+    for (uint32_t step = 1; step <= p.len; step = step * 3 + 1) {
+        reset_flash(0);
+        if (apply(&p, 0, IMAGE_SIZE, step) < 0
+                || memcmp(sim.flash, new_image, IMAGE_SIZE)) {
+            LOGE("Feeding %u bytes at a time failed\n", step);
+            ok = 0;
+        }
+    }
+
+    report("in place, any feed size", ok);
+}
+
+static void test_chunk(void) {
+    struct patch p;
+    uint32_t offset = 5 * WINDOW, size = 3 * WINDOW;
+    int ok;
+
+    put_header(&p, offset, size, image_crc(new_image + offset, size));
+    for (int i = 5; i < WINDOWS; i++)
+        put_data(&p, new_image + i * WINDOW, WINDOW);
+    put_end(&p);
+
+    reset_flash(offset);
+    ok = apply(&p, offset, size, p.len) == 0
+            && !memcmp(sim.flash + offset, new_image + offset, size);
+
+    reset_flash(offset);
+    ok &= apply(&p, 0, size, p.len) < 0;
+
+    reset_flash(offset);
+    ok &= apply(&p, offset, size - WINDOW, p.len) < 0;
+
+    report("chunk offset and size", ok);
+}
+
+static void test_read_behind(void) {
+    struct patch p;
+
+    /*
+     * Window 1 copying from window 0, already overwritten
+     */
+    put_header(&p, 0, 2 * WINDOW, 0);
+    put_copy(&p, 0, WINDOW);
+    put_copy(&p, 0, WINDOW);
+    put_end(&p);
+
+    reset_flash(0);
+    report("copy from rewritten data refused",
+            apply(&p, 0, 2 * WINDOW, p.len) < 0);
+}
+
+static void test_cross_window(void) {
+    struct patch p;
+    int ok;
+
+    put_header(&p, 0, 2 * WINDOW, 0);
+    put_copy(&p, 0, WINDOW + 1);
+    put_copy(&p, WINDOW + 1, WINDOW - 1);
+    put_end(&p);
+
+    reset_flash(0);
+    ok = apply(&p, 0, 2 * WINDOW, p.len) < 0;
+
+    put_header(&p, 0, 2 * WINDOW, 0);
+    put_data(&p, old_image, 2 * WINDOW);
+    put_end(&p);
+
+    reset_flash(0);
+    ok &= apply(&p, 0, 2 * WINDOW, p.len) < 0;
+
+    report("op across windows refused", ok);
+}
+
+static void test_corrupted(void) {
+    struct patch p;
+    int ok;
+
+    build_patch(&p);
+    p.buf[40] ^= 1;
+    reset_flash(0);
+    ok = apply(&p, 0, IMAGE_SIZE, p.len) < 0;
+
+    build_patch(&p);
+    p.len -= 1;
+    reset_flash(0);
+    ok &= apply(&p, 0, IMAGE_SIZE, p.len) < 0;
+
+    build_patch(&p);
+    p.buf[0] ^= 1;
+    reset_flash(0);
+    ok &= apply(&p, 0, IMAGE_SIZE, p.len) < 0;
+
+    build_patch(&p);
+    p.buf[p.len++] = 0;
+    reset_flash(0);
+    ok &= apply(&p, 0, IMAGE_SIZE, p.len) < 0;
+
+    report("corrupted or truncated patch refused", ok);
+}
+
+static void test_max_size(void) {
+    struct patch p;
+
+    put_header(&p, 0, IMAGE_SIZE, 0);
+    for (int i = 0; i < WINDOWS; i++)
+        put_data(&p, new_image + i * WINDOW, WINDOW);
+    put_end(&p);
+
+    report("literal patch within max size",
+            p.len == delta_patch_max_size(IMAGE_SIZE, WINDOW));
+}
+
+int main(int argc, char* argv[]) {
+    build_images();
+
+    test_in_place();
+    test_chunk();
+    test_read_behind();
+    test_cross_window();
+    test_corrupted();
+    test_max_size();
+
+    return report_summary();
+}
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <utils/log.h>
+#include <utils/hashtree.h>
+
+#define LOG_TAG "test_hashtree"
+
+#include <utils/testunit.h>
+
+/*
+ * Writes manifests the way server/otapackage/lib/hashtree.py does, with
+ * the root folded recursively here rather than level by level, then
+ * checks loading them, write buffers against their leaves and leaves
+ * read back one at a time on one thread and on all of them, and times
+ * the readback of an image.
+ */
+
+#define LEAF_SIZE       (128 * 1024)
+#define IMAGE_SIZE      (37 * LEAF_SIZE + 1000)
+#define BENCH_SIZE      (64 << 20)
+#define MANIFEST        "/tmp/test_hashtree.hashtree"
+
+static void sha1(const void* a, uint32_t alen, const void* b, uint32_t blen,
+        uint8_t* digest) {
+    SHA_CTX ctx;
+
+    SHA_init(&ctx);
+    SHA_update(&ctx, a, alen);
+    SHA_update(&ctx, b, blen);
+    memcpy(digest, SHA_final(&ctx), SHA_DIGEST_SIZE);
+}
+
+/*
+ * The left subtree holds the largest power of two of leaves below count,
+ * the shape an odd node moving up as is gives
+ */
+static void fold(const uint8_t* leaves, uint32_t count, uint8_t* digest) {
+    uint8_t pair[1 + 2 * SHA_DIGEST_SIZE];
+    uint32_t left = 1;
+
+    if (count == 1) {
+        memcpy(digest, leaves, SHA_DIGEST_SIZE);
+        return;
+    }
+
+    while (left * 2 < count)
+        left *= 2;
+
+    pair[0] = 0x01;
+    fold(leaves, left, pair + 1);
+    fold(leaves + left * SHA_DIGEST_SIZE, count - left,
+            pair + 1 + SHA_DIGEST_SIZE);
+    sha1(pair, sizeof(pair), NULL, 0, digest);
+}
+
+static void put_le(uint8_t* p, uint64_t v, int len) {
+    for (int i = 0; i < len; i++)
+        p[i] = v >> (8 * i);
+}
+
+static int write_manifest(const uint8_t* image, uint64_t size,
+        uint32_t leaf_size, char* root) {
+    uint32_t count = (size + leaf_size - 1) / leaf_size;
+    uint8_t hdr[HASHTREE_HEADER_SIZE];
+    uint8_t digest[SHA_DIGEST_SIZE];
+    uint8_t* leaves;
+    uint8_t prefix = 0x00;
+    FILE* f;
+
+    leaves = malloc((size_t)count * SHA_DIGEST_SIZE);
+    if (leaves == NULL)
+        return -1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t left = size - (uint64_t)i * leaf_size;
+
+        sha1(&prefix, 1, image + (size_t)i * leaf_size,
+                left < leaf_size ? left : leaf_size,
+                leaves + (size_t)i * SHA_DIGEST_SIZE);
+    }
+
+    fold(leaves, count, digest);
+    for (int i = 0; i < SHA_DIGEST_SIZE; i++)
+        sprintf(root + 2 * i, "%02x", digest[i]);
+
+    put_le(hdr, HASHTREE_MAGIC, 4);
+    put_le(hdr + 4, HASHTREE_VERSION, 2);
+    put_le(hdr + 6, HASHTREE_HASH_SHA1, 2);
+    put_le(hdr + 8, leaf_size, 4);
+    put_le(hdr + 12, count, 4);
+    put_le(hdr + 16, size, 8);
+
+    f = fopen(MANIFEST, "wb");
+    if (f == NULL) {
+        free(leaves);
+        return -1;
+    }
+    fwrite(hdr, 1, sizeof(hdr), f);
+    fwrite(leaves, SHA_DIGEST_SIZE, count, f);
+    fclose(f);
+    free(leaves);
+
+    return 0;
+}
+
+static void fill_random(uint8_t* p, uint64_t len) {
+    for (uint64_t i = 0; i < len; i++)
+        p[i] = rand();
+}
+
+static void test_load(const uint8_t* image) {
+    char root[HASHTREE_ROOT_STR_LEN + 1];
+    char bad_root[HASHTREE_ROOT_STR_LEN + 1];
+    struct hashtree ht;
+    int ok;
+
+    ok = write_manifest(image, IMAGE_SIZE, LEAF_SIZE, root) == 0
+            && hashtree_load(&ht, MANIFEST, root, IMAGE_SIZE) == 0
+            && ht.leaf_count == 38 && ht.leaf_size == LEAF_SIZE;
+    hashtree_destroy(&ht);
+    report("load", ok);
+
+    strcpy(bad_root, root);
+    bad_root[0] = bad_root[0] == '0' ? '1' : '0';
+    ok = hashtree_load(&ht, MANIFEST, bad_root, IMAGE_SIZE) < 0
+            && hashtree_load(&ht, MANIFEST, "00", IMAGE_SIZE) < 0;
+    report("root mismatch", ok);
+
+    ok = hashtree_load(&ht, MANIFEST, root, IMAGE_SIZE + 1) < 0
+            && ht.leaves == NULL;
+    report("image size mismatch", ok);
+
+    truncate(MANIFEST, HASHTREE_HEADER_SIZE + 10 * SHA_DIGEST_SIZE);
+    report("truncated manifest",
+            hashtree_load(&ht, MANIFEST, root, IMAGE_SIZE) < 0);
+
+    ok = write_manifest(image, 1, LEAF_SIZE, root) == 0
+            && hashtree_load(&ht, MANIFEST, root, 1) == 0
+            && hashtree_verify(&ht, 0, image, 1) == 0;
+    hashtree_destroy(&ht);
+    report("single byte image", ok);
+}
+
+static void test_verify(uint8_t* image) {
+    char root[HASHTREE_ROOT_STR_LEN + 1];
+    uint64_t last = (uint64_t)(IMAGE_SIZE / LEAF_SIZE) * LEAF_SIZE;
+    struct hashtree ht;
+    int ok;
+
+    if (write_manifest(image, IMAGE_SIZE, LEAF_SIZE, root) < 0
+            || hashtree_load(&ht, MANIFEST, root, IMAGE_SIZE) < 0) {
+        report("verify", 0);
+        return;
+    }
+
+    ok = hashtree_verify(&ht, 0, image, IMAGE_SIZE) == 0;
+    for (uint64_t offset = 0; offset < last; offset += 4 * LEAF_SIZE) {
+        uint64_t len = last - offset < 4 * LEAF_SIZE ? last - offset
+                : 4 * LEAF_SIZE;
+
+        ok &= hashtree_verify(&ht, offset, image + offset, len) == 0;
+    }
+    ok &= hashtree_verify(&ht, last, image + last, IMAGE_SIZE - last) == 0;
+    report("verify by buffer", ok);
+
+    ok = hashtree_verify(&ht, 1, image + 1, LEAF_SIZE) < 0
+            && hashtree_verify(&ht, last, image + last, LEAF_SIZE) < 0
+            && hashtree_verify(&ht, last + LEAF_SIZE, image, 1) < 0;
+    report("unaligned, long and out of range", ok);
+
+    image[5 * LEAF_SIZE + 77] ^= 0x10;
+    ok = hashtree_verify(&ht, 0, image, IMAGE_SIZE) < 0
+            && hashtree_verify(&ht, 4 * LEAF_SIZE, image + 4 * LEAF_SIZE,
+                    LEAF_SIZE) == 0
+            && hashtree_verify(&ht, 5 * LEAF_SIZE, image + 5 * LEAF_SIZE,
+                    LEAF_SIZE) < 0;
+    image[5 * LEAF_SIZE + 77] ^= 0x10;
+    report("corrupted leaf", ok);
+
+    hashtree_destroy(&ht);
+}
+
+/*
+ * Readback
+ */
+struct source {
+    const uint8_t* image;
+    uint32_t leaf_size;
+    uint32_t next;
+    uint32_t skip;
+    int out_of_order;
+};
+
+static int read_leaf(uint32_t index, void* buf, uint32_t len, void* param) {
+    struct source* s = (struct source *)param;
+
+    if (index != s->next++)
+        s->out_of_order = 1;
+
+    memcpy(buf, s->image + (size_t)index * s->leaf_size, len);
+
+    return index == s->skip ? 1 : 0;
+}
+
+static int read_fails(uint32_t index, void* buf, uint32_t len, void* param) {
+    return index == 3 ? -1 : read_leaf(index, buf, len, param);
+}
+
+static int readback(const struct hashtree* ht, const uint8_t* image,
+        uint32_t first, uint32_t count, uint32_t skip, int threads) {
+    struct source s = {image, ht->leaf_size, first, skip, 0};
+
+    if (hashtree_verify_blocks(ht, first, count, read_leaf, &s, threads) < 0)
+        return -1;
+
+    return s.out_of_order ? -1 : 0;
+}
+
+static void test_verify_blocks(uint8_t* image) {
+    char root[HASHTREE_ROOT_STR_LEN + 1];
+    struct source s = {image, LEAF_SIZE, 0, -1, 0};
+    struct hashtree ht;
+    int ok;
+
+    if (write_manifest(image, IMAGE_SIZE, LEAF_SIZE, root) < 0
+            || hashtree_load(&ht, MANIFEST, root, IMAGE_SIZE) < 0) {
+        report("verify blocks", 0);
+        return;
+    }
+
+    ok = readback(&ht, image, 0, ht.leaf_count, -1, 1) == 0
+            && readback(&ht, image, 0, ht.leaf_count, -1, 0) == 0
+            && readback(&ht, image, 10, 3, -1, 4) == 0
+            && readback(&ht, image, 37, 1, -1, 4) == 0;
+    report("verify blocks in order", ok);
+
+    image[20 * LEAF_SIZE] ^= 0x01;
+    ok = readback(&ht, image, 0, ht.leaf_count, -1, 1) < 0
+            && readback(&ht, image, 0, ht.leaf_count, -1, 0) < 0
+            && readback(&ht, image, 0, 20, -1, 0) == 0
+            && readback(&ht, image, 0, ht.leaf_count, 20, 0) == 0;
+    image[20 * LEAF_SIZE] ^= 0x01;
+    report("verify blocks corrupted and skipped", ok);
+
+    ok = hashtree_verify_blocks(&ht, 0, ht.leaf_count, read_fails, &s, 0) < 0
+            && hashtree_verify_blocks(&ht, 30, 9, read_leaf, &s, 0) < 0;
+    report("verify blocks read error and range", ok);
+
+    hashtree_destroy(&ht);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void bench(void) {
+    char root[HASHTREE_ROOT_STR_LEN + 1];
+    uint8_t* image = malloc(BENCH_SIZE);
+    uint32_t count = BENCH_SIZE / LEAF_SIZE;
+    struct hashtree ht;
+    double t, one_ms, all_ms;
+    int ok;
+
+    if (image == NULL) {
+        LOGE("Cannot allocate %d bytes of memory\n", BENCH_SIZE);
+        failures++;
+        return;
+    }
+
+    fill_random(image, BENCH_SIZE);
+    if (write_manifest(image, BENCH_SIZE, LEAF_SIZE, root) < 0
+            || hashtree_load(&ht, MANIFEST, root, BENCH_SIZE) < 0) {
+        report("bench manifest", 0);
+        free(image);
+        return;
+    }
+
+    t = now_ms();
+    ok = readback(&ht, image, 0, count, -1, 1) == 0;
+    one_ms = now_ms() - t;
+
+    t = now_ms();
+    ok &= readback(&ht, image, 0, count, -1, 0) == 0;
+    all_ms = now_ms() - t;
+
+    report("bench readback", ok);
+    LOGI("readback of %d MB: 1 thread %.1f MB/s, all CPUs %.1f MB/s\n",
+            BENCH_SIZE >> 20, (BENCH_SIZE >> 20) / (one_ms / 1e3),
+            (BENCH_SIZE >> 20) / (all_ms / 1e3));
+
+    hashtree_destroy(&ht);
+    free(image);
+}
+
+int main(int argc, char* argv[]) {
+    uint8_t* image = malloc(IMAGE_SIZE);
+
+    if (image == NULL) {
+        LOGE("Cannot allocate %d bytes of memory\n", IMAGE_SIZE);
+        return -1;
+    }
+    fill_random(image, IMAGE_SIZE);
+
+    test_load(image);
+    test_verify(image);
+    test_verify_blocks(image);
+    free(image);
+
+    bench();
+
+    unlink(MANIFEST);
+
+    return report_summary();
+}
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <utils/log.h>
+#include <utils/memscan.h>
+
+#define LOG_TAG "test_memscan"
+
+#include <utils/testunit.h>
+
+/*
+ * Checks the word-wide 0xFF scanners against a byte loop over every
+ * alignment, length and position of a stray byte, then times both on
+ * an erase block worth of data.
+ */
+
+#define MAX_LEN         160
+#define MAX_ALIGN       16
+#define BLOCK_SIZE      (128 * 1024)
+#define BENCH_ROUNDS    2000
+
+static uint8_t buf[MAX_ALIGN + MAX_LEN];
+
+static int byte_is_ff(const uint8_t* p, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++)
+        if (p[i] != 0xFF)
+            return 0;
+    return 1;
+}
+
+static uint32_t byte_strip_ff(const uint8_t* p, uint32_t len) {
+    while (len && p[len - 1] == 0xFF)
+        len--;
+    return len;
+}
+
+static int check(const uint8_t* p, uint32_t len) {
+    return memscan_is_ff(p, len) == byte_is_ff(p, len)
+            && memscan_strip_ff(p, len) == byte_strip_ff(p, len);
+}
+
+static void test_blank(void) {
+    int ok = 1;
+
+    memset(buf, 0xFF, sizeof(buf));
+    for (int align = 0; align < MAX_ALIGN; align++)
+        for (uint32_t len = 0; len <= MAX_LEN; len++)
+            ok &= check(buf + align, len);
+
+    report("blank buffers", ok);
+}
+
+static void test_stray_byte(void) {
+    int ok = 1;
+
+    for (int align = 0; align < MAX_ALIGN; align++) {
+        for (uint32_t len = 1; len <= MAX_LEN; len++) {
+            for (uint32_t pos = 0; pos < len; pos++) {
+                memset(buf, 0xFF, sizeof(buf));
+                buf[align + pos] = 0x7F;
+                ok &= check(buf + align, len);
+
+                /* Data outside the scanned range must not count */
+                buf[align + pos] = 0xFF;
+                if (align)
+                    buf[align - 1] = 0;
+                if (align + len < sizeof(buf))
+                    buf[align + len] = 0;
+                ok &= check(buf + align, len);
+            }
+        }
+    }
+
+    report("one stray byte at every position", ok);
+}
+
+static void test_strip_length(void) {
+    int ok = 1;
+
+    memset(buf, 0, sizeof(buf));
+    memset(buf + 37, 0xFF, MAX_LEN - 37);
+    ok &= memscan_strip_ff(buf, MAX_LEN) == 37;
+    ok &= memscan_strip_ff(buf + 3, MAX_LEN - 3) == 34;
+    ok &= memscan_strip_ff(buf, 0) == 0;
+
+    report("stripped length", ok);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void bench(void) {
+    uint8_t* block = malloc(BLOCK_SIZE);
+    volatile uint32_t sink = 0;
+    double t, byte_ms, word_ms;
+
+    if (block == NULL) {
+        LOGE("Cannot allocate %d bytes of memory\n", BLOCK_SIZE);
+        failures++;
+        return;
+    }
+    memset(block, 0xFF, BLOCK_SIZE);
+
+    t = now_ms();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+        sink += byte_is_ff(block, BLOCK_SIZE);
+    byte_ms = now_ms() - t;
+
+    t = now_ms();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+        sink += memscan_is_ff(block, BLOCK_SIZE);
+    word_ms = now_ms() - t;
+
+    LOGI("is_ff:    byte loop %.1f MB/s, memscan %.1f MB/s\n",
+            BENCH_ROUNDS * (BLOCK_SIZE / 1048576.0) / (byte_ms / 1e3),
+            BENCH_ROUNDS * (BLOCK_SIZE / 1048576.0) / (word_ms / 1e3));
+
+    /* drop_ffs() on a mostly empty UBI block */
+    memset(block, 0, 64);
+
+    t = now_ms();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+        sink += byte_strip_ff(block, BLOCK_SIZE);
+    byte_ms = now_ms() - t;
+
+    t = now_ms();
+    for (int i = 0; i < BENCH_ROUNDS; i++)
+        sink += memscan_strip_ff(block, BLOCK_SIZE);
+    word_ms = now_ms() - t;
+
+    LOGI("strip_ff: byte loop %.1f MB/s, memscan %.1f MB/s\n",
+            BENCH_ROUNDS * (BLOCK_SIZE / 1048576.0) / (byte_ms / 1e3),
+            BENCH_ROUNDS * (BLOCK_SIZE / 1048576.0) / (word_ms / 1e3));
+
+    free(block);
+}
+
+int main(int argc, char* argv[]) {
+    test_blank();
+    test_stray_byte();
+    test_strip_length();
+
+    bench();
+
+    return report_summary();
+}
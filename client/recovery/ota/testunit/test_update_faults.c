@@ -0,0 +1,690 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <utils/log.h>
+#include <types.h>
+#include <lib/libcommon.h>
+#include <lib/mtd/mtd-user.h>
+#include <lib/mtd/mtd_swab.h>
+#include <lib/mtd/ubi-media.h>
+#include <lib/libmtd.h>
+#include <lib/libmtd_emu.h>
+#include <lib/crc/libcrc.h>
+#include <utils/common.h>
+#include <utils/update_stats.h>
+#include <utils/signal_handler.h>
+#include <block/block_manager.h>
+#include <block/fs/fs_manager.h>
+#include <block/mtd/mtd.h>
+#include <block/sysinfo/sysinfo_manager.h>
+#include <block/sysinfo/flag.h>
+#include <ota/ota_manager.h>
+#include <configure/configure_file.h>
+#include <configure/update_file.h>
+#include "../bench/update_server.h"
+
+#define LOG_TAG "test_update_faults"
+
+#include <utils/testunit.h>
+
+/*
+ * An update under flash faults, on the file-backed MTD emulator: the
+ * packages of ota/bench/make_packages.sh are served from a loopback HTTP
+ * server and update_from_network() of the ota_manager flashes them, one
+ * child process per boot, as bench_update does. The first boot gets
+ * program/erase failures injected or loses power at a chosen program or
+ * erase, the next ones carry on from what it left until one completes
+ * the update.
+ *
+ * The flash is then checked against the images and the flags, and what
+ * each fault cost is reported against a clean update: boots, wall and
+ * modelled flash time, and flash traffic (bytes programmed and erased,
+ * blocks marked bad).
+ *
+ * Run by test_update_faults.sh (make HOST=1 update_faults). Like the
+ * recovery, each boot pings the server first and so needs a raw socket
+ * (root or CAP_NET_RAW).
+ */
+
+#define TEST_IMAGE      "/tmp/test_update_faults.img"
+#define TEST_SPEC       "type=nand size=64M eb=128K page=2K oob=64 "     \
+                        "parts=1M(uboot),4M(kernel),24M(rootfs),"         \
+                        "1M(journal),-(data) bad=12,50 image=" TEST_IMAGE
+#define TEST_LATENCY    "10,100,1000"
+
+#define MAX_BOOTS       4
+#define MAX_SCENARIOS   32
+
+enum {
+    BOOT_DONE = 0,
+    BOOT_FAILED,
+    BOOT_CUT,
+};
+
+#define FAULT_POWER_CUT     MTD_EMU_OP_MAX
+
+struct test_image {
+    const char* part;
+    const char* file;           /* in <dir>/image/nand */
+    const char* fs_type;
+    int64_t size;
+    char* data;
+};
+
+struct scenario {
+    char name[64];
+    int op;                     /* MTD_EMU_OP_PROGRAM/ERASE or FAULT_POWER_CUT */
+    const char* part;
+    int eb;                     /* of the partition */
+    int count;                  /* failures, -1 for ever */
+    long long cut;              /* power cut: program or erase number */
+    int cut_percent;            /* or share of the clean update's */
+};
+
+struct boot_result {
+    int status;
+    uint64_t ns;
+    struct mtd_emu_stats stats;
+};
+
+static struct test_image images[] = {
+    {"uboot",  "u-boot.bin", BM_FILE_TYPE_NORMAL, 0, NULL},
+    {"kernel", "uImage",     BM_FILE_TYPE_NORMAL, 0, NULL},
+    {"rootfs", "rootfs.ubi", BM_FILE_TYPE_UBIFS,  0, NULL},
+};
+
+#define IMAGE_COUNT     (sizeof(images) / sizeof(images[0]))
+
+static struct mtd_emu_config cfg;
+static struct configure_file* cf;
+static struct boot_result* boots;       /* shared with the boot children */
+static int boot_slot;
+static uint64_t boot_start;
+
+static struct scenario scenarios[MAX_SCENARIOS];
+static int scenario_cnt;
+
+static void bm_event_listener(struct block_manager* bm,
+        struct bm_event* event, void* param) {
+    return;
+}
+
+static void power_cut(const struct mtd_emu_stats* stats) {
+    boots[boot_slot].status = BOOT_CUT;
+    boots[boot_slot].ns = update_stats_now() - boot_start;
+    boots[boot_slot].stats = *stats;
+
+    _exit(BOOT_CUT);
+}
+
+/*
+ * The flag area sits in the first block of the chip, bound the way it is
+ * on an XBurst board
+ */
+static struct block_manager* boot_block_manager(void) {
+    struct block_manager* bm = calloc(1, sizeof(*bm));
+
+    if (bm == NULL)
+        return NULL;
+
+    bm->construct = construct_block_manager;
+    bm->destruct = destruct_block_manager;
+    bm->construct(bm, BM_BLOCK_TYPE_MTD, bm_event_listener, "faults");
+
+    if (bm->sysinfo == NULL)
+        sysinfo_manager_bind(GET_SYSINFO_MANAGER(), bm);
+
+    return bm;
+}
+
+static void free_block_manager(struct block_manager* bm) {
+    GET_SYSINFO_MANAGER()->exit(GET_SYSINFO_MANAGER());
+    bm->destruct(bm);
+    free(bm);
+}
+
+static int find_partition(struct block_manager* bm, const char* name) {
+    for (int i = 0; i < bm->get_partition_count(bm); i++)
+        if (!strcmp(BM_GET_PARTINFO_MTD_DEV(bm, i)->name, name))
+            return i;
+
+    return -1;
+}
+
+/*
+ * One boot into recovery, the process ends with it
+ */
+static int run_update(void) {
+    struct ota_manager* om = _new(struct ota_manager, ota_manager);
+
+    om->load_configure(om, cf);
+    om->uf = _new(struct update_file, update_file);
+
+    return om->update_from_network(om);
+}
+
+/*
+ * Raw images read back through the normal writer, but for the sysinfo
+ * areas merged into the first block of the chip
+ */
+static int check_normal(struct block_manager* bm, struct test_image* image) {
+    struct sysinfo_manager* sys_m = GET_SYSINFO_MANAGER();
+    struct bm_operation_option option;
+    int64_t start = BM_GET_PARTINFO_START(bm, find_partition(bm,
+            image->part));
+    int64_t offset, leb_size;
+    char* buf = malloc(image->size);
+    int ok = 0;
+
+    if (buf == NULL)
+        return 0;
+
+    bm->set_operation_option(bm, &option, BM_OPERATION_METHOD_PARTITION,
+            (char *)image->fs_type);
+    if (bm->prepare(bm, start, image->size, &option) == NULL)
+        goto out;
+
+    leb_size = bm->get_prepare_leb_size(bm);
+    offset = bm->get_prepare_write_start(bm);
+    for (int64_t done = 0; done < image->size; done += leb_size) {
+        offset = bm->read(bm, offset, buf + done,
+                MIN(leb_size, image->size - done));
+        if (offset < 0) {
+            bm->finish(bm);
+            goto out;
+        }
+    }
+    bm->finish(bm);
+
+    for (int id = 0; id <= SYSINFO_FLAG; id++) {
+        int64_t from = sys_m->get_offset(sys_m, id) - start;
+        int64_t len = sys_m->get_length(sys_m, id);
+
+        if (from >= 0 && from + len <= image->size)
+            memcpy(buf + from, image->data + from, len);
+    }
+
+    ok = !memcmp(buf, image->data, image->size);
+
+out:
+    free(buf);
+    return ok;
+}
+
+/*
+ * Every good PEB formatted, the layout volume twice and each LEB of the
+ * image volume once, holding its data
+ */
+static int is_erased(const char* buf, int len) {
+    for (int i = 0; i < len; i++)
+        if ((unsigned char)buf[i] != 0xff)
+            return 0;
+
+    return 1;
+}
+
+static int check_ubifs(struct block_manager* bm, struct test_image* image) {
+    int part = find_partition(bm, image->part);
+    struct mtd_dev_info* mtd = BM_GET_PARTINFO_MTD_DEV(bm, part);
+    int fd = *BM_GET_PARTINFO_FD(bm, part);
+    int layouts = 0, lebs = 0, nlebs = 0, ok = 1;
+    char* buf = malloc(mtd->eb_size);
+    char* seen = NULL;
+
+    if (buf == NULL)
+        return 0;
+
+    for (int eb = 0; eb < mtd->eb_cnt && ok; eb++) {
+        struct ubi_ec_hdr* ec = (struct ubi_ec_hdr *)buf;
+        struct ubi_vid_hdr* vid;
+        int data_offs, usable;
+        uint32_t lnum;
+
+        if (mtd_is_bad(mtd, fd, eb) > 0)
+            continue;
+
+        if (mtd_read(mtd, fd, eb, 0, buf, mtd->eb_size) < 0) {
+            LOGE("\"%s\": cannot read PEB %d\n", image->part, eb);
+            ok = 0;
+            break;
+        }
+
+        /*
+         * Left erased by a write error the torture let go, like ubiformat
+         * does; UBI takes it as empty when it attaches
+         */
+        if (is_erased(buf, mtd->eb_size))
+            continue;
+
+        if (be32_to_cpu(ec->magic) != UBI_EC_HDR_MAGIC
+                || be32_to_cpu(ec->hdr_crc) != local_crc32(UBI_CRC32_INIT,
+                        ec, UBI_EC_HDR_SIZE_CRC)) {
+            LOGE("\"%s\": PEB %d is not formatted\n", image->part, eb);
+            ok = 0;
+            break;
+        }
+
+        vid = (struct ubi_vid_hdr *)(buf + be32_to_cpu(ec->vid_hdr_offset));
+        if (be32_to_cpu(vid->magic) == 0xffffffff)
+            continue;
+
+        if (be32_to_cpu(vid->magic) != UBI_VID_HDR_MAGIC
+                || be32_to_cpu(vid->hdr_crc) != local_crc32(UBI_CRC32_INIT,
+                        vid, UBI_VID_HDR_SIZE_CRC)) {
+            LOGE("\"%s\": PEB %d has a corrupted VID header\n", image->part,
+                    eb);
+            ok = 0;
+            break;
+        }
+
+        if (be32_to_cpu(vid->vol_id) == UBI_LAYOUT_VOLUME_ID) {
+            layouts++;
+            continue;
+        }
+
+        data_offs = be32_to_cpu(ec->data_offset);
+        usable = mtd->eb_size - data_offs - be32_to_cpu(vid->data_pad);
+        if (seen == NULL) {
+            nlebs = image->size / usable;
+            seen = calloc(1, nlebs);
+            if (seen == NULL) {
+                ok = 0;
+                break;
+            }
+        }
+
+        lnum = be32_to_cpu(vid->lnum);
+        if (lnum >= nlebs || seen[lnum]
+                || memcmp(buf + data_offs, image->data
+                        + (int64_t)lnum * usable, usable)) {
+            LOGE("\"%s\": PEB %d holds a stray or bad LEB %u\n",
+                    image->part, eb, lnum);
+            ok = 0;
+            break;
+        }
+        seen[lnum] = 1;
+        lebs++;
+    }
+
+    if (ok && (layouts != UBI_LAYOUT_VOLUME_EBS || !nlebs || lebs != nlebs)) {
+        LOGE("\"%s\": %d layout PEBs, %d of %d LEBs\n", image->part, layouts,
+                lebs, nlebs);
+        ok = 0;
+    }
+
+    free(seen);
+    free(buf);
+    return ok;
+}
+
+static int check_flash(void) {
+    struct block_manager* bm = boot_block_manager();
+    uint32_t flag = 0;
+    int ok = 1;
+
+    if (bm == NULL)
+        return -1;
+
+    if (GET_SYSINFO_FLAG()->read(SYSINFO_FLAG_ID_UPDATE_DONE, &flag) < 0
+            || flag != SYSINFO_FLAG_VALUE_UPDATE_DONE) {
+        LOGE("Update flag is 0x%x\n", flag);
+        ok = 0;
+    }
+
+    for (int i = 0; i < IMAGE_COUNT; i++) {
+        int image_ok = strcmp(images[i].fs_type, BM_FILE_TYPE_UBIFS)
+                ? check_normal(bm, &images[i]) : check_ubifs(bm, &images[i]);
+
+        if (!image_ok)
+            LOGE("\"%s\" does not hold its image\n", images[i].part);
+        ok &= image_ok;
+    }
+
+    free_block_manager(bm);
+
+    return ok ? 0 : -1;
+}
+
+static int chip_eb(const char* part, int eb) {
+    long long start = 0;
+
+    for (int i = 0; i < cfg.part_cnt; i++) {
+        if (!strcmp(cfg.parts[i].name, part))
+            return start / cfg.eb_size + eb;
+        start += cfg.parts[i].size;
+    }
+
+    return -1;
+}
+
+static int start_boot(struct scenario* s, int slot, long long cut) {
+    pid_t pid = fork();
+    int status;
+
+    if (pid < 0) {
+        LOGE("Cannot fork: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (pid == 0) {
+        int error;
+
+        boot_slot = slot;
+        if (mtd_emu_setup(&cfg) < 0)
+            _exit(BOOT_FAILED);
+
+        if (s && s->op != FAULT_POWER_CUT) {
+            struct mtd_emu_fault fault = {s->op, chip_eb(s->part, s->eb), 0,
+                    s->count, EIO};
+
+            mtd_emu_add_fault(&fault);
+        }
+        if (cut)
+            mtd_emu_set_power_cut(cut, power_cut);
+
+        boot_start = update_stats_now();
+        error = slot < 0 ? check_flash() : run_update();
+
+        if (slot >= 0) {
+            boots[slot].status = error < 0 ? BOOT_FAILED : BOOT_DONE;
+            boots[slot].ns = update_stats_now() - boot_start;
+            mtd_emu_get_stats(&boots[slot].stats);
+        }
+
+        _exit(error < 0 ? BOOT_FAILED : BOOT_DONE);
+    }
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+        return BOOT_FAILED;
+
+    return WEXITSTATUS(status);
+}
+
+struct run_cost {
+    int boots;
+    int done;
+    int consistent;
+    uint64_t ns;
+    long long busy_ns;          /* flash latency modelled, free of noise */
+    long long programmed;
+    long long erased;
+    long long marked_bad;
+    long long cut_ops;          /* programs and erases of a clean update */
+};
+
+static void run_scenario(struct scenario* s, long long cut,
+        struct run_cost* cost) {
+    memset(cost, 0, sizeof(*cost));
+    memset(boots, 0, MAX_BOOTS * sizeof(*boots));
+
+    unlink(TEST_IMAGE);
+    unlink(TEST_IMAGE ".oob");
+
+    for (int slot = 0; slot < MAX_BOOTS && !cost->done; slot++) {
+        int status = start_boot(slot ? NULL : s, slot, slot ? 0 : cut);
+        struct boot_result* b = &boots[slot];
+
+        cost->boots++;
+        cost->ns += b->ns;
+        cost->busy_ns += b->stats.busy_ns;
+        cost->programmed += b->stats.bytes[MTD_EMU_OP_PROGRAM];
+        cost->erased += b->stats.bytes[MTD_EMU_OP_ERASE];
+        cost->marked_bad += b->stats.marked_bad;
+        cost->cut_ops += b->stats.ops[MTD_EMU_OP_PROGRAM]
+                + b->stats.ops[MTD_EMU_OP_ERASE];
+
+        if (status == BOOT_DONE)
+            cost->done = 1;
+        else if (status != BOOT_CUT)
+            LOGW("%s: boot %d failed\n", s ? s->name : "clean", slot + 1);
+    }
+
+    cost->consistent = cost->done && start_boot(NULL, -1, 0) == BOOT_DONE;
+}
+
+static void report_cost(const char* name, struct run_cost* cost,
+        struct run_cost* clean) {
+    int ok = cost->done && cost->consistent;
+
+    LOGI("%-28s %5d %8.3f %+8.3f %8.3f %+8.3f %10lld %+9lld %10lld %+9lld %3lld  %s\n",
+            name, cost->boots, cost->ns / 1e9,
+            ((int64_t)cost->ns - (int64_t)clean->ns) / 1e9,
+            cost->busy_ns / 1e9, (cost->busy_ns - clean->busy_ns) / 1e9,
+            cost->programmed, cost->programmed - clean->programmed,
+            cost->erased, cost->erased - clean->erased, cost->marked_bad,
+            ok ? "consistent" : cost->done ? "INCONSISTENT" : "NOT DONE");
+    if (!ok)
+        failures++;
+}
+
+static int add_scenario(int op, const char* arg) {
+    struct scenario* s = &scenarios[scenario_cnt];
+    char part[32];
+    int n;
+
+    if (scenario_cnt == MAX_SCENARIOS)
+        return -1;
+
+    memset(s, 0, sizeof(*s));
+    s->op = op;
+    s->count = 1;
+
+    if (op == FAULT_POWER_CUT) {
+        char* end;
+
+        s->cut = strtoll(arg, &end, 0);
+        if (*end == '%') {
+            s->cut_percent = s->cut;
+            s->cut = 0;
+            end++;
+        }
+        if (end == arg || *end || s->cut < 0 || s->cut_percent < 0
+                || s->cut_percent > 100 || (!s->cut && !s->cut_percent))
+            return -1;
+
+        snprintf(s->name, sizeof(s->name), "power cut at %s", arg);
+    } else {
+        n = sscanf(arg, "%31[^:]:%d:%d", part, &s->eb, &s->count);
+        if (n < 2 || chip_eb(part, s->eb) < 0 || !s->count)
+            return -1;
+
+        for (int i = 0; i < cfg.part_cnt; i++)
+            if (!strcmp(cfg.parts[i].name, part))
+                s->part = cfg.parts[i].name;
+
+        snprintf(s->name, sizeof(s->name), "%s EIO %s:%d%s",
+                op == MTD_EMU_OP_PROGRAM ? "program" : "erase", part, s->eb,
+                s->count < 0 ? " always" : "");
+    }
+
+    scenario_cnt++;
+
+    return 0;
+}
+
+/*
+ * mtd_basic_write(), mtd_basic_erase() and ubi_write_one_peb() through
+ * their error branches, and the power cut spread over the update
+ */
+static void add_default_scenarios(void) {
+    add_scenario(MTD_EMU_OP_PROGRAM, "kernel:1");
+    add_scenario(MTD_EMU_OP_ERASE, "kernel:5");
+    add_scenario(MTD_EMU_OP_PROGRAM, "rootfs:4");
+    add_scenario(MTD_EMU_OP_PROGRAM, "rootfs:6:-1");
+    add_scenario(MTD_EMU_OP_ERASE, "rootfs:8");
+    add_scenario(FAULT_POWER_CUT, "1%");
+    add_scenario(FAULT_POWER_CUT, "10%");
+    add_scenario(FAULT_POWER_CUT, "30%");
+    add_scenario(FAULT_POWER_CUT, "50%");
+    add_scenario(FAULT_POWER_CUT, "70%");
+    add_scenario(FAULT_POWER_CUT, "90%");
+    add_scenario(FAULT_POWER_CUT, "99%");
+}
+
+static int load_images(const char* dir) {
+    char path[PATH_MAX];
+
+    for (int i = 0; i < IMAGE_COUNT; i++) {
+        struct test_image* image = &images[i];
+        FILE* fp;
+
+        snprintf(path, sizeof(path), "%s/image/nand/%s", dir, image->file);
+        fp = fopen(path, "r");
+        if (fp == NULL) {
+            LOGE("Cannot open %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+
+        fseek(fp, 0, SEEK_END);
+        image->size = ftell(fp);
+        rewind(fp);
+
+        image->data = malloc(image->size);
+        if (image->data == NULL
+                || fread(image->data, 1, image->size, fp) != image->size) {
+            LOGE("Cannot read %" PRId64 " bytes of %s\n", image->size, path);
+            fclose(fp);
+            return -1;
+        }
+        fclose(fp);
+    }
+
+    return 0;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s -d <dir> [options]\n"
+            "  -d <dir>           output directory of make_packages.sh\n"
+            "  -k <file>          public key, default <dir>/testkey.pub\n"
+            "  -c <n>[%%]          power cut at the nth program or erase, or at\n"
+            "                     n%% of those of a clean update\n"
+            "  -w <part>:<eb>[:n] program failure on a block of a partition,\n"
+            "                     n times, -1 for ever\n"
+            "  -e <part>:<eb>[:n] erase failure, likewise\n"
+            "  -l <r>,<p>,<e>     read, program and erase latency in us,\n"
+            "                     default " TEST_LATENCY "\n"
+            "Without any fault given, a default set is run.\n", name);
+}
+
+int main(int argc, char** argv) {
+    struct run_cost clean, cost;
+    char latency[64] = "latency=" TEST_LATENCY;
+    char packages[PATH_MAX];
+    char key[PATH_MAX] = {0};
+    const char* dir = NULL;
+    pid_t server;
+    int port;
+    int c;
+
+    mtd_emu_default_config(&cfg);
+    if (mtd_emu_parse_config(&cfg, TEST_SPEC) < 0)
+        return 1;
+
+    while ((c = getopt(argc, argv, "d:k:c:w:e:l:h")) != -1) {
+        int error = 0;
+
+        switch (c) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'k':
+            snprintf(key, sizeof(key), "%s", optarg);
+            break;
+        case 'c':
+            error = add_scenario(FAULT_POWER_CUT, optarg);
+            break;
+        case 'w':
+            error = add_scenario(MTD_EMU_OP_PROGRAM, optarg);
+            break;
+        case 'e':
+            error = add_scenario(MTD_EMU_OP_ERASE, optarg);
+            break;
+        case 'l':
+            snprintf(latency, sizeof(latency), "latency=%s", optarg);
+            break;
+        default:
+            error = -1;
+            break;
+        }
+
+        if (error < 0) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (dir == NULL || mtd_emu_parse_config(&cfg, latency) < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (!key[0])
+        snprintf(key, sizeof(key), "%s/testkey.pub", dir);
+    g_data.public_key_path = key;
+    g_data.has_fb = 0;
+
+    if (!scenario_cnt)
+        add_default_scenarios();
+
+    boots = mmap(NULL, MAX_BOOTS * sizeof(*boots), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (boots == MAP_FAILED) {
+        LOGE("Cannot map the boot results: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if (load_images(dir) < 0)
+        return 1;
+
+    /*
+     * Before any thread of the updater
+     */
+    snprintf(packages, sizeof(packages), "%s/packages", dir);
+    port = update_server_start(packages, 0, 0, &server);
+    if (port < 0) {
+        LOGE("Cannot serve %s\n", packages);
+        return 1;
+    }
+
+    cf = update_server_configure(NULL, port);
+    if (cf == NULL) {
+        update_server_stop(server);
+        return 1;
+    }
+
+    run_scenario(NULL, 0, &clean);
+
+    LOGI("%-28s %5s %8s %8s %8s %8s %10s %9s %10s %9s %3s\n", "scenario", "boots",
+            "seconds", "extra", "flash", "extra", "programmed", "extra", "erased", "extra",
+            "bad");
+    report_cost("clean update", &clean, &clean);
+
+    for (int i = 0; i < scenario_cnt && clean.done; i++) {
+        struct scenario* s = &scenarios[i];
+        long long cut = s->cut;
+
+        if (s->cut_percent)
+            cut = MAX(1, clean.cut_ops * s->cut_percent / 100);
+
+        run_scenario(s, cut, &cost);
+        report_cost(s->name, &cost, &clean);
+    }
+
+    update_server_stop(server);
+    _delete(cf);
+
+    unlink(TEST_IMAGE);
+    unlink(TEST_IMAGE ".oob");
+
+    if (failures)
+        LOGE("%d of %d scenarios failed\n", failures, scenario_cnt + 1);
+
+    return report_summary();
+}
@@ -0,0 +1,25 @@
+#!/bin/bash
+#
+# Update under flash faults on the host: random images packed by
+# ota/bench/make_packages.sh, flashed by test_update_faults (make HOST=1
+# test_update_faults) through the faults it injects.
+#
+# usage: test_update_faults.sh [test_update_faults options]
+#
+#   OUTDIR         where test_update_faults is, default out
+#   FAULTS_DIR     work directory, default $OUTDIR/update_faults
+#   BENCH_KERNEL   kernel image size in bytes, sliced, default 2.5M
+#   BENCH_ROOTFS   rootfs (ubifs) image size in LEBs, default 48
+#
+
+set -e
+
+TOPDIR=$(cd $(dirname $0)/../.. && pwd)
+OUTDIR=${OUTDIR:-$TOPDIR/out}
+FAULTS_DIR=${FAULTS_DIR:-$OUTDIR/update_faults}
+
+BENCH_KERNEL=${BENCH_KERNEL:-$((5 << 19))} \
+BENCH_ROOTFS=${BENCH_ROOTFS:-48} \
+        $TOPDIR/ota/bench/make_packages.sh $FAULTS_DIR
+
+$OUTDIR/test_update_faults -d $FAULTS_DIR "$@"
@@ -0,0 +1,420 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/memscan.h>
+#include <lib/crc/libcrc.h>
+#include <block/block_manager.h>
+#include <block/sysinfo/flag.h>
+#include <ota/update_journal.h>
+
+#define LOG_TAG "update_journal"
+
+#define UPDATE_JOURNAL_RECORD_MAGIC 0x4345524a  /* "JREC" */
+
+struct update_journal_record {
+    uint32_t magic;
+    uint32_t sequence;
+    struct update_journal journal;
+    uint32_t crc;
+};
+
+static uint32_t journal_crc(struct update_journal* j) {
+    return local_crc32(0, j, offsetof(struct update_journal, crc));
+}
+
+void update_journal_reset(struct update_journal* j) {
+    assert_die_if(j == NULL, "j is NULL\n");
+
+    memset(j, 0, sizeof(*j));
+    j->magic = UPDATE_JOURNAL_MAGIC;
+    j->crc = journal_crc(j);
+}
+
+int update_journal_load(struct update_journal* j, const void* buf) {
+    assert_die_if(j == NULL, "j is NULL\n");
+    assert_die_if(buf == NULL, "buf is NULL\n");
+
+    memcpy(j, buf, sizeof(*j));
+
+    if (j->magic != UPDATE_JOURNAL_MAGIC || j->crc != journal_crc(j)
+            || j->device >= UPDATE_JOURNAL_MAX_DEVICES) {
+        LOGW("No valid update journal found\n");
+        update_journal_reset(j);
+        return -1;
+    }
+
+    LOGI("Update journal: generation %u, device %u, package %u, "
+            "offset 0x%" PRIx64 "\n", j->generation, j->device, j->package,
+            j->write_offset);
+
+    return 0;
+}
+
+void update_journal_begin_device(struct update_journal* j, uint32_t device,
+        uint32_t fingerprint) {
+    assert_die_if(j == NULL, "j is NULL\n");
+
+    if (device < UPDATE_JOURNAL_MAX_DEVICES
+            && device <= j->device
+            && j->fingerprint[device] == fingerprint) {
+        if (device < j->device)
+            LOGI("Device %u already updated\n", device);
+        else if (j->package)
+            LOGI("Device %u resumes after package %u\n", device, j->package);
+        return;
+    }
+
+    /*
+     * New or different package: this device and whatever follows it
+     * start over, the devices before it stay committed
+     */
+    j->device = device;
+    j->package = 0;
+    j->part_offset = 0;
+    j->write_offset = 0;
+    if (device < UPDATE_JOURNAL_MAX_DEVICES)
+        j->fingerprint[device] = fingerprint;
+    for (uint32_t i = device + 1; i < UPDATE_JOURNAL_MAX_DEVICES; i++)
+        j->fingerprint[i] = 0;
+    j->crc = journal_crc(j);
+}
+
+int update_journal_is_done(struct update_journal* j, uint32_t device,
+        uint32_t package) {
+    if (device >= UPDATE_JOURNAL_MAX_DEVICES)
+        return 0;
+
+    return device < j->device
+            || (device == j->device && package <= j->package);
+}
+
+int update_journal_resume_offset(struct update_journal* j, uint32_t package,
+        int64_t part_offset, int64_t* offset) {
+    if (package != j->package + 1
+            || part_offset != j->part_offset || j->write_offset <= 0)
+        return 0;
+
+    *offset = j->write_offset;
+
+    return 1;
+}
+
+void update_journal_commit(struct update_journal* j, uint32_t package,
+        int64_t part_offset, int64_t write_offset) {
+    j->generation++;
+    j->package = package;
+    j->part_offset = part_offset;
+    j->write_offset = write_offset;
+    j->crc = journal_crc(j);
+}
+
+int update_journal_is_resumable(const char* fs_type) {
+    return strcmp(fs_type, BM_FILE_TYPE_UBIFS) != 0;
+}
+
+int update_journal_fingerprint(const char* path, uint32_t* fingerprint) {
+    char buf[4096];
+    uint32_t crc = 0;
+    ssize_t n;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGE("Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        crc = local_crc32(crc, buf, n);
+
+    close(fd);
+
+    if (n < 0) {
+        LOGE("Failed to read %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    *fingerprint = crc;
+
+    return 0;
+}
+
+static uint32_t record_crc(struct update_journal_record* r) {
+    return local_crc32(0, r, offsetof(struct update_journal_record, crc));
+}
+
+static int load_from_flag(struct update_journal* j) {
+    char buf[SYSINFO_FLAG_UPDATE_JOURNAL_SIZE] = {0};
+
+    if (GET_SYSINFO_FLAG()->read(SYSINFO_FLAG_ID_UPDATE_JOURNAL, buf) < 0) {
+        update_journal_reset(j);
+        return -1;
+    }
+
+    return update_journal_load(j, buf);
+}
+
+static int save_to_flag(struct update_journal* j) {
+    char buf[SYSINFO_FLAG_UPDATE_JOURNAL_SIZE] = {0};
+
+    memcpy(buf, j, sizeof(*j));
+
+    if (GET_SYSINFO_FLAG()->write(SYSINFO_FLAG_ID_UPDATE_JOURNAL, buf) < 0) {
+        LOGE("Cannot write flag%d\n", SYSINFO_FLAG_ID_UPDATE_JOURNAL);
+        return -1;
+    }
+
+    return 0;
+}
+
+int update_journal_store_open(struct update_journal_store* s,
+        struct block_manager* bm, const char* part_name) {
+    struct mtd_dev_info* mtd;
+    int fd, n = 0;
+
+    assert_die_if(s == NULL, "s is NULL\n");
+
+    memset(s, 0, sizeof(*s));
+    s->bm = bm;
+    s->part = -1;
+
+    if (bm && part_name && *part_name
+            && !strcmp(bm->name, BM_BLOCK_TYPE_MTD)) {
+        for (int i = 0; i < bm->get_partition_count(bm); i++)
+            if (!strcmp(BM_GET_PARTINFO_MTD_DEV(bm, i)->name, part_name))
+                s->part = i;
+    }
+
+    if (s->part < 0) {
+        LOGW("No \"%s\" partition, the update journal goes to the flag "
+                "area\n", part_name ? part_name : "");
+        return 0;
+    }
+
+    mtd = BM_GET_PARTINFO_MTD_DEV(bm, s->part);
+    fd = *BM_GET_PARTINFO_FD(bm, s->part);
+
+    for (int eb = 0; eb < mtd->eb_cnt && n < 2; eb++)
+        if (!mtd_is_bad(mtd, fd, eb))
+            s->eb[n++] = eb;
+
+    s->slot_size = (sizeof(struct update_journal_record)
+            + mtd->min_io_size - 1) / mtd->min_io_size * mtd->min_io_size;
+    s->slots = mtd->eb_size / s->slot_size;
+    s->buf = malloc(s->slot_size);
+
+    if (n < 2 || s->slots == 0 || s->buf == NULL) {
+        LOGE("Cannot keep the update journal in \"%s\"\n", part_name);
+        update_journal_store_close(s);
+        return -1;
+    }
+
+    LOGI("Update journal in \"%s\", erase blocks %d and %d\n", part_name,
+            s->eb[0], s->eb[1]);
+
+    return 0;
+}
+
+void update_journal_store_close(struct update_journal_store* s) {
+    free(s->buf);
+    s->buf = NULL;
+    s->part = -1;
+}
+
+/*
+ * The chip lock of the partition, the other threads may be programming
+ * the same chip
+ */
+static pthread_mutex_t* store_lock(struct update_journal_store* s) {
+    return s->bm->get_device_lock(s->bm,
+            BM_GET_PARTINFO_START(s->bm, s->part));
+}
+
+/*
+ * Reads the records of an erase block up to the first blank one, keeps
+ * the newest valid one in best and tells where the next one would go
+ */
+static int scan_block(struct update_journal_store* s, int b,
+        struct update_journal_record* best, int* found) {
+    struct mtd_dev_info* mtd = BM_GET_PARTINFO_MTD_DEV(s->bm, s->part);
+    struct update_journal_record* r = (struct update_journal_record*)s->buf;
+    int fd = *BM_GET_PARTINFO_FD(s->bm, s->part);
+    int slot;
+
+    for (slot = 0; slot < s->slots; slot++) {
+        int error = mtd_read(mtd, fd, s->eb[b], slot * s->slot_size, s->buf,
+                s->slot_size);
+
+        if (!error && memscan_is_ff(s->buf, s->slot_size))
+            break;
+
+        if (error || r->magic != UPDATE_JOURNAL_RECORD_MAGIC
+                || r->crc != record_crc(r))
+            continue;
+
+        if (!*found || (int32_t)(r->sequence - best->sequence) > 0) {
+            memcpy(best, r, sizeof(*best));
+            s->cur = b;
+            *found = 1;
+        }
+    }
+
+    return slot;
+}
+
+int update_journal_store_load(struct update_journal_store* s,
+        struct update_journal* j) {
+    struct update_journal_record best;
+    pthread_mutex_t* lock;
+    int next[2], found = 0;
+
+    assert_die_if(s == NULL, "s is NULL\n");
+    assert_die_if(j == NULL, "j is NULL\n");
+
+    if (s->part < 0)
+        return load_from_flag(j);
+
+    lock = store_lock(s);
+    pthread_mutex_lock(lock);
+    for (int b = 0; b < 2; b++)
+        next[b] = scan_block(s, b, &best, &found);
+    pthread_mutex_unlock(lock);
+
+    /*
+     * Nothing usable: the first save starts on an erased first block
+     */
+    if (!found) {
+        s->cur = 1;
+        s->slot = s->slots;
+        s->sequence = 0;
+        LOGW("No valid update journal found\n");
+        update_journal_reset(j);
+        return -1;
+    }
+
+    s->slot = next[s->cur];
+    s->sequence = best.sequence;
+
+    return update_journal_load(j, &best.journal);
+}
+
+int update_journal_store_save(struct update_journal_store* s,
+        struct update_journal* j) {
+    struct update_journal_record* r = (struct update_journal_record*)s->buf;
+    struct mtd_dev_info* mtd;
+    pthread_mutex_t* lock;
+    int fd, error = -1;
+
+    assert_die_if(s == NULL, "s is NULL\n");
+    assert_die_if(j == NULL, "j is NULL\n");
+
+    if (s->part < 0)
+        return save_to_flag(j);
+
+    mtd = BM_GET_PARTINFO_MTD_DEV(s->bm, s->part);
+    fd = *BM_GET_PARTINFO_FD(s->bm, s->part);
+
+    memset(s->buf, 0xff, s->slot_size);
+    r->magic = UPDATE_JOURNAL_RECORD_MAGIC;
+    r->sequence = s->sequence + 1;
+    memcpy(&r->journal, j, sizeof(*j));
+    r->crc = record_crc(r);
+
+    lock = store_lock(s);
+    pthread_mutex_lock(lock);
+
+    /*
+     * A record which does not program moves on to the other block, but a
+     * freshly erased block failing does not get the last good record
+     * erased in turn
+     */
+    for (;;) {
+        int fresh = s->slot >= s->slots;
+
+        if (fresh) {
+            if (mtd_erase(BM_GET_MTD_DESC(s->bm), mtd, fd, s->eb[!s->cur])) {
+                LOGE("Cannot erase update journal block %d\n",
+                        s->eb[!s->cur]);
+                break;
+            }
+            s->cur = !s->cur;
+            s->slot = 0;
+        }
+
+        if (!mtd_write(BM_GET_MTD_DESC(s->bm), mtd, fd, s->eb[s->cur],
+                s->slot * s->slot_size, s->buf, s->slot_size, NULL, 0, 0)) {
+            s->slot++;
+            s->sequence = r->sequence;
+            error = 0;
+            break;
+        }
+
+        LOGW("Cannot write update journal record at block %d page %d\n",
+                s->eb[s->cur], s->slot);
+        s->slot = s->slots;
+        if (fresh)
+            break;
+    }
+
+    pthread_mutex_unlock(lock);
+
+    if (error < 0)
+        LOGE("Cannot save update journal\n");
+
+    return error;
+}
+
+/*
+ * A fresh update starts with an empty journal, an interrupted one carries
+ * on with what it left behind
+ */
+int update_journal_restore(struct update_journal_store* s,
+        struct update_journal* j, int interrupted) {
+    if (update_journal_store_load(s, j) == 0 && interrupted)
+        return 0;
+
+    update_journal_reset(j);
+
+    return update_journal_store_save(s, j);
+}
+
+/*
+ * Partitions which cannot be continued half way are committed whole, and
+ * so are all of them when the journal is in the flag area, so that the
+ * first block of the chip is not rewritten after every package
+ */
+int update_journal_commit_package(struct update_journal_store* s,
+        struct update_journal* j, uint32_t package, int64_t part_offset,
+        int64_t write_offset, int last_in_part, int resumable) {
+    if (!last_in_part && (!resumable || s->part < 0))
+        return 0;
+
+    update_journal_commit(j, package, part_offset, write_offset);
+
+    return update_journal_store_save(s, j);
+}
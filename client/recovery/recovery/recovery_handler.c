@@ -38,6 +38,7 @@
 #include <utils/linux.h>
 #include <utils/compare_string.h>
 #include <net/net_interface.h>
+#include <net/http_client.h>
 #include <netlink/netlink_handler.h>
 #include <netlink/netlink_event.h>
 #include <utils/configure_file.h>
@@ -45,17 +46,13 @@
 #include <eeprom/eeprom_manager.h>
 #include <flash/flash_manager.h>
 #include <recovery/recovery_handler.h>
-#include <lib/md5/libmd5.h>
+#include <utils/hash.h>
 
 #define LOG_TAG "recovery_handler"
 
 #define STORAGE_MEDIUM_UDISK    0
 #define STORAGE_MEDIUM_SDCARD   1
 
-#define READ_DATA_SIZE  1024
-#define MD5_SIZE        16
-#define MD5_STR_LEN     (MD5_SIZE * 2)
-
 #define SYSCONF_MEDIA_EEPROM    0
 #define SYSCONF_MEDIA_FLASH     1
 
@@ -471,55 +468,7 @@ static bool file_exist(const char* file_path) {
 
 static bool check_file_md5(struct recovery_handler* this, const char* file_path,
         const char* md5) {
-    int fd = 0;
-    int i;
-    int retval = 0;
-    unsigned char buf[READ_DATA_SIZE] = { 0 };
-    unsigned char md5_value[MD5_SIZE] = { 0 };
-    char md5_str[MD5_STR_LEN + 1] = { 0 };
-
-    MD5_CTX md5_ctx;
-
-    fd = open(file_path, O_RDONLY);
-    if (fd < 0) {
-        LOGE("Failed to open \"%s\" for check md5: %s", file_path,
-                strerror(errno));
-        return false;
-    }
-
-    MD5Init(&md5_ctx);
-
-    for (;;) {
-        retval = read(fd, buf, sizeof(buf));
-        if (retval < 0) {
-            LOGE("Failed to read \"%s\" for check md5: %s", file_path,
-                    strerror(errno));
-            goto error;
-        }
-
-        MD5Update(&md5_ctx, buf, retval);
-
-        if (retval == 0 || retval < READ_DATA_SIZE)
-            break;
-    }
-
-    close(fd);
-
-    MD5Final(&md5_ctx, md5_value);
-
-    for (i = 0; i < MD5_SIZE; i++)
-        snprintf(md5_str + i * 2, 2 + 1, "%02x", md5_value[i]);
-
-    md5_str[MD5_STR_LEN] = '\0';
-
-    if (!strcmp(md5_str, md5))
-        return true;
-
-    return false;
-
-    error: close(fd);
-
-    return false;
+    return hash_check_file(file_path, HASH_MD5, md5) == 0;
 }
 
 static void set_flag(struct recovery_handler* this, int flag) {
@@ -896,22 +845,20 @@ static bool create_download_directory(struct recovery_handler* this,
 static bool download_file(struct recovery_handler* this, const char* src_path,
         const char* dest_path) {
     int retval = 0;
-    int timeout = 5;
-    char cmd[NAME_MAX] = { 0 };
+    struct http_client client;
 
     if (!create_download_directory(this, dest_path))
         return false;
 
     free_cached_mem();
 
-    sprintf(cmd, "wget -c %s -O %s", src_path, dest_path);
-    retval = system(cmd);
-    while (retval != 0 && timeout != 0) {
-        free_cached_mem();
-        sleep(2);
-        retval = system(cmd);
-        timeout--;
-    }
+    /*
+     * Retries, backoff and resume are done by the http client
+     */
+    construct_http_client(&client);
+    client.set_retry(&client, 5, 2000);
+    retval = client.download(&client, src_path, dest_path);
+    destruct_http_client(&client);
 
     free_cached_mem();
 
@@ -0,0 +1,126 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <utils/blocking_queue.h>
+
+void blocking_queue_init(struct blocking_queue* q, uint32_t depth,
+        uint64_t max_weight) {
+    assert_die_if(depth == 0, "depth is zero\n");
+
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    INIT_LIST_HEAD(&q->list);
+
+    q->depth = depth;
+    q->slots = 0;
+    q->max_weight = max_weight;
+    q->weight = 0;
+    q->closed = 0;
+    q->aborted = 0;
+}
+
+void blocking_queue_destroy(struct blocking_queue* q) {
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->lock);
+}
+
+/*
+ * Called by producer, blocks until there is room for one more item of
+ * the given weight. Return -1 if the queue was aborted.
+ */
+int blocking_queue_reserve(struct blocking_queue* q, uint64_t weight) {
+    int error = 0;
+
+    pthread_mutex_lock(&q->lock);
+
+    while (!q->aborted && (q->slots >= q->depth
+            || (q->weight && q->weight + weight > q->max_weight)))
+        pthread_cond_wait(&q->cond, &q->lock);
+
+    if (q->aborted) {
+        error = -1;
+
+    } else {
+        q->slots++;
+        q->weight += weight;
+    }
+
+    pthread_mutex_unlock(&q->lock);
+
+    return error;
+}
+
+void blocking_queue_push(struct blocking_queue* q, struct list_head* item) {
+    pthread_mutex_lock(&q->lock);
+
+    list_add_tail(item, &q->list);
+    pthread_cond_broadcast(&q->cond);
+
+    pthread_mutex_unlock(&q->lock);
+}
+
+/*
+ * Called by consumer, return NULL once the queue is closed and drained
+ * or aborted.
+ */
+struct list_head* blocking_queue_pop(struct blocking_queue* q) {
+    struct list_head* item = NULL;
+
+    pthread_mutex_lock(&q->lock);
+
+    while (!q->aborted && !q->closed && list_empty(&q->list))
+        pthread_cond_wait(&q->cond, &q->lock);
+
+    if (!q->aborted && !list_empty(&q->list)) {
+        item = q->list.next;
+        list_del(item);
+        q->slots--;
+        pthread_cond_broadcast(&q->cond);
+    }
+
+    pthread_mutex_unlock(&q->lock);
+
+    return item;
+}
+
+void blocking_queue_release(struct blocking_queue* q, uint64_t weight) {
+    pthread_mutex_lock(&q->lock);
+
+    q->weight -= MIN(weight, q->weight);
+    pthread_cond_broadcast(&q->cond);
+
+    pthread_mutex_unlock(&q->lock);
+}
+
+void blocking_queue_close(struct blocking_queue* q) {
+    pthread_mutex_lock(&q->lock);
+
+    q->closed = 1;
+    pthread_cond_broadcast(&q->cond);
+
+    pthread_mutex_unlock(&q->lock);
+}
+
+void blocking_queue_abort(struct blocking_queue* q) {
+    pthread_mutex_lock(&q->lock);
+
+    q->aborted = 1;
+    pthread_cond_broadcast(&q->cond);
+
+    pthread_mutex_unlock(&q->lock);
+}
@@ -14,6 +14,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <sys/time.h>
 #include <sys/types.h>
 #include <stdio.h>
@@ -26,7 +27,7 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <sys/wait.h>
+#include <pthread.h>
 #include <errno.h>
 
 #include <types.h>
@@ -34,6 +35,8 @@
 #include <utils/assert.h>
 #include <utils/file_ops.h>
 #include <utils/common.h>
+#include <utils/update_stats.h>
+#include <net/http_segmented.h>
 
 #define LOG_TAG "common"
 
@@ -44,8 +47,19 @@ struct global_data g_data = {
     .has_fb = 1,
 };
 
-static const char* prefix_wget_path = "/usr/bin/wget";
+/*
+ * Downloads running at once, any more wait for a client to be put back
+ */
+#define HTTP_CLIENTS_MAX    8
+
+static struct http_segmented* http_clients[HTTP_CLIENTS_MAX];
+static int http_client_busy[HTTP_CLIENTS_MAX];
+static int http_connections = 1;
+static pthread_mutex_t http_client_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t http_client_cond = PTHREAD_COND_INITIALIZER;
+#ifndef HOST_BUILD
 static const char* prefix_platform_xburst = "Ingenic Xburst";
+#endif
 
 static void do_cold_boot(DIR *d, int lvl) {
     struct dirent *de;
@@ -104,49 +118,131 @@ void msleep(uint64_t msec) {
     } while (err < 0 && errno == EINTR);
 }
 
+/*
+ * Each download takes an idle client of its own, so that a slow sink of
+ * one, a flash write, does not hold up the others. Idle clients keep their
+ * keep-alive connections for the next download. http_client_lock only
+ * guards the pool, never a transfer.
+ */
+static struct http_segmented* get_http_client(void) {
+    struct http_segmented* client = NULL;
+
+    pthread_mutex_lock(&http_client_lock);
+
+    while (client == NULL) {
+        for (int i = 0; i < HTTP_CLIENTS_MAX; i++) {
+            if (http_client_busy[i])
+                continue;
+
+            if (http_clients[i] == NULL)
+                http_clients[i] = _new(struct http_segmented, http_segmented);
+
+            http_client_busy[i] = 1;
+            client = http_clients[i];
+            break;
+        }
+
+        if (client == NULL)
+            pthread_cond_wait(&http_client_cond, &http_client_lock);
+    }
+
+    client->set_connections(client, http_connections);
+
+    pthread_mutex_unlock(&http_client_lock);
+
+    return client;
+}
+
+static void put_http_client(struct http_segmented* client) {
+    pthread_mutex_lock(&http_client_lock);
+
+    for (int i = 0; i < HTTP_CLIENTS_MAX; i++) {
+        if (http_clients[i] == client)
+            http_client_busy[i] = 0;
+    }
+
+    pthread_cond_signal(&http_client_cond);
+    pthread_mutex_unlock(&http_client_lock);
+}
+
+/*
+ * Accounts the bytes and retries of a download from the statistics of
+ * the connections of its client, taken before and after it
+ */
+static void account_download(struct http_segmented* client,
+        const struct http_stats* before, uint64_t start) {
+    struct http_stats after;
+
+    client->get_stats(client, &after);
+
+    update_stats_add(UPDATE_STAGE_DOWNLOAD, after.bytes - before->bytes,
+            start);
+    update_stats_count(UPDATE_COUNTER_RETRIES,
+            after.retries - before->retries);
+}
+
+/*
+ * Connections per download, applied as each client is taken
+ */
+void set_download_connections(int connections) {
+    pthread_mutex_lock(&http_client_lock);
+    http_connections = connections;
+    pthread_mutex_unlock(&http_client_lock);
+}
+
 int download_file(const char* file, const char* path) {
     assert_die_if(file == NULL, "file is NULL\n");
     assert_die_if(path == NULL, "path is NULL\n");
 
     int error = 0;
-    int status = 0;
-    pid_t pid;
-
-    if (file_executable(prefix_wget_path) < 0) {
-        LOGE("%s not execuable\n", prefix_wget_path);
+    char* target = NULL;
+    const char* name = strrchr(file, '/');
+    struct http_segmented* client;
+    struct http_stats stats;
+    uint64_t start;
+
+    name = name ? name + 1 : file;
+    if (asprintf(&target, "%s/%s", path, name) < 0)
         return -1;
-    }
 
-    pid = fork();
-    if (pid < 0) {
-        LOGE("fork() fail: %s\n", strerror(errno));
-        return -1;
-    }
+    client = get_http_client();
+    client->get_stats(client, &stats);
+    start = update_stats_now();
+    error = client->download(client, file, target);
+    account_download(client, &stats, start);
+    put_http_client(client);
 
-    if (!pid) {
-        error = execl("/usr/bin/wget", "wget", "-c", "-T", "120", "-q", file,
-                "-P", path, (char*) 0);
-        if (error < 0) {
-            LOGE("execl() fail: %s\n", strerror(errno));
-            return -1;
-        }
+    free(target);
 
-    } else {
-        while(waitpid(pid, &status, 0) < 0) {
-            if(errno != EINTR){
-                status = -1;
-                break;
-            }
-        }
-    }
+    return error;
+}
 
-    if (status)
-        return -1;
+int download_file_stream(const char* file, download_cb_t cb, void* param) {
+    assert_die_if(file == NULL, "file is NULL\n");
+    assert_die_if(cb == NULL, "cb is NULL\n");
 
-    return 0;
+    int error = 0;
+    struct http_segmented* client;
+    struct http_stats stats;
+    uint64_t start;
+
+    client = get_http_client();
+    client->get_stats(client, &stats);
+    start = update_stats_now();
+    error = client->get(client, file, cb, param);
+    account_download(client, &stats, start);
+    put_http_client(client);
+
+    return error;
 }
 
 enum system_platform_t get_system_platform(void) {
+#ifdef HOST_BUILD
+    /*
+     * The MTD emulator stands in for the NAND of an XBURST board
+     */
+    return XBURST;
+#else
     FILE* fp = NULL;
     char line[256] = {0};
 
@@ -163,6 +259,39 @@ enum system_platform_t get_system_platform(void) {
     }
 
     return UNKNOWN;
+#endif
+}
+
+uint64_t get_available_memory(void) {
+    FILE* fp = NULL;
+    char line[256] = {0};
+    unsigned long long kb = 0;
+    unsigned long long free_kb = 0;
+    unsigned long long cached_kb = 0;
+
+    fp = fopen("/proc/meminfo", "r");
+    if (fp == NULL) {
+        LOGE("Failed to open /proc/meminfo: %s\n", strerror(errno));
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1)
+            break;
+
+        sscanf(line, "MemFree: %llu kB", &free_kb);
+        sscanf(line, "Cached: %llu kB", &cached_kb);
+    }
+
+    fclose(fp);
+
+    /*
+     * Kernels older than 3.14 do not export MemAvailable
+     */
+    if (!kb)
+        kb = free_kb + cached_kb;
+
+    return kb * 1024;
 }
 
 #if 0
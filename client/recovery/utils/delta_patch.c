@@ -0,0 +1,283 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <utils/delta_patch.h>
+#include "zlib.h"
+
+#define LOG_TAG "delta_patch"
+
+enum {
+    STATE_HEADER,
+    STATE_OP,
+    STATE_ARGS,
+    STATE_DATA,
+    STATE_DONE,
+};
+
+static inline uint32_t get_le32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint16_t get_le16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+/*
+ * Collects dp->need bytes into dp->hdr, returns the bytes consumed
+ */
+static uint32_t collect(struct delta_patch* dp, const uint8_t* p,
+        uint32_t len) {
+    uint32_t n = MIN(len, dp->need - dp->hdr_len);
+
+    memcpy(dp->hdr + dp->hdr_len, p, n);
+    dp->hdr_len += n;
+
+    return n;
+}
+
+static int output(struct delta_patch* dp, const void* buf, uint32_t len) {
+    dp->crc = crc32(dp->crc, buf, len);
+    dp->out_pos += len;
+
+    return dp->output_cb(buf, len, dp->param);
+}
+
+static int check_range(struct delta_patch* dp, uint32_t len) {
+    uint64_t window_left = dp->window - dp->out_pos % dp->window;
+
+    if (dp->out_pos + len > (uint64_t)dp->out_offset + dp->out_size) {
+        LOGE("Patch overruns its chunk at 0x%" PRIx64 "\n", dp->out_pos);
+        return -1;
+    }
+
+    if (len > window_left) {
+        LOGE("Patch op crosses a window boundary at 0x%" PRIx64 "\n", dp->out_pos);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int parse_header(struct delta_patch* dp, uint32_t out_offset,
+        uint32_t out_size, uint32_t window) {
+    const uint8_t* h = dp->hdr;
+
+    if (get_le32(h) != DELTA_PATCH_MAGIC) {
+        LOGE("Bad delta patch magic 0x%x\n", get_le32(h));
+        return -1;
+    }
+
+    if (get_le16(h + 4) != DELTA_PATCH_VERSION) {
+        LOGE("Unsupported delta patch version %u\n", get_le16(h + 4));
+        return -1;
+    }
+
+    dp->out_offset = get_le32(h + 8);
+    dp->out_size = get_le32(h + 12);
+    dp->window = get_le32(h + 16);
+    dp->out_crc = get_le32(h + 20);
+
+    if (dp->out_offset != out_offset) {
+        LOGE("Patch is for offset 0x%x, expected 0x%x\n", dp->out_offset,
+                out_offset);
+        return -1;
+    }
+
+    if (dp->out_size != out_size) {
+        LOGE("Patch rebuilds %u bytes, expected %u\n", dp->out_size,
+                out_size);
+        return -1;
+    }
+
+    if (dp->window != window) {
+        LOGE("Patch built for %u bytes windows, device uses %u\n",
+                dp->window, window);
+        return -1;
+    }
+
+    dp->out_pos = dp->out_offset;
+
+    return 0;
+}
+
+static int do_copy(struct delta_patch* dp, uint32_t src, uint32_t len) {
+    if (check_range(dp, len) < 0)
+        return -1;
+
+    /*
+     * Whatever lies before the current window has been overwritten
+     */
+    if (src < dp->out_pos - dp->out_pos % dp->window) {
+        LOGE("Patch reads 0x%x, already overwritten at 0x%" PRIx64 "\n", src,
+                dp->out_pos);
+        return -1;
+    }
+
+    while (len) {
+        uint32_t n = MIN(len, DELTA_PATCH_COPY_SIZE);
+
+        if (dp->source_cb(src, dp->copybuf, n, dp->param) < 0)
+            return -1;
+
+        if (output(dp, dp->copybuf, n) < 0)
+            return -1;
+
+        src += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+int delta_patch_init(struct delta_patch* dp, uint32_t out_offset,
+        uint32_t out_size, uint32_t window, delta_source_cb_t source_cb,
+        delta_output_cb_t output_cb, void* param) {
+    assert_die_if(dp == NULL, "dp is NULL\n");
+    assert_die_if(source_cb == NULL, "source_cb is NULL\n");
+    assert_die_if(output_cb == NULL, "output_cb is NULL\n");
+    assert_die_if(window == 0, "window is 0\n");
+
+    memset(dp, 0, sizeof(*dp));
+    dp->state = STATE_HEADER;
+    dp->need = DELTA_PATCH_HEADER_SIZE;
+    dp->out_offset = out_offset;
+    dp->out_size = out_size;
+    dp->window = window;
+    dp->crc = crc32(0, Z_NULL, 0);
+    dp->source_cb = source_cb;
+    dp->output_cb = output_cb;
+    dp->param = param;
+
+    dp->copybuf = (uint8_t *) malloc(DELTA_PATCH_COPY_SIZE);
+    if (dp->copybuf == NULL) {
+        LOGE("Failed to alloc copy buffer\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int delta_patch_feed(struct delta_patch* dp, const void* buf, uint32_t len) {
+    const uint8_t* p = (const uint8_t *)buf;
+
+    while (len) {
+        uint32_t n;
+
+        switch (dp->state) {
+        case STATE_HEADER:
+            n = collect(dp, p, len);
+            if (dp->hdr_len == dp->need) {
+                if (parse_header(dp, dp->out_offset, dp->out_size,
+                        dp->window) < 0)
+                    return -1;
+
+                dp->state = STATE_OP;
+            }
+            break;
+
+        case STATE_OP:
+            n = 1;
+            dp->op = *p;
+            dp->hdr_len = 0;
+
+            if (dp->op == DELTA_OP_END) {
+                dp->state = STATE_DONE;
+            } else if (dp->op == DELTA_OP_COPY) {
+                dp->need = 8;
+                dp->state = STATE_ARGS;
+            } else if (dp->op == DELTA_OP_DATA) {
+                dp->need = 4;
+                dp->state = STATE_ARGS;
+            } else {
+                LOGE("Bad delta op %u\n", dp->op);
+                return -1;
+            }
+            break;
+
+        case STATE_ARGS:
+            n = collect(dp, p, len);
+            if (dp->hdr_len != dp->need)
+                break;
+
+            if (dp->op == DELTA_OP_COPY) {
+                if (do_copy(dp, get_le32(dp->hdr), get_le32(dp->hdr + 4)) < 0)
+                    return -1;
+
+                dp->state = STATE_OP;
+            } else {
+                dp->remain = get_le32(dp->hdr);
+                if (check_range(dp, dp->remain) < 0)
+                    return -1;
+
+                dp->state = dp->remain ? STATE_DATA : STATE_OP;
+            }
+            break;
+
+        case STATE_DATA:
+            n = MIN(len, dp->remain);
+            if (output(dp, p, n) < 0)
+                return -1;
+
+            dp->remain -= n;
+            if (!dp->remain)
+                dp->state = STATE_OP;
+            break;
+
+        default:
+            LOGE("Trailing data after the end of patch\n");
+            return -1;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+int delta_patch_finish(struct delta_patch* dp) {
+    if (dp->state != STATE_DONE) {
+        LOGE("Truncated delta patch\n");
+        return -1;
+    }
+
+    if (dp->out_pos != (uint64_t)dp->out_offset + dp->out_size) {
+        LOGE("Patch produced %" PRIu64 " bytes, expected %u\n",
+                dp->out_pos - dp->out_offset, dp->out_size);
+        return -1;
+    }
+
+    if (dp->crc != dp->out_crc) {
+        LOGE("Patched data CRC mismatch: 0x%08x != 0x%08x\n", dp->crc,
+                dp->out_crc);
+        return -1;
+    }
+
+    return 0;
+}
+
+void delta_patch_destroy(struct delta_patch* dp) {
+    free(dp->copybuf);
+    dp->copybuf = NULL;
+}
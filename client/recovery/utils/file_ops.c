@@ -27,14 +27,10 @@
 
 #include <utils/log.h>
 #include <utils/assert.h>
-#include <lib/md5/libmd5.h>
+#include <utils/hash.h>
 
 #define LOG_TAG "file_ops"
 
-#define READ_DATA_SIZE  1024
-#define MD5_SIZE        16
-#define MD5_STR_LEN     (MD5_SIZE * 2)
-
 int file_exist(const char *path) {
 
     assert_die_if(path == NULL, "path is NULL");
@@ -91,52 +87,7 @@ out:
 }
 
 int check_file_md5(const char* path, const char* md5) {
-    int fd = 0;
-    int i;
-    int retval = 0;
-    unsigned char buf[READ_DATA_SIZE] = { 0 };
-    unsigned char md5_value[MD5_SIZE] = { 0 };
-    char md5_str[MD5_STR_LEN + 1] = { 0 };
-
-    MD5_CTX md5_ctx;
-
-    fd = open(path, O_RDONLY);
-    if (fd < 0)
-        return -1;
-
-    MD5Init(&md5_ctx);
-
-    for (;;) {
-        retval = read(fd, buf, sizeof(buf));
-        if (retval < 0) {
-            LOGE("Failed to read %s: %s\n", path, strerror(errno));
-            goto error;
-        }
-
-        MD5Update(&md5_ctx, buf, retval);
-
-        if (retval == 0 || retval < READ_DATA_SIZE)
-            break;
-    }
-
-    close(fd);
-
-    MD5Final(&md5_ctx, md5_value);
-
-    for (i = 0; i < MD5_SIZE; i++)
-        snprintf(md5_str + i * 2, 2 + 1, "%02x", md5_value[i]);
-
-    md5_str[MD5_STR_LEN] = '\0';
-
-    if (!strcmp(md5_str, md5))
-        return 0;
-
-    return -1;
-
-error:
-    close(fd);
-
-    return -1;
+    return hash_check_file(path, HASH_MD5, md5);
 }
 
 
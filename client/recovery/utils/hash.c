@@ -0,0 +1,540 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <linux/if_alg.h>
+
+#include <utils/log.h>
+#include <utils/hash.h>
+
+#define LOG_TAG "hash"
+
+/*
+ * Several contexts take the data in slices that stay in cache between
+ * them, rather than each going through the whole window in turn
+ */
+#define HASH_SLICE_SIZE         (64 * 1024)
+
+/*
+ * Bytes moved per splice() of a file to a kernel context, the pipe is
+ * grown to hold them
+ */
+#define HASH_SPLICE_SIZE        (1024 * 1024)
+
+#ifndef AF_ALG
+#define AF_ALG                  38
+#endif
+
+static const char* hash_names[HASH_TYPES] = {
+    [HASH_MD5] = "md5",
+    [HASH_SHA1] = "sha1",
+    [HASH_SHA256] = "sha256",
+};
+
+static const int hash_sizes[HASH_TYPES] = {
+    [HASH_MD5] = 16,
+    [HASH_SHA1] = SHA_DIGEST_SIZE,
+    [HASH_SHA256] = SHA256_DIGEST_SIZE,
+};
+
+static int backends[HASH_TYPES];
+static int tfm_fds[HASH_TYPES] = {-1, -1, -1};
+static pthread_mutex_t tfm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int hash_digest_size(int type) {
+    if (type < 0 || type >= HASH_TYPES)
+        return -1;
+
+    return hash_sizes[type];
+}
+
+const char* hash_name(int type) {
+    if (type < 0 || type >= HASH_TYPES)
+        return "unknown";
+
+    return hash_names[type];
+}
+
+int hash_type(const char* name) {
+    for (int type = 0; type < HASH_TYPES; type++)
+        if (!strcasecmp(name, hash_names[type]))
+            return type;
+
+    return -1;
+}
+
+/*
+ * Kernel crypto API
+ *
+ * A type is bound once to an AF_ALG socket, the transform; each context
+ * accepts an operation socket of its own from it. The kernel picks the
+ * driver of highest priority for the algorithm.
+ */
+void hash_set_backend(int type, int backend) {
+    if (type < 0 || type >= HASH_TYPES)
+        return;
+
+    pthread_mutex_lock(&tfm_lock);
+    backends[type] = backend;
+    if (backend == HASH_BACKEND_SOFT && tfm_fds[type] >= 0) {
+        close(tfm_fds[type]);
+        tfm_fds[type] = -1;
+    }
+    pthread_mutex_unlock(&tfm_lock);
+}
+
+int hash_backend(int type) {
+    int backend;
+
+    if (type < 0 || type >= HASH_TYPES)
+        return HASH_BACKEND_SOFT;
+
+    pthread_mutex_lock(&tfm_lock);
+    backend = backends[type];
+    pthread_mutex_unlock(&tfm_lock);
+
+    return backend;
+}
+
+static int kernel_bind(int type) {
+    struct sockaddr_alg sa;
+    int fd;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.salg_family = AF_ALG;
+    strcpy((char *)sa.salg_type, "hash");
+    strcpy((char *)sa.salg_name, hash_names[type]);
+
+    fd = socket(AF_ALG, SOCK_SEQPACKET, 0);
+    if (fd < 0) {
+        LOGW("No AF_ALG sockets, %s in software: %s\n", hash_names[type],
+                strerror(errno));
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        LOGW("No %s in the kernel, in software: %s\n", hash_names[type],
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    return fd;
+}
+
+/*
+ * Returns an operation socket, or -1 to hash in software
+ */
+static int kernel_open(int type) {
+    int fd = -1;
+
+    pthread_mutex_lock(&tfm_lock);
+
+    if (backends[type] == HASH_BACKEND_KERNEL && tfm_fds[type] < 0) {
+        tfm_fds[type] = kernel_bind(type);
+        if (tfm_fds[type] < 0)
+            backends[type] = HASH_BACKEND_SOFT;
+    }
+
+    if (backends[type] == HASH_BACKEND_KERNEL) {
+        fd = accept(tfm_fds[type], NULL, 0);
+        if (fd < 0)
+            LOGW("Failed to open kernel %s, in software: %s\n",
+                    hash_names[type], strerror(errno));
+        else
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    pthread_mutex_unlock(&tfm_lock);
+
+    return fd;
+}
+
+/*
+ * MSG_MORE holds the kernel hash open for the next piece
+ */
+static void kernel_update(struct hash_ctx* ctx, const uint8_t* p,
+        uint32_t len) {
+    while (len && !ctx->error) {
+        ssize_t n = send(ctx->fd, p, len, MSG_MORE);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            LOGE("Failed to send to kernel %s: %s\n", hash_names[ctx->type],
+                    strerror(errno));
+            ctx->error = -1;
+            break;
+        }
+
+        p += n;
+        len -= n;
+    }
+}
+
+/*
+ * An empty send without MSG_MORE finishes the hash, an empty message
+ * included, the digest is then read
+ */
+static int kernel_final(struct hash_ctx* ctx) {
+    int size = hash_sizes[ctx->type];
+
+    if (ctx->error)
+        return -1;
+
+    if (send(ctx->fd, NULL, 0, 0) < 0
+            || read(ctx->fd, ctx->digest, size) != size) {
+        LOGE("Failed to finish kernel %s: %s\n", hash_names[ctx->type],
+                strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+void hash_destroy(struct hash_ctx* ctx) {
+    if (ctx->fd >= 0)
+        close(ctx->fd);
+    ctx->fd = -1;
+}
+
+int hash_init(struct hash_ctx* ctx, int type) {
+    ctx->type = type;
+    ctx->fd = -1;
+    ctx->error = 0;
+
+    if (type >= 0 && type < HASH_TYPES) {
+        ctx->fd = kernel_open(type);
+        if (ctx->fd >= 0)
+            return 0;
+    }
+
+    switch (type) {
+    case HASH_MD5:
+        MD5Init(&ctx->md5);
+        break;
+    case HASH_SHA1:
+        SHA_init(&ctx->sha1);
+        break;
+    case HASH_SHA256:
+        SHA256_init(&ctx->sha256);
+        break;
+    default:
+        LOGE("Unknown hash type %d\n", type);
+        return -1;
+    }
+
+    return 0;
+}
+
+void hash_update(struct hash_ctx* ctx, const void* data, uint32_t len) {
+    if (ctx->fd >= 0) {
+        kernel_update(ctx, data, len);
+        return;
+    }
+
+    switch (ctx->type) {
+    case HASH_MD5:
+        MD5Update(&ctx->md5, (unsigned char *)data, len);
+        break;
+    case HASH_SHA1:
+        SHA_update(&ctx->sha1, data, len);
+        break;
+    case HASH_SHA256:
+        SHA256_update(&ctx->sha256, data, len);
+        break;
+    }
+}
+
+const uint8_t* hash_final(struct hash_ctx* ctx) {
+    if (ctx->fd >= 0) {
+        int error = kernel_final(ctx);
+
+        hash_destroy(ctx);
+
+        return error ? NULL : ctx->digest;
+    }
+
+    switch (ctx->type) {
+    case HASH_MD5:
+        MD5Final(&ctx->md5, ctx->digest);
+        break;
+    case HASH_SHA1:
+        memcpy(ctx->digest, SHA_final(&ctx->sha1), SHA_DIGEST_SIZE);
+        break;
+    case HASH_SHA256:
+        memcpy(ctx->digest, SHA256_final(&ctx->sha256), SHA256_DIGEST_SIZE);
+        break;
+    }
+
+    return ctx->digest;
+}
+
+char* hash_to_hex(const uint8_t* digest, int len, char* str) {
+    static const char hex[] = "0123456789abcdef";
+
+    for (int i = 0; i < len; i++) {
+        str[2 * i] = hex[digest[i] >> 4];
+        str[2 * i + 1] = hex[digest[i] & 0x0f];
+    }
+    str[2 * len] = '\0';
+
+    return str;
+}
+
+static void update_all(struct hash_ctx* ctxs, int count, const uint8_t* p,
+        size_t len) {
+    if (count == 1) {
+        hash_update(ctxs, p, len);
+        return;
+    }
+
+    while (len) {
+        size_t n = len < HASH_SLICE_SIZE ? len : HASH_SLICE_SIZE;
+
+        for (int i = 0; i < count; i++)
+            hash_update(&ctxs[i], p, n);
+
+        p += n;
+        len -= n;
+    }
+}
+
+/*
+ * Advances offset and length as windows are hashed, for the rest to be
+ * read should one fail to map
+ */
+static int hash_mapped(int fd, uint64_t* offset, uint64_t* length,
+        struct hash_ctx* ctxs, int count) {
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    while (*length) {
+        uint64_t start = *offset & ~((uint64_t)page_size - 1);
+        size_t skip = *offset - start;
+        size_t n = *length < HASH_FILE_WINDOW ? *length : HASH_FILE_WINDOW;
+        void* map;
+
+        map = mmap(NULL, skip + n, PROT_READ, MAP_PRIVATE, fd, start);
+        if (map == MAP_FAILED)
+            return -1;
+
+        madvise(map, skip + n, MADV_SEQUENTIAL);
+        madvise(map, skip + n, MADV_WILLNEED);
+        update_all(ctxs, count, (const uint8_t *)map + skip, n);
+        munmap(map, skip + n);
+
+        *offset += n;
+        *length -= n;
+    }
+
+    return 0;
+}
+
+static int hash_read(int fd, uint64_t offset, uint64_t length,
+        struct hash_ctx* ctxs, int count) {
+    uint8_t* buf = malloc(HASH_FILE_BUF_SIZE);
+
+    if (buf == NULL) {
+        LOGE("Failed to alloc hash buffer\n");
+        return -1;
+    }
+
+    while (length) {
+        size_t n = length < HASH_FILE_BUF_SIZE ? length : HASH_FILE_BUF_SIZE;
+        ssize_t retval = pread(fd, buf, n, offset);
+
+        if (retval < 0 && errno == EINTR)
+            continue;
+
+        if (retval <= 0) {
+            LOGE("Failed to read at 0x%" PRIx64 ": %s\n", offset,
+                    retval ? strerror(errno) : "end of file");
+            free(buf);
+            return -1;
+        }
+
+        update_all(ctxs, count, buf, retval);
+
+        offset += retval;
+        length -= retval;
+    }
+
+    free(buf);
+
+    return 0;
+}
+
+/*
+ * The file goes to the socket of a kernel context through a pipe, no copy
+ * made on the way. Advances offset and length as it goes, for the rest to
+ * be mapped or read should the file not splice; data stuck in the pipe
+ * is an error of the context.
+ */
+static int kernel_splice(int fd, uint64_t* offset, uint64_t* length,
+        struct hash_ctx* ctx) {
+    int pipefd[2];
+    int error = 0;
+
+    if (pipe(pipefd) < 0)
+        return -1;
+
+#ifdef F_SETPIPE_SZ
+    fcntl(pipefd[1], F_SETPIPE_SZ, HASH_SPLICE_SIZE);
+#endif
+
+    while (*length) {
+        size_t n = *length < HASH_SPLICE_SIZE ? *length : HASH_SPLICE_SIZE;
+        loff_t off = *offset;
+        ssize_t in, out;
+
+        in = splice(fd, &off, pipefd[1], NULL, n, SPLICE_F_MORE);
+        if (in < 0 && errno == EINTR)
+            continue;
+
+        if (in <= 0) {
+            error = -1;
+            break;
+        }
+
+        for (ssize_t left = in; left; left -= out) {
+            out = splice(pipefd[0], NULL, ctx->fd, NULL, left, SPLICE_F_MORE);
+            if (out < 0 && errno == EINTR) {
+                out = 0;
+                continue;
+            }
+
+            if (out <= 0) {
+                LOGE("Failed to splice to kernel %s: %s\n",
+                        hash_names[ctx->type], strerror(errno));
+                ctx->error = -1;
+                error = -1;
+                goto out;
+            }
+        }
+
+        *offset += in;
+        *length -= in;
+    }
+
+out:
+    close(pipefd[0]);
+    close(pipefd[1]);
+
+    return error;
+}
+
+int hash_file(const char* path, uint64_t offset, int64_t length,
+        struct hash_ctx* ctxs, int count) {
+    struct stat st;
+    uint64_t left;
+    int error = -1;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGE("Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        LOGE("Failed to stat %s: %s\n", path, strerror(errno));
+        goto out;
+    }
+
+    if (offset > (uint64_t)st.st_size || (length >= 0
+            && (uint64_t)length > (uint64_t)st.st_size - offset)) {
+        LOGE("%s is %" PRIu64 " bytes, short of 0x%" PRIx64 " + %" PRId64 "\n", path,
+                (uint64_t)st.st_size, offset, length);
+        goto out;
+    }
+
+    left = length < 0 ? st.st_size - offset : (uint64_t)length;
+
+    posix_fadvise(fd, offset, left, POSIX_FADV_SEQUENTIAL);
+
+    /*
+     * Only regular files are mapped. One that shrinks under the map would
+     * be a SIGBUS, it could not be read to the end either way.
+     */
+    if (count == 1 && ctxs[0].fd >= 0
+            && kernel_splice(fd, &offset, &left, ctxs) == 0) {
+        error = 0;
+        goto out;
+    }
+
+    if (S_ISREG(st.st_mode)
+            && hash_mapped(fd, &offset, &left, ctxs, count) == 0) {
+        error = 0;
+        goto out;
+    }
+
+    error = hash_read(fd, offset, left, ctxs, count);
+
+out:
+    for (int i = 0; i < count; i++)
+        if (ctxs[i].error)
+            error = -1;
+
+    if (error < 0)
+        LOGE("Failed to hash %s\n", path);
+
+    close(fd);
+
+    return error;
+}
+
+int hash_check_file(const char* path, int type, const char* expected) {
+    char str[HASH_MAX_STR_LEN + 1];
+    const uint8_t* digest;
+    struct hash_ctx ctx;
+
+    if (hash_init(&ctx, type) < 0)
+        return -1;
+
+    if (hash_file(path, 0, -1, &ctx, 1) < 0) {
+        hash_destroy(&ctx);
+        return -1;
+    }
+
+    digest = hash_final(&ctx);
+    if (digest == NULL)
+        return -1;
+
+    hash_to_hex(digest, hash_digest_size(type), str);
+    if (strcasecmp(str, expected)) {
+        LOGE("%s of %s is %s, expected %s\n", hash_name(type), path, str,
+                expected);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,349 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <utils/log.h>
+#include <utils/hashtree.h>
+
+#define LOG_TAG "hashtree"
+
+#define HASHTREE_MAX_THREADS    8
+
+static const uint8_t leaf_prefix = 0x00;
+static const uint8_t node_prefix = 0x01;
+
+static inline uint32_t get_le32(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint16_t get_le16(const uint8_t* p) {
+    return p[0] | p[1] << 8;
+}
+
+static inline uint64_t get_le64(const uint8_t* p) {
+    return get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+static int parse_hex(const char* s, uint8_t* out, int len) {
+    if (s == NULL || strlen(s) != len * 2)
+        return -1;
+
+    for (int i = 0; i < len; i++) {
+        unsigned int byte;
+
+        if (sscanf(s + i * 2, "%2x", &byte) != 1)
+            return -1;
+        out[i] = byte;
+    }
+
+    return 0;
+}
+
+static void hash_leaf(const void* buf, uint32_t len, uint8_t* digest) {
+    SHA_CTX ctx;
+
+    SHA_init(&ctx);
+    SHA_update(&ctx, &leaf_prefix, 1);
+    SHA_update(&ctx, buf, len);
+    memcpy(digest, SHA_final(&ctx), SHA_DIGEST_SIZE);
+}
+
+/*
+ * Folds the leaves level by level, in place
+ */
+static void hash_root(uint8_t* level, uint32_t count, uint8_t* root) {
+    while (count > 1) {
+        uint32_t i;
+
+        for (i = 0; i < count / 2; i++) {
+            SHA_CTX ctx;
+
+            SHA_init(&ctx);
+            SHA_update(&ctx, &node_prefix, 1);
+            SHA_update(&ctx, level + 2 * i * SHA_DIGEST_SIZE,
+                    2 * SHA_DIGEST_SIZE);
+            memcpy(level + i * SHA_DIGEST_SIZE, SHA_final(&ctx),
+                    SHA_DIGEST_SIZE);
+        }
+
+        if (count & 1) {
+            memmove(level + i * SHA_DIGEST_SIZE,
+                    level + (count - 1) * SHA_DIGEST_SIZE, SHA_DIGEST_SIZE);
+            i++;
+        }
+
+        count = i;
+    }
+
+    memcpy(root, level, SHA_DIGEST_SIZE);
+}
+
+int hashtree_load(struct hashtree* ht, const char* path, const char* root,
+        uint64_t image_size) {
+    uint8_t hdr[HASHTREE_HEADER_SIZE];
+    uint8_t expected[SHA_DIGEST_SIZE];
+    uint8_t* level = NULL;
+    uint64_t leaf_count;
+    size_t leaves_size;
+    struct stat st;
+    FILE* f;
+
+    memset(ht, 0, sizeof(*ht));
+
+    if (parse_hex(root, expected, SHA_DIGEST_SIZE) < 0) {
+        LOGE("Bad hash tree root \"%s\"\n", root);
+        return -1;
+    }
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        LOGE("Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) {
+        LOGE("Failed to read hash tree header of %s\n", path);
+        goto out;
+    }
+
+    if (get_le32(hdr) != HASHTREE_MAGIC) {
+        LOGE("Bad hash tree magic 0x%x\n", get_le32(hdr));
+        goto out;
+    }
+
+    if (get_le16(hdr + 4) != HASHTREE_VERSION
+            || get_le16(hdr + 6) != HASHTREE_HASH_SHA1) {
+        LOGE("Unsupported hash tree version %u, hash %u\n",
+                get_le16(hdr + 4), get_le16(hdr + 6));
+        goto out;
+    }
+
+    ht->leaf_size = get_le32(hdr + 8);
+    ht->leaf_count = get_le32(hdr + 12);
+    ht->image_size = get_le64(hdr + 16);
+
+    if (ht->leaf_size == 0 || image_size == 0
+            || ht->image_size != image_size) {
+        LOGE("Hash tree of %s covers %" PRIu64 " bytes, the image is %" PRIu64 "\n",
+                path, ht->image_size, image_size);
+        goto out;
+    }
+
+    leaf_count = (image_size + ht->leaf_size - 1) / ht->leaf_size;
+    leaves_size = (size_t)leaf_count * SHA_DIGEST_SIZE;
+    if (ht->leaf_count != leaf_count || fstat(fileno(f), &st) < 0
+            || st.st_size != HASHTREE_HEADER_SIZE + leaves_size) {
+        LOGE("Hash tree of %s does not hold %" PRIu64 " leaves\n", path, leaf_count);
+        goto out;
+    }
+
+    ht->leaves = malloc(leaves_size);
+    level = malloc(leaves_size);
+    if (ht->leaves == NULL || level == NULL) {
+        LOGE("Failed to alloc %u leaves\n", ht->leaf_count);
+        goto out;
+    }
+
+    if (fread(ht->leaves, 1, leaves_size, f) != leaves_size) {
+        LOGE("Failed to read hash tree leaves of %s\n", path);
+        goto out;
+    }
+
+    memcpy(level, ht->leaves, leaves_size);
+    hash_root(level, ht->leaf_count, ht->root);
+    if (memcmp(ht->root, expected, SHA_DIGEST_SIZE)) {
+        LOGE("Hash tree root of %s does not match\n", path);
+        goto out;
+    }
+
+    free(level);
+    fclose(f);
+
+    return 0;
+
+out:
+    free(level);
+    hashtree_destroy(ht);
+    fclose(f);
+
+    return -1;
+}
+
+void hashtree_destroy(struct hashtree* ht) {
+    free(ht->leaves);
+    ht->leaves = NULL;
+    ht->leaf_count = 0;
+}
+
+static int verify_leaf(const struct hashtree* ht, uint32_t index,
+        const void* buf, uint32_t len) {
+    uint8_t digest[SHA_DIGEST_SIZE];
+
+    if (index >= ht->leaf_count || len != hashtree_leaf_len(ht, index)) {
+        LOGE("Leaf %u of %u bytes is out of the hash tree\n", index, len);
+        return -1;
+    }
+
+    hash_leaf(buf, len, digest);
+    if (memcmp(digest, ht->leaves + (size_t)index * SHA_DIGEST_SIZE,
+            SHA_DIGEST_SIZE)) {
+        LOGE("Leaf %u does not match its hash\n", index);
+        return -1;
+    }
+
+    return 0;
+}
+
+int hashtree_verify(const struct hashtree* ht, uint64_t offset,
+        const void* buf, uint32_t len) {
+    const uint8_t* p = (const uint8_t *)buf;
+    uint32_t index;
+
+    if (offset % ht->leaf_size) {
+        LOGE("Offset 0x%" PRIx64 " is not leaf aligned\n", offset);
+        return -1;
+    }
+
+    for (index = offset / ht->leaf_size; len; index++) {
+        uint32_t n = len < ht->leaf_size ? len : ht->leaf_size;
+
+        if (verify_leaf(ht, index, p, n) < 0)
+            return -1;
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Readback
+ *
+ * The leaves are read one at a time in order, the source may well have
+ * to (bad blocks shift everything after them), and hashed by whichever
+ * thread read them while the next one is being read.
+ */
+struct verify_job {
+    const struct hashtree* ht;
+    hashtree_read_cb_t read_cb;
+    void* param;
+    pthread_mutex_t lock;
+    uint32_t next;
+    uint32_t end;
+    int error;
+};
+
+static void* verify_task(void* param) {
+    struct verify_job* job = (struct verify_job *)param;
+    uint8_t* buf = malloc(job->ht->leaf_size);
+
+    if (buf == NULL) {
+        LOGE("Failed to alloc leaf buffer\n");
+        pthread_mutex_lock(&job->lock);
+        job->error = -1;
+        pthread_mutex_unlock(&job->lock);
+        return NULL;
+    }
+
+    for (;;) {
+        uint32_t index, len;
+        int error;
+
+        pthread_mutex_lock(&job->lock);
+        if (job->error || job->next == job->end) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+
+        index = job->next++;
+        len = hashtree_leaf_len(job->ht, index);
+        error = job->read_cb(index, buf, len, job->param);
+        if (error < 0) {
+            LOGE("Failed to read leaf %u\n", index);
+            job->error = -1;
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        pthread_mutex_unlock(&job->lock);
+
+        if (error == 0 && verify_leaf(job->ht, index, buf, len) < 0) {
+            pthread_mutex_lock(&job->lock);
+            job->error = -1;
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+    }
+
+    free(buf);
+
+    return NULL;
+}
+
+int hashtree_verify_blocks(const struct hashtree* ht, uint32_t first,
+        uint32_t count, hashtree_read_cb_t read_cb, void* param,
+        int threads) {
+    pthread_t tids[HASHTREE_MAX_THREADS];
+    struct verify_job job;
+    int started = 0;
+
+    if (first > ht->leaf_count || count > ht->leaf_count - first) {
+        LOGE("Leaves %u-%u are out of the hash tree\n", first,
+                first + count);
+        return -1;
+    }
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > HASHTREE_MAX_THREADS)
+        threads = HASHTREE_MAX_THREADS;
+    if (threads > count)
+        threads = count;
+
+    memset(&job, 0, sizeof(job));
+    job.ht = ht;
+    job.read_cb = read_cb;
+    job.param = param;
+    job.next = first;
+    job.end = first + count;
+    pthread_mutex_init(&job.lock, NULL);
+
+    /*
+     * The calling thread is one of them
+     */
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&tids[started], NULL, verify_task, &job))
+            break;
+        started++;
+    }
+
+    verify_task(&job);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    pthread_mutex_destroy(&job.lock);
+
+    return job.error;
+}
@@ -0,0 +1,80 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+
+
+#include <stdint.h>
+
+#include <utils/memscan.h>
+
+/*
+ * Words may alias the byte buffers they are read from
+ */
+typedef unsigned long __attribute__((__may_alias__)) scan_word_t;
+
+#define WORD_SIZE   sizeof(scan_word_t)
+#define WORD_FF     ((scan_word_t)~0UL)
+#define IS_ALIGNED(p)   (((uintptr_t)(p) & (WORD_SIZE - 1)) == 0)
+
+int memscan_is_ff(const void* buf, uint32_t len) {
+    const uint8_t* p = buf;
+    const scan_word_t* w;
+
+    for (; len && !IS_ALIGNED(p); p++, len--)
+        if (*p != 0xFF)
+            return 0;
+
+    for (w = (const scan_word_t*)p; len >= 4 * WORD_SIZE;
+            w += 4, len -= 4 * WORD_SIZE)
+        if ((w[0] & w[1] & w[2] & w[3]) != WORD_FF)
+            return 0;
+
+    for (; len >= WORD_SIZE; w++, len -= WORD_SIZE)
+        if (*w != WORD_FF)
+            return 0;
+
+    for (p = (const uint8_t*)w; len; p++, len--)
+        if (*p != 0xFF)
+            return 0;
+
+    return 1;
+}
+
+uint32_t memscan_strip_ff(const void* buf, uint32_t len) {
+    const uint8_t* p = buf;
+    const scan_word_t* w;
+
+    for (; len && !IS_ALIGNED(p + len); len--)
+        if (p[len - 1] != 0xFF)
+            return len;
+
+    /*
+     * Whole words from the end, the last one holding data is then
+     * looked at byte by byte
+     */
+    for (w = (const scan_word_t*)(p + len); len >= 4 * WORD_SIZE;
+            w -= 4, len -= 4 * WORD_SIZE)
+        if ((w[-1] & w[-2] & w[-3] & w[-4]) != WORD_FF)
+            break;
+
+    for (; len >= WORD_SIZE && w[-1] == WORD_FF; w--, len -= WORD_SIZE)
+        ;
+
+    while (len && p[len - 1] == 0xFF)
+        len--;
+
+    return len;
+}
@@ -14,8 +14,11 @@
  *
  */
 
+#define _GNU_SOURCE
+#include <inttypes.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <string.h>
 #include <unistd.h>
@@ -25,6 +28,7 @@
 #include <utils/minizip.h>
 #include <lib/zip/minizip/zip.h>
 #include <lib/zip/minizip/unzip.h>
+#include "zlib.h"
 
 #define WRITEBUFFERSIZE (8192)
 
@@ -198,3 +202,156 @@ int unzip(const char* path, const char* dir, const char* password,
 
     return error;
 }
+
+static int locate_entry(unzFile uf, const char* name,
+        unz_file_info64* file_info) {
+    char filename_inzip[256];
+    int error;
+
+    for (error = unzGoToFirstFile(uf); error == UNZ_OK;
+            error = unzGoToNextFile(uf)) {
+        const char* base;
+
+        error = unzGetCurrentFileInfo64(uf, file_info, filename_inzip,
+                sizeof(filename_inzip), NULL, 0, NULL, 0);
+        if (error != UNZ_OK) {
+            LOGE("error %d with zipfile in unzGetCurrentFileInfo\n", error);
+            return -1;
+        }
+
+        base = strrchr(filename_inzip, '/');
+        base = base ? base + 1 : filename_inzip;
+        if (!strcmp(base, name))
+            return 0;
+    }
+
+    return -1;
+}
+
+int unzip_entry_open(struct unzip_entry* entry, const char* path,
+        const char* name) {
+    assert_die_if(path == NULL, "path is NULL");
+    assert_die_if(name == NULL, "name is NULL");
+
+    unz_file_info64 file_info;
+    int error;
+
+    memset(entry, 0, sizeof(*entry));
+    entry->fd = -1;
+
+    entry->uf = unzOpen64(path);
+    if (entry->uf == NULL) {
+        LOGE("Failed to open %s\n", path);
+        return -1;
+    }
+
+    if (locate_entry(entry->uf, name, &file_info) < 0) {
+        LOGE("Failed to find %s in %s\n", name, path);
+        goto error;
+    }
+
+    error = unzOpenCurrentFile(entry->uf);
+    if (error != UNZ_OK) {
+        LOGE("error %d with zipfile in unzOpenCurrentFile\n", error);
+        goto error;
+    }
+
+    entry->size = file_info.uncompressed_size;
+    entry->expected_crc = file_info.crc;
+
+    /*
+     * Stored and not encrypted, the data lies as is in the zip file
+     */
+    if (file_info.compression_method == 0 && !(file_info.flag & 1)
+            && file_info.compressed_size == file_info.uncompressed_size) {
+        entry->offset = unzGetCurrentFileZStreamPos64(entry->uf);
+        entry->fd = open(path, O_RDONLY);
+        if (entry->fd < 0) {
+            LOGE("Failed to open %s: %s\n", path, strerror(errno));
+            goto error;
+        }
+
+        posix_fadvise(entry->fd, entry->offset, entry->size,
+                POSIX_FADV_SEQUENTIAL);
+        entry->crc = crc32(0L, Z_NULL, 0);
+        entry->stored = 1;
+    }
+
+    return 0;
+
+error:
+    if (entry->fd >= 0)
+        close(entry->fd);
+    unzClose(entry->uf);
+    entry->uf = NULL;
+    return -1;
+}
+
+int64_t unzip_entry_read(struct unzip_entry* entry, void* buf, uint32_t len) {
+    char* p = (char *)buf;
+    uint32_t done = 0;
+
+    if (len > entry->size - entry->pos)
+        len = entry->size - entry->pos;
+
+    while (done < len) {
+        ssize_t n;
+
+        if (entry->stored)
+            n = pread(entry->fd, p + done, len - done,
+                    entry->offset + entry->pos + done);
+        else
+            n = unzReadCurrentFile(entry->uf, p + done, len - done);
+
+        if (n < 0 && entry->stored && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            LOGE("Failed to read entry at %" PRIu64 ": %s\n", entry->pos + done,
+                    n < 0 && entry->stored ? strerror(errno) : "truncated");
+            return -1;
+        }
+
+        done += n;
+    }
+
+    if (entry->stored)
+        entry->crc = crc32(entry->crc, (const Bytef *)buf, done);
+
+    entry->pos += done;
+
+    return done;
+}
+
+int unzip_entry_close(struct unzip_entry* entry) {
+    int error = 0;
+
+    if (entry->uf == NULL)
+        return 0;
+
+    /*
+     * Inflated entries are checked by minizip once read up to the end
+     */
+    if (entry->pos == entry->size) {
+        if (entry->stored && entry->crc != entry->expected_crc) {
+            LOGE("CRC error, 0x%08x expected 0x%08x\n", entry->crc,
+                    entry->expected_crc);
+            error = -1;
+        }
+
+        if (unzCloseCurrentFile(entry->uf) != UNZ_OK) {
+            LOGE("Failed to close entry, CRC error\n");
+            error = -1;
+        }
+    } else
+        unzCloseCurrentFile(entry->uf);
+
+    if (entry->fd >= 0)
+        close(entry->fd);
+
+    unzClose(entry->uf);
+    memset(entry, 0, sizeof(*entry));
+    entry->fd = -1;
+
+    return error;
+}
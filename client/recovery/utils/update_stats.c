@@ -0,0 +1,320 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <utils/log.h>
+#include <utils/list.h>
+#include <utils/update_stats.h>
+
+#define LOG_TAG "update_stats"
+
+#define STATS_NAME_MAX  64
+
+struct stage_stats {
+    uint64_t bytes;
+    uint64_t ns;
+    uint32_t calls;
+};
+
+struct chunk_stats {
+    struct list_head head;
+    char partition[STATS_NAME_MAX];
+    char image[STATS_NAME_MAX];
+    uint32_t chunk_index;
+    struct stage_stats stages[UPDATE_STAGE_COUNT];
+    uint32_t counters[UPDATE_COUNTER_COUNT];
+};
+
+static const char* stage_names[UPDATE_STAGE_COUNT] = {
+    [UPDATE_STAGE_DOWNLOAD] = "download",
+    [UPDATE_STAGE_VERIFY] = "verify",
+    [UPDATE_STAGE_UNZIP] = "unzip",
+    [UPDATE_STAGE_READ] = "read",
+    [UPDATE_STAGE_ERASE] = "erase",
+    [UPDATE_STAGE_WRITE] = "write",
+    [UPDATE_STAGE_FINISH] = "finish",
+    [UPDATE_STAGE_FORMAT] = "format",
+};
+
+static const char* counter_names[UPDATE_COUNTER_COUNT] = {
+    [UPDATE_COUNTER_BAD_BLOCKS] = "bad_blocks",
+    [UPDATE_COUNTER_RETRIES] = "retries",
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(chunk_list);
+static struct chunk_stats update_stats;     /* outside of any chunk */
+static uint64_t start_time;
+static __thread struct chunk_stats* current;
+
+uint64_t update_stats_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline struct chunk_stats* get_current(void) {
+    return current ? current : &update_stats;
+}
+
+void update_stats_add(enum update_stage stage, uint64_t bytes, uint64_t start) {
+    uint64_t now = update_stats_now();
+
+    pthread_mutex_lock(&stats_lock);
+
+    struct stage_stats* s = &get_current()->stages[stage];
+    s->bytes += bytes;
+    s->ns += now - start;
+    s->calls++;
+
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void update_stats_count(enum update_counter counter, uint32_t n) {
+    pthread_mutex_lock(&stats_lock);
+    get_current()->counters[counter] += n;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void update_stats_begin_chunk(const char* partition, const char* image,
+        uint32_t chunk_index) {
+    struct chunk_stats* chunk;
+
+    pthread_mutex_lock(&stats_lock);
+
+    list_for_each_entry(chunk, &chunk_list, head) {
+        if (chunk->chunk_index == chunk_index
+                && !strcmp(chunk->partition, partition)
+                && !strcmp(chunk->image, image))
+            goto out;
+    }
+
+    /*
+     * Statistics are not worth failing the update for
+     */
+    chunk = (struct chunk_stats *) calloc(1, sizeof(*chunk));
+    if (chunk == NULL) {
+        LOGW("Failed to alloc chunk stats\n");
+        goto out;
+    }
+
+    snprintf(chunk->partition, sizeof(chunk->partition), "%s", partition);
+    snprintf(chunk->image, sizeof(chunk->image), "%s", image);
+    chunk->chunk_index = chunk_index;
+    list_add_tail(&chunk->head, &chunk_list);
+
+out:
+    current = chunk;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void update_stats_end_chunk(void) {
+    current = NULL;
+}
+
+void update_stats_reset(void) {
+    struct chunk_stats* chunk;
+    struct chunk_stats* next;
+
+    pthread_mutex_lock(&stats_lock);
+
+    list_for_each_entry_safe(chunk, next, &chunk_list, head) {
+        list_del(&chunk->head);
+        free(chunk);
+    }
+
+    memset(&update_stats, 0, sizeof(update_stats));
+    start_time = update_stats_now();
+
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void stats_sum(struct chunk_stats* sum, const struct chunk_stats* s) {
+    for (int i = 0; i < UPDATE_STAGE_COUNT; i++) {
+        sum->stages[i].bytes += s->stages[i].bytes;
+        sum->stages[i].ns += s->stages[i].ns;
+        sum->stages[i].calls += s->stages[i].calls;
+    }
+
+    for (int i = 0; i < UPDATE_COUNTER_COUNT; i++)
+        sum->counters[i] += s->counters[i];
+}
+
+void update_stats_get_stage(enum update_stage stage, uint64_t* bytes,
+        uint64_t* ns) {
+    struct chunk_stats total;
+    struct chunk_stats* chunk;
+
+    pthread_mutex_lock(&stats_lock);
+
+    memcpy(&total, &update_stats, sizeof(total));
+    list_for_each_entry(chunk, &chunk_list, head)
+        stats_sum(&total, chunk);
+
+    pthread_mutex_unlock(&stats_lock);
+
+    *bytes = total.stages[stage].bytes;
+    *ns = total.stages[stage].ns;
+}
+
+const char* update_stats_stage_name(enum update_stage stage) {
+    return stage_names[stage];
+}
+
+/*
+ * More members follow in the object unless last is set
+ */
+static void write_stats(FILE* fp, const struct chunk_stats* s,
+        const char* indent, int last) {
+    for (int i = 0; i < UPDATE_STAGE_COUNT; i++) {
+        const struct stage_stats* stage = &s->stages[i];
+        double mbps = 0;
+
+        if (stage->ns)
+            mbps = stage->bytes * 1e9 / stage->ns / (1024 * 1024);
+
+        fprintf(fp, "%s\"%s\": {\"bytes\": %llu, \"ms\": %.3f, "
+                "\"calls\": %u, \"mbps\": %.2f},\n", indent, stage_names[i],
+                (unsigned long long) stage->bytes, stage->ns / 1e6,
+                stage->calls, mbps);
+    }
+
+    for (int i = 0; i < UPDATE_COUNTER_COUNT; i++)
+        fprintf(fp, "%s\"%s\": %u%s\n", indent, counter_names[i],
+                s->counters[i], (last && i + 1 == UPDATE_COUNTER_COUNT) ? "" : ",");
+}
+
+/*
+ * Names come from the package, escape what would end or break the string
+ */
+static void write_string(FILE* fp, const char* str) {
+    fputc('"', fp);
+
+    for (const unsigned char* p = (const unsigned char *) str; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            fprintf(fp, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(fp, "\\u%04x", *p);
+        else
+            fputc(*p, fp);
+    }
+
+    fputc('"', fp);
+}
+
+static int is_first_of_partition(struct chunk_stats* chunk) {
+    struct chunk_stats* prev;
+
+    list_for_each_entry(prev, &chunk_list, head) {
+        if (prev == chunk)
+            return 1;
+
+        if (!strcmp(prev->partition, chunk->partition))
+            return 0;
+    }
+
+    return 1;
+}
+
+static void write_partition(FILE* fp, struct chunk_stats* first) {
+    struct chunk_stats total;
+    struct chunk_stats* chunk;
+    int n = 0;
+
+    memset(&total, 0, sizeof(total));
+
+    chunk = first;
+    list_for_each_entry_from(chunk, &chunk_list, head) {
+        if (!strcmp(chunk->partition, first->partition))
+            stats_sum(&total, chunk);
+    }
+
+    fprintf(fp, "    {\n      \"name\": ");
+    write_string(fp, first->partition);
+    fprintf(fp, ",\n");
+    write_stats(fp, &total, "      ", 0);
+    fprintf(fp, "      \"chunks\": [\n");
+
+    chunk = first;
+    list_for_each_entry_from(chunk, &chunk_list, head) {
+        if (strcmp(chunk->partition, first->partition))
+            continue;
+
+        fprintf(fp, "%s        {\n          \"image\": ", n++ ? ",\n" : "");
+        write_string(fp, chunk->image);
+        fprintf(fp, ",\n          \"chunk\": %u,\n", chunk->chunk_index);
+        write_stats(fp, chunk, "          ", 1);
+        fprintf(fp, "        }");
+    }
+
+    fprintf(fp, "\n      ]\n    }");
+}
+
+int update_stats_write(const char* path, int error) {
+    struct chunk_stats total;
+    struct chunk_stats* chunk;
+    uint64_t elapsed;
+    FILE* fp;
+    int n = 0;
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        LOGE("Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    pthread_mutex_lock(&stats_lock);
+
+    elapsed = update_stats_now() - start_time;
+
+    memcpy(&total, &update_stats, sizeof(total));
+    list_for_each_entry(chunk, &chunk_list, head)
+        stats_sum(&total, chunk);
+
+    fprintf(fp, "{\n  \"result\": \"%s\",\n  \"elapsed_ms\": %.3f,\n",
+            error ? "failure" : "success", elapsed / 1e6);
+    write_stats(fp, &total, "  ", 0);
+    fprintf(fp, "  \"partitions\": [\n");
+
+    list_for_each_entry(chunk, &chunk_list, head) {
+        if (!is_first_of_partition(chunk))
+            continue;
+
+        if (n++)
+            fprintf(fp, ",\n");
+        write_partition(fp, chunk);
+    }
+
+    fprintf(fp, "\n  ]\n}\n");
+
+    pthread_mutex_unlock(&stats_lock);
+
+    if (fclose(fp) < 0) {
+        LOGE("Failed to write %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    LOGI("Update statistics written to %s\n", path);
+
+    return 0;
+}
@@ -23,19 +23,135 @@
 #include <types.h>
 #include <utils/log.h>
 #include <utils/verifier.h>
+#include <utils/hash.h>
 #include "mincrypt/rsa.h"
 #include "mincrypt/sha.h"
+#include "mincrypt/sha256.h"
 
 #define LOG_TAG "verifier"
 
+#define FOOTER_SIZE 6
+#define EOCD_HEADER_SIZE 22
+
+// Check that the end-of-central-directory record (including the
+// archive comment) is a well formed whole-file signature footer,
+// before anything is hashed.
+//
+// Return VERIFY_SUCCESS, VERIFY_FAILURE (if the record is malformed).
+
+static int verify_eocd(const unsigned char* eocd, size_t eocd_size) {
+    if (eocd_size < EOCD_HEADER_SIZE + FOOTER_SIZE) {
+        LOGE("eocd record is too short\n");
+        return VERIFY_FAILURE;
+    }
+
+    const unsigned char* footer = eocd + eocd_size - FOOTER_SIZE;
+    if (footer[2] != 0xff || footer[3] != 0xff)
+        return VERIFY_FAILURE;
+
+    size_t comment_size = footer[4] + (footer[5] << 8);
+    size_t signature_start = footer[0] + (footer[1] << 8);
+    LOGD("comment is %zu bytes; signature %zu bytes from end\n",
+         comment_size, signature_start);
+
+    if (comment_size + EOCD_HEADER_SIZE != eocd_size) {
+        LOGE("comment size doesn't match EOCD record size\n");
+        return VERIFY_FAILURE;
+    }
+
+    if (signature_start - FOOTER_SIZE < RSANUMBYTES) {
+        // "signature" block isn't big enough to contain an RSA block.
+        LOGE("signature is too short\n");
+        return VERIFY_FAILURE;
+    }
+
+    // If this is really is the EOCD record, it will begin with the
+    // magic number $50 $4b $05 $06.
+    if (eocd[0] != 0x50 || eocd[1] != 0x4b ||
+        eocd[2] != 0x05 || eocd[3] != 0x06) {
+        LOGE("signature length doesn't match EOCD marker\n");
+        return VERIFY_FAILURE;
+    }
+
+    size_t i;
+    for (i = 4; i < eocd_size-3; ++i) {
+        if (eocd[i  ] == 0x50 && eocd[i+1] == 0x4b &&
+            eocd[i+2] == 0x05 && eocd[i+3] == 0x06) {
+            // if the sequence $50 $4b $05 $06 appears anywhere after
+            // the real one, minzip will find the later (wrong) one,
+            // which could be exploitable.  Fail verification if
+            // this sequence occurs anywhere after the real one.
+            LOGE("EOCD marker occurs after start of EOCD\n");
+            return VERIFY_FAILURE;
+        }
+    }
+
+    return VERIFY_SUCCESS;
+}
+
+// Check that the end-of-central-directory record is well formed and
+// that the RSA signature in it matches the SHA-1 or SHA-256 of the
+// signed part of the archive, whichever the key is for, against one
+// of the public keys.
+//
+// Return VERIFY_SUCCESS, VERIFY_FAILURE (if any error is encountered
+// or no key matches the signature).
+
+int verify_eocd_signature(const unsigned char* eocd, size_t eocd_size,
+        const uint8_t* sha1, const uint8_t* sha256, const Certificate *pKeys,
+        unsigned int numKeys) {
+    size_t i;
+
+    if (verify_eocd(eocd, eocd_size) != VERIFY_SUCCESS)
+        return VERIFY_FAILURE;
+
+    for (i = 0; i < numKeys; ++i) {
+        const uint8_t* hash = pKeys[i].hash_len == SHA256_DIGEST_SIZE
+                ? sha256 : sha1;
+
+        if (hash == NULL) {
+            LOGE("no hash of %d bytes for key %zu\n", pKeys[i].hash_len, i);
+            continue;
+        }
+
+        // The 6 bytes is the "(signature_start) $ff $ff (comment_size)" that
+        // the signing tool appends after the signature itself.
+        if (RSA_verify(&pKeys[i].public_key,
+                       eocd + eocd_size - 6 - RSANUMBYTES, RSANUMBYTES,
+                       hash, pKeys[i].hash_len)) {
+            LOGD("whole-file signature verified against key %zu\n", i);
+            return VERIFY_SUCCESS;
+        } else {
+            LOGE("failed to verify against key %zu\n", i);
+        }
+    }
+    LOGE("failed to verify whole-file signature\n");
+    return VERIFY_FAILURE;
+}
+
+// The hashes whole-file signatures must be checked against for the
+// given keys, as HASH_MASK() bits.
+
+int keys_hash_mask(const Certificate *pKeys, unsigned int numKeys) {
+    int mask = 0;
+    unsigned int i;
+
+    for (i = 0; i < numKeys; ++i)
+        mask |= HASH_MASK(pKeys[i].hash_len == SHA256_DIGEST_SIZE
+                ? HASH_SHA256 : HASH_SHA1);
+
+    return mask;
+}
+
 // Look for an RSA signature embedded in the .ZIP file comment given
 // the path to the zip.  Verify it matches one of the given public
-// keys.
+// keys. The signed part is hashed in one pass through mmap() windows,
+// with only the hashes the keys need.
 //
 // Return VERIFY_SUCCESS, VERIFY_FAILURE (if any error is encountered
 // or no key matches the signature).
 
-int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKeys) {
+int verify_file(const char* path, const Certificate *pKeys, unsigned int numKeys) {
     FILE* f = fopen(path, "rb");
     if (f == NULL) {
         LOGE("failed to open %s (%s)\n", path, strerror(errno));
@@ -51,8 +167,6 @@ int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKey
     // us how far back from the end we have to start reading to find
     // the whole comment.
 
-#define FOOTER_SIZE 6
-
     if (fseek(f, -FOOTER_SIZE, SEEK_END) != 0) {
         LOGE("failed to seek in %s (%s)\n", path, strerror(errno));
         fclose(f);
@@ -72,18 +186,6 @@ int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKey
     }
 
     size_t comment_size = footer[4] + (footer[5] << 8);
-    size_t signature_start = footer[0] + (footer[1] << 8);
-    LOGD("comment is %d bytes; signature %d bytes from end\n",
-         comment_size, signature_start);
-
-    if (signature_start - FOOTER_SIZE < RSANUMBYTES) {
-        // "signature" block isn't big enough to contain an RSA block.
-        LOGE("signature is too short\n");
-        fclose(f);
-        return VERIFY_FAILURE;
-    }
-
-#define EOCD_HEADER_SIZE 22
 
     // The end-of-central-directory record is 22 bytes plus any
     // comment length.
@@ -109,81 +211,50 @@ int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKey
     }
     if (fread(eocd, 1, eocd_size, f) != eocd_size) {
         LOGE("failed to read eocd from %s (%s)\n", path, strerror(errno));
+        free(eocd);
         fclose(f);
         return VERIFY_FAILURE;
     }
 
-    // If this is really is the EOCD record, it will begin with the
-    // magic number $50 $4b $05 $06.
-    if (eocd[0] != 0x50 || eocd[1] != 0x4b ||
-        eocd[2] != 0x05 || eocd[3] != 0x06) {
-        LOGE("signature length doesn't match EOCD marker\n");
-        fclose(f);
-        return VERIFY_FAILURE;
-    }
+    fclose(f);
 
-    size_t i;
-    for (i = 4; i < eocd_size-3; ++i) {
-        if (eocd[i  ] == 0x50 && eocd[i+1] == 0x4b &&
-            eocd[i+2] == 0x05 && eocd[i+3] == 0x06) {
-            // if the sequence $50 $4b $05 $06 appears anywhere after
-            // the real one, minzip will find the later (wrong) one,
-            // which could be exploitable.  Fail verification if
-            // this sequence occurs anywhere after the real one.
-            LOGE("EOCD marker occurs after start of EOCD\n");
-            fclose(f);
-            return VERIFY_FAILURE;
-        }
+    // Reject a malformed record before the whole file is hashed
+    if (verify_eocd(eocd, eocd_size) != VERIFY_SUCCESS) {
+        free(eocd);
+        return VERIFY_FAILURE;
     }
 
-#define BUFFER_SIZE 4096
-
-    SHA_CTX ctx;
-    SHA_init(&ctx);
-    unsigned char* buffer = (unsigned char*)malloc(BUFFER_SIZE);
-    if (buffer == NULL) {
-        LOGE("failed to alloc memory for sha1 buffer\n");
-        fclose(f);
+    struct hash_ctx ctxs[2];
+    const uint8_t* sha1 = NULL;
+    const uint8_t* sha256 = NULL;
+    int mask = keys_hash_mask(pKeys, numKeys);
+    int count = 0;
+
+    if (mask & HASH_MASK(HASH_SHA1))
+        hash_init(&ctxs[count++], HASH_SHA1);
+    if (mask & HASH_MASK(HASH_SHA256))
+        hash_init(&ctxs[count++], HASH_SHA256);
+
+    if (hash_file(path, 0, signed_len, ctxs, count) < 0) {
+        LOGE("failed to hash %s\n", path);
+        for (int i = 0; i < count; i++)
+            hash_destroy(&ctxs[i]);
+        free(eocd);
         return VERIFY_FAILURE;
     }
 
-    double frac = -1.0;
-    size_t so_far = 0;
-    fseek(f, 0, SEEK_SET);
-    while (so_far < signed_len) {
-        size_t size = BUFFER_SIZE;
-        if (signed_len - so_far < size) size = signed_len - so_far;
-        if (fread(buffer, 1, size, f) != size) {
-            LOGE("failed to read data from %s (%s)\n", path, strerror(errno));
-            fclose(f);
-            return VERIFY_FAILURE;
-        }
-        SHA_update(&ctx, buffer, size);
-        so_far += size;
-        double f = so_far / (double)signed_len;
-        if (f > frac + 0.02 || size == so_far) {
-            frac = f;
-        }
+    for (int i = 0; i < count; i++) {
+        if (ctxs[i].type == HASH_SHA1)
+            sha1 = hash_final(&ctxs[i]);
+        else
+            sha256 = hash_final(&ctxs[i]);
     }
-    fclose(f);
-    free(buffer);
 
-    const uint8_t* sha1 = SHA_final(&ctx);
-    for (i = 0; i < numKeys; ++i) {
-        // The 6 bytes is the "(signature_start) $ff $ff (comment_size)" that
-        // the signing tool appends after the signature itself.
-        if (RSA_verify(pKeys+i, eocd + eocd_size - 6 - RSANUMBYTES,
-                       RSANUMBYTES, sha1)) {
-            LOGD("whole-file signature verified against key %d\n", i);
-            free(eocd);
-            return VERIFY_SUCCESS;
-        } else {
-            LOGE("failed to verify against key %d\n", i);
-        }
-    }
+    int error = verify_eocd_signature(eocd, eocd_size, sha1, sha256,
+            pKeys, numKeys);
     free(eocd);
-    LOGE("failed to verify whole-file signature\n");
-    return VERIFY_FAILURE;
+
+    return error;
 }
 
 // Reads a file containing one or more public keys as produced by
@@ -198,6 +269,9 @@ int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKey
 //
 //  "v2 {64,0xc926ad21,{1795090719,...,-695002876},{-857949815,...,1175080310}}"
 //
+// v2 keys are e=65537, v3 and v4 keys are e=3 and e=65537 keys whose
+// signatures are made over SHA-256 rather than SHA-1.
+//
 // (Note that the braces and commas in this example are actual
 // characters the parser expects to find in the file; the ellipses
 // indicate more numbers omitted from this example.)
@@ -206,9 +280,9 @@ int verify_file(const char* path, const RSAPublicKey *pKeys, unsigned int numKey
 // commas.  The last key must not be followed by a comma.
 //
 // Returns NULL if the file failed to parse, or if it contain zero keys.
-RSAPublicKey*
+Certificate*
 load_keys(const char* filename, int* numKeys) {
-    RSAPublicKey* out = NULL;
+    Certificate* out = NULL;
     *numKeys = 0;
 
     FILE* f = fopen(filename, "r");
@@ -222,19 +296,28 @@ load_keys(const char* filename, int* numKeys) {
         bool done = false;
         while (!done) {
             ++*numKeys;
-            out = (RSAPublicKey*)realloc(out, *numKeys * sizeof(RSAPublicKey));
-            RSAPublicKey* key = out + (*numKeys - 1);
+            out = (Certificate*)realloc(out, *numKeys * sizeof(Certificate));
+            Certificate* cert = out + (*numKeys - 1);
+            RSAPublicKey* key = &cert->public_key;
 
             char start_char;
             if (fscanf(f, " %c", &start_char) != 1) goto exit;
             if (start_char == '{') {
                 // a version 1 key has no version specifier.
                 key->exponent = 3;
+                cert->hash_len = SHA_DIGEST_SIZE;
             } else if (start_char == 'v') {
                 int version;
                 if (fscanf(f, "%d {", &version) != 1) goto exit;
                 if (version == 2) {
                     key->exponent = 65537;
+                    cert->hash_len = SHA_DIGEST_SIZE;
+                } else if (version == 3) {
+                    key->exponent = 3;
+                    cert->hash_len = SHA256_DIGEST_SIZE;
+                } else if (version == 4) {
+                    key->exponent = 65537;
+                    cert->hash_len = SHA256_DIGEST_SIZE;
                 } else {
                     goto exit;
                 }
@@ -272,7 +355,7 @@ load_keys(const char* filename, int* numKeys) {
                 goto exit;
             }
 
-            LOGD("read key e=%d\n", key->exponent);
+            LOGD("read key e=%d hash=%d\n", key->exponent, cert->hash_len);
         }
     }
 
@@ -0,0 +1,556 @@
+/*
+ *  Copyright (C) 2016, Zhang YanMing <jamincheung@126.com>
+ *
+ *  Linux recovery updater
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under  the terms of the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the License, or (at your
+ *  option) any later version.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <utils/log.h>
+#include <utils/assert.h>
+#include <utils/common.h>
+#include <utils/verifier.h>
+#include <utils/zip_stream.h>
+
+#define LOG_TAG "zip_stream"
+
+#define ZIP_LOCAL_HEADER_SIG        0x04034b50
+#define ZIP_CENTRAL_HEADER_SIG      0x02014b50
+#define ZIP_EOCD_SIG                0x06054b50
+#define ZIP_DATA_DESCRIPTOR_SIG     0x08074b50
+
+#define ZIP_FLAG_ENCRYPTED          (1 << 0)
+#define ZIP_FLAG_DATA_DESCRIPTOR    (1 << 3)
+
+#define ZIP_METHOD_STORED           0
+#define ZIP_METHOD_DEFLATED         8
+
+/*
+ * Sizes of the fixed records following their 4 bytes signature
+ */
+#define ZIP_LOCAL_HEADER_SIZE       26
+#define ZIP_CENTRAL_HEADER_SIZE     42
+#define ZIP_EOCD_SIZE               18
+
+/*
+ * The whole-file signature covers the EOCD record except for the
+ * comment length field and the comment itself
+ */
+#define ZIP_EOCD_SIGNED_SIZE        (ZIP_EOCD_SIZE - 2)
+
+enum {
+    ZS_SIGNATURE,
+    ZS_LOCAL_HEADER,
+    ZS_NAME,
+    ZS_SKIP_EXTRA,
+    ZS_STORED,
+    ZS_DEFLATED,
+    ZS_DESCRIPTOR,
+    ZS_CENTRAL_HEADER,
+    ZS_SKIP_CENTRAL,
+    ZS_EOCD,
+    ZS_COMMENT,
+    ZS_DONE,
+};
+
+static inline uint16_t get_le16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_le32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void hash(struct zip_stream* zs, const uint8_t* p,
+        uint32_t len) {
+    for (int i = 0; i < zs->nhashes; i++)
+        hash_update(&zs->hashes[i], p, len);
+}
+
+static inline void consume(struct zip_stream* zs, const uint8_t* p,
+        uint32_t len) {
+    if (zs->hashing)
+        hash(zs, p, len);
+
+    zs->consumed += len;
+}
+
+static inline void expect(struct zip_stream* zs, int state, uint32_t need) {
+    zs->state = state;
+    zs->hdr_len = 0;
+    zs->need = need;
+}
+
+/*
+ * Accumulate zs->need bytes into zs->hdr, return 1 once complete
+ */
+static int collect(struct zip_stream* zs, const uint8_t** p, uint32_t* len) {
+    uint32_t n = MIN(*len, zs->need - zs->hdr_len);
+
+    memcpy(zs->hdr + zs->hdr_len, *p, n);
+    consume(zs, *p, n);
+
+    zs->hdr_len += n;
+    *p += n;
+    *len -= n;
+
+    return zs->hdr_len == zs->need;
+}
+
+/*
+ * Drop zs->skip bytes, return 1 once all of them are gone
+ */
+static int discard(struct zip_stream* zs, const uint8_t** p, uint32_t* len) {
+    uint32_t n = MIN(*len, zs->skip);
+
+    consume(zs, *p, n);
+
+    zs->skip -= n;
+    *p += n;
+    *len -= n;
+
+    return zs->skip == 0;
+}
+
+static int deliver(struct zip_stream* zs, const void* buf, uint32_t len) {
+    if (!len)
+        return 0;
+
+    zs->crc_calc = crc32(zs->crc_calc, buf, len);
+    zs->usize_calc += len;
+
+    if (zs->wanted && zs->data_cb(zs, buf, len, zs->param) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int check_entry(struct zip_stream* zs, uint32_t crc, uint32_t usize) {
+    if (zs->crc_calc != crc || zs->usize_calc != usize) {
+        LOGE("Entry %s corrupted: crc 0x%08x/0x%08x, size %u/%u\n", zs->name,
+                zs->crc_calc, crc, zs->usize_calc, usize);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int end_entry(struct zip_stream* zs) {
+    if (zs->flag & ZIP_FLAG_DATA_DESCRIPTOR) {
+        expect(zs, ZS_DESCRIPTOR, 4);
+        return 0;
+    }
+
+    if (check_entry(zs, zs->crc, zs->usize) < 0)
+        return -1;
+
+    expect(zs, ZS_SIGNATURE, 4);
+
+    return 0;
+}
+
+static int begin_entry(struct zip_stream* zs) {
+    if (zs->flag & ZIP_FLAG_ENCRYPTED) {
+        LOGE("Encrypted entry %s is not supported\n", zs->name);
+        return -1;
+    }
+
+    if (zs->csize == 0xffffffff || zs->usize == 0xffffffff) {
+        LOGE("Zip64 entry %s is not supported\n", zs->name);
+        return -1;
+    }
+
+    zs->wanted = zs->entry_cb ? zs->entry_cb(zs, zs->name, zs->param) : 0;
+    if (zs->wanted < 0)
+        return -1;
+
+    zs->crc_calc = crc32(0L, Z_NULL, 0);
+    zs->usize_calc = 0;
+    zs->remain = zs->csize;
+    zs->entries++;
+
+    if (zs->method == ZIP_METHOD_STORED) {
+        if (zs->flag & ZIP_FLAG_DATA_DESCRIPTOR) {
+            LOGE("Stored entry %s without size is not supported\n", zs->name);
+            return -1;
+        }
+
+        zs->state = ZS_STORED;
+        if (!zs->remain)
+            return end_entry(zs);
+
+    } else if (zs->method == ZIP_METHOD_DEFLATED) {
+        if (inflateReset(&zs->strm) != Z_OK) {
+            LOGE("Failed to reset inflate stream\n");
+            return -1;
+        }
+
+        zs->state = ZS_DEFLATED;
+
+    } else {
+        LOGE("Unsupported compress method %d of %s\n", zs->method, zs->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int do_stored(struct zip_stream* zs, const uint8_t** p,
+        uint32_t* len) {
+    uint32_t n = MIN(*len, zs->remain);
+
+    consume(zs, *p, n);
+    if (deliver(zs, *p, n) < 0)
+        return -1;
+
+    zs->remain -= n;
+    *p += n;
+    *len -= n;
+
+    if (!zs->remain)
+        return end_entry(zs);
+
+    return 0;
+}
+
+static int do_deflated(struct zip_stream* zs, const uint8_t** p,
+        uint32_t* len) {
+    int has_size = !(zs->flag & ZIP_FLAG_DATA_DESCRIPTOR);
+    uint32_t in_len = has_size ? MIN(*len, zs->remain) : *len;
+    int ret = Z_OK;
+
+    zs->strm.next_in = (Bytef *)*p;
+    zs->strm.avail_in = in_len;
+
+    do {
+        zs->strm.next_out = zs->outbuf;
+        zs->strm.avail_out = ZIP_STREAM_OUTBUF_SIZE;
+
+        ret = inflate(&zs->strm, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            LOGE("Failed to inflate %s: %d\n", zs->name, ret);
+            return -1;
+        }
+
+        if (deliver(zs, zs->outbuf,
+                ZIP_STREAM_OUTBUF_SIZE - zs->strm.avail_out) < 0)
+            return -1;
+
+    } while (ret != Z_STREAM_END
+            && (zs->strm.avail_in || !zs->strm.avail_out));
+
+    uint32_t used = in_len - zs->strm.avail_in;
+
+    consume(zs, *p, used);
+    *p += used;
+    *len -= used;
+    if (has_size)
+        zs->remain -= used;
+
+    if (ret == Z_STREAM_END) {
+        if (has_size && zs->remain) {
+            LOGE("Entry %s has %u trailing bytes\n", zs->name, zs->remain);
+            return -1;
+        }
+
+        return end_entry(zs);
+    }
+
+    if (has_size && !zs->remain) {
+        LOGE("Entry %s is truncated\n", zs->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int do_header(struct zip_stream* zs) {
+    const uint8_t* h = zs->hdr;
+
+    switch (zs->state) {
+    case ZS_SIGNATURE:
+        switch (get_le32(h)) {
+        case ZIP_LOCAL_HEADER_SIG:
+            expect(zs, ZS_LOCAL_HEADER, ZIP_LOCAL_HEADER_SIZE);
+            break;
+
+        case ZIP_CENTRAL_HEADER_SIG:
+            expect(zs, ZS_CENTRAL_HEADER, ZIP_CENTRAL_HEADER_SIZE);
+            break;
+
+        case ZIP_EOCD_SIG:
+            /*
+             * Hash the signed part of the record by hand
+             */
+            zs->hashing = 0;
+            expect(zs, ZS_EOCD, ZIP_EOCD_SIZE);
+            break;
+
+        default:
+            LOGE("Bad zip record signature 0x%08x at %" PRIu64 "\n", get_le32(h),
+                    zs->consumed - 4);
+            return -1;
+        }
+        break;
+
+    case ZS_LOCAL_HEADER:
+        zs->flag = get_le16(h + 2);
+        zs->method = get_le16(h + 4);
+        zs->crc = get_le32(h + 10);
+        zs->csize = get_le32(h + 14);
+        zs->usize = get_le32(h + 18);
+        zs->name_len = get_le16(h + 22);
+        zs->skip = get_le16(h + 24);
+
+        if (zs->name_len >= ZIP_STREAM_NAME_MAX) {
+            LOGE("Entry name is too long: %u\n", zs->name_len);
+            return -1;
+        }
+
+        memset(zs->name, 0, sizeof(zs->name));
+        expect(zs, ZS_NAME, zs->name_len);
+        break;
+
+    case ZS_NAME:
+        memcpy(zs->name, zs->hdr, zs->name_len);
+        zs->state = ZS_SKIP_EXTRA;
+        break;
+
+    case ZS_DESCRIPTOR:
+        if (zs->need == 4) {
+            /*
+             * The descriptor signature is optional, without it the
+             * four bytes just read are already the crc
+             */
+            if (get_le32(h) == ZIP_DATA_DESCRIPTOR_SIG)
+                expect(zs, ZS_DESCRIPTOR, 12);
+            else
+                zs->need = 12;
+            break;
+        }
+
+        if (check_entry(zs, get_le32(h), get_le32(h + 8)) < 0)
+            return -1;
+
+        expect(zs, ZS_SIGNATURE, 4);
+        break;
+
+    case ZS_CENTRAL_HEADER:
+        zs->skip = get_le16(h + 24) + get_le16(h + 26) + get_le16(h + 28);
+        zs->state = ZS_SKIP_CENTRAL;
+        break;
+
+    case ZS_EOCD: {
+        uint32_t comment_len = get_le16(h + ZIP_EOCD_SIGNED_SIZE);
+
+        hash(zs, h, ZIP_EOCD_SIGNED_SIZE);
+
+        zs->eocd_size = 4 + ZIP_EOCD_SIZE + comment_len;
+        zs->eocd = (uint8_t *) malloc(zs->eocd_size);
+        if (zs->eocd == NULL) {
+            LOGE("Failed to alloc eocd record: %s\n", strerror(errno));
+            return -1;
+        }
+
+        zs->eocd[0] = 0x50;
+        zs->eocd[1] = 0x4b;
+        zs->eocd[2] = 0x05;
+        zs->eocd[3] = 0x06;
+        memcpy(zs->eocd + 4, h, ZIP_EOCD_SIZE);
+
+        zs->skip = comment_len;
+        zs->state = comment_len ? ZS_COMMENT : ZS_DONE;
+        break;
+    }
+
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+int zip_stream_feed(struct zip_stream* zs, const void* buf, uint32_t len) {
+    const uint8_t* p = (const uint8_t *)buf;
+
+    while (len) {
+        switch (zs->state) {
+        case ZS_SIGNATURE:
+        case ZS_LOCAL_HEADER:
+        case ZS_NAME:
+        case ZS_DESCRIPTOR:
+        case ZS_CENTRAL_HEADER:
+        case ZS_EOCD:
+            if (collect(zs, &p, &len) && do_header(zs) < 0)
+                return -1;
+            break;
+
+        case ZS_SKIP_EXTRA:
+            if (discard(zs, &p, &len) && begin_entry(zs) < 0)
+                return -1;
+            break;
+
+        case ZS_SKIP_CENTRAL:
+            if (discard(zs, &p, &len))
+                expect(zs, ZS_SIGNATURE, 4);
+            break;
+
+        case ZS_STORED:
+            if (do_stored(zs, &p, &len) < 0)
+                return -1;
+            break;
+
+        case ZS_DEFLATED:
+            if (do_deflated(zs, &p, &len) < 0)
+                return -1;
+            break;
+
+        case ZS_COMMENT: {
+            uint32_t off = zs->eocd_size - zs->skip;
+            uint32_t n = MIN(len, zs->skip);
+
+            memcpy(zs->eocd + off, p, n);
+            discard(zs, &p, &len);
+            if (!zs->skip)
+                zs->state = ZS_DONE;
+            break;
+        }
+
+        case ZS_DONE:
+            LOGE("Trailing garbage after end of archive\n");
+            return -1;
+
+        default:
+            return -1;
+        }
+
+        /*
+         * Empty names/extras complete without consuming anything
+         */
+        if (zs->state == ZS_NAME && zs->need == 0 && do_header(zs) < 0)
+            return -1;
+
+        if (zs->state == ZS_SKIP_EXTRA && zs->skip == 0
+                && begin_entry(zs) < 0)
+            return -1;
+
+        if (zs->state == ZS_SKIP_CENTRAL && zs->skip == 0)
+            expect(zs, ZS_SIGNATURE, 4);
+    }
+
+    return 0;
+}
+
+int zip_stream_finish(struct zip_stream* zs) {
+    if (zs->state != ZS_DONE) {
+        LOGE("Archive is truncated after %" PRIu64 " bytes\n", zs->consumed);
+        return -1;
+    }
+
+    for (int i = 0; i < zs->nhashes; i++) {
+        const uint8_t* digest = hash_final(&zs->hashes[i]);
+
+        if (digest == NULL) {
+            LOGE("Failed to hash the archive\n");
+            return -1;
+        }
+
+        if (zs->hashes[i].type == HASH_SHA1)
+            zs->sha1 = digest;
+        else
+            zs->sha256 = digest;
+    }
+
+    return 0;
+}
+
+int zip_stream_verify(struct zip_stream* zs) {
+    int error = 0;
+
+    if (zs->state != ZS_DONE || zs->eocd == NULL)
+        return -1;
+
+    error = verify_eocd_signature(zs->eocd, zs->eocd_size, zs->sha1,
+            zs->sha256, zs->keys, zs->nkeys);
+
+    return error == VERIFY_SUCCESS ? 0 : -1;
+}
+
+int zip_stream_init(struct zip_stream* zs, const char* key_path,
+        zip_stream_entry_cb_t entry_cb, zip_stream_data_cb_t data_cb,
+        void* param) {
+    int mask;
+
+    memset(zs, 0, sizeof(*zs));
+
+    zs->keys = load_keys(key_path, &zs->nkeys);
+    if (zs->keys == NULL) {
+        LOGE("Failed to load public keys from: %s\n", key_path);
+        return -1;
+    }
+
+    zs->outbuf = (uint8_t *) malloc(ZIP_STREAM_OUTBUF_SIZE);
+    if (zs->outbuf == NULL) {
+        LOGE("Failed to alloc inflate buffer: %s\n", strerror(errno));
+        free(zs->keys);
+        zs->keys = NULL;
+        return -1;
+    }
+
+    if (inflateInit2(&zs->strm, -MAX_WBITS) != Z_OK) {
+        LOGE("Failed to init inflate stream\n");
+        free(zs->outbuf);
+        zs->outbuf = NULL;
+        free(zs->keys);
+        zs->keys = NULL;
+        return -1;
+    }
+    zs->strm_inited = 1;
+
+    mask = keys_hash_mask(zs->keys, zs->nkeys);
+    if (mask & HASH_MASK(HASH_SHA1))
+        hash_init(&zs->hashes[zs->nhashes++], HASH_SHA1);
+    if (mask & HASH_MASK(HASH_SHA256))
+        hash_init(&zs->hashes[zs->nhashes++], HASH_SHA256);
+    zs->hashing = 1;
+
+    zs->entry_cb = entry_cb;
+    zs->data_cb = data_cb;
+    zs->param = param;
+
+    expect(zs, ZS_SIGNATURE, 4);
+
+    return 0;
+}
+
+void zip_stream_destroy(struct zip_stream* zs) {
+    if (zs->strm_inited)
+        inflateEnd(&zs->strm);
+
+    if (zs->outbuf)
+        free(zs->outbuf);
+
+    if (zs->eocd)
+        free(zs->eocd);
+
+    if (zs->keys)
+        free(zs->keys);
+
+    for (int i = 0; i < zs->nhashes; i++)
+        hash_destroy(&zs->hashes[i]);
+
+    memset(zs, 0, sizeof(*zs));
+}
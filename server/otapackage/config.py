@@ -16,6 +16,9 @@ customer_path = 'otapackage/customer/generated/'
 #### Info for package making ####
 # where is image files deployed to be sliced
 image_path = 'otapackage/res/image'
+# where is the images running on the devices deployed, delta images are
+# patches against them
+base_image_path = 'otapackage/res/base'
 # where is update files deployed
 output_path = 'otapackage/out'
 
@@ -34,6 +37,10 @@ signature_cipher_lib = 'signapk/signapk.jar'
 signature_key_dir = 'otapackage/res/keys'
 signature_rsa_public_key = "%s/%s" % (signature_key_dir, "testkey.x509.pem")
 signature_rsa_private_key = "%s/%s" % (signature_key_dir, "testkey.pk8")
+# digest the whole-file signature is made over, sha1 for the v1/v2 keys
+# devices in the field hold, sha256 for v3/v4 keys
+signature_digests = ('sha1', 'sha256')
+signature_digest = 'sha1'
 
 # generated packages for ota update application
 # package named with prefix 'update', fullname is 'update'+'X'+'.zip', X
@@ -65,10 +72,15 @@ img_types = ('normal', 'ubifs', 'jffs2', 'cramfs', 'yaffs2')
 e_img_types = base.enum_f1(
     normal=0, ubifs=0x110, jffs2=0x111, cramfs=0x112, yaffs2=0x113)
 # update mode supported by system defined
-updatemodes = ('full', 'slice')
+updatemodes = ('full', 'slice', 'delta')
 # enum defination relative to updatemodes
 # e_updatemodes = base.enum_f1(full=0x200, slice=0x201)
-e_updatemodes = {'full': 0x200, 'slice': 0x201}
+e_updatemodes = {'full': 0x200, 'slice': 0x201, 'delta': 0x202}
+# how much of the partition a normal image erases, the first is the default
+# partition: all of it before writing
+# deferred:  the span of the image, the rest once every image is written
+# image:     the span of the image only
+erase_policies = ('partition', 'deferred', 'image')
 # slice chunk size, unit is byte
 slicesize = 1024*1024
 slicebase = 1024*1024
@@ -90,6 +102,18 @@ ubi_leb_size = nandflash_page_size * (nandflash_pages_per_block - 2)
 yaffs2_tagsize_per_page = 28
 yaffs2_page_size = (nandflash_page_size+yaffs2_tagsize_per_page)
 yaffs2_block_size = yaffs2_page_size * nandflash_pages_per_block
+# nor flash
+norflash_block_size = 64 * 1024
+# delta
+# patches are applied one erase block at a time, shorter runs of old
+# data than delta_match_size are sent as they are
+delta_windows = {'nor': norflash_block_size, 'nand': nandflash_block_size}
+delta_match_size = 4096
+# hash tree
+# an image is hashed by leaves of one erase block (one LEB for ubifs,
+# one block with its tags for yaffs2), the blocks the device writes
+hashtree_leaf_sizes = {'nor': norflash_block_size,
+                       'nand': nandflash_block_size, 'mmc': 128 * 1024}
 local = locals()
 
 
@@ -97,10 +121,12 @@ class Config(object):
     v = {
         'image_cfg_path': customer_path,
         'image_path': image_path,
+        'base_image_path': base_image_path,
         'outputdir_path': output_path,
         'slicesize': slicesize,
         'public_key': signature_rsa_public_key,
         'private_key': signature_rsa_private_key,
+        'signature_digest': signature_digest,
         'partition_file_name': partition_file_name,       #exclusively used for judge configuration file "partition_*.conf, customization_*.conf"
         'customize_file_name': customize_file_name,
         'customer_suffix': customer_suffix, #exclusively used for judge configuration file "partition_*.conf, customization_*.conf"
@@ -124,6 +150,15 @@ class Config(object):
     def set_image_path(cls, path):
         cls.v['image_path'] = path
 
+    # where is the image repository delta images are built against
+    @classmethod
+    def get_base_image_path(cls):
+        return cls.v['base_image_path']
+
+    @classmethod
+    def set_base_image_path(cls, path):
+        cls.v['base_image_path'] = path
+
     # where is update package
     @classmethod
     def get_outputdir_path(cls):
@@ -160,6 +195,15 @@ class Config(object):
     def set_private_key(cls, key):
         cls.v['private_key'] = key
 
+    # digest of the whole-file signature
+    @classmethod
+    def get_signature_digest(cls):
+        return cls.v['signature_digest']
+
+    @classmethod
+    def set_signature_digest(cls, digest):
+        cls.v['signature_digest'] = digest
+
     # configuration file name
     @classmethod
     def get_customer_files_suffix(cls):
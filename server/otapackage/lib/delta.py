@@ -0,0 +1,148 @@
+import os
+import struct
+import zlib
+import hashlib
+
+# patch layout, all integers are little endian
+#   header: magic, version, flags, out offset, out size, window, out crc32
+#   ops:    END | COPY source offset, length | DATA length, bytes
+patch_magic = 0x544c4452
+patch_version = 1
+patch_header = '<IHHIIII'
+op_end = 0
+op_copy = 1
+op_data = 2
+
+
+def get_max_size(size, window):
+    return (struct.calcsize(patch_header) + size +
+            5 * ((size + window - 1) // window) + 1)
+
+
+class Generator(object):
+    '''
+    Builds the patches rebuilding new from old in place, one window
+    (erase block) at a time: an op never crosses a window and copies only
+    from old data at or after the start of its window, which has not been
+    overwritten yet when the window is programmed.
+
+    Old data is indexed by match sized blocks, new data is searched at
+    every offset with a rolling adler32 so shifted content is found too.
+    '''
+
+    def __init__(self, old, new, window, match):
+        self.old = bytearray(old)
+        self.new = bytearray(new)
+        self.window = window
+        self.match = match
+        self.index = {}
+        for offset in range(0, len(old) - match + 1, match):
+            a, b = self.checksum(self.old, offset)
+            self.index.setdefault((b << 16) | a, []).append(offset)
+
+    def checksum(self, data, offset):
+        value = zlib.adler32(bytes(data[offset:offset + self.match]))
+        return value & 0xffff, (value >> 16) & 0xffff
+
+    def find(self, pos, wstart, a, b):
+        block = self.new[pos:pos + self.match]
+        if pos + self.match <= len(self.old) and \
+                self.old[pos:pos + self.match] == block:
+            return pos
+        for src in self.index.get((b << 16) | a, []):
+            if src >= wstart and self.old[src:src + self.match] == block:
+                return src
+        return -1
+
+    def extend(self, src, pos, limit):
+        length = self.match
+        while pos + length < limit and src + length < len(self.old):
+            n = min(self.match, limit - pos - length,
+                    len(self.old) - src - length)
+            if (self.old[src + length:src + length + n] !=
+                    self.new[pos + length:pos + length + n]):
+                break
+            length += n
+        while (pos + length < limit and src + length < len(self.old) and
+                self.old[src + length] == self.new[pos + length]):
+            length += 1
+        return length
+
+    def generate_window(self, pos, wend, ops):
+        wstart = pos - pos % self.window
+        literal = pos
+        a = b = None
+        while pos + self.match <= wend:
+            if a is None:
+                a, b = self.checksum(self.new, pos)
+            src = self.find(pos, wstart, a, b)
+            if src >= 0:
+                if pos > literal:
+                    ops.append(self.data(literal, pos))
+                length = self.extend(src, pos, wend)
+                ops.append(struct.pack('<BII', op_copy, src, length))
+                pos += length
+                literal = pos
+                a = None
+                continue
+            if pos + self.match < wend:
+                out = self.new[pos]
+                a = (a - out + self.new[pos + self.match]) % 65521
+                b = (b - self.match * out - 1 + a) % 65521
+            pos += 1
+        if wend > literal:
+            ops.append(self.data(literal, wend))
+
+    def generate(self, offset, size):
+        end = offset + size
+        ops = []
+        for pos in range(offset, end, self.window):
+            self.generate_window(pos, min(pos + self.window, end), ops)
+
+        patch = b''.join(ops)
+        if len(patch) > get_max_size(size, self.window) - self.overhead():
+            patch = b''.join([self.data(p, min(p + self.window, end))
+                             for p in range(offset, end, self.window)])
+
+        crc = zlib.crc32(bytes(self.new[offset:end])) & 0xffffffff
+        header = struct.pack(patch_header, patch_magic, patch_version, 0,
+                             offset, size, self.window, crc)
+        return header + patch + struct.pack('<B', op_end)
+
+    def data(self, start, end):
+        return (struct.pack('<BI', op_data, end - start) +
+                bytes(self.new[start:end]))
+
+    def overhead(self):
+        return struct.calcsize(patch_header) + 1
+
+
+def split(oldfile, newfile, todir, chunksize, window, match, func):
+    '''
+    Writes one patch per chunk of newfile, named like file.split() names
+    the slices, and returns the chunk count
+    '''
+    if not os.path.exists(todir):
+        os.makedirs(todir)
+    old = open(oldfile, 'rb').read()
+    new = open(newfile, 'rb').read()
+    generator = Generator(old, new, window, match)
+    count = (len(new) + chunksize - 1) // chunksize
+    for i in range(count):
+        name = os.path.basename(newfile)
+        if count > 1:
+            name = '%s_%03d' % (name, i + 1)
+        filename = os.path.join(todir, name)
+        offset = i * chunksize
+        fileobj = open(filename, 'wb')
+        fileobj.write(generator.generate(
+            offset, min(chunksize, len(new) - offset)))
+        fileobj.close()
+        if func != None:
+            func(filename)
+    return count
+
+
+def get_source_info(oldfile):
+    data = open(oldfile, 'rb').read()
+    return len(data), hashlib.sha1(data).hexdigest()
@@ -0,0 +1,52 @@
+import os
+import struct
+import hashlib
+
+# hash tree layout, all integers are little endian, see
+# client/recovery/include/utils/hashtree.h
+#   header: magic, version, hash, leaf size, leaf count, image size
+#   leaves: sha1(0x00 + leaf data), the last leaf is short
+# the root is folded from the leaves, sha1(0x01 + left + right) per
+# node, an odd node out moves up as is
+tree_magic = 0x45525448
+tree_version = 1
+tree_hash_sha1 = 1
+tree_header = '<IHHIIQ'
+leaf_prefix = '\x00'
+node_prefix = '\x01'
+
+
+def get_root(leaves):
+    level = list(leaves)
+    while len(level) > 1:
+        up = []
+        for i in range(0, len(level) - 1, 2):
+            up.append(hashlib.sha1(
+                node_prefix + level[i] + level[i + 1]).digest())
+        if len(level) & 1:
+            up.append(level[-1])
+        level = up
+    return level[0]
+
+
+def generate(imagefile, leafsize, treefile):
+    '''
+    Writes the hash tree of imagefile to treefile, returns the root as
+    a hex string for update.xml
+    '''
+    size = os.path.getsize(imagefile)
+    leaves = []
+    f = open(imagefile, 'rb')
+    while 1:
+        leaf = f.read(leafsize)
+        if not leaf:
+            break
+        leaves.append(hashlib.sha1(leaf_prefix + leaf).digest())
+    f.close()
+
+    fileobj = open(treefile, 'wb')
+    fileobj.write(struct.pack(tree_header, tree_magic, tree_version,
+                              tree_hash_sha1, leafsize, len(leaves), size))
+    fileobj.write(''.join(leaves))
+    fileobj.close()
+    return get_root(leaves).encode('hex')
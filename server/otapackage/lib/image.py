@@ -2,7 +2,7 @@ import os
 import sys
 import shutil
 import xml.etree.cElementTree as et
-from otapackage.lib import base, ini, file, log
+from otapackage.lib import base, ini, file, log, delta, hashtree
 from otapackage import config
 
 
@@ -12,6 +12,10 @@ class Image(object):
     devctls = config.devctls
     imagesum = config.output_pack_config_index
     printer = None
+    # erase block size patches are applied by, 0 when delta is unsupported
+    delta_window = 0
+    # leaf size of the hash trees of normal images on this medium
+    hashtree_leaf = 0
 
     class UpdateMode(object):
 
@@ -42,12 +46,14 @@ class Image(object):
             updatetype = config.e_updatemodes['%s' % updatemode]
             size = 0
             count = 0
-            if updatemode == Image.updatemodes[1]:
+            if updatemode in (Image.updatemodes[1], Image.updatemodes[2]):
                 size = cls.get_slice_size(imagetype, slicesize)
                 count = (imagesize + size - 1) / size
             return cls(updatetype, size, count)
 
     class Imageinfo(object):
+        erase = config.erase_policies[0]
+        hashtree = None
 
         @base.struct('name', 'size', 'type', 'offset', 'updatemode')
         def __init__(self, *value):
@@ -68,7 +74,20 @@ class Image(object):
                 return None
 
             count = 1
-            if self.updatemode.size > 0:
+            if self.updatemode.type == config.e_updatemodes['delta']:
+                path_base_image = Image.get_base_image_path(self.name)
+                self.srcsize, self.srcsha1 = delta.get_source_info(
+                    path_base_image)
+                count = delta.split(
+                    path_base_image, path_src_image, path_dst_image_dir,
+                    self.updatemode.size, Image.delta_window,
+                    config.delta_match_size, self.generate_process)
+                if count != self.updatemode.count:
+                    Image.printer.error('''error:patch count %d is
+                        not equal with preset value %d''' % (
+                        count, self.updatemode.count))
+                    return None
+            elif self.updatemode.size > 0:
                 count = file.split(
                     path_src_image, path_dst_image_dir,
                     self.updatemode.size, self.generate_process)
@@ -84,9 +103,27 @@ class Image(object):
                 shutil.copy(path_src_image, path_dst_image_dir)
                 self.generate_process(path_dst_image)
 
+            self.hashtree = self.generate_hashtree(path_src_image)
+
             eroot = self.generate_config(element)
             return eroot
 
+        # the tree of the image as it is written, delta ones included,
+        # goes to the signed config package
+        def generate_hashtree(self, path_src_image):
+            leafsize = Image.hashtree_leaf
+            if self.type == 'ubifs':
+                leafsize = config.ubi_leb_size
+            elif self.type == 'yaffs2':
+                leafsize = config.yaffs2_block_size
+            if not leafsize or not file.get_size(path_src_image):
+                return None
+            path_tree = "%s/%s/%s/%s.hashtree" % (
+                config.Config.get_outputdir_path(),
+                config.Config.get_customer_files_suffix(),
+                config.output_pack_config_dir, self.name)
+            return hashtree.generate(path_src_image, leafsize, path_tree)
+
         def generate_config(self, element):
             Image.printer.debug(
                 "generate imageinfo[\'%s\'] config" % (self.name))
@@ -105,13 +142,28 @@ class Image(object):
             element_mode_type = et.SubElement(element_mode, 'type')
             element_mode_type.attrib = {"type": config.xml_data_type_integer}
             element_mode_type.text = '0x%x' % self.updatemode.type
-            if self.updatemode.type == config.e_updatemodes['slice']:
+            if self.updatemode.type in (config.e_updatemodes['slice'],
+                                        config.e_updatemodes['delta']):
                 element_mode_size = et.SubElement(element_mode, 'chunksize')
                 element_mode_size.attrib = {"type": config.xml_data_type_integer}
                 element_mode_size.text = '%d' % self.updatemode.size
                 element_mode_count = et.SubElement(element_mode, 'chunkcount')
                 element_mode_count.attrib = {"type": config.xml_data_type_integer}
                 element_mode_count.text = '%d' % self.updatemode.count
+            if self.updatemode.type == config.e_updatemodes['delta']:
+                element_mode_srcsize = et.SubElement(element_mode, 'srcsize')
+                element_mode_srcsize.text = '%d' % self.srcsize
+                element_mode_srcsha1 = et.SubElement(element_mode, 'srcsha1')
+                element_mode_srcsha1.attrib = {"type": config.xml_data_type_string}
+                element_mode_srcsha1.text = self.srcsha1
+            if self.erase != config.erase_policies[0]:
+                element_erase = et.SubElement(eroot, 'erase')
+                element_erase.attrib = {"type": config.xml_data_type_string}
+                element_erase.text = self.erase
+            if self.hashtree:
+                element_hashtree = et.SubElement(eroot, 'hashtree')
+                element_hashtree.attrib = {"type": config.xml_data_type_string}
+                element_hashtree.text = self.hashtree
             return eroot
 
         def generate_process(self, imagename):
@@ -133,6 +185,39 @@ class Image(object):
             if self.offset < 0:
                 Image.printer.error('%s offset is not number' % (self.name))
                 return False
+            if self.erase not in config.erase_policies:
+                Image.printer.error('%s: erase must be one in %s' % (
+                    self.name, config.erase_policies))
+                return False
+            if self.erase != config.erase_policies[0] and self.type != 'normal':
+                Image.printer.error(
+                    '%s: erase %s supports normal images only' % (
+                        self.name, self.erase))
+                return False
+            if self.updatemode.type == config.e_updatemodes['delta']:
+                return self.judge_delta()
+            return True
+
+        # patches are applied in place to the same image on the device
+        def judge_delta(self):
+            if self.type != 'normal':
+                Image.printer.error(
+                    '%s: delta supports normal images only' % (self.name))
+                return False
+            if not Image.delta_window:
+                Image.printer.error(
+                    '%s: delta is not supported on this medium' % (self.name))
+                return False
+            if self.updatemode.size % Image.delta_window:
+                Image.printer.error(
+                    '%s: slice size must be a multiple of %d' % (
+                        self.name, Image.delta_window))
+                return False
+            path = Image.get_base_image_path(self.name)
+            if not file.is_readable(path):
+                Image.printer.error(
+                    '%s: base image %s is not readable' % (self.name, path))
+                return False
             return True
 
     @base.struct('mediumtype', 'imgcnt', 'devctl', 'imageinfo')
@@ -143,6 +228,12 @@ class Image(object):
     def get_image_total_cnt(cls):
         return cls.imagesum - config.output_pack_config_index
 
+    @classmethod
+    def get_base_image_path(cls, imagename):
+        return os.path.join(
+            config.Config.get_base_image_path(),
+            "%s/%s" % (config.Config.get_customer_files_suffix(), imagename))
+
     @classmethod
     def get_image_size(cls, imagename):
         imgfull = "%s/%s" %(config.Config.get_customer_files_suffix() ,imagename)
@@ -183,6 +274,8 @@ class Image(object):
         imgcnt = base.str2int(imgcnt)
         devctl = ini_parser.get('update', 'devctl')
         devctl = 0 if not devctl else base.str2int(devctl)
+        cls.delta_window = config.delta_windows.get(mediumtype, 0)
+        cls.hashtree_leaf = config.hashtree_leaf_sizes.get(mediumtype, 0)
 
         imageinfos = []
         for i in range(1, imgcnt+1):
@@ -208,6 +301,9 @@ class Image(object):
                 return None
             imageinfo = cls.Imageinfo(
                 name, imgsize, imgtype, base.str2int(offset), updateinfo)
+            erase = ini_parser.get(section_name, 'erase')
+            if erase:
+                imageinfo.erase = erase
             imageinfos.append(imageinfo)
         image = cls(mediumtype, imgcnt, devctl, imageinfos)
         if not image.judge():
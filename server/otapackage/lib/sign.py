@@ -0,0 +1,56 @@
+import os
+import struct
+import subprocess
+import tempfile
+from distutils.spawn import find_executable
+
+# whole-file signature as "signapk -w" leaves it for the recovery verifier:
+# the archive comment ends with the RSA signature of everything before the
+# comment length, then the footer
+#   footer: signature start, 0xff, 0xff, comment size
+rsa_size = 256
+footer = '<HBBH'
+eocd_magic = 'PK\x05\x06'
+eocd_size = 22
+
+
+def have_signapk():
+    return find_executable('java') is not None
+
+
+def sign_with_openssl(private_key, infile, outfile, digest='sha1'):
+    '''
+    Signs with the openssl command line, for hosts without java and for
+    sha256 signatures, signapk makes sha1 ones only. The comment holds the
+    bare signature where signapk puts a PKCS#7 block, the verifier reads
+    only its last rsa_size bytes.
+    '''
+    data = open(infile, 'rb').read()
+    if data[-eocd_size:-eocd_size+4] != eocd_magic or data[-2:] != '\0\0':
+        return False
+    signed = data[:-2]
+
+    fd, pem = tempfile.mkstemp(suffix='.pem')
+    os.close(fd)
+    try:
+        subprocess.check_call(['openssl', 'pkcs8', '-inform', 'DER',
+                               '-nocrypt', '-in', private_key, '-out', pem])
+        p = subprocess.Popen(['openssl', 'dgst', '-' + digest, '-sign',
+                              pem],
+                             stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+        signature = p.communicate(signed)[0]
+        if p.returncode or len(signature) != rsa_size:
+            return False
+    except (OSError, subprocess.CalledProcessError):
+        return False
+    finally:
+        os.remove(pem)
+
+    comment_size = rsa_size + struct.calcsize(footer)
+    f = open(outfile, 'wb')
+    f.write(signed)
+    f.write(struct.pack('<H', comment_size))
+    f.write(signature)
+    f.write(struct.pack(footer, comment_size, 0xff, 0xff, comment_size))
+    f.close()
+    return True
@@ -3,7 +3,7 @@ import sys
 import shutil
 import argparse
 import xml.etree.cElementTree as et
-from otapackage.lib import base, log, image, dev
+from otapackage.lib import base, log, image, dev, sign
 from otapackage import config
 
 
@@ -100,7 +100,8 @@ class Maker(object):
             self.image.generate()
 
             self.dev.generate()
-            self.pack()
+            if not self.pack():
+                os._exit(1)
 
         self.generate(self.customer_types)
         os._exit(0)
@@ -151,11 +152,19 @@ class Maker(object):
             caller_zip = "zip -r %s %s" % (
                 output_package_unencrypted, output_package)
             os.system(caller_zip)
-            if config.signature_flag:
+            if (config.signature_flag and sign.have_signapk()
+                    and config.Config.get_signature_digest() == 'sha1'):
                 caller_signature = "java -jar -Xms512M -Xmx1024M %s -w %s %s %s %s" % (
                     cipher_lib_path, keys_public_path, keys_private_path,
                     output_package_unencrypted, output_package_encrypted)
                 os.system(caller_signature)
+            elif config.signature_flag and not sign.sign_with_openssl(
+                    keys_private_path, output_package_unencrypted,
+                    output_package_encrypted,
+                    config.Config.get_signature_digest()):
+                self.printer.error("signing %s" % (output_package_unencrypted))
+                os.chdir(orgdir)
+                return False
 
             os.remove(output_package_unencrypted)
             shutil.rmtree(output_package)
@@ -177,6 +186,9 @@ class Maker(object):
         parser = argparse.ArgumentParser()
         help = '''The Image path is where you place the images'''
         parser.add_argument('-i', '--imgpath', help=help)
+        help = '''The base image path is where you place the images running
+                  on the devices, delta images are built against them'''
+        parser.add_argument('-b', '--baseimgpath', help=help)
         help = '''The output path is where you place the generated packages'''
         parser.add_argument('-o', '--output', help=help)
         help = '''The slice size is the length you pointed for slice updatemode.
@@ -192,10 +204,17 @@ class Maker(object):
             parser.add_argument('--publickey', help=help)
             help = '''private key path'''
             parser.add_argument('--privatekey', help=help)
+            help = '''Digest of the whole-file signature, sha256 needs a v3
+                      or v4 public key on the device. Default is %s''' % (
+                config.signature_digest)
+            parser.add_argument('--digest', help=help,
+                                choices=config.signature_digests)
 
         args = parser.parse_args()
         if args.imgpath:
             config.Config.set_image_path(args.imgpath)
+        if args.baseimgpath:
+            config.Config.set_base_image_path(args.baseimgpath)
         if args.output:
             config.Config.set_outputdir_path(args.output)
         if args.slicesize:
@@ -205,6 +224,8 @@ class Maker(object):
                 config.Config.set_public_key(args.publickey)
             if args.privatekey:
                 config.Config.set_private_key(args.privatekey)
+            if args.digest:
+                config.Config.set_signature_digest(args.digest)
 
         self.printer = log.Logger.get_logger(config.log_console)
         if args.verbose == True:
@@ -215,6 +236,8 @@ class Maker(object):
                            (config.Config.get_image_cfg_path()))
         self.printer.debug("image file path: %s" %
                            (config.Config.get_image_path()))
+        self.printer.debug("base image file path: %s" %
+                           (config.Config.get_base_image_path()))
         self.printer.debug("output directory path: %s" %
                            (config.Config.get_outputdir_path()))
         self.printer.debug("slice size: %d" % (config.Config.get_slicesize()))
@@ -222,6 +245,8 @@ class Maker(object):
                            (config.Config.get_public_key()))
         self.printer.debug("private key path: %s" %
                            (config.Config.get_private_key()))
+        self.printer.debug("signature digest: %s" %
+                           (config.Config.get_signature_digest()))
         return self
 
 